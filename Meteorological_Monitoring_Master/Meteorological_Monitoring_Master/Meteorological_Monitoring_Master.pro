@@ -21,8 +21,13 @@ SOURCES += \
 
 HEADERS += \
     shared_data.h \
+    shm_map.h \
+    shm_notify.h \
+    trace.h \
     widget.h
 
+LIBS += -lpthread
+
 FORMS += \
     widget.ui
 
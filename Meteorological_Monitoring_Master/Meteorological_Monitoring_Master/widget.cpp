@@ -9,14 +9,24 @@
 #include <cerrno>    // for errno
 #include <cstring>   // for strerror()
 #include <QTimeZone>
+#include "trace.h"
+#include <chrono>
+
+// 一批连续到达的帧只刷新一次界面：等待线程每次唤醒后至少间隔这么久再等下一次
+static const int kNotifyCoalesceMs = 20;
 
 
 Widget::Widget(QWidget *parent)
     : QWidget(parent)
+    , m_dataCheckTimer(nullptr)
     , m_sharedData(nullptr)
-    , m_shmId(-1)
+    , m_shmLen(0)
+    , m_shmIno(0)
     , m_sharedMemoryValid(false)
     , m_lastUpdateCounter(0)
+    , m_latest()
+    , m_fullRefresh(true)
+    , m_notifyStop(false)
     , m_currentStationIndex(0)
     , m_useRealData(false)
 {
@@ -59,11 +69,14 @@ Widget::Widget(QWidget *parent)
     connect(m_updateSystemInfoTimer, &QTimer::timeout, this, &Widget::updateSystemInfoDisplay);
     m_updateSystemInfoTimer->start(100); // 每秒更新一次系统信息显示
 
-    // 创建数据检查定时器
+    // 创建数据检查定时器：只在还没连上共享内存或接收程序未运行时定时检查，写端运行时由它的通知驱动刷新
     m_dataCheckTimer = new QTimer(this);
     connect(m_dataCheckTimer, &QTimer::timeout, this, &Widget::checkSharedMemoryUpdate);
-    m_dataCheckTimer->start(2000); // 检查一次数据更新
+    if (!m_sharedMemoryValid || m_sharedData->writer_pid == 0) {
+        m_dataCheckTimer->start(2000); // 检查一次数据更新
+    }
 
+    trace_init("ui");
     qDebug() << "Qt application started, PID:" << getpid();
 }
 
@@ -76,28 +89,17 @@ Widget::~Widget()
 
 bool Widget::initSharedMemory()
 {
-    // 获取共享内存
-    m_shmId = shmget(SHARED_MEMORY_KEY, 0, 0);
-    if (m_shmId == -1) {
-    //    qDebug() << "Shared memory does not exist, please start receiver program first";
-    //    qDebug() << "shmget error:" << strerror(errno);
-        return false;
-    }
-
-    // 连接到共享内存
-    m_sharedData = (struct shared_weather_data *)shmat(m_shmId, NULL, 0);
-    if (m_sharedData == (void *)-1) {
-        qDebug() << "Failed to attach shared memory:" << strerror(errno);
-        m_sharedData = nullptr;
-        return false;
-    }
-
-    // 验证魔数
-    if (m_sharedData->magic != SHARED_MEMORY_MAGIC) {
-        qDebug() << "Shared memory magic number mismatch. Expected:" << QString::number(SHARED_MEMORY_MAGIC, 16)
-                 << "Got:" << QString::number(m_sharedData->magic, 16);
-        shmdt(m_sharedData);
-        m_sharedData = nullptr;
+    // 映射接收程序的共享内存文件；文件在接收程序退出和开发板重启后都保留，
+    // 接收程序还没启动时也能先显示上次留下的各节点数据
+    m_sharedData = shm_map_attach(shm_map_path(), &m_shmLen, &m_shmIno);
+    // 魔数、主版本和各段位置已由 shm_map_attach 核对（shm_header_check），不按本程序的 sizeof 判断文件
+    if (m_sharedData == nullptr) {
+        if (errno == EPROTO) {
+            qDebug() << "Shared memory file" << shm_map_path() << "has an unsupported schema, expected major version"
+                     << SHM_VERSION_MAJOR(SHM_SCHEMA_VERSION) << "; waiting for the receiver to rebuild it";
+        } else if (errno != ENOENT) {
+            qDebug() << "Failed to map shared memory file" << shm_map_path() << ":" << strerror(errno);
+        }
         return false;
     }
 
@@ -107,9 +109,13 @@ bool Widget::initSharedMemory()
 
     // 设置为0以确保第一次检查时会触发更新
     m_lastUpdateCounter = 0;
+    // 脏位可能已被上一个界面进程取走，连上后先把所有上报过的节点刷一遍
+    m_fullRefresh = true;
 
-    qDebug() << "Successfully connected to shared memory, writer PID:" << m_sharedData->writer_pid;
-    qDebug() << "Current update counter:" << m_sharedData->update_counter;
+    qDebug() << "Successfully connected to shared memory, schema"
+             << QString("%1.%2").arg(SHM_VERSION_MAJOR(m_sharedData->hdr.version)).arg(SHM_VERSION_MINOR(m_sharedData->hdr.version))
+             << "writer PID:" << m_sharedData->writer_pid;
+    qDebug() << "Current update counter:" << shm_stat_get(&m_sharedData->update_counter);
     qDebug() << "Connection status:" << m_sharedData->connection_status;
 
     // 立即更新状态显示
@@ -117,16 +123,49 @@ bool Widget::initSharedMemory()
     updateSystemInfoDisplay();
     updateDataFromSharedMemory();
 
+    // 之后的更新由写端唤醒，不再定时轮询（接收程序未运行时由 checkSharedMemoryUpdate 重新打开定时器）
+    startNotifyThread();
+    if (m_dataCheckTimer != nullptr) {
+        m_dataCheckTimer->stop();
+    }
+
     return true;
 }
 
+void Widget::startNotifyThread()
+{
+    m_notifyStop = false;
+    m_notifyThread = std::thread(&Widget::notifyLoop, this, m_sharedData);
+}
+
+void Widget::stopNotifyThread()
+{
+    if (!m_notifyThread.joinable()) return;
+    m_notifyStop = true;
+    // 自己递增一次通知字，阻塞中的等待线程立即返回
+    shm_notify_readers(m_sharedData);
+    m_notifyThread.join();
+}
+
+void Widget::notifyLoop(struct shared_weather_data *sd)
+{
+    uint32_t seen = shm_notify_current(sd);
+    while (!m_notifyStop) {
+        uint32_t cur = shm_notify_wait(sd, seen, -1);
+        if (cur == seen || m_notifyStop) continue;
+        seen = cur;
+        // 界面只能在主线程更新，排队交给事件循环
+        QMetaObject::invokeMethod(this, "checkSharedMemoryUpdate", Qt::QueuedConnection);
+        std::this_thread::sleep_for(std::chrono::milliseconds(kNotifyCoalesceMs));
+    }
+}
+
 void Widget::cleanupSharedMemory()
 {
     if (m_sharedData != nullptr) {
+        stopNotifyThread();
         m_sharedData->reader_pid = 0; // 清除读进程PID
-        if (shmdt(m_sharedData) == -1) {
-            qDebug() << "Failed to detach shared memory:" << strerror(errno);
-        }
+        shm_map_detach(m_sharedData, m_shmLen);
         m_sharedData = nullptr;
     }
     m_sharedMemoryValid = false;
@@ -166,16 +205,19 @@ void Widget::updateSystemInfoDisplay()
     info += QString("Connection status: %1\n").arg(statusText);
 
     info += QString("Writer PID: %1\n").arg(m_sharedData->writer_pid);
-    info += QString("Update counter: %1\n").arg(m_sharedData->update_counter);
-    info += QString("Total received: %1 frames\n").arg(m_sharedData->total_received);
-    info += QString("Error frames: %1\n").arg(m_sharedData->total_errors);
+    info += QString("Update counter: %1\n").arg(shm_stat_get(&m_sharedData->update_counter));
+    info += QString("Total received: %1 frames\n").arg(shm_stat_get(&m_sharedData->total_received));
+    info += QString("Error frames: %1\n").arg(shm_stat_get(&m_sharedData->total_errors));
 
     // 显示各类型数据统计
-    info += QString("BME280: %1, Light: %2\n").arg(m_sharedData->bme280_count).arg(m_sharedData->lightrain_count);
-    info += QString("GPS: %1, Status: %2\n").arg(m_sharedData->gps_count).arg(m_sharedData->system_status_count);
-
-    if (m_sharedData->last_update_time > 0) {
-        QDateTime lastUpdate = QDateTime::fromSecsSinceEpoch(m_sharedData->last_update_time);
+    info += QString("BME280: %1, Light: %2\n").arg(shm_stat_get(&m_sharedData->bme280_count))
+                                                 .arg(shm_stat_get(&m_sharedData->lightrain_count));
+    info += QString("GPS: %1, Status: %2\n").arg(shm_stat_get(&m_sharedData->gps_count))
+                                            .arg(shm_stat_get(&m_sharedData->system_status_count));
+
+    time_t lastUpdateTime = __atomic_load_n(&m_sharedData->last_update_time, __ATOMIC_RELAXED);
+    if (lastUpdateTime > 0) {
+        QDateTime lastUpdate = QDateTime::fromSecsSinceEpoch(lastUpdateTime);
         info += QString("Last update: %1\n").arg(lastUpdate.toString("hh:mm:ss"));
     }
 
@@ -196,16 +238,40 @@ void Widget::checkSharedMemoryUpdate()
 
     if (m_sharedMemoryValid && m_sharedData != nullptr){
         // 检查数据是否有更新
-        if (m_sharedData->update_counter != m_lastUpdateCounter || m_lastUpdateCounter == 0) {
+        if (shm_stat_get(&m_sharedData->update_counter) != m_lastUpdateCounter || m_lastUpdateCounter == 0) {
             //qDebug() << "Data updated, counter changed from" << m_lastUpdateCounter
             //         << "to" << m_sharedData->update_counter;
-            updateDataFromSharedMemory();
-            m_lastUpdateCounter = m_sharedData->update_counter;
+            uint64_t tSeen = trace_clock();
+            // 写端更新中途被挂起时本轮读不到一致快照，计数器不动，写端写完后会再通知一次
+            if (updateDataFromSharedMemory()) {
+                // 只有两次刷新之间最后写入的那一帧能在界面上留下区间
+                uint32_t traceId = g_trace.every ? m_latest.trace_frame_id : 0;
+                if (traceId != 0) {
+                    trace_span(TRACE_UI_POLL_WAIT, traceId, m_latest.trace_write_ns, tSeen);
+                    trace_span(TRACE_UI_UPDATE, traceId, tSeen, trace_now_ns());
+                }
+                m_lastUpdateCounter = m_latest.update_counter;
+            }
         }
     }
 
     // 更新连接状态
     updateConnectionStatus();
+
+    // 接收程序退出后文件保留，界面继续显示最后的数据；它重启后接着写同一个文件，通知线程照常唤醒。
+    // 布局或容量变化时它会另建文件替换，这里定时检查，发现后重新映射
+    if (m_sharedMemoryValid && m_sharedData != nullptr && m_sharedData->writer_pid == 0) {
+        if (shm_map_replaced(shm_map_path(), m_shmIno)) {
+            qDebug() << "Shared memory file replaced, remapping";
+            cleanupSharedMemory();
+            initSharedMemory();
+        }
+        if (!m_dataCheckTimer->isActive()) {
+            m_dataCheckTimer->start(2000);
+        }
+    } else if (m_sharedMemoryValid && m_dataCheckTimer->isActive()) {
+        m_dataCheckTimer->stop();
+    }
 }
 
 QString Widget::getStationNameFromNodeId(int nodeId){
@@ -221,78 +287,57 @@ QString Widget::getStationNameFromNodeId(int nodeId){
     }
 }
 
-void Widget::updateDataFromSharedMemory()
+bool Widget::updateDataFromSharedMemory()
 {
-    if (!m_sharedMemoryValid || m_sharedData == nullptr) return;
-
-    //qDebug() << "Updating data from shared memory, latest data type:" << m_sharedData->latest_data.data_type;
-
-    // 根据最新数据类型更新显示
-    switch (m_sharedData->latest_data.data_type) {
-        case SENSOR_BME280:
-            if (m_sharedData->latest_bme280.valid) {
-                // 获取node_id并查找对应的站点名称
-                int nodeId = m_sharedData->latest_bme280.node_id;
-                ensureWidgetsForNode(nodeId);
-                QString stationName = getStationNameFromNodeId(nodeId);
-                m_stationByNodeId[nodeId]->setStationName(stationName);
-                updateStationWithBME280Data(m_sharedData->latest_bme280, nodeId);
-                // 更新告警状态
-                updateAlertWithLatestData(nodeId);
-            //    qDebug() << "Updated BME280 data: T=" << m_sharedData->latest_bme280.temperature
-            //             << "°C, H=" << m_sharedData->latest_bme280.humidity
-            //             << "%, P=" << m_sharedData->latest_bme280.pressure << "hPa";
-            }
-            break;
-
-        case SENSOR_LIGHTRAIN:
-            if (m_sharedData->latest_lightrain.valid) {
-                // 获取node_id并查找对应的站点名称
-                int nodeId = m_sharedData->latest_lightrain.node_id;
-                ensureWidgetsForNode(nodeId);
-                QString stationName = getStationNameFromNodeId(nodeId);
-                m_stationByNodeId[nodeId]->setStationName(stationName);
-                updateStationWithLightRainData(m_sharedData->latest_lightrain, nodeId);
-                // 更新告警状态
-                updateAlertWithLatestData(nodeId);
-            //    qDebug() << "Updated LightRain data: Lux=" << m_sharedData->latest_lightrain.light_intensity
-            //             << "lx, Rain=" << m_sharedData->latest_lightrain.rainfall << "%";
-            }
-            break;
-
-        case SENSOR_GPS:
-            if (m_sharedData->latest_gps.valid) {
-                // 获取node_id并查找对应的站点名称
-                int nodeId = m_sharedData->latest_gps.node_id;
-                ensureWidgetsForNode(nodeId);
-                QString stationName = getStationNameFromNodeId(nodeId);
-                m_stationByNodeId[nodeId]->setStationName(stationName);
-                updateStationWithGPSData(m_sharedData->latest_gps, nodeId);
-                // 更新告警状态
-                updateAlertWithLatestData(nodeId);
-            //    qDebug() << "Updated GPS data: Lat=" << m_sharedData->latest_gps.latitude
-            //             << ", Lon=" << m_sharedData->latest_gps.longitude;
-            }
-            break;
-
-        case SENSOR_SYSTEM_STATUS:
-            if (m_sharedData->latest_system_status.valid) {
-            //   qDebug() << "Updated System Status: Node=" << m_sharedData->latest_system_status.node_id
-            //             << ", Uptime=" << m_sharedData->latest_system_status.uptime_seconds << "s";
-            }
-            break;
-
-        default:
-            //qDebug() << "Unknown data type:" << m_sharedData->latest_data.data_type;
-            break;
+    if (!m_sharedMemoryValid || m_sharedData == nullptr) return false;
+
+    // 先复制一份一致的快照，避免读到一帧的温度配上下一帧的湿度
+    if (shm_read_latest(m_sharedData, &m_latest) != 0) return false;
+
+    // 只刷新两次轮询之间有更新的节点
+    uint8_t nodeIds[MAX_NODE_SLOTS];
+    int count = shm_take_dirty(m_sharedData, nodeIds);
+    if (m_fullRefresh) {
+        count = 0;
+        for (int i = 0; i < MAX_NODE_SLOTS; i++) {
+            if (m_sharedData->nodes[i].seq != 0) nodeIds[count++] = (uint8_t)i;
+        }
+        m_fullRefresh = false;
     }
-
-
+    for (int i = 0; i < count; i++) {
+        if (!refreshNodeFromSharedMemory(nodeIds[i])) {
+            // 写端更新该槽位途中被挂起，放回脏位下次再读
+            shm_node_mark_dirty(m_sharedData, nodeIds[i]);
+        }
+    }
+    //qDebug() << "Refreshed" << count << "nodes from shared memory";
 
 //    // 为其他站点生成随机数据
 //    simulateRandomDataForOtherStations(0);
 
     m_useRealData = true;
+    return true;
+}
+
+bool Widget::refreshNodeFromSharedMemory(int nodeId)
+{
+    struct node_latest node;
+    if (shm_read_node(m_sharedData, (uint8_t)nodeId, &node) != 0) return false;
+
+    // 只有系统状态的节点不单独建卡片
+    if (!node.bme280.valid && !node.lightrain.valid && !node.gps.valid) return true;
+
+    ensureWidgetsForNode(nodeId);
+    if (!m_stationByNodeId.contains(nodeId)) return true;
+    QString stationName = getStationNameFromNodeId(nodeId);
+    m_stationByNodeId[nodeId]->setStationName(stationName);
+    if (node.bme280.valid) updateStationWithBME280Data(node.bme280, nodeId);
+    if (node.lightrain.valid) updateStationWithLightRainData(node.lightrain, nodeId);
+    if (node.gps.valid) updateStationWithGPSData(node.gps, nodeId);
+    // 更新告警状态
+    updateAlertWithLatestData(node, nodeId);
+    //qDebug() << "Refreshed node" << nodeId << "version" << node.version;
+    return true;
 }
 
 void Widget::updateStationWithBME280Data(const struct bme280_data &data, int nodeId)
@@ -316,44 +361,42 @@ void Widget::updateStationWithGPSData(const struct gps_data &data, int nodeId)
     }
 }
 
-void Widget::updateAlertWithLatestData(int nodeId)
+void Widget::updateAlertWithLatestData(const struct node_latest &node, int nodeId)
 {
     if(!m_alertByNodeId.contains(nodeId)) return;
 
     QString alertType, alertMessage, status = QString::fromUtf8("正常");
 
     // 检查BME280数据告警
-    if (m_sharedData->latest_bme280.valid &&
-        m_sharedData->latest_bme280.node_id == nodeId) {
-        if (m_sharedData->latest_bme280.temperature > 35.0f) {
+    if (node.bme280.valid) {
+        if (node.bme280.temperature > 35.0f) {
             alertType = QString::fromUtf8("温度");
-            alertMessage = QString::fromUtf8("极高温警报：%1°C").arg(m_sharedData->latest_bme280.temperature, 0, 'f', 1);
+            alertMessage = QString::fromUtf8("极高温警报：%1°C").arg(node.bme280.temperature, 0, 'f', 1);
             status = QString::fromUtf8("警报");
-        } else if (m_sharedData->latest_bme280.temperature > 30.0f) {
+        } else if (node.bme280.temperature > 30.0f) {
             alertType = QString::fromUtf8("温度");
-            alertMessage = QString::fromUtf8("高温告警：%1°C").arg(m_sharedData->latest_bme280.temperature, 0, 'f', 1);
+            alertMessage = QString::fromUtf8("高温告警：%1°C").arg(node.bme280.temperature, 0, 'f', 1);
             status = QString::fromUtf8("告警");
-        } else if (m_sharedData->latest_bme280.humidity > 90) {
+        } else if (node.bme280.humidity > 90) {
             alertType = QString::fromUtf8("湿度");
-            alertMessage = QString::fromUtf8("高湿度警报：%1%").arg(m_sharedData->latest_bme280.humidity, 0, 'f', 1);
+            alertMessage = QString::fromUtf8("高湿度警报：%1%").arg(node.bme280.humidity, 0, 'f', 1);
             status = QString::fromUtf8("警报");
-        } else if (m_sharedData->latest_bme280.humidity > 80) {
+        } else if (node.bme280.humidity > 80) {
             alertType = QString::fromUtf8("湿度");
-            alertMessage = QString::fromUtf8("湿度告警：%1%").arg(m_sharedData->latest_bme280.humidity, 0, 'f', 1);
+            alertMessage = QString::fromUtf8("湿度告警：%1%").arg(node.bme280.humidity, 0, 'f', 1);
             status = QString::fromUtf8("告警");
         }
     }
 
     // 检查光强雨量数据告警
-    if (status == QString::fromUtf8("正常") && m_sharedData->latest_lightrain.valid&&
-            m_sharedData->latest_lightrain.node_id == nodeId) {
-        if (m_sharedData->latest_lightrain.rainfall > 80) {
+    if (status == QString::fromUtf8("正常") && node.lightrain.valid) {
+        if (node.lightrain.rainfall > 80) {
             alertType = QString::fromUtf8("降雨");
-            alertMessage = QString::fromUtf8("强降雨警报：%1%").arg(m_sharedData->latest_lightrain.rainfall);
+            alertMessage = QString::fromUtf8("强降雨警报：%1%").arg(node.lightrain.rainfall);
             status = QString::fromUtf8("警报");
-        } else if (m_sharedData->latest_lightrain.rainfall > 50) {
+        } else if (node.lightrain.rainfall > 50) {
             alertType = QString::fromUtf8("降雨");
-            alertMessage = QString::fromUtf8("降雨告警：%1%").arg(m_sharedData->latest_lightrain.rainfall);
+            alertMessage = QString::fromUtf8("降雨告警：%1%").arg(node.lightrain.rainfall);
             status = QString::fromUtf8("告警");
         }
     }
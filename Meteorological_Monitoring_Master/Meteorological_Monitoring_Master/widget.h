@@ -18,14 +18,15 @@
 #include <QMessageBox>
 #include <QTextEdit>
 #include <random>
+#include <atomic>
+#include <thread>
 
 extern "C" {
 #include "shared_data.h"
+#include "shm_map.h"
+#include "shm_notify.h"
 }
 
-#include <sys/shm.h>
-#include <sys/ipc.h>
-
 QT_BEGIN_NAMESPACE
 QT_END_NAMESPACE
 
@@ -46,7 +47,7 @@ private slots:
     void updateTimeDisplay(); // 更新时间显示
     void showSystemInfo(); // 显示系统信息
     void updateSystemInfoDisplay(); // 更新系统信息显示
-    void updateDataFromSharedMemory(); // 从共享内存更新数据
+    bool updateDataFromSharedMemory(); // 从共享内存更新数据，未取得一致快照时返回false
 
 private:
     void setupUI();
@@ -62,13 +63,17 @@ private:
     // 共享内存相关
     bool initSharedMemory();
     void cleanupSharedMemory();
+    void startNotifyThread();
+    void stopNotifyThread();
+    void notifyLoop(struct shared_weather_data *sd); // 等待线程：阻塞在写端通知上，唤醒后让界面线程刷新
     void updateConnectionStatus();
 
     // 数据更新相关 - 修改和新增
     void updateStationWithBME280Data(const struct bme280_data &data, int stationIndex);
     void updateStationWithLightRainData(const struct lightrain_data &data, int stationIndex);
     void updateStationWithGPSData(const struct gps_data &data, int stationIndex);
-    void updateAlertWithLatestData(int stationIndex);
+    void updateAlertWithLatestData(const struct node_latest &node, int stationIndex);
+    bool refreshNodeFromSharedMemory(int nodeId); // 按槽位快照刷新一个节点，读取失败返回false
     void simulateRandomDataForOtherStations(int excludeIndex);
 
     // 新增：确保某 nodeId 的控件已创建并显示
@@ -114,9 +119,14 @@ private:
 
     // 共享内存相关
     struct shared_weather_data *m_sharedData;
-    int m_shmId;
+    size_t m_shmLen; // 映射长度
+    ino_t m_shmIno;  // 映射文件的 inode，用来发现接收程序重建了文件
     bool m_sharedMemoryValid;
     uint32_t m_lastUpdateCounter; // 上次更新计数器
+    struct shm_latest m_latest; // 最近一次一致读取的最新数据快照
+    bool m_fullRefresh; // 下次更新时刷新所有上报过的节点，而不只是脏位置位的
+    std::thread m_notifyThread; // 共享内存变化通知的等待线程
+    std::atomic<bool> m_notifyStop;
     // 数据相关
     int m_currentStationIndex; // 当前显示真实数据的站点索引
     bool m_useRealData; // 是否使用真实数据
@@ -0,0 +1,553 @@
+/*
+端到端回环压测
+
+每个场景启动一个全新的 server 进程，再 fork 出发送进程（N 个发送线程，各自一条
+TCP 连接）和接收进程（M 个接收线程），按给定总速率发送 BME280 帧。发送时在帧的
+FRAME_TS_OFF 处写入 CLOCK_MONOTONIC 纳秒低 32 位，接收端据此计算端到端延迟。
+结果以 JSON 输出，便于不同版本之间比较：吞吐、丢帧、延迟分位数、
+每帧 CPU 时间（server/发送进程/接收进程分别统计）、各进程 RSS。
+
+-k 在接收进程里再挂若干个慢接收端（slow_reader.h，-m 选择限速/间歇/停止），
+它们不计入延迟与丢帧，用来观察正常接收端的延迟和发送端吞吐随慢接收端数量的变化。
+
+用法见 usage()；场景矩阵为 -s × -r × -R × -k 的笛卡尔积。
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "proto.h"
+#include "hdr_hist.h"
+#include "slow_reader.h"
+
+#define MAX_LIST      16
+#define MAX_THREADS   256
+#define TICK_NS       1000000LL    /* 发送节拍 1ms，每拍把应发的帧合并成一次写 */
+#define MAX_BURST     4096         /* 每拍最多帧数 */
+#define DRAIN_MS      2000         /* 发送结束后等待接收端收齐的最长时间 */
+
+struct scenario {
+    int senders;
+    int receivers;
+    long rate;                     /* 总帧率，帧/秒 */
+    int slow;                      /* 慢接收端个数 */
+};
+
+static struct {
+    const char *server_bin;
+    const char *label;
+    int port;
+    double duration;               /* 计量时长，秒 */
+    double warmup;                 /* 预热时长，不计入延迟与 CPU */
+    const char *slow_spec;         /* 慢接收端模式，见 slow_reader.h */
+    struct slow_mode slow_mode;
+} g_opt = { "./output/server", "", 19000, 5.0, 1.0, "stop", { SLOW_STOP, 0, 0, 0 } };
+
+/* 子进程回报给父进程的结果 */
+struct child_report {
+    uint64_t frames;               /* 发送进程：已发帧数；接收进程：已收帧数（所有接收线程之和） */
+    uint64_t measured;             /* 接收进程：计入延迟统计的帧数 */
+    uint64_t hist[HIST_BUCKETS];   /* 接收进程：端到端延迟 (ns) */
+    uint64_t lat_sum;
+    double cpu_s;                  /* 计量窗口内的 CPU 时间 */
+    long rss_kb, hwm_kb;
+    int connect_failures;
+    uint64_t on_time;              /* 发送进程：在发送窗口结束前写完的帧数 */
+    uint64_t max_block_ns;         /* 发送进程：单次写被服务器反压阻塞的最长时间 */
+    uint64_t slow_bytes;           /* 接收进程：慢接收端读到的字节数 */
+    int slow_evicted;              /* 接收进程：被服务器断开的慢接收端个数 */
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = { (time_t)(t / 1000000000ull), (long)(t % 1000000000ull) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) { }
+}
+
+static double self_cpu_s(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* /proc/<pid>/stat 的 utime+stime */
+static double proc_cpu_s(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    const char *p = strrchr(buf, ')');   /* 跳过可能含空格的进程名 */
+    if (p == NULL) return 0;
+    unsigned long ut = 0, st = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &st) != 2) return 0;
+    return (double)(ut + st) / (double)sysconf(_SC_CLK_TCK);
+}
+
+/* /proc/<pid>/status 中的 VmRSS 和 VmHWM (kB) */
+static void proc_rss_kb(pid_t pid, long *rss, long *hwm) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    *rss = *hwm = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) *rss = atol(line + 6);
+        else if (strncmp(line, "VmHWM:", 6) == 0) *hwm = atol(line + 6);
+    }
+    fclose(f);
+}
+
+static int connect_role(int port, const uint8_t *role) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        send_all(fd, role, ROLE_LEN) != ROLE_LEN) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 合法的 BME280 帧；时间戳位于填充区，不参与校验，发送时直接改写 */
+static void build_template(uint8_t *buf, uint8_t node_id) {
+    memset(buf, 0, FRAME_LEN);
+    buf[0] = node_id;
+    buf[1] = CMD_BME280;
+    buf[2] = 0x09; buf[3] = 0xC4;      /* 25.00°C */
+    buf[4] = 0x27; buf[5] = 0x74;      /* 1010.0 hPa */
+    buf[6] = 0x13; buf[7] = 0x88;      /* 50.00% */
+    buf[8] = Calculate_CRC4(&buf[2], 6) & 0x0F;
+    uint8_t cs = 0;
+    for (int i = 0; i < 9; i++) cs ^= buf[i];
+    buf[9] = cs;
+    buf[10] = END_SYMBOL[0];
+}
+
+/* ---------------- 发送进程 ---------------- */
+
+struct sender_arg {
+    int port;
+    int idx;
+    double rate;                   /* 本线程帧率 */
+    uint64_t t_start, t_end;
+    uint64_t sent, on_time, max_block_ns;
+    int failed;
+};
+
+static void *sender_main(void *arg) {
+    struct sender_arg *a = (struct sender_arg *)arg;
+    int fd = connect_role(a->port, ROLE_SENDER);
+    if (fd < 0) { a->failed = 1; return NULL; }
+
+    static __thread uint8_t burst[MAX_BURST][FRAME_LEN];
+    for (int i = 0; i < MAX_BURST; ++i) build_template(burst[i], (uint8_t)(a->idx + 1));
+
+    sleep_until(a->t_start);
+    for (uint64_t tick = a->t_start; tick < a->t_end; tick += TICK_NS) {
+        uint64_t due = (uint64_t)(a->rate * (double)(tick + TICK_NS - a->t_start) / 1e9);
+        uint64_t n = due > a->sent ? due - a->sent : 0;
+        if (n > MAX_BURST) n = MAX_BURST;
+        if (n > 0) {
+            uint32_t ts = (uint32_t)now_ns();
+            for (uint64_t i = 0; i < n; ++i) put_be32(&burst[i][FRAME_TS_OFF], ts ? ts : 1);
+            uint64_t t0 = now_ns();
+            if (send_all(fd, burst, (size_t)n * FRAME_LEN) != (ssize_t)(n * FRAME_LEN)) { a->failed = 1; break; }
+            uint64_t t1 = now_ns();
+            if (t1 - t0 > a->max_block_ns) a->max_block_ns = t1 - t0;
+            if (t1 <= a->t_end) a->on_time += n;
+            a->sent += n;
+        }
+        sleep_until(tick + TICK_NS);
+    }
+    /* 等服务器读完再断开，避免丢掉尾部 */
+    shutdown(fd, SHUT_WR);
+    poll(NULL, 0, 200);
+    close(fd);
+    return NULL;
+}
+
+static void run_senders(const struct scenario *sc, int port, uint64_t t_start, uint64_t t_measure,
+                        uint64_t t_end, int out_fd) {
+    static struct sender_arg args[MAX_THREADS];
+    pthread_t th[MAX_THREADS];
+    for (int i = 0; i < sc->senders; ++i) {
+        args[i] = (struct sender_arg){ .port = port, .idx = i, .rate = (double)sc->rate / sc->senders,
+                                       .t_start = t_start, .t_end = t_end };
+        pthread_create(&th[i], NULL, sender_main, &args[i]);
+    }
+    sleep_until(t_measure);
+    double cpu0 = self_cpu_s();
+    struct child_report rep;
+    memset(&rep, 0, sizeof(rep));
+    for (int i = 0; i < sc->senders; ++i) {
+        pthread_join(th[i], NULL);
+        rep.frames += args[i].sent;
+        rep.on_time += args[i].on_time;
+        if (args[i].max_block_ns > rep.max_block_ns) rep.max_block_ns = args[i].max_block_ns;
+        rep.connect_failures += args[i].failed;
+    }
+    rep.cpu_s = self_cpu_s() - cpu0;
+    proc_rss_kb(getpid(), &rep.rss_kb, &rep.hwm_kb);
+    if (write(out_fd, &rep, sizeof(rep)) != (ssize_t)sizeof(rep)) perror("[bench] report");
+}
+
+/* ---------------- 接收进程 ---------------- */
+
+struct recv_arg {
+    int fd;
+    uint64_t t_measure;
+    volatile int *stop;
+    uint64_t frames, measured, lat_sum;
+    uint64_t hist[HIST_BUCKETS];
+};
+
+static void *receiver_main(void *arg) {
+    struct recv_arg *a = (struct recv_arg *)arg;
+    static __thread uint8_t buf[64 * 1024];
+    size_t have = 0;
+    while (!*a->stop) {
+        struct pollfd pfd = { .fd = a->fd, .events = POLLIN };
+        if (poll(&pfd, 1, 50) <= 0) continue;
+        ssize_t r = recv(a->fd, buf + have, sizeof(buf) - have, 0);
+        if (r <= 0) break;
+        uint64_t t = now_ns();
+        have += (size_t)r;
+        size_t off = 0;
+        for (; off + FRAME_LEN <= have; off += FRAME_LEN) {
+            a->frames++;
+            uint32_t ts = get_be32(buf + off + FRAME_TS_OFF);
+            /* 按发送时刻筛选：预热期发出、计量期才到的帧不计；32 位回绕相减，间隔小于 2.1 s 时正确 */
+            if (ts == 0 || (int32_t)(ts - (uint32_t)a->t_measure) < 0) continue;
+            uint64_t lat = (uint32_t)((uint32_t)t - ts);
+            a->hist[hist_bucket(lat)]++;
+            a->lat_sum += lat;
+            a->measured++;
+        }
+        memmove(buf, buf + off, have - off);
+        have -= off;
+    }
+    return NULL;
+}
+
+struct slow_arg {
+    int fd;
+    uint64_t until;
+    volatile int *stop;
+    struct slow_result res;
+};
+
+/* 慢接收端到发送结束时自行断开，否则停止读取的连接会让服务器一直卡在发送上 */
+static void *slow_main(void *arg) {
+    struct slow_arg *a = (struct slow_arg *)arg;
+    slow_read_loop(a->fd, &g_opt.slow_mode, a->stop, a->until, &a->res);
+    close(a->fd);
+    return NULL;
+}
+
+static void run_receivers(const struct scenario *sc, int port, int ready_fd, int ctl_fd, int out_fd) {
+    static struct recv_arg args[MAX_THREADS];
+    static struct slow_arg slow[MAX_THREADS];
+    pthread_t th[MAX_THREADS], sth[MAX_THREADS];
+    volatile int stop = 0;
+    struct child_report rep;
+    memset(&rep, 0, sizeof(rep));
+
+    int n = 0;
+    for (int i = 0; i < sc->receivers; ++i) {
+        int fd = connect_role(port, ROLE_RECVR);
+        if (fd < 0) { rep.connect_failures++; continue; }
+        memset(&args[n], 0, sizeof(args[n]));
+        args[n].fd = fd;
+        args[n].stop = &stop;
+        n++;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int ns = 0;
+    for (int i = 0; i < sc->slow; ++i) {
+        int fd = slow_connect(&addr);
+        if (fd < 0) { rep.connect_failures++; continue; }
+        memset(&slow[ns], 0, sizeof(slow[ns]));
+        slow[ns].fd = fd;
+        slow[ns].stop = &stop;
+        ns++;
+    }
+    /* 服务器登记接收者在 accept 线程里完成，稍等再让发送端开始 */
+    poll(NULL, 0, 100);
+    uint8_t ok = 1;
+    if (write(ready_fd, &ok, 1) != 1) perror("[bench] ready");
+
+    /* 父进程定好计量起点后再启动接收线程，预热期的帧只计数不计延迟 */
+    uint64_t t_measure = 0;
+    if (read(ctl_fd, &t_measure, sizeof(t_measure)) != (ssize_t)sizeof(t_measure)) t_measure = 0;
+    for (int i = 0; i < n; ++i) {
+        args[i].t_measure = t_measure;
+        pthread_create(&th[i], NULL, receiver_main, &args[i]);
+    }
+    for (int i = 0; i < ns; ++i) {
+        slow[i].until = t_measure + (uint64_t)(g_opt.duration * 1e9);
+        pthread_create(&sth[i], NULL, slow_main, &slow[i]);
+    }
+    sleep_until(t_measure);
+    double cpu0 = self_cpu_s();
+
+    /* 父进程写来发送总数后，等所有接收线程收齐或超时 */
+    uint64_t expect = 0;
+    if (read(ctl_fd, &expect, sizeof(expect)) != (ssize_t)sizeof(expect)) expect = 0;
+    uint64_t deadline = now_ns() + (uint64_t)DRAIN_MS * 1000000ull;
+    for (;;) {
+        int done = 1;
+        for (int i = 0; i < n; ++i) if (__atomic_load_n(&args[i].frames, __ATOMIC_RELAXED) < expect) done = 0;
+        if (done || now_ns() > deadline) break;
+        poll(NULL, 0, 10);
+    }
+    stop = 1;
+    for (int i = 0; i < n; ++i) {
+        pthread_join(th[i], NULL);
+        close(args[i].fd);
+        rep.frames += args[i].frames;
+        rep.measured += args[i].measured;
+        rep.lat_sum += args[i].lat_sum;
+        for (int b = 0; b < HIST_BUCKETS; ++b) rep.hist[b] += args[i].hist[b];
+    }
+    for (int i = 0; i < ns; ++i) {
+        pthread_join(sth[i], NULL);
+        rep.slow_bytes += slow[i].res.bytes;
+        rep.slow_evicted += slow[i].res.closed_ns != 0;
+    }
+    rep.cpu_s = self_cpu_s() - cpu0;
+    proc_rss_kb(getpid(), &rep.rss_kb, &rep.hwm_kb);
+    if (write(out_fd, &rep, sizeof(rep)) != (ssize_t)sizeof(rep)) perror("[bench] report");
+}
+
+/* ---------------- 父进程 ---------------- */
+
+static pid_t start_server(int port) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) { dup2(devnull, 1); dup2(devnull, 2); close(devnull); }
+        char p[16];
+        snprintf(p, sizeof(p), "%d", port);
+        execl(g_opt.server_bin, g_opt.server_bin, p, (char *)NULL);
+        _exit(127);
+    }
+    /* 等端口可连 */
+    for (int i = 0; i < 100 && pid > 0; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int rc = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+        close(fd);   /* 未发角色即断开，服务器只记一条日志 */
+        if (rc == 0) return pid;
+        poll(NULL, 0, 50);
+    }
+    if (pid > 0) { kill(pid, SIGKILL); waitpid(pid, NULL, 0); }
+    return -1;
+}
+
+static int read_report(int fd, struct child_report *rep) {
+    size_t got = 0;
+    while (got < sizeof(*rep)) {
+        ssize_t r = read(fd, (char *)rep + got, sizeof(*rep) - got);
+        if (r <= 0) return -1;
+        got += (size_t)r;
+    }
+    return 0;
+}
+
+static int run_scenario(const struct scenario *sc, int port, FILE *out, int first) {
+    pid_t srv = start_server(port);
+    if (srv < 0) { fprintf(stderr, "[bench] cannot start %s on %d\n", g_opt.server_bin, port); return -1; }
+
+    int rpipe[2], rready[2], rctl[2], spipe[2];
+    if (pipe(rpipe) || pipe(rready) || pipe(rctl) || pipe(spipe)) { perror("pipe"); return -1; }
+
+    uint64_t t0 = now_ns();
+    /* 接收端先全部连上，再由父进程定下统一的发送起点与计量起点 */
+    static struct child_report rrep, srep;
+    pid_t rp = fork();
+    if (rp == 0) {
+        run_receivers(sc, port, rready[1], rctl[0], rpipe[1]);
+        _exit(0);
+    }
+    uint8_t ok;
+    if (read(rready[0], &ok, 1) != 1) return -1;
+
+    uint64_t t_start = now_ns() + 100000000ull;
+    uint64_t t_measure = t_start + (uint64_t)(g_opt.warmup * 1e9);
+    uint64_t t_end = t_measure + (uint64_t)(g_opt.duration * 1e9);
+    if (write(rctl[1], &t_measure, sizeof(t_measure)) != (ssize_t)sizeof(t_measure)) return -1;
+
+    pid_t sp = fork();
+    if (sp == 0) {
+        run_senders(sc, port, t_start, t_measure, t_end, spipe[1]);
+        _exit(0);
+    }
+
+    sleep_until(t_measure);
+    double srv_cpu0 = proc_cpu_s(srv);
+    int rc = read_report(spipe[0], &srep);
+    double srv_cpu = proc_cpu_s(srv) - srv_cpu0;
+    uint64_t expect = srep.frames;
+    if (write(rctl[1], &expect, sizeof(expect)) != (ssize_t)sizeof(expect)) rc = -1;
+    if (rc == 0) rc = read_report(rpipe[0], &rrep);
+    long srv_rss, srv_hwm;
+    proc_rss_kb(srv, &srv_rss, &srv_hwm);
+
+    waitpid(sp, NULL, 0);
+    waitpid(rp, NULL, 0);
+    kill(srv, SIGTERM);
+    waitpid(srv, NULL, 0);
+    close(rpipe[0]); close(rpipe[1]); close(rready[0]); close(rready[1]);
+    close(rctl[0]); close(rctl[1]); close(spipe[0]); close(spipe[1]);
+    if (rc != 0) { fprintf(stderr, "[bench] scenario failed\n"); return -1; }
+
+    double wall = (now_ns() - t0) / 1e9;
+    uint64_t expected_rx = expect * (uint64_t)sc->receivers;
+    uint64_t lost = expected_rx > rrep.frames ? expected_rx - rrep.frames : 0;
+    /* 计量窗口内发出的帧数按速率估算；接收端按计入延迟统计的帧数折算 */
+    double measured_tx = (double)sc->rate * g_opt.duration;
+    double per = measured_tx > 0 ? 1e6 / measured_tx : 0;
+    double per_rx = rrep.measured ? 1e6 / (double)rrep.measured : 0;
+    const uint64_t *h = rrep.hist;
+
+    fprintf(out, "%s    {\"senders\": %d, \"receivers\": %d, \"rate\": %ld, \"duration_s\": %.1f,\n"
+                 "     \"slow_receivers\": %d, \"slow_mode\": \"%s\", \"slow_bytes\": %llu, \"slow_evicted\": %d,\n"
+                 "     \"sent\": %llu, \"received\": %llu, \"lost\": %llu, \"connect_failures\": %d,\n"
+                 "     \"throughput_fps\": %.1f, \"delivered_fps\": %.1f, \"ingest_ratio\": %.4f, \"sender_max_block_ms\": %.3f,\n"
+                 "     \"latency_us\": {\"samples\": %llu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f},\n"
+                 "     \"cpu_us_per_frame\": {\"server\": %.3f, \"senders\": %.3f, \"receivers\": %.3f},\n"
+                 "     \"rss_kb\": {\"server\": %ld, \"server_peak\": %ld, \"senders\": %ld, \"senders_peak\": %ld, \"receivers\": %ld, \"receivers_peak\": %ld},\n"
+                 "     \"wall_s\": %.2f}",
+            first ? "" : ",\n", sc->senders, sc->receivers, sc->rate, g_opt.duration,
+            sc->slow, sc->slow ? g_opt.slow_spec : "", (unsigned long long)rrep.slow_bytes, rrep.slow_evicted,
+            (unsigned long long)expect, (unsigned long long)rrep.frames, (unsigned long long)lost,
+            srep.connect_failures + rrep.connect_failures,
+            expect / (g_opt.warmup + g_opt.duration),
+            rrep.frames / (g_opt.warmup + g_opt.duration),
+            srep.on_time / ((double)sc->rate * (g_opt.warmup + g_opt.duration)), srep.max_block_ns / 1e6,
+            (unsigned long long)rrep.measured,
+            rrep.measured ? rrep.lat_sum / (double)rrep.measured / 1e3 : 0.0,
+            hist_quantile(h, 0.50) / 1e3, hist_quantile(h, 0.99) / 1e3,
+            hist_quantile(h, 0.999) / 1e3, hist_quantile(h, 1.0) / 1e3,
+            srv_cpu * per, srep.cpu_s * per, rrep.cpu_s * per_rx,
+            srv_rss, srv_hwm, srep.rss_kb, srep.hwm_kb, rrep.rss_kb, rrep.hwm_kb, wall);
+    fflush(out);
+    fprintf(stderr, "[bench] s=%d r=%d rate=%ld slow=%d: sent=%llu lost=%llu p99=%.1fus\n", sc->senders,
+            sc->receivers, sc->rate, sc->slow, (unsigned long long)expect, (unsigned long long)lost,
+            hist_quantile(h, 0.99) / 1e3);
+    return 0;
+}
+
+static int parse_list(const char *s, long *out) {
+    int n = 0;
+    char *end;
+    while (*s && n < MAX_LIST) {
+        out[n++] = strtol(s, &end, 10);
+        if (*end != ',') break;
+        s = end + 1;
+    }
+    return n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-b server程序] [-s 发送端数列表] [-r 接收端数列表] [-R 总帧率列表]\n"
+                    "          [-k 慢接收端数列表] [-m 慢接收端模式]\n"
+                    "          [-d 计量秒数] [-w 预热秒数] [-p 起始端口] [-l 版本标签] [-o 输出文件]\n"
+                    "  列表用逗号分隔，如 -s 1,8 -r 1,4 -R 1000,20000 -k 0,1,4；每个组合跑一个场景\n"
+                    "  -m throttle:<字节/秒> | pause:<读毫秒>/<停毫秒> | stop\n"
+                    "  默认 -b ./output/server -s 1 -r 1 -R 1000 -k 0 -m stop -d 5 -w 1 -p 19000，结果 JSON 写到标准输出\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    long ns[MAX_LIST] = { 1 }, nr[MAX_LIST] = { 1 }, rates[MAX_LIST] = { 1000 }, nk[MAX_LIST] = { 0 };
+    int cs = 1, cr = 1, crate = 1, ck = 1, opt;
+    const char *out_path = NULL;
+    while ((opt = getopt(argc, argv, "b:s:r:R:k:m:d:w:p:l:o:h")) != -1) {
+        switch (opt) {
+        case 'b': g_opt.server_bin = optarg; break;
+        case 's': cs = parse_list(optarg, ns); break;
+        case 'r': cr = parse_list(optarg, nr); break;
+        case 'R': crate = parse_list(optarg, rates); break;
+        case 'k': ck = parse_list(optarg, nk); break;
+        case 'm':
+            g_opt.slow_spec = optarg;
+            if (slow_mode_parse(optarg, &g_opt.slow_mode) != 0) { usage(argv[0]); return 1; }
+            break;
+        case 'd': g_opt.duration = atof(optarg); break;
+        case 'w': g_opt.warmup = atof(optarg); break;
+        case 'p': g_opt.port = atoi(optarg); break;
+        case 'l': g_opt.label = optarg; break;
+        case 'o': out_path = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    FILE *out = stdout;
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) { perror(out_path); return 1; }
+
+    time_t now = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(out, "{\"label\": \"%s\", \"server\": \"%s\", \"date\": \"%s\", \"cpus\": %ld,\n \"scenarios\": [\n",
+            g_opt.label, g_opt.server_bin, stamp, sysconf(_SC_NPROCESSORS_ONLN));
+
+    int idx = 0, failed = 0;
+    for (int a = 0; a < cs; ++a)
+        for (int b = 0; b < cr; ++b)
+            for (int c = 0; c < crate; ++c)
+                for (int d = 0; d < ck; ++d) {
+                    struct scenario sc = { (int)ns[a], (int)nr[b], rates[c], (int)nk[d] };
+                    if (sc.senders < 1 || sc.senders > MAX_THREADS || sc.receivers < 1 ||
+                        sc.receivers > MAX_THREADS || sc.rate <= 0 || sc.slow < 0 || sc.slow > MAX_THREADS) {
+                        fprintf(stderr, "[bench] skip invalid scenario s=%d r=%d rate=%ld slow=%d\n",
+                                sc.senders, sc.receivers, sc.rate, sc.slow);
+                        continue;
+                    }
+                    if (run_scenario(&sc, g_opt.port + idx, out, idx == 0) == 0) idx++;
+                    else failed++;
+                }
+    fprintf(out, "\n ]}\n");
+    if (out != stdout) fclose(out);
+    return failed ? 1 : 0;
+}
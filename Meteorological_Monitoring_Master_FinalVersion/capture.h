@@ -0,0 +1,211 @@
+/*
+帧抓包文件
+
+server（-C）和 receiver_with_shm（-C）把收到的原始帧连同到达时刻、连接编号
+追加写入抓包文件，capture_replay 再按原始节奏（或加速、压缩空闲）回放给服务器，
+用真实流量的时间分布和数值分布做可重复的压测。
+
+文件格式（多字节整数均为大端）：
+  文件头 8 字节：  "MMMCAP" 版本(1) 保留(1)
+  记录：           长度(1) ...
+    长度 0      同步记录：CLOCK_MONOTONIC ns(8) CLOCK_REALTIME ns(8)，之后的时间差以此为起点
+    长度 1..32  帧记录：  时间差 ns(zigzag varint) 连接编号(varint) 帧字节(长度)
+帧只保存到最后一个非零字节，回放时补零到 FRAME_LEN，填充区的时间戳 / 来源 / 跳数原样保留。
+典型记录 15~30 字节。每次打开文件都先写一条同步记录，所以可以反复追加（包括热升级后
+新进程接着写同一个文件）；不同进程的 CLOCK_MONOTONIC 在同一台机器上可比。
+
+写入端多个线程共用一个 stdio 缓冲区，加锁后只做一次 fwrite，不在数据通路上等磁盘；
+未开启时 capture_frame() 只有一次判空。使用前需先包含 proto.h，并链接 -lpthread。
+*/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define CAPTURE_MAGIC     "MMMCAP"
+#define CAPTURE_VERSION   1
+#define CAPTURE_HDR_LEN   8
+#define CAPTURE_BUF_SIZE  (1 << 20)
+#define CAPTURE_REC_MAX   (1 + 10 + 5 + FRAME_LEN)
+
+struct capture_writer {
+    FILE *f;
+    uint64_t prev_ns;                  /* 上一条记录的时刻 */
+    int resync;                        /* 下一条记录前先写同步记录 */
+    uint64_t frames, bytes;
+    pthread_mutex_t mtx;
+};
+
+#define CAPTURE_WRITER_INIT { NULL, 0, 1, 0, 0, PTHREAD_MUTEX_INITIALIZER }
+
+struct capture_record {
+    uint64_t ts_ns;                    /* 到达时刻，CLOCK_MONOTONIC */
+    uint32_t conn;
+    uint8_t len;                       /* 文件中保存的字节数 */
+    uint8_t frame[FRAME_LEN];          /* 已补零 */
+};
+
+struct capture_reader {
+    FILE *f;
+    uint64_t prev_ns;
+    uint64_t mono_ns, wall_ns;         /* 最近一条同步记录 */
+    int synced;
+};
+
+static inline uint64_t capture_clock_ns(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline size_t capture_put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline int capture_get_varint(FILE *f, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return -1;
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return 0;
+    }
+    return -1;
+}
+
+/* 追加打开；新文件写文件头，已有文件校验文件头，不是抓包文件时拒绝写入 */
+static inline int capture_open(struct capture_writer *w, const char *path) {
+    FILE *f = fopen(path, "a+b");
+    if (f == NULL) return -1;
+    uint8_t hdr[CAPTURE_HDR_LEN];
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0) {
+        memcpy(hdr, CAPTURE_MAGIC, 6);
+        hdr[6] = CAPTURE_VERSION;
+        hdr[7] = 0;
+        if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) { fclose(f); return -1; }
+    } else {
+        rewind(f);
+        if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, CAPTURE_MAGIC, 6) != 0 ||
+            hdr[6] != CAPTURE_VERSION) {
+            fclose(f);
+            return -1;
+        }
+        fseek(f, 0, SEEK_END);
+    }
+    setvbuf(f, NULL, _IOFBF, CAPTURE_BUF_SIZE);
+    pthread_mutex_lock(&w->mtx);
+    w->resync = 1;
+    __atomic_store_n(&w->f, f, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&w->mtx);
+    return 0;
+}
+
+/* 记录一帧；ts_ns 为 CLOCK_MONOTONIC 到达时刻 */
+static inline void capture_frame(struct capture_writer *w, uint64_t ts_ns, uint32_t conn, const uint8_t *frame) {
+    if (__atomic_load_n(&w->f, __ATOMIC_ACQUIRE) == NULL) return;
+    uint8_t rec[1 + 16 + CAPTURE_REC_MAX];
+    size_t n = 0;
+    int len = FRAME_LEN;
+    while (len > 1 && frame[len - 1] == 0) len--;
+
+    pthread_mutex_lock(&w->mtx);
+    if (w->f == NULL) { pthread_mutex_unlock(&w->mtx); return; }
+    if (w->resync) {
+        rec[n++] = 0;
+        put_be64(rec + n, ts_ns); n += 8;
+        put_be64(rec + n, capture_clock_ns(CLOCK_REALTIME)); n += 8;
+        w->prev_ns = ts_ns;
+        w->resync = 0;
+    }
+    /* 多个线程先取时刻后抢锁，时间差可能为负，用 zigzag 编码 */
+    int64_t d = (int64_t)(ts_ns - w->prev_ns);
+    w->prev_ns = ts_ns;
+    rec[n++] = (uint8_t)len;
+    n += capture_put_varint(rec + n, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+    n += capture_put_varint(rec + n, conn);
+    memcpy(rec + n, frame, (size_t)len); n += (size_t)len;
+    if (fwrite(rec, 1, n, w->f) == n) {
+        w->frames++;
+        w->bytes += n;
+    }
+    pthread_mutex_unlock(&w->mtx);
+}
+
+/* 刷到文件；之后的记录重新从同步记录开始，另一个进程可以安全地接着追加 */
+static inline void capture_sync(struct capture_writer *w) {
+    pthread_mutex_lock(&w->mtx);
+    if (w->f != NULL) fflush(w->f);
+    w->resync = 1;
+    pthread_mutex_unlock(&w->mtx);
+}
+
+static inline void capture_close(struct capture_writer *w) {
+    pthread_mutex_lock(&w->mtx);
+    if (w->f != NULL) {
+        fclose(w->f);
+        __atomic_store_n(&w->f, NULL, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&w->mtx);
+}
+
+static inline int capture_reader_open(struct capture_reader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->f = fopen(path, "rb");
+    if (r->f == NULL) return -1;
+    uint8_t hdr[CAPTURE_HDR_LEN];
+    if (fread(hdr, 1, sizeof(hdr), r->f) != sizeof(hdr) || memcmp(hdr, CAPTURE_MAGIC, 6) != 0 ||
+        hdr[6] != CAPTURE_VERSION) {
+        fclose(r->f);
+        r->f = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void capture_reader_rewind(struct capture_reader *r) {
+    fseek(r->f, CAPTURE_HDR_LEN, SEEK_SET);
+    r->prev_ns = 0;
+    r->synced = 0;
+}
+
+/* 读下一帧；返回 1 成功，0 文件结束（末尾半条记录也按结束处理），-1 格式错误 */
+static inline int capture_next(struct capture_reader *r, struct capture_record *rec) {
+    for (;;) {
+        int len = getc(r->f);
+        if (len == EOF) return 0;
+        if (len == 0) {
+            uint8_t b[16];
+            if (fread(b, 1, sizeof(b), r->f) != sizeof(b)) return 0;
+            r->mono_ns = get_be64(b);
+            r->wall_ns = get_be64(b + 8);
+            r->prev_ns = r->mono_ns;
+            r->synced = 1;
+            continue;
+        }
+        if (len > FRAME_LEN || !r->synced) return -1;
+        uint64_t zz, conn;
+        if (capture_get_varint(r->f, &zz) != 0 || capture_get_varint(r->f, &conn) != 0) return 0;
+        int64_t d = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+        r->prev_ns += (uint64_t)d;
+        memset(rec, 0, sizeof(*rec));
+        rec->ts_ns = r->prev_ns;
+        rec->conn = (uint32_t)conn;
+        rec->len = (uint8_t)len;
+        if (fread(rec->frame, 1, (size_t)len, r->f) != (size_t)len) return 0;
+        return 1;
+    }
+}
+
+static inline void capture_reader_close(struct capture_reader *r) {
+    if (r->f != NULL) fclose(r->f);
+    r->f = NULL;
+}
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,257 @@
+/*
+抓包回放：把 server -C / receiver_with_shm -C 写下的抓包文件按原始节奏发给服务器。
+
+- 抓包里每个连接编号对应一条发送端连接（-1 时全部合并到一条），第一次出现时建立。
+- -s 倍速：1 为原速，N 为 N 倍速，max 不等待尽快发送；
+  -g 把超过该毫秒数的空闲间隔压缩到该值，长时间抓包里夜间的静默段不必等完。
+- 同一时刻到期的帧先攒进各连接的缓冲区，需要等待或缓冲区满时再一起发出，
+  max 模式下每次 send 是一整块而不是一帧。
+- -t 用回放时刻改写帧的 FRAME_TS_OFF，配合 bench 接收端测端到端延迟。
+- 结束时打印发送帧数、实际速率，以及相对计划时刻的滞后分位数（服务器跟不上时变大）。
+- -i 只统计抓包文件内容，-p N 打印前 N 条记录，都不需要服务器。
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "proto.h"
+#include "capture.h"
+#include "hdr_hist.h"
+
+#define MAX_CONNS    1024           /* 与服务器 MAX_SEND_CLIENTS 一致 */
+#define CONN_BUF     (FRAME_LEN * 128)
+
+struct replay_conn {
+    uint32_t id;                    /* 抓包里的连接编号 */
+    int fd;
+    size_t used;
+    uint8_t buf[CONN_BUF];
+};
+
+static struct replay_conn *g_conns;
+static int g_nconns = 0;
+static int g_dirty[MAX_CONNS], g_ndirty = 0;
+static struct sockaddr_in g_addr;
+static volatile sig_atomic_t g_stop = 0;
+
+static struct {
+    double speed;                   /* 0 表示尽快 */
+    uint64_t max_gap_ns;            /* 0 表示不压缩 */
+    int loops;
+    int single;                     /* 合并到一条连接 */
+    int restamp;
+} g_opt = { 1.0, 0, 1, 0, 0 };
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static uint64_t now_ns(void) {
+    return capture_clock_ns(CLOCK_MONOTONIC);
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = { (time_t)(t / 1000000000ull), (long)(t % 1000000000ull) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !g_stop) {}
+}
+
+static int open_sender(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0 ||
+        send_all(fd, ROLE_SENDER, ROLE_LEN) != ROLE_LEN) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 找到或建立抓包连接编号对应的发送端连接 */
+static struct replay_conn *get_conn(uint32_t id) {
+    if (g_opt.single) id = 0;
+    for (int i = 0; i < g_nconns; ++i)
+        if (g_conns[i].id == id) return &g_conns[i];
+    if (g_nconns == MAX_CONNS) {
+        static int warned = 0;
+        if (!warned) fprintf(stderr, "[sender] more than %d connections in capture, folding the rest\n", MAX_CONNS);
+        warned = 1;
+        return &g_conns[id % MAX_CONNS];
+    }
+    struct replay_conn *c = &g_conns[g_nconns];
+    c->fd = open_sender();
+    if (c->fd < 0) return NULL;
+    c->id = id;
+    c->used = 0;
+    g_nconns++;
+    return c;
+}
+
+static int flush_all(void) {
+    for (int i = 0; i < g_ndirty; ++i) {
+        struct replay_conn *c = &g_conns[g_dirty[i]];
+        if (c->used > 0 && send_all(c->fd, c->buf, c->used) != (ssize_t)c->used) return -1;
+        c->used = 0;
+    }
+    g_ndirty = 0;
+    return 0;
+}
+
+static int enqueue(struct replay_conn *c, const uint8_t *frame) {
+    if (c->used + FRAME_LEN > CONN_BUF && flush_all() != 0) return -1;
+    if (c->used == 0) g_dirty[g_ndirty++] = (int)(c - g_conns);
+    memcpy(c->buf + c->used, frame, FRAME_LEN);
+    c->used += FRAME_LEN;
+    return 0;
+}
+
+/* -i / -p：不连服务器，只看抓包内容 */
+static int show_info(const char *path, long print_n) {
+    struct capture_reader r;
+    if (capture_reader_open(&r, path) != 0) { fprintf(stderr, "[sender] %s is not a capture file\n", path); return 1; }
+    struct capture_record rec;
+    uint64_t frames = 0, by_cmd[5] = { 0 }, first = 0, last = 0, wall = 0;
+    uint32_t ids[MAX_CONNS];
+    int nids = 0, rc;
+    while ((rc = capture_next(&r, &rec)) == 1) {
+        if (frames == 0) { first = rec.ts_ns; wall = r.wall_ns + (rec.ts_ns - r.mono_ns); }
+        last = rec.ts_ns;
+        frames++;
+        by_cmd[rec.frame[1] <= CMD_GPS ? rec.frame[1] : 0]++;
+        int known = 0;
+        for (int i = 0; i < nids && !known; ++i) known = ids[i] == rec.conn;
+        if (!known && nids < MAX_CONNS) ids[nids++] = rec.conn;
+        if ((long)frames <= print_n) {
+            printf("%12.6f conn=%-5u len=%-2u ", (rec.ts_ns - first) / 1e9, rec.conn, rec.len);
+            for (int i = 0; i < rec.len; ++i) printf("%02x", rec.frame[i]);
+            printf("\n");
+        }
+    }
+    long size = ftell(r.f);
+    capture_reader_close(&r);
+    if (rc < 0) fprintf(stderr, "[sender] %s: corrupt record after %llu frames\n", path, (unsigned long long)frames);
+    if (print_n > 0) return rc < 0;
+
+    time_t t = (time_t)(wall / 1000000000ull);
+    char ts[32] = "-";
+    if (frames > 0) strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    double dur = (last - first) / 1e9;
+    printf("file:        %s (%ld bytes, %.1f bytes/frame)\n", path, size, frames ? (double)size / frames : 0.0);
+    printf("frames:      %llu (bme280 %llu, lightrain %llu, status %llu, gps %llu, other %llu)\n",
+           (unsigned long long)frames, (unsigned long long)by_cmd[1], (unsigned long long)by_cmd[2],
+           (unsigned long long)by_cmd[3], (unsigned long long)by_cmd[4], (unsigned long long)by_cmd[0]);
+    printf("connections: %d%s\n", nids, nids == MAX_CONNS ? "+" : "");
+    printf("start:       %s\n", ts);
+    printf("duration:    %.3f s, %.1f frames/s\n", dur, dur > 0 ? frames / dur : 0.0);
+    return rc < 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-s 倍速|max] [-g 最大间隔毫秒] [-l 次数] [-1] [-t] <抓包文件> <server_ip> <port>\n"
+                    "      %s -i <抓包文件>          统计抓包内容\n"
+                    "      %s -p N <抓包文件>        打印前 N 条记录\n"
+                    "  -s  回放倍速，默认 1（原始节奏），max 为不等待\n"
+                    "  -g  超过该毫秒数的间隔压缩到该值，默认不压缩\n"
+                    "  -l  循环回放次数，0 为直到 Ctrl-C，默认 1\n"
+                    "  -1  所有帧走同一条连接，默认每个抓包连接编号一条\n"
+                    "  -t  用回放时刻改写帧的 FRAME_TS_OFF\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char **argv) {
+    int info = 0, opt;
+    long print_n = 0;
+    while ((opt = getopt(argc, argv, "s:g:l:1tip:h")) != -1) {
+        switch (opt) {
+        case 's': g_opt.speed = strcmp(optarg, "max") == 0 ? 0 : atof(optarg); break;
+        case 'g': g_opt.max_gap_ns = (uint64_t)(atof(optarg) * 1e6); break;
+        case 'l': g_opt.loops = atoi(optarg); break;
+        case '1': g_opt.single = 1; break;
+        case 't': g_opt.restamp = 1; break;
+        case 'i': info = 1; break;
+        case 'p': print_n = atol(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc || g_opt.speed < 0 || g_opt.loops < 0) { usage(argv[0]); return 1; }
+    const char *path = argv[optind];
+    if (info || print_n > 0) return show_info(path, print_n);
+    if (argc - optind < 3) { usage(argv[0]); return 1; }
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons((uint16_t)atoi(argv[optind + 2]));
+    if (inet_pton(AF_INET, argv[optind + 1], &g_addr.sin_addr) != 1) { usage(argv[0]); return 1; }
+
+    struct capture_reader r;
+    if (capture_reader_open(&r, path) != 0) { fprintf(stderr, "[sender] %s is not a capture file\n", path); return 1; }
+    g_conns = (struct replay_conn *)calloc(MAX_CONNS, sizeof(*g_conns));
+    if (g_conns == NULL) { perror("[sender] calloc"); return 1; }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    static uint64_t lag_hist[HIST_BUCKETS];
+    uint64_t sent = 0, t0 = now_ns(), sched = 0;    /* sched：回放时间轴上的位置（抓包时间，已压缩） */
+    int failed = 0;
+    for (int loop = 0; !g_stop && !failed && (g_opt.loops == 0 || loop < g_opt.loops); ++loop) {
+        struct capture_record rec;
+        uint64_t prev = 0;
+        int rc = 0, first = 1;
+        capture_reader_rewind(&r);
+        while (!g_stop && (rc = capture_next(&r, &rec)) == 1) {
+            /* 相邻帧间隔；同步记录之间可能倒退（多线程抢锁），按 0 处理 */
+            uint64_t gap = first || rec.ts_ns < prev ? 0 : rec.ts_ns - prev;
+            if (g_opt.max_gap_ns && gap > g_opt.max_gap_ns) gap = g_opt.max_gap_ns;
+            prev = rec.ts_ns;
+            first = 0;
+            sched += gap;
+
+            if (g_opt.speed > 0) {
+                uint64_t due = t0 + (uint64_t)(sched / g_opt.speed);
+                uint64_t now = now_ns();
+                if (due > now) {
+                    if (flush_all() != 0) { failed = 1; break; }
+                    sleep_until(due);
+                    now = now_ns();
+                }
+                lag_hist[hist_bucket(now > due ? now - due : 0)]++;
+            }
+            if (g_opt.restamp) put_be32(&rec.frame[FRAME_TS_OFF], (uint32_t)now_ns());
+
+            struct replay_conn *c = get_conn(rec.conn);
+            if (c == NULL) { perror("[sender] connect"); failed = 1; break; }
+            if (enqueue(c, rec.frame) != 0) { failed = 1; break; }
+            sent++;
+        }
+        if (rc < 0) fprintf(stderr, "[sender] corrupt record in %s, stopping this pass\n", path);
+    }
+    if (!failed && flush_all() != 0) failed = 1;
+    if (failed && !g_stop) fprintf(stderr, "[sender] send failed: %s\n", strerror(errno));
+
+    double el = (now_ns() - t0) / 1e9;
+    printf("[sender] replayed %llu frames over %d connection(s) in %.3f s (%.0f frames/s)\n",
+           (unsigned long long)sent, g_nconns, el, el > 0 ? sent / el : 0.0);
+    if (g_opt.speed > 0 && sent > 0) {
+        printf("[sender] lag behind schedule: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               hist_quantile(lag_hist, 0.5) / 1e6, hist_quantile(lag_hist, 0.99) / 1e6,
+               hist_quantile(lag_hist, 1.0) / 1e6);
+    }
+    for (int i = 0; i < g_nconns; ++i) close(g_conns[i].fd);
+    capture_reader_close(&r);
+    free(g_conns);
+    return failed ? 1 : 0;
+}
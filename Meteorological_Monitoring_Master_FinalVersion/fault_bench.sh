@@ -0,0 +1,47 @@
+#!/bin/bash
+# 故障注入压测：每类故障单独跑一轮，每轮启动新的 server，
+# 用 sender 集群模式（-F 注入、-M 监视接收端）统计送达率、延迟和恢复时间。
+#
+# 用法：make serv send && ./fault_bench.sh [秒数] [总帧率] [节点数] [连接数]
+# 环境变量 FAULTS 可覆盖默认的各类故障概率
+
+DUR=${1:-10}
+RATE=${2:-5000}
+NODES=${3:-1000}
+CONNS=${4:-100}
+PORT=${PORT:-19300}
+STALL_MS=${STALL_MS:-500}
+OUT=./output
+FAULTS=${FAULTS:-"none crc=0.001 xor=0.001 cmd=0.001 trunc=0.001 split=0.01 stall=0.001"}
+TMP=$(mktemp -d)
+SPID=
+
+cleanup() {
+    [ -n "$SPID" ] && kill "$SPID" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+printf "%-16s %9s %9s %8s %9s %9s %9s %9s %9s %8s\n" \
+    fault sent delivered deliv% p99_ms p999_ms rec_p50 rec_p99 unrecov srv_bad
+for f in $FAULTS; do
+    "$OUT/server" $PORT >"$TMP/server.log" 2>&1 &
+    SPID=$!
+    sleep 0.5
+    args=()
+    [ "$f" != none ] && args=(-F "$f")
+    "$OUT/sender" -N "$NODES" -c "$CONNS" -r "$RATE" -d "$DUR" -W "$STALL_MS" -M "${args[@]}" \
+        127.0.0.1 $PORT >"$TMP/sender.log" 2>&1
+    kill "$SPID"; wait "$SPID" 2>/dev/null; SPID=
+
+    sent=$(sed -n 's/.* frames=\([0-9]*\) (.*/\1/p' "$TMP/sender.log")
+    read -r deliv pct p99 p999 < <(sed -n \
+        's/.*delivered=\([0-9]*\) (\([0-9.]*\)%.*p99=\([0-9.]*\) p999=\([0-9.]*\).*/\1 \2 \3 \4/p' "$TMP/sender.log")
+    read -r ep rec rp50 rp99 < <(sed -n \
+        's/.*episodes=\([0-9]*\) recovered=\([0-9]*\) recovery_ms p50=\([0-9.]*\) p99=\([0-9.]*\).*/\1 \2 \3 \4/p' "$TMP/sender.log")
+    bad=$(sed -n 's/.*frames in, \([0-9]*\) bad.*/\1/p' "$TMP/server.log")
+    printf "%-16s %9s %9s %8s %9s %9s %9s %9s %9s %8s\n" "$f" "${sent:--}" "${deliv:--}" "${pct:--}" \
+        "${p99:--}" "${p999:--}" "${rp50:--}" "${rp99:--}" "$(( ${ep:-0} - ${rec:-0} ))" "${bad:--}"
+    PORT=$((PORT + 1))
+done
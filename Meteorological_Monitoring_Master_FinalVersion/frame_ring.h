@@ -0,0 +1,210 @@
+/*
+服务器帧共享内存环形缓冲区（POSIX 共享内存）
+
+服务器把每个校验通过、已广播的帧写入环形缓冲区（单写者），
+同机的 receiver_with_shm 或分析程序直接映射读取（多读者），
+每个读者自己保存读游标，互不影响，也不经过 TCP 回环。
+写者只在有读者等待时才调用 futex 唤醒，空闲读者阻塞在 futex 上不占 CPU。
+
+使用前需定义 _GNU_SOURCE（futex 通过 syscall 调用），并先包含 proto.h。
+*/
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FRAME_RING_MAGIC         0x464E5247   /* "FRNG" */
+#define FRAME_RING_VERSION       1
+#define FRAME_RING_DEFAULT_NAME  "/mmm_frames"
+#define FRAME_RING_DEFAULT_SLOTS 4096         /* 必须为 2 的幂 */
+
+/* 一个槽位正好一个 cache line */
+struct frame_ring_slot {
+    uint64_t seq;                  /* 帧序号，从 1 开始；0 表示正在写入 */
+    uint64_t ts_ns;                /* 发布时间 (CLOCK_REALTIME, ns) */
+    uint8_t frame[FRAME_LEN];
+    uint8_t pad[64 - 16 - FRAME_LEN];
+};
+
+struct frame_ring_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;             /* 槽位数 */
+    uint32_t slot_size;
+    uint32_t writer_pid;
+    uint8_t pad0[44];
+
+    uint64_t head;                 /* 最近发布的帧序号，写者独占的 cache line */
+    uint8_t pad1[56];
+
+    uint32_t futex_word;           /* 每次发布递增，读者在此等待 */
+    uint32_t waiters;              /* 正在等待的读者数 */
+    uint8_t pad2[56];
+};
+
+struct frame_ring {
+    struct frame_ring_hdr *hdr;
+    struct frame_ring_slot *slots;
+    uint32_t mask;
+    size_t map_size;
+};
+
+static inline size_t frame_ring_bytes(uint32_t slots) {
+    return sizeof(struct frame_ring_hdr) + (size_t)slots * sizeof(struct frame_ring_slot);
+}
+
+static inline int frame_ring_map(struct frame_ring *r, int fd, size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return -1;
+    r->hdr = (struct frame_ring_hdr *)p;
+    r->slots = (struct frame_ring_slot *)((uint8_t *)p + sizeof(struct frame_ring_hdr));
+    r->map_size = size;
+    return 0;
+}
+
+/* 写者：创建或接管环形缓冲区；已有且容量一致时沿用其中的序号（服务器重启/热升级后读者不中断） */
+static inline int frame_ring_create(struct frame_ring *r, const char *name, uint32_t slots) {
+    if (slots == 0 || (slots & (slots - 1)) != 0) { errno = EINVAL; return -1; }
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) return -1;
+
+    size_t size = frame_ring_bytes(slots);
+    struct stat st;
+    int reuse = (fstat(fd, &st) == 0 && (size_t)st.st_size == size);
+    if (!reuse && ftruncate(fd, (off_t)size) != 0) { close(fd); return -1; }
+    if (frame_ring_map(r, fd, size) != 0) { close(fd); return -1; }
+    close(fd);
+
+    struct frame_ring_hdr *h = r->hdr;
+    if (!(reuse && h->magic == FRAME_RING_MAGIC && h->version == FRAME_RING_VERSION &&
+          h->capacity == slots && h->slot_size == sizeof(struct frame_ring_slot))) {
+        memset(h, 0, size);
+        h->version = FRAME_RING_VERSION;
+        h->capacity = slots;
+        h->slot_size = sizeof(struct frame_ring_slot);
+        __atomic_store_n(&h->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+    }
+    h->writer_pid = (uint32_t)getpid();
+    r->mask = slots - 1;
+    return 0;
+}
+
+/* 读者：映射已存在的环形缓冲区 */
+static inline int frame_ring_attach(struct frame_ring *r, const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct frame_ring_hdr)) {
+        close(fd); errno = EINVAL; return -1;
+    }
+    if (frame_ring_map(r, fd, (size_t)st.st_size) != 0) { close(fd); return -1; }
+    close(fd);
+
+    struct frame_ring_hdr *h = r->hdr;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC ||
+        h->version != FRAME_RING_VERSION || h->slot_size != sizeof(struct frame_ring_slot) ||
+        frame_ring_bytes(h->capacity) != r->map_size) {
+        munmap(r->hdr, r->map_size);
+        errno = EPROTO;
+        return -1;
+    }
+    r->mask = h->capacity - 1;
+    return 0;
+}
+
+static inline void frame_ring_close(struct frame_ring *r) {
+    if (r->hdr != NULL) munmap(r->hdr, r->map_size);
+    r->hdr = NULL;
+    r->slots = NULL;
+}
+
+/* 最近发布的帧序号；读者从 head+1 开始只读新帧 */
+static inline uint64_t frame_ring_head(const struct frame_ring *r) {
+    return __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+/* 写者：发布一帧。只允许一个线程调用（服务器在广播锁内调用） */
+static inline void frame_ring_publish(struct frame_ring *r, const uint8_t *frame) {
+    struct frame_ring_hdr *h = r->hdr;
+    uint64_t seq = __atomic_load_n(&h->head, __ATOMIC_RELAXED) + 1;
+    struct frame_ring_slot *s = &r->slots[seq & r->mask];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    memcpy(s->frame, frame, FRAME_LEN);
+    __atomic_store_n(&s->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->head, seq, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&h->futex_word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->waiters, __ATOMIC_SEQ_CST) != 0) {
+        syscall(SYS_futex, &h->futex_word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* 读者等待新帧；返回 0 超时或被信号打断 */
+static inline int frame_ring_wait(struct frame_ring *r, uint64_t cursor, int timeout_ms) {
+    struct frame_ring_hdr *h = r->hdr;
+    __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t val = __atomic_load_n(&h->futex_word, __ATOMIC_SEQ_CST);
+    int ready = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) >= cursor;
+    if (!ready) {
+        struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+        syscall(SYS_futex, &h->futex_word, FUTEX_WAIT, val, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+        ready = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) >= cursor;
+    }
+    __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+    return ready;
+}
+
+/*
+ * 读者：读取序号为 *cursor 的帧并前移游标。
+ * 返回 1 读到帧，0 超时，-1 出错。
+ * 读得太慢被写者追上时，游标跳到仍然有效的最早一帧，*lost 返回跳过的帧数。
+ */
+static inline int frame_ring_next(struct frame_ring *r, uint64_t *cursor, uint8_t *frame,
+                                  uint64_t *lost, int timeout_ms) {
+    if (r->hdr == NULL) return -1;
+    uint64_t cap = (uint64_t)r->mask + 1;
+    if (lost != NULL) *lost = 0;
+
+    for (;;) {
+        uint64_t c = *cursor;
+        struct frame_ring_slot *s = &r->slots[c & r->mask];
+        uint64_t s1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (s1 == c) {
+            memcpy(frame, s->frame, FRAME_LEN);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == c) {
+                *cursor = c + 1;
+                return 1;
+            }
+        }
+
+        uint64_t head = frame_ring_head(r);
+        if (head >= c + cap || s1 > c) {
+            /* 被覆盖：留一个槽位的余量，避开正在写入的槽 */
+            uint64_t oldest = head - cap + 2;
+            if (lost != NULL) *lost += oldest - c;
+            *cursor = oldest;
+            continue;
+        }
+        if (head < c) {
+            if (!frame_ring_wait(r, c, timeout_ms)) return 0;
+        }
+        /* head >= c 但槽位还在写：写者马上完成，重试即可 */
+    }
+}
+
+#endif /* FRAME_RING_H */
@@ -0,0 +1,202 @@
+/*
+共享内存缓存行布局的多读端争用基准
+
+一个写线程按 shm_write_frame 的顺序更新每帧都变的字段（顺序锁、计数器、历史环 head、通知字），
+N 个读线程像 shm_tail / 界面那样反复读 head、notify_seq 和计数器，并在每次读前后加减
+notify_waiters（shm_notify_wait 的登记）。同样的循环分别跑在两种排布上：
+  packed   分组之前 shared_weather_data 里这些字段的相邻关系：history_ring_head、notify_seq、
+           notify_waiters 在同一缓存行，update_counter 与 seq、各计数器彼此挨着
+  aligned  现在的 shared_weather_data（shared_data.h 的 SHM_ALIGNED 分组）
+读端不停轮询是比实际（阻塞在 futex 上）更重的负载，用来放大伪共享；
+伪共享只在多核上出现，单核机器上两种排布的结果应当相同。
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared_data.h"
+
+#define MAX_READERS 32
+
+/* 两种排布共用的字段指针，写端、读端循环只通过它访问 */
+struct hot_fields {
+    uint32_t *seq;
+    uint32_t *update_counter;
+    uint32_t *total_received;
+    uint32_t *type_count;
+    uint64_t *head;
+    uint32_t *notify_seq;
+    uint32_t *notify_waiters;
+};
+
+/* 分组之前的相对位置：中间隔开的最新数据、历史记录用等长的填充代替 */
+struct packed_layout {
+    uint32_t magic, writer_pid, reader_pid, update_counter, seq;
+    uint8_t connection_status;
+    char latest[SHM_CACHE_LINE * 4];
+    uint32_t total_received, total_errors;
+    uint32_t type_count[4];
+    char history[SHM_CACHE_LINE * 4];
+    uint32_t history_ring_capacity;
+    uint64_t history_ring_head;
+    uint32_t notify_seq, notify_waiters;
+};
+
+struct reader_arg {
+    const struct hot_fields *h;
+    int cpu;
+    uint64_t polls;
+    uint64_t sink;
+};
+
+static volatile int g_stop = 0;
+static int g_ncpu = 1;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 多核时把线程分散到不同 CPU 上，争用才会体现为缓存行在核间来回 */
+static void pin_to(int cpu) {
+    if (g_ncpu < 2) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % g_ncpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *reader_thread(void *arg) {
+    struct reader_arg *r = (struct reader_arg *)arg;
+    const struct hot_fields *h = r->h;
+    uint64_t polls = 0, sink = 0;
+    pin_to(r->cpu);
+    while (!__atomic_load_n(&g_stop, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(h->notify_waiters, 1, __ATOMIC_SEQ_CST);
+        sink += __atomic_load_n(h->head, __ATOMIC_ACQUIRE);
+        sink += __atomic_load_n(h->notify_seq, __ATOMIC_ACQUIRE);
+        sink += shm_stat_get(h->total_received);
+        __atomic_fetch_sub(h->notify_waiters, 1, __ATOMIC_SEQ_CST);
+        polls++;
+    }
+    r->polls = polls;
+    r->sink = sink;
+    return NULL;
+}
+
+/* 跑 ms 毫秒，返回写端帧数，*reader_polls 返回所有读端的轮询次数之和 */
+static uint64_t run_layout(const struct hot_fields *h, int readers, int ms, uint64_t *reader_polls) {
+    static struct reader_arg args[MAX_READERS];
+    pthread_t tids[MAX_READERS];
+    g_stop = 0;
+    for (int i = 0; i < readers; i++) {
+        args[i].h = h;
+        args[i].cpu = i + 1;
+        pthread_create(&tids[i], NULL, reader_thread, &args[i]);
+    }
+
+    pin_to(0);
+    uint64_t frames = 0, end = now_ns() + (uint64_t)ms * 1000000ull;
+    while (1) {
+        for (int k = 0; k < 256; k++) {
+            shm_seq_write_begin(h->seq);
+            shm_stat_inc(h->type_count);
+            shm_stat_inc(h->update_counter);
+            shm_stat_inc(h->total_received);
+            __atomic_store_n(h->head, __atomic_load_n(h->head, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+            shm_seq_write_end(h->seq);
+            /* shm_notify_readers 去掉唤醒系统调用 */
+            __atomic_fetch_add(h->notify_seq, 1, __ATOMIC_SEQ_CST);
+            (void)__atomic_load_n(h->notify_waiters, __ATOMIC_SEQ_CST);
+        }
+        frames += 256;
+        if (now_ns() >= end) break;
+    }
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+
+    *reader_polls = 0;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(tids[i], NULL);
+        *reader_polls += args[i].polls;
+    }
+    return frames;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-r 读端数] [-d 毫秒] [-n 轮数]\n"
+                    "  -r  读线程数（1-%d），默认 3\n"
+                    "  -d  每种排布每轮运行的毫秒数，默认 1000\n"
+                    "  -n  轮数，两种排布交替运行，取各自的中位数，默认 5\n",
+            prog, MAX_READERS);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    int readers = 3, ms = 1000, rounds = 5, opt;
+    while ((opt = getopt(argc, argv, "r:d:n:h")) != -1) {
+        switch (opt) {
+        case 'r': readers = atoi(optarg); break;
+        case 'd': ms = atoi(optarg); break;
+        case 'n': rounds = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (readers < 1 || readers > MAX_READERS || ms <= 0 || rounds < 1 || rounds > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+    g_ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_ncpu < 1) g_ncpu = 1;
+
+    void *mem_packed = NULL, *mem_aligned = NULL;
+    if (posix_memalign(&mem_packed, SHM_CACHE_LINE, sizeof(struct packed_layout)) != 0 ||
+        posix_memalign(&mem_aligned, SHM_CACHE_LINE, sizeof(struct shared_weather_data)) != 0) {
+        perror("[layout] posix_memalign");
+        return 1;
+    }
+    memset(mem_packed, 0, sizeof(struct packed_layout));
+    memset(mem_aligned, 0, sizeof(struct shared_weather_data));
+    struct packed_layout *p = (struct packed_layout *)mem_packed;
+    struct shared_weather_data *a = (struct shared_weather_data *)mem_aligned;
+
+    struct hot_fields layouts[2] = {
+        { &p->seq, &p->update_counter, &p->total_received, &p->type_count[0],
+          &p->history_ring_head, &p->notify_seq, &p->notify_waiters },
+        { &a->seq, &a->update_counter, &a->total_received, &a->bme280_count,
+          &a->history_ring_head, &a->notify_seq, &a->notify_waiters },
+    };
+    static const char *const names[2] = { "packed", "aligned" };
+
+    printf("[layout] %d CPU，%d 个读线程，每轮 %d ms × %d 轮\n", g_ncpu, readers, ms, rounds);
+    if (g_ncpu < 2) printf("[layout] 单核机器上没有核间缓存行争用，两种排布的差别只是噪声\n");
+
+    static uint64_t frames[2][100], polls[2][100];
+    for (int r = 0; r < rounds; r++) {
+        for (int l = 0; l < 2; l++) frames[l][r] = run_layout(&layouts[l], readers, ms, &polls[l][r]);
+    }
+
+    double med_frames[2];
+    printf("%-8s %16s %16s\n", "layout", "writer frames/s", "reader polls/s");
+    for (int l = 0; l < 2; l++) {
+        qsort(frames[l], (size_t)rounds, sizeof(uint64_t), cmp_u64);
+        qsort(polls[l], (size_t)rounds, sizeof(uint64_t), cmp_u64);
+        med_frames[l] = (double)frames[l][rounds / 2] * 1000.0 / ms;
+        printf("%-8s %16.0f %16.0f\n", names[l], med_frames[l], (double)polls[l][rounds / 2] * 1000.0 / ms);
+    }
+    printf("[layout] aligned / packed 写端吞吐：%.2fx\n", med_frames[1] / med_frames[0]);
+
+    free(mem_packed);
+    free(mem_aligned);
+    return 0;
+}
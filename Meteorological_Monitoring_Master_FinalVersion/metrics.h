@@ -0,0 +1,223 @@
+/*
+服务器运行指标
+
+- 全局计数与延迟直方图按线程分片：每个连接线程启动时领取一个独占分片，
+  热路径上只对自己的分片做普通的读-加-写（relaxed 原子读写，无锁前缀），
+  读取时把所有分片相加。分片用完后新线程共用溢出分片，改用原子加。
+- 直方图见 hdr_hist.h：对数-线性分桶，相对误差不超过 12.5%。
+- 每个连接一个统计槽（帧数、字节数、错误数），由该连接唯一的写者更新；
+  接收端的槽在广播锁内更新，同样只有一个写者。
+
+使用前需先包含 proto.h。
+*/
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "hdr_hist.h"
+
+#define METRICS_SHARDS     128
+#define METRICS_CONN_SLOTS 1280        /* 连接槽数，用完后新连接只计入全局计数，不单独列出 */
+/* 全局计数器编号 */
+enum {
+    MET_FRAMES_IN = 0,   /* 校验通过的入口帧（含中继收到的） */
+    MET_BYTES_IN,
+    MET_BAD_FRAMES,      /* 校验失败、未知 CMD、UDP 截断 */
+    MET_FRAMES_OUT,      /* 发给接收端的帧（每个接收端各算一次） */
+    MET_BYTES_OUT,
+    MET_SEND_FAIL,       /* 发给接收端失败并摘除 */
+    MET_BROADCASTS,      /* 广播的帧数 */
+    MET_LOCK_ACQ,        /* 取广播锁次数，批量广播时小于 MET_BROADCASTS */
+    MET_TYPE_BASE,       /* 按 CMD 分类的广播帧数，MET_TYPE_BASE + CMD - 1 */
+    MET_TYPE_LAST = MET_TYPE_BASE + CMD_GPS - 1,
+    MET_COUNTERS
+};
+
+static const char *const metrics_counter_names[MET_COUNTERS] = {
+    "frames_in", "bytes_in", "bad_frames", "frames_out", "bytes_out",
+    "send_fail", "broadcasts", "lock_acquisitions",
+    "frames_bme280", "frames_lightrain", "frames_system_status", "frames_gps"
+};
+
+/* 直方图编号 */
+enum { HIST_INGEST_TO_SEND = 0, HIST_LOCK_HOLD, HIST_COUNT };
+
+static const char *const metrics_hist_names[HIST_COUNT] = {
+    "ingest_to_send_ns", "lock_hold_ns"
+};
+
+struct metrics_shard {
+    uint64_t c[MET_COUNTERS];
+    uint64_t h[HIST_COUNT][HIST_BUCKETS];
+    uint64_t sum[HIST_COUNT];          /* 样本总和 (ns)，用于平均值 */
+    int owned;                         /* 1 表示已被某个线程独占 */
+    int shared;                        /* 溢出分片，多个线程共用 */
+} __attribute__((aligned(64)));
+
+/* 连接角色，与 server.c 的 CONN_* 一致 */
+enum { MCONN_SENDER = 1, MCONN_RECVR = 2, MCONN_UPSTREAM = 3, MCONN_UDP = 4 };
+
+struct metrics_conn {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t opened_ns;
+    int fd;
+    int role;                          /* 0 表示空槽 */
+    char peer[24];
+    uint64_t last_frames, last_ns;     /* 仅统计查询方使用，用于计算最近速率 */
+} __attribute__((aligned(64)));
+
+static struct {
+    struct metrics_shard shards[METRICS_SHARDS + 1];   /* 最后一个为溢出分片 */
+    struct metrics_conn conns[METRICS_CONN_SLOTS];
+    pthread_mutex_t mtx;               /* 领取/归还分片、领取连接槽、读取连接槽时使用 */
+    uint64_t start_ns;
+} g_metrics = { .mtx = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct metrics_shard *t_shard = NULL;
+
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void metrics_init(void) {
+    g_metrics.shards[METRICS_SHARDS].shared = 1;
+    g_metrics.start_ns = metrics_now_ns();
+}
+
+/* 线程启动时领取分片，退出时归还；计数留在分片里，由下一个线程接着累加 */
+static inline void metrics_thread_init(void) {
+    pthread_mutex_lock(&g_metrics.mtx);
+    t_shard = &g_metrics.shards[METRICS_SHARDS];
+    for (int i = 0; i < METRICS_SHARDS; ++i) {
+        if (!g_metrics.shards[i].owned) {
+            g_metrics.shards[i].owned = 1;
+            t_shard = &g_metrics.shards[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_metrics.mtx);
+}
+
+static inline void metrics_thread_exit(void) {
+    if (t_shard == NULL) return;
+    pthread_mutex_lock(&g_metrics.mtx);
+    if (!t_shard->shared) t_shard->owned = 0;
+    pthread_mutex_unlock(&g_metrics.mtx);
+    t_shard = NULL;
+}
+
+static inline struct metrics_shard *metrics_shard(void) {
+    return t_shard != NULL ? t_shard : &g_metrics.shards[METRICS_SHARDS];
+}
+
+/* 单写者累加：独占分片不需要带锁前缀的原子加 */
+static inline void metrics_bump(uint64_t *p, uint64_t n, int shared) {
+    if (shared) __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+    else __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_add(int counter, uint64_t n) {
+    struct metrics_shard *s = metrics_shard();
+    metrics_bump(&s->c[counter], n, s->shared);
+}
+
+/* 记录 n 个相同取值的样本（批量广播的一批帧共用一个完成时刻） */
+static inline void metrics_record(int hist, uint64_t ns, uint64_t n) {
+    struct metrics_shard *s = metrics_shard();
+    metrics_bump(&s->h[hist][hist_bucket(ns)], n, s->shared);
+    metrics_bump(&s->sum[hist], ns * n, s->shared);
+}
+
+/* ---------- 连接统计槽 ---------- */
+
+static inline struct metrics_conn *metrics_conn_open(int fd, int role) {
+    struct metrics_conn *mc = NULL;
+    pthread_mutex_lock(&g_metrics.mtx);
+    for (int i = 0; i < METRICS_CONN_SLOTS; ++i) {
+        if (g_metrics.conns[i].role == 0) { mc = &g_metrics.conns[i]; break; }
+    }
+    if (mc != NULL) {
+        memset(mc, 0, sizeof(*mc));
+        mc->fd = fd;
+        mc->role = role;
+        mc->opened_ns = mc->last_ns = metrics_now_ns();
+        struct sockaddr_in a;
+        socklen_t al = sizeof(a);
+        if (fd >= 0 && getpeername(fd, (struct sockaddr*)&a, &al) == 0 && a.sin_family == AF_INET) {
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &a.sin_addr, ip, sizeof(ip));
+            snprintf(mc->peer, sizeof(mc->peer), "%s:%u", ip, (unsigned)ntohs(a.sin_port));
+        } else {
+            snprintf(mc->peer, sizeof(mc->peer), "-");
+        }
+    }
+    pthread_mutex_unlock(&g_metrics.mtx);
+    return mc;
+}
+
+/* 归还连接槽，须在 close(fd) 之前调用。取 g_metrics.mtx：统计查询在锁内对各槽的 fd 做 ioctl，
+   归还后 fd 才能关闭、被别的连接复用。接收端的槽在广播锁内归还，最多等一次统计查询扫完连接槽 */
+static inline void metrics_conn_close(struct metrics_conn *mc) {
+    if (mc == NULL) return;
+    pthread_mutex_lock(&g_metrics.mtx);
+    mc->role = 0;
+    pthread_mutex_unlock(&g_metrics.mtx);
+}
+
+/* 连接槽只有一个写者；mc 为 NULL（槽用完）时不统计 */
+static inline void metrics_conn_add(struct metrics_conn *mc, uint64_t frames, uint64_t bytes) {
+    if (mc == NULL) return;
+    metrics_bump(&mc->frames, frames, 0);
+    metrics_bump(&mc->bytes, bytes, 0);
+}
+
+static inline void metrics_conn_error(struct metrics_conn *mc, uint64_t n) {
+    if (mc != NULL) metrics_bump(&mc->errors, n, 0);
+}
+
+/* ---------- 读取与汇总 ---------- */
+
+struct metrics_snapshot {
+    uint64_t c[MET_COUNTERS];
+    uint64_t h[HIST_COUNT][HIST_BUCKETS];
+    uint64_t sum[HIST_COUNT];
+    uint64_t uptime_ns;
+};
+
+static inline void metrics_collect(struct metrics_snapshot *snap) {
+    memset(snap, 0, sizeof(*snap));
+    for (int i = 0; i <= METRICS_SHARDS; ++i) {
+        const struct metrics_shard *s = &g_metrics.shards[i];
+        for (int k = 0; k < MET_COUNTERS; ++k) snap->c[k] += __atomic_load_n(&s->c[k], __ATOMIC_RELAXED);
+        for (int k = 0; k < HIST_COUNT; ++k) {
+            snap->sum[k] += __atomic_load_n(&s->sum[k], __ATOMIC_RELAXED);
+            for (int b = 0; b < HIST_BUCKETS; ++b) {
+                snap->h[k][b] += __atomic_load_n(&s->h[k][b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    snap->uptime_ns = metrics_now_ns() - g_metrics.start_ns;
+}
+
+static inline const char *metrics_role_name(int role) {
+    switch (role) {
+    case MCONN_SENDER:   return "sender";
+    case MCONN_RECVR:    return "receiver";
+    case MCONN_UPSTREAM: return "upstream";
+    case MCONN_UDP:      return "udp";
+    default:             return "?";
+    }
+}
+
+#endif /* METRICS_H */
@@ -0,0 +1,401 @@
+/*
+热点路径微基准
+
+对协议解析、共享内存写入和 SD 卡日志格式化这些每帧都要走的函数单独计时，
+改动前后各跑一次即可看出是否变慢，不需要起服务器。
+
+- 每个用例先预热，再按目标时长标定每轮迭代次数，跑多轮后取中位数，
+  同时给出最小 / 平均 / 标准差 / 最大值，减少调度和频率波动的干扰。
+- 拦截 malloc/calloc/realloc/free 统计每次操作的分配次数，热路径应当为 0。
+- -o 把结果写成 JSON；-c 读入之前保存的 JSON 作为基线逐项比较，
+  中位数变慢超过阈值或分配次数增加即判为回退，进程返回 1，可直接放进 CI。
+
+用法：
+  ./micro_bench [-f 名称子串] [-r 轮数] [-T 每轮毫秒] [-w 预热毫秒] [-l 标签] [-o 输出.json]
+                [-c 基线.json] [-t 阈值百分比]
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proto.h"
+#include "shared_data.h"
+#include "shm_writer.h"
+#include "sd_log.h"
+
+#define MAX_REPS     101
+#define MAX_RESULTS  64
+
+/* ---------------- 分配计数 ---------------- */
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static uint64_t g_allocs = 0;
+
+void *malloc(size_t n)            { __atomic_fetch_add(&g_allocs, 1, __ATOMIC_RELAXED); return __libc_malloc(n); }
+void *calloc(size_t m, size_t n)  { __atomic_fetch_add(&g_allocs, 1, __ATOMIC_RELAXED); return __libc_calloc(m, n); }
+void *realloc(void *p, size_t n)  { __atomic_fetch_add(&g_allocs, 1, __ATOMIC_RELAXED); return __libc_realloc(p, n); }
+void free(void *p)                { __libc_free(p); }
+
+/* ---------------- 用例 ---------------- */
+
+static volatile uint32_t g_sink;           /* 防止结果被优化掉 */
+static uint8_t g_frames[4][FRAME_LEN];     /* 按 CMD-1 索引的合法帧 */
+static const int g_frame_len[4] = { 11, 8, 15, 25 };
+static struct shared_weather_data *g_sd;
+static FILE *g_null;
+
+static void build_frames(void) {
+    uint8_t *b = g_frames[0];
+    b[0] = 1; b[1] = CMD_BME280;
+    b[2] = 0x09; b[3] = 0xC4;              /* 25.00°C */
+    b[4] = 0x27; b[5] = 0x74;              /* 1010.0 hPa */
+    b[6] = 0x13; b[7] = 0x88;              /* 50.00% */
+    b[8] = Calculate_CRC4(&b[2], 6) & 0x0F;
+
+    b = g_frames[1];
+    b[0] = 1; b[1] = CMD_LIGHTRAIN;
+    b[2] = 0x0F; b[3] = 0xA0;              /* 400.0 lx */
+    b[4] = 35;
+    b[5] = Calculate_CRC4(&b[2], 3) & 0x0F;
+
+    b = g_frames[2];
+    b[0] = 1; b[1] = CMD_SYSTEM_STATUS;
+    put_be32(&b[6], 86400);
+    b[11] = 3;
+
+    b = g_frames[3];
+    b[0] = 1; b[1] = CMD_GPS;
+    memcpy(&b[2], "123456", 6);
+    put_be32(&b[8], 3990420);
+    put_be32(&b[12], 11640740);
+    b[16] = 3; b[17] = 9;
+    b[18] = 0x00; b[19] = 0x0C;            /* HDOP 1.2 */
+    b[20] = 0x01; b[21] = 0xF4;            /* 50.0 m */
+    b[22] = Calculate_CRC4(&b[2], 20) & 0x0F;
+
+    for (int k = 0; k < 4; ++k) {
+        int len = g_frame_len[k];
+        uint8_t cs = 0;
+        for (int i = 0; i < len - 2; i++) cs ^= g_frames[k][i];
+        g_frames[k][len - 2] = cs;
+        g_frames[k][len - 1] = END_SYMBOL[0];
+    }
+}
+
+static void bench_crc4_6(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) acc += Calculate_CRC4(&g_frames[0][2], 6);
+    g_sink = acc;
+}
+
+static void bench_crc4_20(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) acc += Calculate_CRC4(&g_frames[3][2], 20);
+    g_sink = acc;
+}
+
+#define PARSE_CASE(fn, k)                                                     \
+    static void fn(uint64_t n) {                                              \
+        uint32_t acc = 0;                                                     \
+        for (uint64_t i = 0; i < n; ++i)                                      \
+            acc += LORA_ParseResponse(g_frames[k], g_frame_len[k]);           \
+        g_sink = acc;                                                         \
+    }
+PARSE_CASE(bench_parse_bme280, 0)
+PARSE_CASE(bench_parse_lightrain, 1)
+PARSE_CASE(bench_parse_status, 2)
+PARSE_CASE(bench_parse_gps, 3)
+
+#define SHM_CASE(fn, k)                                                       \
+    static void fn(uint64_t n) {                                              \
+        for (uint64_t i = 0; i < n; ++i) shm_write_frame(g_sd, g_frames[k]);  \
+        g_sink = g_sd->update_counter;                                        \
+    }
+SHM_CASE(bench_shm_bme280, 0)
+SHM_CASE(bench_shm_lightrain, 1)
+SHM_CASE(bench_shm_status, 2)
+SHM_CASE(bench_shm_gps, 3)
+
+static void bench_history_push(uint64_t n) {
+    /* GPS 帧占 3 条记录，是最重的一种；类型取自 latest_data，单独运行本用例时也要先设好 */
+    g_sd->latest_data.data_type = SENSOR_GPS;
+    for (uint64_t i = 0; i < n; ++i) shm_history_push(g_sd, g_frames[3], 0);
+    g_sink = g_sd->history_write_index;
+}
+
+/* 界面画温度曲线的读法：某节点最近 240 个 BME280 样本（main 里预先写满该节点的 lane） */
+#define SERIES_READ_N 240
+static void bench_series_read(uint64_t n) {
+    static struct weather_frame out[SERIES_READ_N];
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) acc += (uint32_t)shm_series_read(g_sd, SENSOR_BME280, g_frames[0][0], out, NULL, SERIES_READ_N);
+    g_sink = acc;
+}
+
+static void bench_now_str(uint64_t n) {
+    char ts[32];
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) { now_str(ts, sizeof ts); acc += (uint8_t)ts[18]; }
+    g_sink = acc;
+}
+
+/* 与 open_sd_file 一样行缓冲，每行一次 write；fsync 取决于存储介质，不计入 */
+#define LOG_CASE(fn, logf, k)                                                 \
+    static void fn(uint64_t n) {                                              \
+        for (uint64_t i = 0; i < n; ++i) logf(g_null, g_frames[k]);           \
+    }
+LOG_CASE(bench_log_bme280, log_bme280, 0)
+LOG_CASE(bench_log_lightrain, log_lightrain, 1)
+LOG_CASE(bench_log_system, log_system, 2)
+LOG_CASE(bench_log_gps, log_gps, 3)
+
+static const struct bench_case {
+    const char *name;
+    void (*fn)(uint64_t n);
+} g_cases[] = {
+    { "crc4/6B",          bench_crc4_6 },
+    { "crc4/20B",         bench_crc4_20 },
+    { "parse/bme280",     bench_parse_bme280 },
+    { "parse/lightrain",  bench_parse_lightrain },
+    { "parse/status",     bench_parse_status },
+    { "parse/gps",        bench_parse_gps },
+    { "shm_write/bme280", bench_shm_bme280 },
+    { "shm_write/lightrain", bench_shm_lightrain },
+    { "shm_write/status", bench_shm_status },
+    { "shm_write/gps",    bench_shm_gps },
+    { "history_push",     bench_history_push },
+    { "series_read/240",  bench_series_read },
+    { "now_str",          bench_now_str },
+    { "log/bme280",       bench_log_bme280 },
+    { "log/lightrain",    bench_log_lightrain },
+    { "log/system",       bench_log_system },
+    { "log/gps",          bench_log_gps },
+};
+#define NUM_CASES ((int)(sizeof(g_cases) / sizeof(g_cases[0])))
+
+/* ---------------- 计时与统计 ---------------- */
+
+struct bench_result {
+    char name[48];
+    double median, min, mean, stddev, max;   /* ns/op */
+    double allocs_per_op;
+    uint64_t iters;                          /* 每轮迭代次数 */
+    int reps;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_case(const struct bench_case *c, int reps, double target_ms, double warmup_ms,
+                     struct bench_result *r) {
+    /* 标定：迭代次数翻倍直到一轮超过目标时长的 1/10，再按比例放大 */
+    uint64_t n = 1, t;
+    for (;;) {
+        t = now_ns();
+        c->fn(n);
+        t = now_ns() - t;
+        if (t >= target_ms * 1e5 || n >= (1ull << 40)) break;
+        n *= 2;
+    }
+    uint64_t iters = (uint64_t)(n * (target_ms * 1e6 / (t ? t : 1)));
+    if (iters < 1) iters = 1;
+
+    uint64_t until = now_ns() + (uint64_t)(warmup_ms * 1e6);
+    while (now_ns() < until) c->fn(iters);
+
+    double samples[MAX_REPS];
+    uint64_t a0 = __atomic_load_n(&g_allocs, __ATOMIC_RELAXED);
+    for (int i = 0; i < reps; ++i) {
+        t = now_ns();
+        c->fn(iters);
+        samples[i] = (double)(now_ns() - t) / iters;
+    }
+    uint64_t a1 = __atomic_load_n(&g_allocs, __ATOMIC_RELAXED);
+
+    qsort(samples, reps, sizeof(double), cmp_double);
+    double sum = 0, sq = 0;
+    for (int i = 0; i < reps; ++i) sum += samples[i];
+    double mean = sum / reps;
+    for (int i = 0; i < reps; ++i) sq += (samples[i] - mean) * (samples[i] - mean);
+
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", c->name);
+    r->median = reps % 2 ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2;
+    r->min = samples[0];
+    r->max = samples[reps - 1];
+    r->mean = mean;
+    r->stddev = reps > 1 ? sqrt(sq / (reps - 1)) : 0;
+    r->allocs_per_op = (double)(a1 - a0) / ((double)iters * reps);
+    r->iters = iters;
+    r->reps = reps;
+}
+
+/* ---------------- JSON 读写 ---------------- */
+
+/* 每个结果占一行，基线比较按行读取 */
+static int write_json(const char *path, const char *label, const struct bench_result *res, int n) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) { perror("[bench] open output"); return -1; }
+    fprintf(f, "{\"label\":\"%s\",\"results\":[\n", label);
+    for (int i = 0; i < n; ++i) {
+        const struct bench_result *r = &res[i];
+        fprintf(f, "{\"name\":\"%s\",\"median_ns\":%.3f,\"min_ns\":%.3f,\"mean_ns\":%.3f,\"stddev_ns\":%.3f,"
+                   "\"max_ns\":%.3f,\"ops_per_s\":%.0f,\"allocs_per_op\":%.4f,\"iters\":%llu,\"reps\":%d}%s\n",
+                r->name, r->median, r->min, r->mean, r->stddev, r->max, 1e9 / r->median, r->allocs_per_op,
+                (unsigned long long)r->iters, r->reps, i + 1 < n ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    int err = ferror(f);
+    if (fclose(f) != 0 || err) { perror("[bench] write output"); return -1; }
+    return 0;
+}
+
+static int json_num(const char *line, const char *key, double *out) {
+    char pat[32];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(line, pat);
+    return p != NULL && sscanf(p + strlen(pat), "%lf", out) == 1 ? 0 : -1;
+}
+
+static int read_json(const char *path, struct bench_result *res, int max) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) { perror("[bench] open baseline"); return -1; }
+    char line[512];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        struct bench_result *r = &res[n];
+        memset(r, 0, sizeof(*r));
+        if (sscanf(line, "{\"name\":\"%47[^\"]\"", r->name) != 1) continue;
+        if (json_num(line, "median_ns", &r->median) != 0 || json_num(line, "allocs_per_op", &r->allocs_per_op) != 0)
+            continue;
+        json_num(line, "stddev_ns", &r->stddev);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/* 中位数变慢超过 threshold% 或分配次数增加记为回退，返回回退项数 */
+static int compare(const struct bench_result *cur, int n, const struct bench_result *base, int nb, double threshold) {
+    int regressions = 0;
+    printf("\n%-22s %12s %12s %9s %10s  %s\n", "case", "base ns/op", "ns/op", "delta", "allocs/op", "verdict");
+    for (int i = 0; i < n; ++i) {
+        const struct bench_result *b = NULL;
+        for (int j = 0; j < nb; ++j)
+            if (strcmp(base[j].name, cur[i].name) == 0) { b = &base[j]; break; }
+        if (b == NULL) {
+            printf("%-22s %12s %12.2f %9s %10.4f  new\n", cur[i].name, "-", cur[i].median, "-", cur[i].allocs_per_op);
+            continue;
+        }
+        double delta = b->median > 0 ? (cur[i].median - b->median) / b->median * 100.0 : 0;
+        int slower = delta > threshold;
+        int allocs = cur[i].allocs_per_op > b->allocs_per_op + 0.001;
+        const char *verdict = slower && allocs ? "REGRESSION (time, allocs)" :
+                              slower ? "REGRESSION (time)" : allocs ? "REGRESSION (allocs)" :
+                              delta < -threshold ? "faster" : "ok";
+        if (slower || allocs) regressions++;
+        printf("%-22s %12.2f %12.2f %+8.1f%% %10.4f  %s\n",
+               cur[i].name, b->median, cur[i].median, delta, cur[i].allocs_per_op, verdict);
+    }
+    return regressions;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-f 名称子串] [-r 轮数] [-T 每轮毫秒] [-w 预热毫秒] [-l 标签]\n"
+                    "          [-o 输出.json] [-c 基线.json] [-t 阈值百分比] [-L]\n"
+                    "  -r  重复轮数（1-%d），默认 15\n"
+                    "  -T  每轮目标时长，默认 20ms\n"
+                    "  -w  每个用例的预热时长，默认 100ms\n"
+                    "  -t  与基线比较时中位数允许变慢的百分比，默认 10\n"
+                    "  -L  只列出用例名\n",
+            prog, MAX_REPS);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL, *out = NULL, *baseline = NULL, *label = "run";
+    int reps = 15, opt;
+    double target_ms = 20, warmup_ms = 100, threshold = 10;
+    while ((opt = getopt(argc, argv, "f:r:T:w:l:o:c:t:Lh")) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 'r': reps = atoi(optarg); break;
+        case 'T': target_ms = atof(optarg); break;
+        case 'w': warmup_ms = atof(optarg); break;
+        case 'l': label = optarg; break;
+        case 'o': out = optarg; break;
+        case 'c': baseline = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        case 'L':
+            for (int i = 0; i < NUM_CASES; ++i) printf("%s\n", g_cases[i].name);
+            return 0;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (reps < 1 || reps > MAX_REPS || target_ms <= 0 || warmup_ms < 0 || threshold < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    build_frames();
+    /* 带默认容量的大容量历史环和样本序列，和 receiver_with_shm 实际写入的一样 */
+    /* 按缓存行对齐分配，与 mmap 得到的布局一致（shared_data.h 的 SHM_ALIGNED） */
+    static const uint32_t series_cap[SERIES_TYPES] = SERIES_CAP_DEFAULT;
+    size_t shm_size = shm_layout_size(HISTORY_RING_DEFAULT, series_cap);
+    void *mem = NULL;
+    if (posix_memalign(&mem, SHM_CACHE_LINE, shm_size) != 0) mem = NULL;
+    if (mem != NULL) memset(mem, 0, shm_size);
+    g_sd = (struct shared_weather_data *)mem;
+    g_null = fopen("/dev/null", "w");
+    if (g_sd == NULL || g_null == NULL) { perror("[bench] init"); return 1; }
+    shm_layout_init(g_sd, HISTORY_RING_DEFAULT, series_cap);
+    for (uint32_t i = 0; i < series_cap[0]; ++i) shm_series_push(g_sd, SENSOR_BME280, g_frames[0][0], 0, g_frames[0] + 2);
+    setvbuf(g_null, NULL, _IOLBF, 0);
+    for (int k = 0; k < 4; ++k) {
+        if (LORA_ParseResponse(g_frames[k], g_frame_len[k]) == 0) {
+            fprintf(stderr, "[bench] frame for cmd %d failed validation\n", k + 1);
+            return 1;
+        }
+    }
+
+    static struct bench_result res[MAX_RESULTS];
+    int n = 0;
+    printf("%-22s %10s %10s %10s %10s %10s %14s %10s\n",
+           "case", "median", "min", "mean", "stddev", "max", "ops/s", "allocs/op");
+    for (int i = 0; i < NUM_CASES && n < MAX_RESULTS; ++i) {
+        if (filter != NULL && strstr(g_cases[i].name, filter) == NULL) continue;
+        struct bench_result *r = &res[n++];
+        run_case(&g_cases[i], reps, target_ms, warmup_ms, r);
+        printf("%-22s %10.2f %10.2f %10.2f %10.2f %10.2f %14.0f %10.4f\n",
+               r->name, r->median, r->min, r->mean, r->stddev, r->max, 1e9 / r->median, r->allocs_per_op);
+        fflush(stdout);
+    }
+    printf("(ns/op，%d 轮取统计)\n", reps);
+
+    if (out != NULL && write_json(out, label, res, n) != 0) return 1;
+    if (baseline != NULL) {
+        static struct bench_result base[MAX_RESULTS];
+        int nb = read_json(baseline, base, MAX_RESULTS);
+        if (nb <= 0) { fprintf(stderr, "[bench] no results in %s\n", baseline); return 1; }
+        int bad = compare(res, n, base, nb, threshold);
+        printf("%d regression(s), threshold %.1f%%\n", bad, threshold);
+        if (bad) return 1;
+    }
+    return 0;
+}
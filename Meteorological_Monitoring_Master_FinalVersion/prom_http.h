@@ -0,0 +1,199 @@
+/*
+极简 HTTP 指标端点（Prometheus 文本格式）
+
+单独一个线程监听，依次处理抓取请求：读请求行，调用渲染回调把指标写进启动时
+分配好的缓冲区，一次发出后关闭连接。渲染回调只读计数，不取数据通路上的锁，
+抓取方再慢也只会卡住这个线程。
+
+使用前需定义 _GNU_SOURCE，并链接 -lpthread。
+*/
+#ifndef PROM_HTTP_H
+#define PROM_HTTP_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define PROM_BUF_SIZE   (256 * 1024)
+#define PROM_REQ_MAX    1024
+#define PROM_IO_TIMEOUT_MS 1000
+
+/* 把 body 渲染进 buf，返回长度 */
+typedef size_t (*prom_render_fn)(char *buf, size_t cap);
+
+struct prom_http {
+    int fd;
+    prom_render_fn render;
+    volatile int *running;
+    char *body;
+    char req[PROM_REQ_MAX];
+    time_t start_time;
+};
+
+/* 追加格式化文本，超出容量时截断 */
+static inline size_t buf_appendf(char *buf, size_t cap, size_t len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static inline size_t buf_appendf(char *buf, size_t cap, size_t len, const char *fmt, ...) {
+    if (len >= cap) return len;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, cap - len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return len;
+    return (len + (size_t)n < cap) ? len + (size_t)n : cap - 1;
+}
+
+/* 进程指标：CPU 时间、常驻内存、打开的 fd 数、启动时间 */
+static inline size_t prom_process_metrics(char *buf, size_t cap, size_t len, time_t start_time) {
+    struct rusage ru;
+    double cpu = 0;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    }
+    long rss_pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        long size;
+        if (fscanf(f, "%ld %ld", &size, &rss_pages) != 2) rss_pages = 0;
+        fclose(f);
+    }
+    int nfd = 0;
+    DIR *d = opendir("/proc/self/fd");
+    if (d != NULL) {
+        while (readdir(d) != NULL) nfd++;
+        closedir(d);
+        nfd -= 3;   /* "." ".." 以及 opendir 自身 */
+    }
+    len = buf_appendf(buf, cap, len,
+        "# TYPE process_cpu_seconds_total counter\n"
+        "process_cpu_seconds_total %.3f\n"
+        "# TYPE process_resident_memory_bytes gauge\n"
+        "process_resident_memory_bytes %ld\n"
+        "# TYPE process_open_fds gauge\n"
+        "process_open_fds %d\n"
+        "# TYPE process_start_time_seconds gauge\n"
+        "process_start_time_seconds %ld\n",
+        cpu, rss_pages * sysconf(_SC_PAGESIZE), nfd, (long)start_time);
+    return len;
+}
+
+/* 读到请求头结束；返回 1 是 GET /metrics（或 /），0 其他路径，-1 出错/超时 */
+static inline int prom_read_request(struct prom_http *h, int fd) {
+    size_t got = 0;
+    while (got < sizeof(h->req) - 1) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, PROM_IO_TIMEOUT_MS) != 1) return -1;
+        ssize_t r = recv(fd, h->req + got, sizeof(h->req) - 1 - got, 0);
+        if (r <= 0) return -1;
+        got += (size_t)r;
+        h->req[got] = '\0';
+        if (strstr(h->req, "\r\n\r\n") != NULL || strstr(h->req, "\n\n") != NULL) break;
+    }
+    return (strncmp(h->req, "GET /metrics", 12) == 0 || strncmp(h->req, "GET / ", 6) == 0) ? 1 : 0;
+}
+
+static inline void prom_send(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+static inline void *prom_http_thread(void *arg) {
+    struct prom_http *h = (struct prom_http *)arg;
+    while (*h->running) {
+        struct pollfd pfd = { .fd = h->fd, .events = POLLIN };
+        if (poll(&pfd, 1, 200) != 1) continue;
+        int fd = accept(h->fd, NULL, NULL);
+        if (fd < 0) continue;
+        struct timeval tv = { PROM_IO_TIMEOUT_MS / 1000, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        int ok = prom_read_request(h, fd);
+        if (ok == 1) {
+            size_t n = h->render(h->body, PROM_BUF_SIZE);
+            n = prom_process_metrics(h->body, PROM_BUF_SIZE, n, h->start_time);
+            char hdr[160];
+            int hl = snprintf(hdr, sizeof(hdr),
+                              "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n", n);
+            prom_send(fd, hdr, (size_t)hl);
+            prom_send(fd, h->body, n);
+        } else if (ok == 0) {
+            static const char nf[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            prom_send(fd, nf, sizeof(nf) - 1);
+        }
+        close(fd);
+    }
+    close(h->fd);
+    return NULL;
+}
+
+/* 在 "[ip:]port" 上启动指标端点；缓冲区一次分配，之后的抓取不再分配内存 */
+static inline int prom_http_start(const char *spec, prom_render_fn render, volatile int *running) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    const char *colon = strrchr(spec, ':');
+    int port = atoi(colon ? colon + 1 : spec);
+    if (colon != NULL) {
+        char ip[INET_ADDRSTRLEN] = {0};
+        if ((size_t)(colon - spec) >= sizeof(ip)) return -1;
+        memcpy(ip, spec, (size_t)(colon - spec));
+        if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) return -1;
+    }
+    if (port <= 0) return -1;
+    addr.sin_port = htons((uint16_t)port);
+
+    struct prom_http *h = (struct prom_http *)calloc(1, sizeof(*h));
+    if (h == NULL) return -1;
+    h->body = (char *)malloc(PROM_BUF_SIZE);
+    h->render = render;
+    h->running = running;
+    h->start_time = time(NULL);
+    h->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    pthread_t th;
+    /* 端点线程屏蔽所有信号，退出/升级信号仍由主线程处理 */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int err = (h->body == NULL || h->fd < 0 ||
+        setsockopt(h->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        /* 热升级时新进程在旧进程退出前就要绑定同一端口 */
+        setsockopt(h->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        bind(h->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(h->fd, 16) != 0 ||
+        pthread_create(&th, NULL, prom_http_thread, h) != 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        if (h->fd >= 0) close(h->fd);
+        free(h->body);
+        free(h);
+        return -1;
+    }
+    pthread_detach(th);
+    return 0;
+}
+
+#endif /* PROM_HTTP_H */
@@ -27,10 +27,56 @@ static const uint8_t ROLE_SENDER[ROLE_LEN] = {0xAA, 0x00};  // 发送端
 static const uint8_t ROLE_RECVR [ROLE_LEN] = {0xBB, 0x00};  // 接收端
 static const uint8_t ROLE_ACK   [ROLE_LEN] = {0x01, 0x01};  // 服务器接受
 static const uint8_t ROLE_ERRORB[ROLE_LEN] = {0x99, 0x99};  // 服务器拒绝
+static const uint8_t ROLE_REPAIR[ROLE_LEN] = {0xDD, 0x00};  // 组播补发通道
 
 /* 帧尾结束符 */
 static const uint8_t END_SYMBOL[1] = {0xFF};
 
+/* 订阅消息（接收端握手后可随时发送）：SUB_HEADER + 1 字节 CMD 位图 */
+#define SUB_HEADER    0xCC
+#define CMD_BIT(cmd)  ((uint8_t)(1u << ((cmd) - 1)))   // CMD_BME280..CMD_GPS -> bit0..bit3
+#define SUB_ALL       0x0F
+
+/* 帧扩展区：位于最长数据包（GPS 25字节）之后的填充字节，解析函数不读取 */
+#define FRAME_ORIGIN_OFF  29   // 首个接收该帧的服务器 ID，0=未标记
+#define FRAME_HOPS_OFF    30   // 已经过的中继跳数
+#define RELAY_MAX_HOPS    8
+#define FRAME_TS_OFF      25   // [25..28] 发送时刻 CLOCK_MONOTONIC ns 低 32 位（大端），压测测端到端延迟，0=未标记
+#define FRAME_LANE_OFF    31   // 压测发送端的连接编号低 8 位，用于按连接统计恢复时间
+
+/* 组播数据报：MCAST_HDR_LEN 字节头 + 一个 FRAME_LEN 帧
+ * 头：'M' 'C' 版本 服务器ID 纪元(4字节大端) 序号(8字节大端)，序号从 1 开始连续递增。
+ * 纪元是服务器启动时取的非零随机数，热升级时交给新进程，只有重启才变；
+ * 服务器 ID 固定（-i）时接收端靠它发现重启，不用等序号追上重启前的位置 */
+#define MCAST_HDR_LEN     16
+#define MCAST_PKT_LEN     (MCAST_HDR_LEN + FRAME_LEN)
+#define MCAST_VERSION     2
+#define MCAST_EPOCH_OFF   4
+#define MCAST_SEQ_OFF     8
+#define MCAST_HISTORY     4096   // 服务器保留供补发的帧数，2 的幂；同一纪元内序号回退超过它也视为重启
+/* 补发请求（ROLE_REPAIR 连接上发送）：起始序号(8字节大端) + 帧数(4字节大端)
+ * 起始序号为 0 表示快照：服务器仍保留的全部帧。
+ * 应答：若干组播数据报格式的包，最后以序号为 0 的包结束 */
+#define MCAST_REQ_LEN     12
+
+static inline void put_be64(uint8_t *p, uint64_t v) {
+    for (int i = 7; i >= 0; --i) { p[i] = (uint8_t)v; v >>= 8; }
+}
+
+static inline uint64_t get_be64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
 static inline ssize_t read_n(int fd, void *buf, size_t n);
 
 
@@ -229,6 +275,25 @@ int LORA_ParseResponse(uint8_t *buf, uint16_t len)
 }
 
 
+/* 根据 CMD 返回数据包长度，未知 CMD 返回 0 */
+static inline int LORA_FrameLen(uint8_t cmd) {
+    switch (cmd) {
+    case CMD_BME280:        return 11; // BME280
+    case CMD_LIGHTRAIN:     return 8;  // 光强雨量
+    case CMD_SYSTEM_STATUS: return 15; // 系统状态
+    case CMD_GPS:           return 25; // GPS数据
+    default:                return 0;
+    }
+}
+
+/* 校验内存中一个完整的 FRAME_LEN 单元（如 UDP 数据报中的帧）
+   返回值同 LORA_ParseResponse；未知 CMD 或结束符错误返回 -1 */
+static inline int LORA_ParseFrame(uint8_t *buf) {
+    int expected_len = LORA_FrameLen(buf[1]);
+    if (expected_len == 0 || buf[expected_len - 1] != END_SYMBOL[0]) return -1;
+    return LORA_ParseResponse(buf, (uint16_t)expected_len);
+}
+
 /* ================== 通用数据解析函数 ================== */
 /*1、该函数可以自动识别读取的数据长度
   2、然后根据数据长度来判断数据包类型
@@ -253,15 +318,8 @@ int LORA_ReadAndRarse(int fd,uint8_t *buf){
     // printf("cmd:%02x\n",cmd);
 
     //根据CMD确定包长
-    int expected_len = 0;
-    switch (cmd)
-    {
-    case CMD_BME280:        expected_len = 11; break; // BME280
-    case CMD_LIGHTRAIN:     expected_len = 8;  break; // 光强雨量
-    case CMD_SYSTEM_STATUS: expected_len = 15; break; // 系统状态
-    case CMD_GPS:           expected_len = 25;   break; // GPS数据
-    
-    default:
+    int expected_len = LORA_FrameLen(cmd);
+    if (expected_len == 0) {
         //fprintf(stderr, "Node 0x%02X unknown cmd=0x%02X\n", node_id, cmd);
         return -1;
     }
@@ -13,6 +13,7 @@
 #include <signal.h>
 #include <time.h>
 #include "proto.h"
+#include "sd_log.h"
 // #include "shared_data.h"
 
 /* 连接状态定义 */
@@ -24,15 +25,6 @@ static int g_socket_fd = -1;
 static volatile int g_running = 1;
 
 /* ================== 小工具函数 ================== */
-static void now_str(char *out, size_t n) {
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    time_t t = ts.tv_sec;
-    struct tm tm;
-    localtime_r(&t, &tm);
-    strftime(out, n, "%Y-%m-%d %H:%M:%S", &tm);
-}
-
 //打卡SD设备文件
 static FILE* open_sd_file(const char *path){
     FILE *fp = fopen(path, "a");
@@ -51,20 +43,6 @@ static void fsync_file(FILE *fp) {
     if (fd >= 0) fsync(fd);
 }
 
-/* 将 6 字节 UTC（"hhmmss"）格式化为 "hh:mm:ss"；输入未必是 C 字符串 */
-static void format_utc_hhmmss(const uint8_t *six, char *out, size_t n) {
-    // 兜底处理非可见字符
-    int hh = 0, mm = 0, ss = 0;
-    char buf[7];
-    for (int i = 0; i < 6; ++i) buf[i] = (char)six[i];
-    buf[6] = '\0';
-    if (sscanf(buf, "%2d%2d%2d", &hh, &mm, &ss) != 3) {
-        snprintf(out, n, "--:--:--");
-        return;
-    }
-    snprintf(out, n, "%02d:%02d:%02d", hh, mm, ss);
-}
-
 /* 连接到服务器 */
 static int connect_to_server(const char *server_ip, int port) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -114,82 +92,6 @@ static int perform_handshake(int fd) {
     return 0;
 }
 
-/* ================== 写入一行 CSV ================== */
-/*
- * 统一 CSV 字段顺序（含人类时间）：
- * type,node_id,ts_local,extra_fields...
- * 其中 type ∈ {BME280,LightRain,System,GPS}
- */
-static void log_bme280(FILE *f, const uint8_t *frame) {
-    // frame: [0]=node,[1]=cmd,[2..3]=t100,[4..5]=p10,[6..7]=h100,[8]=crc4低4位,[9]=xor_cs,[10]=0xFF
-    uint8_t node_id = frame[0];
-    int16_t t100 = (frame[2] << 8) | frame[3];
-    int16_t p10  = (frame[4] << 8) | frame[5];
-    int16_t h100 = (frame[6] << 8) | frame[7];
-
-    char ts[32]; now_str(ts, sizeof ts);
-    fprintf(f, "BME280,%u,%s,%.2f,%.1f,%.2f\n",
-            node_id, ts, t100/100.0f, p10/10.0f, h100/100.0f);
-}
-
-static void log_lightrain(FILE *f, const uint8_t *frame) {
-    // frame: [0]=node,[1]=cmd,[2..3]=lux10,[4]=rain,[5]=crc4低4位,[6]=xor_cs,[7]=0xFF
-    uint8_t node_id = frame[0];
-    int16_t lux10 = (frame[2] << 8) | frame[3];
-    uint8_t rain  = frame[4];
-
-    char ts[32]; now_str(ts, sizeof ts);
-    fprintf(f, "LightRain,%u,%s,%.1f,%u\n",
-            node_id, ts, lux10/10.0f, rain);
-}
-
-static void log_system(FILE *f, const uint8_t *frame) {
-    // frame: [0]=node,[1]=cmd,[2]=bme,[3]=bh1750,[4]=rain,[5]=i2c,
-    // [6..9]=uptime,[10..11]=total_err,[12]=保留? (见头文件未用),[13]=xor_cs,[14]=0xFF
-    uint8_t node_id = frame[0];
-    uint8_t bme_ok   = frame[2];
-    uint8_t bh_ok    = frame[3];
-    uint8_t rain_ok  = frame[4];
-    uint8_t i2c_ok   = frame[5];
-    uint32_t uptime  = (frame[6] << 24) | (frame[7] << 16) | (frame[8] << 8) | frame[9];
-    uint16_t errors  = (frame[10] << 8) | frame[11];
-
-    char ts[32]; now_str(ts, sizeof ts);
-    fprintf(f, "System,%u,%s,%u,%u,%u,%u,%u,%u\n",
-            node_id, ts,
-            (unsigned)(bme_ok==0), (unsigned)(bh_ok==0),
-            (unsigned)(rain_ok==0), (unsigned)(i2c_ok==0),
-            uptime, errors);
-}
-
-static void log_gps(FILE *f, const uint8_t *frame) {
-    // frame: [0]=node,[1]=cmd,[2..7]=UTC(6字节),"hhmmss",
-    // [8..11]=lat*1e5,[12..15]=lon*1e5,[16]=pos_mode,[17]=sats,
-    // [18..19]=hdop*10,[20..21]=alt*10,[22]=crc4低4位,[23]=xor_cs,[24]=0xFF
-    uint8_t node_id = frame[0];
-
-    char utc_fmt[16];
-    format_utc_hhmmss(&frame[2], utc_fmt, sizeof utc_fmt);
-
-    int32_t lat1e5 = (frame[8] << 24) | (frame[9] << 16) | (frame[10] << 8) | frame[11];
-    int32_t lon1e5 = (frame[12] << 24) | (frame[13] << 16) | (frame[14] << 8) | frame[15];
-
-    float lat = lat1e5 / 1e5f;
-    float lon = lon1e5 / 1e5f;
-
-    uint8_t pos_mode = frame[16];
-    uint8_t sats     = frame[17];
-    int16_t hdop10   = (frame[18] << 8) | frame[19];
-    int16_t alt10    = (frame[20] << 8) | frame[21];
-
-    float hdop = hdop10 / 10.0f;
-    float alt  = alt10 / 10.0f;
-
-    char ts[32]; now_str(ts, sizeof ts);
-    fprintf(f, "GPS,%u,%s,%s,%.5f,%.5f,%u,%u,%.1f,%.1f\n",
-            node_id, ts, utc_fmt, lat, lon, pos_mode, sats, hdop, alt);
-}
-
 /* 接收数据循环 */
 static void receive_loop(int fd,FILE *f) {
     uint8_t frame[FRAME_LEN];
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -8,335 +8,354 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/shm.h>
-#include <sys/ipc.h>
 #include <netinet/in.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/file.h>
 #include "proto.h"
+#include "frame_ring.h"
 #include "shared_data.h"
+#include "shm_map.h"
+#include "prom_http.h"
+#include "trace.h"
+#include "shm_writer.h"
+#include "capture.h"
 
 /* 全局变量 */
 static struct shared_weather_data *g_shared_data = NULL;
-static int g_shm_id = -1;
+static size_t g_shm_len = 0;
 static int g_socket_fd = -1;
 static volatile int g_running = 1;
 
-/* 初始化共享内存 */
-static int init_shared_memory() {
-    /* 创建或获取共享内存 */
-    g_shm_id = shmget(SHARED_MEMORY_KEY, SHARED_MEMORY_SIZE, IPC_CREAT | 0666);
-    if (g_shm_id == -1) {
-        perror("shmget");
+/* 多写端：本进程认领的通道，收到的帧只写进这里；合并线程竞争合并者，由它写全局字段 */
+static int g_lane = -1;
+static uint32_t g_pid = 0;
+static pthread_t g_merge_tid;
+static int g_merge_started = 0;
+static volatile int g_merge_stop = 0;
+static struct shm_dedup g_dedup;
+/* 合并线程归并、汇总时持有；主线程直接写全局结构（shm_lane_write_through）时也要拿，两边不会同时写 */
+static pthread_mutex_t g_merge_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* 抓包：写入共享内存的帧连同到达时刻、连接编号追加到文件（-C） */
+static struct capture_writer g_capture = CAPTURE_WRITER_INIT;
+static uint32_t g_capture_conn = 0;      /* 每次连上服务器加一，环形缓冲区和组播为 0 */
+
+/* 读取开机 ID，用来判断映射文件里的读端登记是否还有效 */
+static void read_boot_id(char *buf, size_t len) {
+    memset(buf, 0, len);
+    FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (f == NULL) return;
+    if (fgets(buf, (int)len, f) != NULL) buf[strcspn(buf, "\n")] = '\0';
+    fclose(f);
+}
+
+/* 新建映射文件：先在临时文件里初始化好再 rename，读端任何时候打开的都是完整的文件；
+   src 不为 NULL 时把旧文件的内容迁移过来（shm_migrate） */
+static struct shared_weather_data *create_shm_file(const char *path, uint32_t history_cap, const uint32_t *series_cap,
+                                                   size_t size, const struct shared_weather_data *src) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        perror("[receiver] 创建映射文件");
+        return NULL;
+    }
+    /* 与原来 shmget 的 0666 一致，不受 umask 影响，界面以其他用户运行时也能读写映射 */
+    fchmod(fd, 0666);
+    /* 新扩展的部分读出来都是 0，相当于 memset */
+    if (ftruncate(fd, (off_t)size) != 0) {
+        perror("[receiver] ftruncate");
+        close(fd);
+        unlink(tmp);
+        return NULL;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("[receiver] mmap");
+        unlink(tmp);
+        return NULL;
+    }
+    struct shared_weather_data *sd = (struct shared_weather_data *)p;
+    if (src != NULL) {
+        uint64_t samples = 0;
+        uint64_t records = shm_migrate(sd, src, history_cap, series_cap, &samples);
+        printf("[receiver] 从格式 %u.%u 迁移：历史 %llu 条记录，样本 %llu 个，下一序号 %llu\n",
+               SHM_VERSION_MAJOR(src->hdr.version), SHM_VERSION_MINOR(src->hdr.version), (unsigned long long)records,
+               (unsigned long long)samples, (unsigned long long)sd->history_ring_head);
+    } else {
+        shm_layout_init(sd, history_cap, series_cap);
+        strncpy(sd->last_error, "共享内存已初始化", sizeof(sd->last_error) - 1);
+    }
+    __atomic_store_n(&sd->hdr.magic, SHARED_MEMORY_MAGIC, __ATOMIC_RELEASE);
+    if (rename(tmp, path) != 0) {
+        perror("[receiver] rename");
+        munmap(p, size);
+        unlink(tmp);
+        return NULL;
+    }
+    return sd;
+}
+
+/*
+初始化共享内存：映射 path，头部、布局和容量都相符时接管上次留下的数据；同一主版本但结构体大小或容量不同时
+迁移到新文件，历史和样本保留；没有头部、主版本不同或文件损坏时重建。
+已有别的接收程序在写这个文件时（多写端冗余接入）不恢复、不迁移，沿用它的布局，只认领一个写端通道。
+整个过程持有 path.lock 上的文件锁，几个接收程序同时启动时依次进行。
+history_cap 为大容量历史环的记录数（2 的幂，16 字节一条，一帧 1～3 条），
+series_cap 为各类型样本序列每个节点的样本数（按 type - 1 索引，2 的幂或 0）
+*/
+static int init_shared_memory_locked(const char *path, uint32_t history_cap, const uint32_t *series_cap) {
+    size_t size = shm_layout_size(history_cap, series_cap);
+    size_t len = 0;
+    ino_t ino;
+    struct shared_weather_data *old = shm_map_open(path, sizeof(struct shm_header), &len, &ino);
+    if (old == NULL && errno != ENOENT && errno != EINVAL) {
+        perror("[receiver] 打开映射文件");
         return -1;
     }
-    
-    /* 连接到共享内存 */
-    g_shared_data = (struct shared_weather_data *)shmat(g_shm_id, NULL, 0);
-    if (g_shared_data == (void *)-1) {
-        perror("shmat");
+    const char *bad = old != NULL ? shm_header_check(old, len) : NULL;
+    if (bad != NULL) {
+        printf("[receiver] 映射文件 %s 无法沿用（%s），重建\n", path, bad);
+        munmap(old, len);
+        old = NULL;
+    }
+
+    char boot_id[sizeof(old->boot_id)];
+    read_boot_id(boot_id, sizeof(boot_id));
+    if (old != NULL && SHM_HAS(old, lanes)) {
+        /* 开机后第一次写：文件里的 PID 都是上次开机的，可能恰好等于现在某个无关进程 */
+        if (strcmp(boot_id, old->boot_id) != 0) {
+            old->merge_pid = 0;
+            for (int i = 0; i < SHM_WRITER_LANES; i++) old->lanes[i].owner_pid = 0;
+        }
+        if (shm_other_writer(old, g_pid)) {
+            int same = len == size && old->history_ring_capacity == history_cap;
+            for (int t = 0; same && t < SERIES_TYPES; t++) same = old->series[t].lane_cap == series_cap[t];
+            printf("[receiver] 映射文件 %s（格式 %u.%u）已有接收程序（合并者 PID %u）在写，作为冗余写端加入%s\n", path,
+                   SHM_VERSION_MAJOR(old->hdr.version), SHM_VERSION_MINOR(old->hdr.version), old->merge_pid,
+                   same ? "" : "，沿用现有的历史环和样本序列容量（-N/-S 不生效）");
+            g_shared_data = old;
+            g_shm_len = len;
+            return 0;
+        }
+    } else if (old != NULL && old->writer_pid != 0 && shm_pid_alive(old->writer_pid) &&
+               strcmp(boot_id, old->boot_id) == 0) {
+        fprintf(stderr, "[receiver] 映射文件 %s 正由不支持多写端的接收程序（PID %u，格式 %u.%u）写入，先停止它\n", path,
+                old->writer_pid, SHM_VERSION_MAJOR(old->hdr.version), SHM_VERSION_MINOR(old->hdr.version));
+        munmap(old, len);
         return -1;
     }
-    
-    /* 初始化共享内存数据 */
-    if (g_shared_data->magic != SHARED_MEMORY_MAGIC) {
-        printf("[receiver] 初始化共享内存...\n");
-        memset(g_shared_data, 0, sizeof(struct shared_weather_data));
-        g_shared_data->magic = SHARED_MEMORY_MAGIC;
-        g_shared_data->writer_pid = getpid();
-        g_shared_data->connection_status = CONNECTION_DISCONNECTED;
-        g_shared_data->update_counter = 0;
-        g_shared_data->history_write_index = 0;
-        g_shared_data->history_count = 0;
-        g_shared_data->total_received = 0;
-        g_shared_data->total_errors = 0;
-        strncpy(g_shared_data->last_error, "共享内存已初始化", sizeof(g_shared_data->last_error) - 1);
+
+    struct shared_weather_data *sd = NULL;
+    if (old != NULL) {
+        uint64_t dropped = 0;
+        uint64_t kept = shm_recover(old, &dropped);
+        int same = old->hdr.version == SHM_SCHEMA_VERSION && old->hdr.data_size == sizeof(*old) && len == size &&
+                   old->hdr.region_size == size && old->history_ring_capacity == history_cap;
+        for (int t = 0; same && t < SERIES_TYPES; t++) same = old->series[t].lane_cap == series_cap[t];
+        printf("[receiver] %s映射文件 %s（格式 %u.%u）：历史 %llu 帧，下一序号 %llu，丢弃损坏记录 %llu\n",
+               same ? "接管" : "迁移", path, SHM_VERSION_MAJOR(old->hdr.version), SHM_VERSION_MINOR(old->hdr.version),
+               (unsigned long long)kept, (unsigned long long)old->history_ring_head, (unsigned long long)dropped);
+        if (SHM_HAS(old, lanes)) {
+            /* 上次各通道里还没合并的帧先写进去，迁移时通道不搬 */
+            int merged = shm_merge_lanes(old, &g_dedup, INT_MAX);
+            if (merged > 0) printf("[receiver] 合并上次写端通道里剩下的 %d 帧\n", merged);
+        }
+        if (same) {
+            sd = old;
+        } else {
+            /* 新文件建好、rename 到位后再通知映射着旧文件的读端：它们发现 inode 变了就重新映射，游标照用 */
+            sd = create_shm_file(path, history_cap, series_cap, size, old);
+            if (sd == NULL) {
+                munmap(old, len);
+                return -1;
+            }
+            old->writer_pid = 0;
+            shm_notify_readers(old);
+            munmap(old, len);
+        }
     } else {
-        printf("[receiver] 共享内存已存在，接管控制...\n");
-        g_shared_data->writer_pid = getpid();
+        printf("[receiver] 初始化共享内存...\n");
+        sd = create_shm_file(path, history_cap, series_cap, size, NULL);
+        if (sd == NULL) return -1;
     }
-    
-    printf("[receiver] 共享内存初始化成功，ID=%d, 地址=%p\n", g_shm_id, g_shared_data);
+    g_shared_data = sd;
+    g_shm_len = size;
+
+    if (strcmp(boot_id, sd->boot_id) != 0) {
+        /* 开机后第一次写：上次掉电时阻塞着的读端登记还留在文件里，不清掉写端每帧都要多一次空唤醒。
+           界面可能先于本程序启动并已登记，读端还活着就不动；用 CAS 清零，读端恰好在这之间登记时放弃 */
+        pid_t reader = sd->reader_pid;
+        if (reader == 0 || (kill(reader, 0) != 0 && errno == ESRCH)) {
+            uint32_t stale = __atomic_load_n(&sd->notify_waiters, __ATOMIC_SEQ_CST);
+            if (__atomic_compare_exchange_n(&sd->notify_waiters, &stale, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                sd->reader_pid = 0;
+            }
+        }
+        memcpy(sd->boot_id, boot_id, sizeof(sd->boot_id));
+    }
+    shm_merge_claim(sd, g_pid);
+    sd->writer_pid = g_pid;
+    sd->connection_status = CONNECTION_DISCONNECTED;
+
+    printf("[receiver] 共享内存初始化成功，文件=%s, 格式 %u.%u, 地址=%p, 历史环 %u 条 (%zu 字节)\n", path,
+           SHM_VERSION_MAJOR(SHM_SCHEMA_VERSION), SHM_VERSION_MINOR(SHM_SCHEMA_VERSION), (void *)sd, history_cap, size);
+    printf("[receiver] 样本序列（每节点，最多 %d 个节点）：bme280 %u、lightrain %u、status %u、gps %u\n",
+           SERIES_LANES, series_cap[0], series_cap[1], series_cap[2], series_cap[3]);
     return 0;
 }
 
-/* 清理共享内存 */
-static void cleanup_shared_memory(void) {
-    if (g_shared_data != NULL) {
-		// 通知读取进程即将关闭
-        g_shared_data->connection_status = CONNECTION_DISCONNECTED;
-        g_shared_data->writer_pid = 0;
-        snprintf(g_shared_data->last_error, sizeof(g_shared_data->last_error), 
-                "接收程序已退出 (PID: %d)", getpid());
-        
-        if (shmdt(g_shared_data) == -1) {
-            perror("shmdt");
-        }
-        g_shared_data = NULL;
+static int init_shared_memory(const char *path, uint32_t history_cap, const uint32_t *series_cap) {
+    char lock_path[512];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    int lfd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (lfd < 0 || flock(lfd, LOCK_EX) != 0) {
+        perror("[receiver] 映射文件锁");
+        if (lfd >= 0) close(lfd);
+        return -1;
     }
-	// 新增：删除共享内存段
-    if (g_shm_id != -1) {
-        if (shmctl(g_shm_id, IPC_RMID, NULL) == -1) {
-            // 如果共享内存已经被其他进程附加，可能无法立即删除
-            // 但这没关系，系统会在所有进程都解除附加后自动清理
-            perror("shmctl IPC_RMID");
+    fchmod(lfd, 0666);
+    g_pid = (uint32_t)getpid();
+    int rc = init_shared_memory_locked(path, history_cap, series_cap);
+    if (rc == 0) {
+        g_lane = shm_lane_claim(g_shared_data, g_pid);
+        if (g_lane < 0) {
+            fprintf(stderr, "[receiver] %d 个写端通道都已被占用\n", SHM_WRITER_LANES);
+            munmap(g_shared_data, g_shm_len);
+            g_shared_data = NULL;
+            rc = -1;
         } else {
-            printf("[receiver] 共享内存段已删除，ID=%d\n", g_shm_id);
+            printf("[receiver] 写端通道 %d（%u 帧）\n", g_lane, g_shared_data->lane_slots);
         }
-        g_shm_id = -1;
-	}
+    }
+    close(lfd);                             /* 关闭即解锁 */
+    return rc;
 }
 
-/* 更新连接状态 */
-static void update_connection_status(uint8_t status) {
-    if (g_shared_data != NULL) {
-        g_shared_data->connection_status = status;
-        g_shared_data->last_update_time = time(NULL);
+/*
+合并线程：每个接收程序都有一个，只有拿到 merge_pid 的那个在工作——把各通道的帧归并、去重后写进全局结构，
+再汇总连接状态和错误信息；其余的等在 merge_pid 上，合并者退出时立刻接手，崩溃时 1 秒内接手
+*/
+static void *merge_thread(void *arg) {
+    struct shared_weather_data *sd = (struct shared_weather_data *)arg;
+    int merging = 0;
+    time_t last_reap = 0;
+    while (!g_merge_stop) {
+        if (!shm_merge_claim(sd, g_pid)) {
+            merging = 0;
+            shm_merge_wait(sd, 1000);
+            continue;
+        }
+        if (!merging) {
+            merging = 1;
+            sd->writer_pid = g_pid;
+            printf("[receiver] 本进程为合并者 (PID: %d)\n", (int)g_pid);
+        }
+        uint32_t seen = __atomic_load_n(&sd->lane_notify, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&g_merge_mtx);
+        shm_merge_lanes(sd, &g_dedup, INT_MAX);
+        time_t now = time(NULL);
+        if (now != last_reap) {
+            last_reap = now;
+            int reaped = shm_lane_reap(sd);
+            if (reaped > 0) printf("[receiver] 收回 %d 个写端已退出的通道\n", reaped);
+        }
+        shm_merge_publish(sd);
+        pthread_mutex_unlock(&g_merge_mtx);
+        shm_lane_wait(sd, seen, 1000);
     }
+    return NULL;
 }
 
-/* 更新错误信息 */
-static void update_error_message(const char *error_msg) {
-    if (g_shared_data != NULL && error_msg != NULL) {
-        strncpy(g_shared_data->last_error, error_msg, sizeof(g_shared_data->last_error) - 1);
-        g_shared_data->last_error[sizeof(g_shared_data->last_error) - 1] = '\0';
-        g_shared_data->last_update_time = time(NULL);
+static int start_merge_thread(void) {
+    /* 信号只由主线程处理 */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int rc = pthread_create(&g_merge_tid, NULL, merge_thread, g_shared_data);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
     }
+    g_merge_started = 1;
+    return 0;
 }
 
-/* 将数据写入共享内存 */
-static void write_data_to_shared_memory(const uint8_t *frame) {
-    if (g_shared_data == NULL) return;
-    
-    uint8_t node_id = frame[0];
-    uint8_t cmd = frame[1];
-    time_t now = time(NULL);
-    
-    /* 根据命令类型解析数据并写入共享内存 */
-    switch (cmd) {
-        case CMD_BME280: {
-            if (frame[10] != END_SYMBOL[0]) {
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 解析BME280数据
-            int16_t t100 = (frame[2] << 8) | frame[3];
-            int16_t p10 = (frame[4] << 8) | frame[5];
-            int16_t h100 = (frame[6] << 8) | frame[7];
-            uint8_t recv_crc4 = frame[8] & 0x0F;
-            uint8_t frame_cs = frame[9];
-            
-            // 验证帧校验和
-            uint8_t calc_cs = 0;
-            for (int i = 0; i < 9; i++) calc_cs ^= frame[i];
-            if (calc_cs != frame_cs) {
-                //printf("[shared_memory] Node %d BME280 frame checksum error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 验证CRC4
-            uint8_t crc_data[6] = {frame[2], frame[3], frame[4], frame[5], frame[6], frame[7]};
-            uint8_t calc_crc4 = Calculate_CRC4(crc_data, 6);
-            if (calc_crc4 != recv_crc4) {
-                //printf("[shared_memory] Node %d BME280 CRC4 error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 更新BME280数据
-            g_shared_data->latest_bme280.node_id = node_id;
-            g_shared_data->latest_bme280.temperature = t100 / 100.0f;
-            g_shared_data->latest_bme280.pressure = p10 / 10.0f;
-            g_shared_data->latest_bme280.humidity = h100 / 100.0f;
-            g_shared_data->latest_bme280.timestamp = now;
-            g_shared_data->latest_bme280.valid = 1;
-            
-            // 更新通用数据帧
-            g_shared_data->latest_data.data_type = SENSOR_BME280;
-            g_shared_data->latest_data.data.bme280 = g_shared_data->latest_bme280;
-            
-            g_shared_data->bme280_count++;
-            //printf("[shared_memory] BME280 data updated: Node=%u, T=%.2f°C, P=%.1f hPa, H=%.2f%%\n",
-            //       node_id, g_shared_data->latest_bme280.temperature, 
-            //       g_shared_data->latest_bme280.pressure, g_shared_data->latest_bme280.humidity);
-            break;
+/* 清理共享内存：文件保留，下次启动（包括开发板重启后）接着用。
+   先交还通道，是合并者时把剩下的帧合并完再放弃；还有别的写端时全局状态交给接手的合并者 */
+static void cleanup_shared_memory(void) {
+    if (g_shared_data != NULL) {
+        struct shared_weather_data *sd = g_shared_data;
+        if (g_merge_started) {
+            g_merge_stop = 1;
+            shm_futex(&sd->lane_notify, FUTEX_WAKE, INT_MAX, NULL);
+            shm_futex(&sd->merge_pid, FUTEX_WAKE, INT_MAX, NULL);
+            pthread_join(g_merge_tid, NULL);
+            g_merge_started = 0;
         }
-        
-        case CMD_LIGHTRAIN: {
-            if (frame[7] != END_SYMBOL[0]) {
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 解析光强雨量数据
-            int16_t lux10 = (frame[2] << 8) | frame[3];
-            uint8_t rain = frame[4];
-            uint8_t recv_crc4 = frame[5] & 0x0F;
-            uint8_t frame_cs = frame[6];
-            
-            // 验证帧校验和
-            uint8_t calc_cs = 0;
-            for (int i = 0; i < 6; i++) calc_cs ^= frame[i];
-            if (calc_cs != frame_cs) {
-                //printf("[shared_memory] Node %d LightRain frame checksum error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 验证CRC4
-            uint8_t crc_data[3] = {frame[2], frame[3], frame[4]};
-            uint8_t calc_crc4 = Calculate_CRC4(crc_data, 3);
-            if (calc_crc4 != recv_crc4) {
-                //printf("[shared_memory] Node %d LightRain CRC4 error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 更新光强雨量数据
-            g_shared_data->latest_lightrain.node_id = node_id;
-            g_shared_data->latest_lightrain.light_intensity = lux10 / 10.0f;
-            g_shared_data->latest_lightrain.rainfall = rain;
-            g_shared_data->latest_lightrain.timestamp = now;
-            g_shared_data->latest_lightrain.valid = 1;
-            
-            // 更新通用数据帧
-            g_shared_data->latest_data.data_type = SENSOR_LIGHTRAIN;
-            g_shared_data->latest_data.data.lightrain = g_shared_data->latest_lightrain;
-            
-            g_shared_data->lightrain_count++;
-            //printf("[shared_memory] LightRain data updated: Node=%u, Lux=%.1f lx, Rain=%u%%\n",
-            //       node_id, g_shared_data->latest_lightrain.light_intensity, 
-            //       g_shared_data->latest_lightrain.rainfall);
-            break;
+        if (g_lane >= 0) {
+            sd->lanes[g_lane].connection_status = CONNECTION_DISCONNECTED;
+            shm_lane_release(sd, g_lane, g_pid);
+            g_lane = -1;
         }
-        
-        case CMD_SYSTEM_STATUS: {
-            if (frame[14] != END_SYMBOL[0]) {
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 解析系统状态数据
-            uint8_t bme280_status = frame[2];
-            uint8_t bh1750_status = frame[3];
-            uint8_t rain_sensor_status = frame[4];
-            uint8_t i2c_bus_status = frame[5];
-            uint32_t uptime_seconds = (frame[6] << 24) | (frame[7] << 16) | (frame[8] << 8) | frame[9];
-            uint16_t total_errors = (frame[10] << 8) | frame[11];
-            uint8_t frame_cs = frame[13];
-            
-            // 验证帧校验和
-            uint8_t calc_cs = 0;
-            for (int i = 0; i < 13; i++) calc_cs ^= frame[i];
-            if (calc_cs != frame_cs) {
-                //printf("[shared_memory] Node %d SystemStatus frame checksum error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
+        if (shm_merge_claim(sd, g_pid)) {
+            shm_merge_lanes(sd, &g_dedup, INT_MAX);
+            shm_merge_publish(sd);
+            if (!shm_other_writer(sd, g_pid)) {
+                // 通知读取进程即将关闭
+                sd->connection_status = CONNECTION_DISCONNECTED;
+                sd->writer_pid = 0;
+                snprintf(sd->last_error, sizeof(sd->last_error), "接收程序已退出 (PID: %d)", (int)g_pid);
             }
-            
-            // 更新系统状态数据
-            g_shared_data->latest_system_status.node_id = node_id;
-            g_shared_data->latest_system_status.bme280_status = bme280_status;
-            g_shared_data->latest_system_status.bh1750_status = bh1750_status;
-            g_shared_data->latest_system_status.rain_sensor_status = rain_sensor_status;
-            g_shared_data->latest_system_status.i2c_bus_status = i2c_bus_status;
-            g_shared_data->latest_system_status.uptime_seconds = uptime_seconds;
-            g_shared_data->latest_system_status.total_errors = total_errors;
-            g_shared_data->latest_system_status.timestamp = now;
-            g_shared_data->latest_system_status.valid = 1;
-            
-            // 更新通用数据帧
-            g_shared_data->latest_data.data_type = SENSOR_SYSTEM_STATUS;
-            g_shared_data->latest_data.data.system_status = g_shared_data->latest_system_status;
-            
-            g_shared_data->system_status_count++;
-            //printf("[shared_memory] SystemStatus data updated: Node=%u, Uptime=%u s, Errors=%u\n",
-            //       node_id, uptime_seconds, total_errors);
-            break;
+            shm_merge_release(sd, g_pid);
         }
-        
-        case CMD_GPS: {
-            if (frame[24] != END_SYMBOL[0]) {
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 解析GPS数据
-            char utc[7] = {0};
-            memcpy(utc, &frame[2], 6);
-            int32_t lat1e5 = (frame[8] << 24) | (frame[9] << 16) | (frame[10] << 8) | frame[11];
-            int32_t lon1e5 = (frame[12] << 24) | (frame[13] << 16) | (frame[14] << 8) | frame[15];
-            uint8_t positioning = frame[16];
-            uint8_t sats = frame[17];
-            int16_t hdop10 = (frame[18] << 8) | frame[19];
-            int16_t alt10 = (frame[20] << 8) | frame[21];
-            uint8_t recv_crc4 = frame[22] & 0x0F;
-            uint8_t frame_cs = frame[23];
-            
-            // 验证帧校验和
-            uint8_t calc_cs = 0;
-            for (int i = 0; i < 23; i++) calc_cs ^= frame[i];
-            if (calc_cs != frame_cs) {
-                //printf("[shared_memory] Node %d GPS frame checksum error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 验证CRC4
-            uint8_t crc_data[20];
-            memcpy(crc_data, &frame[2], 20);
-            uint8_t calc_crc4 = Calculate_CRC4(crc_data, 20);
-            if (calc_crc4 != recv_crc4) {
-                //printf("[shared_memory] Node %d GPS CRC4 error!\n", node_id);
-                g_shared_data->total_errors++;
-                return;
-            }
-            
-            // 更新GPS数据
-            g_shared_data->latest_gps.node_id = node_id;
-            strncpy(g_shared_data->latest_gps.utc, utc, sizeof(g_shared_data->latest_gps.utc) - 1);
-            g_shared_data->latest_gps.latitude = lat1e5 / 1e5f;
-            g_shared_data->latest_gps.longitude = lon1e5 / 1e5f;
-            g_shared_data->latest_gps.positioning = positioning;
-            g_shared_data->latest_gps.satellites = sats;
-            g_shared_data->latest_gps.hdop = hdop10 / 10.0f;
-            g_shared_data->latest_gps.altitude = alt10 / 10.0f;
-            g_shared_data->latest_gps.timestamp = now;
-            g_shared_data->latest_gps.valid = 1;
-            
-            // 更新通用数据帧
-            g_shared_data->latest_data.data_type = SENSOR_GPS;
-            g_shared_data->latest_data.data.gps = g_shared_data->latest_gps;
-            
-            g_shared_data->gps_count++;
-            //printf("[shared_memory] GPS data updated: Node=%u, UTC=%s, Lat=%.5f, Lon=%.5f\n",
-            //       node_id, utc, g_shared_data->latest_gps.latitude, g_shared_data->latest_gps.longitude);
-            break;
+        shm_notify_readers(sd);
+
+        /* 平时靠内核回写脏页，退出前同步落盘一次 */
+        if (msync(g_shared_data, g_shm_len, MS_SYNC) != 0) {
+            perror("msync");
         }
-        
-        default:
-            printf("[shared_memory] Unknown command: 0x%02X\n", cmd);
-            g_shared_data->total_errors++;
-            return;
+        munmap(g_shared_data, g_shm_len);
+        g_shared_data = NULL;
+        printf("[receiver] 共享内存已写回文件\n");
     }
-    
-    /* 添加到历史缓冲区 */
-    uint32_t write_idx = g_shared_data->history_write_index;
-    g_shared_data->history[write_idx] = g_shared_data->latest_data;
-    
-    /* 更新写入索引 */
-    g_shared_data->history_write_index = (write_idx + 1) % MAX_HISTORY_COUNT;
-    
-    /* 更新历史数据计数 */
-    if (g_shared_data->history_count < MAX_HISTORY_COUNT) {
-        g_shared_data->history_count++;
-    }
-    /* 更新计数器和统计信息 */
-    g_shared_data->update_counter++;
-    g_shared_data->total_received++;
-    g_shared_data->last_update_time = now;
+}
+
+/* 更新连接状态：写本进程的通道，合并者汇总后更新全局字段 */
+static void update_connection_status(uint8_t status) {
+    if (g_shared_data != NULL && g_lane >= 0) {
+        g_shared_data->lanes[g_lane].connection_status = status;
+        shm_lane_notify(g_shared_data);
+    }
+}
+
+/* 更新错误信息 */
+static void update_error_message(const char *error_msg) {
+    if (g_shared_data != NULL && g_lane >= 0 && error_msg != NULL) {
+        shm_lane_set_error(g_shared_data, g_lane, error_msg);
+        shm_lane_notify(g_shared_data);
+    }
+}
+
+/* 接收侧的错误帧（组播丢包、环形缓冲区丢帧等）计入本通道，合并者加到 total_errors */
+static void add_receive_errors(uint32_t n) {
+    if (g_shared_data != NULL && g_lane >= 0) shm_stat_add(&g_shared_data->lanes[g_lane].errors, n);
+}
+
+/* 将数据写入本进程的写端通道，由合并者校验、去重后写入共享内存；
+   本进程是合并者且没有别的写端时直接写，不用每帧叫醒合并线程 */
+static void write_data_to_shared_memory(const uint8_t *frame) {
+    if (g_shared_data == NULL || g_lane < 0) return;
+    if (g_capture.f != NULL) capture_frame(&g_capture, capture_clock_ns(CLOCK_MONOTONIC), g_capture_conn, frame);
+    uint64_t ts_ns = capture_clock_ns(CLOCK_REALTIME);
+    pthread_mutex_lock(&g_merge_mtx);
+    int done = shm_lane_write_through(g_shared_data, &g_dedup, g_lane, g_pid, frame, ts_ns);
+    pthread_mutex_unlock(&g_merge_mtx);
+    if (!done) shm_lane_push(g_shared_data, g_lane, frame, ts_ns);
 }
 
 /* 连接到服务器 */
@@ -400,6 +419,13 @@ static void receive_loop(int fd) {
     while (g_running) {
 
         /*读取数据帧*/
+        /* 追踪开启时先等到数据可读再计时，区间里不含空闲等待 */
+        uint64_t t_rd = 0;
+        if (g_trace.every) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, 1000) <= 0) continue;
+            t_rd = trace_now_ns();
+        }
 		int L_r = LORA_ReadAndRarse(fd,frame);
 
 		if(L_r < 0){
@@ -414,52 +440,383 @@ static void receive_loop(int fd) {
             break;
         }
 
+        trace_span(TRACE_RECV_PARSE, trace_sampled(frame), t_rd, trace_clock());
+
         /* 将数据写入共享内存 */
         write_data_to_shared_memory(frame);
     }
 }
 
 
-/* 信号处理函数 */
-static void signal_handler(int sig) {
-    printf("[receiver] 接收到信号 %d，准备退出...\n", sig);
-    g_running = 0;
-    
-    if (g_socket_fd >= 0) {
-        close(g_socket_fd);
-        g_socket_fd = -1;
+/* 共享内存环形缓冲区接收循环：与服务器同机时直接读取服务器发布的帧 */
+static void ring_loop(struct frame_ring *ring) {
+    uint8_t frame[FRAME_LEN];
+    uint64_t cursor = frame_ring_head(ring) + 1;   // 只处理新帧
+
+    printf("[receiver] 开始从共享内存环形缓冲区接收...\n");
+    while (g_running) {
+        uint64_t lost = 0;
+        int r = frame_ring_next(ring, &cursor, frame, &lost, 1000);
+        if (r < 0) break;
+        if (lost > 0 && g_shared_data != NULL) {
+            char error_buf[64];
+            snprintf(error_buf, sizeof(error_buf), "环形缓冲区读取过慢，丢失 %llu 帧", (unsigned long long)lost);
+            update_error_message(error_buf);
+            add_receive_errors((uint32_t)lost);
+        }
+        if (r == 1) write_data_to_shared_memory(frame);
     }
+}
 
-	// 新增：清理共享内存
-    cleanup_shared_memory();
+/* ================== 组播接收 ================== */
+static int g_repair_fd = -1;
+
+/* 加入组播组，返回 UDP socket */
+static int mcast_join(const char *group, int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); close(fd); return -1; }
+
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        perror("IP_ADD_MEMBERSHIP");
+        close(fd);
+        return -1;
+    }
+
+    /* 定时返回以便检查 g_running */
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+/* 经 ROLE_REPAIR 连接请求补发 [from, from+count)，from=0 为快照；
+ * 按序写入共享内存并推进 *last，不是纪元 epoch 的包（服务器在这之间重启了）不写；返回 -1 表示补发通道不可用 */
+static int mcast_repair(const char *server_ip, int port, uint32_t epoch, uint64_t from, uint32_t count,
+                        uint64_t *last) {
+    if (g_repair_fd < 0) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        if (fd < 0 || inet_pton(AF_INET, server_ip, &addr.sin_addr) != 1 ||
+            connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            send_all(fd, ROLE_REPAIR, ROLE_LEN) != ROLE_LEN) {
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        g_repair_fd = fd;
+    }
+
+    uint8_t req[MCAST_REQ_LEN];
+    put_be64(req, from);
+    req[8] = (uint8_t)(count >> 24); req[9] = (uint8_t)(count >> 16);
+    req[10] = (uint8_t)(count >> 8); req[11] = (uint8_t)count;
+    if (send_all(g_repair_fd, req, sizeof(req)) != (ssize_t)sizeof(req)) goto fail;
+
+    uint8_t pkt[MCAST_PKT_LEN];
+    for (;;) {
+        if (read_n(g_repair_fd, pkt, sizeof(pkt)) != (ssize_t)sizeof(pkt)) goto fail;
+        uint64_t seq = get_be64(pkt + MCAST_SEQ_OFF);
+        if (seq == 0) return 0;
+        if (seq > *last && get_be32(pkt + MCAST_EPOCH_OFF) == epoch) {
+            write_data_to_shared_memory(pkt + MCAST_HDR_LEN);
+            *last = seq;
+        }
+    }
+
+fail:
+    close(g_repair_fd);
+    g_repair_fd = -1;
+    return -1;
+}
+
+/* 组播接收循环：按序号检测缺口，缺口经 TCP 补发，补不回来的计入错误帧 */
+static void mcast_loop(int mfd, const char *server_ip, int port) {
+    uint8_t pkt[MCAST_PKT_LEN + 1];
+    uint64_t last = 0;          /* 已写入共享内存的最大序号 */
+    int have_stream = 0;
+    uint8_t server_id = 0;
+    uint32_t epoch = 0;
+
+    printf("[receiver] 开始组播接收...\n");
+    while (g_running) {
+        ssize_t n = recv(mfd, pkt, sizeof(pkt), 0);
+        if (n < 0) continue;    /* 超时或信号 */
+        if (n != MCAST_PKT_LEN || pkt[0] != 'M' || pkt[1] != 'C' || pkt[2] != MCAST_VERSION) {
+            add_receive_errors(1);
+            continue;
+        }
+
+        uint64_t seq = get_be64(pkt + MCAST_SEQ_OFF);
+        uint32_t pkt_epoch = get_be32(pkt + MCAST_EPOCH_OFF);
+        if (!have_stream || pkt[3] != server_id || pkt_epoch != epoch || seq + MCAST_HISTORY < last) {
+            /* 首包或服务器重启（纪元变了，或序号回退超出补发范围）：先取快照把共享内存填满，再从当前序号继续 */
+            have_stream = 1;
+            server_id = pkt[3];
+            epoch = pkt_epoch;
+            last = 0;
+            if (mcast_repair(server_ip, port, epoch, 0, 0, &last) != 0 || last == 0) last = seq - 1;
+        }
+        if (seq <= last) continue;   /* 重复或已补发 */
+
+        if (seq > last + 1) {
+            uint64_t want = seq - last - 1;
+            mcast_repair(server_ip, port, epoch, last + 1, (uint32_t)want, &last);
+            if (seq > last + 1 && g_shared_data != NULL) {
+                char error_buf[64];
+                snprintf(error_buf, sizeof(error_buf), "组播丢失 %llu 帧未能补发",
+                         (unsigned long long)(seq - last - 1));
+                update_error_message(error_buf);
+                add_receive_errors((uint32_t)(seq - last - 1));
+            }
+            if (seq <= last) continue;
+        }
+        write_data_to_shared_memory(pkt + MCAST_HDR_LEN);
+        last = seq;
+    }
+    if (g_repair_fd >= 0) { close(g_repair_fd); g_repair_fd = -1; }
+}
+
+/* Prometheus 指标：导出共享内存中的统计，原来只能在 Qt 面板上看到 */
+static size_t render_prometheus(char *buf, size_t cap) {
+    struct shared_weather_data *sd = g_shared_data;
+    if (!g_running || sd == NULL) return 0;
+    size_t len = 0;
+    len = buf_appendf(buf, cap, len,
+        "# TYPE mmm_receiver_frames_received_total counter\n"
+        "mmm_receiver_frames_received_total %u\n"
+        "# TYPE mmm_receiver_errors_total counter\n"
+        "mmm_receiver_errors_total %u\n"
+        "# TYPE mmm_receiver_updates_total counter\n"
+        "mmm_receiver_updates_total %u\n"
+        "# TYPE mmm_receiver_frames_by_type_total counter\n"
+        "mmm_receiver_frames_by_type_total{type=\"bme280\"} %u\n"
+        "mmm_receiver_frames_by_type_total{type=\"lightrain\"} %u\n"
+        "mmm_receiver_frames_by_type_total{type=\"system_status\"} %u\n"
+        "mmm_receiver_frames_by_type_total{type=\"gps\"} %u\n"
+        "# TYPE mmm_receiver_history_count gauge\n"
+        "mmm_receiver_history_count %u\n"
+        "# TYPE mmm_receiver_connection_status gauge\n"
+        "mmm_receiver_connection_status %u\n"
+        "# TYPE mmm_receiver_last_update_timestamp_seconds gauge\n"
+        "mmm_receiver_last_update_timestamp_seconds %ld\n",
+        shm_stat_get(&sd->total_received), shm_stat_get(&sd->total_errors), shm_stat_get(&sd->update_counter),
+        shm_stat_get(&sd->bme280_count), shm_stat_get(&sd->lightrain_count),
+        shm_stat_get(&sd->system_status_count), shm_stat_get(&sd->gps_count), shm_stat_get(&sd->history_count),
+        (unsigned)sd->connection_status, (long)__atomic_load_n(&sd->last_update_time, __ATOMIC_RELAXED));
+    len = buf_appendf(buf, cap, len, "# TYPE mmm_receiver_series_nodes gauge\n");
+    for (int t = 0; t < SERIES_TYPES; t++) {
+        len = buf_appendf(buf, cap, len, "mmm_receiver_series_nodes{type=\"%s\"} %u\n",
+                          shm_sensor_type_name((uint8_t)(t + 1)), shm_stat_get(&sd->series[t].lanes_used));
+    }
+    len = buf_appendf(buf, cap, len, "# TYPE mmm_receiver_series_dropped_total counter\n");
+    for (int t = 0; t < SERIES_TYPES; t++) {
+        len = buf_appendf(buf, cap, len, "mmm_receiver_series_dropped_total{type=\"%s\"} %u\n",
+                          shm_sensor_type_name((uint8_t)(t + 1)), shm_stat_get(&sd->series[t].dropped));
+    }
+    /* 多写端：每个接收程序都导出同样的各通道计数，lane 标签与 shm_tail -L 的通道号一致 */
+    len = buf_appendf(buf, cap, len,
+        "# TYPE mmm_receiver_lane gauge\n"
+        "mmm_receiver_lane %d\n"
+        "# TYPE mmm_receiver_merger gauge\n"
+        "mmm_receiver_merger %d\n",
+        g_lane, __atomic_load_n(&sd->merge_pid, __ATOMIC_RELAXED) == g_pid);
+    static const char *const lane_metrics[] = { "frames", "applied", "duplicates", "lost" };
+    for (int m = 0; m < 4; m++) {
+        len = buf_appendf(buf, cap, len, "# TYPE mmm_receiver_lane_%s_total counter\n", lane_metrics[m]);
+        for (int i = 0; i < SHM_WRITER_LANES; i++) {
+            const struct writer_lane *l = &sd->lanes[i];
+            const uint32_t *v[4] = { &l->frames, &l->applied, &l->duplicates, &l->lost };
+            len = buf_appendf(buf, cap, len, "mmm_receiver_lane_%s_total{lane=\"%d\"} %u\n", lane_metrics[m], i,
+                              shm_stat_get(v[m]));
+        }
+    }
+    return len;
+}
+
+/* 退出时把抓包缓冲刷到文件 */
+static void close_capture(void) {
+    if (g_capture.f != NULL) {
+        printf("[receiver] 已抓取 %llu 帧 (%llu 字节)\n", (unsigned long long)g_capture.frames,
+               (unsigned long long)g_capture.bytes);
+    }
+    capture_close(&g_capture);
 }
 
+/* 信号处理函数：只置退出标志，并 shutdown 连接让阻塞的 read 立即返回；
+   合并线程、共享内存的清理由 main 退出前的 cleanup_shared_memory() 统一按顺序做，
+   在信号上下文里 join 线程、munmap 会和正在写共享内存的主线程冲突 */
+static void signal_handler(int sig) {
+    (void)sig;
+    g_running = 0;
+    int fd = g_socket_fd;
+    if (fd >= 0) shutdown(fd, SHUT_RDWR);
+}
+
+/* 解析 -S 类型=样本数[,类型=样本数...]，样本数向上取 2 的幂，0 表示该类型不保存序列；格式不对返回 -1 */
+static int parse_series_caps(const char *spec, uint32_t *series_cap) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save = NULL, *tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (eq == NULL) return -1;
+        *eq = '\0';
+        uint8_t type = shm_sensor_type_parse(tok);
+        char *end;
+        unsigned long n = strtoul(eq + 1, &end, 0);
+        if (type == 0 || *end != '\0' || n > SERIES_CAP_MAX) return -1;
+        uint32_t c = n ? 1 : 0;
+        while (c != 0 && c < n) c <<= 1;
+        series_cap[type - 1] = c;
+    }
+    return 0;
+}
 
 int main(int argc, char **argv) {
-    if (argc < 3) {
-        fprintf(stderr, "用法：%s <server_ip> <port>\n", argv[0]);
+    const char *ring_name = NULL;
+    const char *mcast_spec = NULL;
+    const char *prom_spec = NULL;
+    const char *capture_path = NULL;
+    const char *shm_path = NULL;
+    unsigned long history_cap = HISTORY_RING_DEFAULT;
+    uint32_t series_cap[SERIES_TYPES] = SERIES_CAP_DEFAULT;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:g:H:C:N:F:S:")) != -1) {
+        if (opt == 'r') ring_name = optarg;
+        else if (opt == 'g') mcast_spec = optarg;
+        else if (opt == 'H') prom_spec = optarg;
+        else if (opt == 'C') capture_path = optarg;
+        else if (opt == 'N') history_cap = strtoul(optarg, NULL, 0);
+        else if (opt == 'F') shm_path = optarg;
+        else if (opt == 'S') {
+            if (parse_series_caps(optarg, series_cap) != 0) {
+                fprintf(stderr, "[receiver] -S 格式为 类型=样本数[,...]，类型为 bme280/lightrain/system_status/gps，"
+                                "样本数 0..%u\n", SERIES_CAP_MAX);
+                return 1;
+            }
+        }
+        else break;
+    }
+    if (ring_name == NULL && argc - optind < 2) {
+        fprintf(stderr, "用法：%s <server_ip> <port>\n"
+                        "      %s -r <共享内存名>    与服务器同机时读取 server -m 发布的帧\n"
+                        "      %s -g <组播地址:端口> <server_ip> <port>    加入 server -g 的组播组，经服务器补发缺口\n"
+                        "      以上任一方式都可加 -H [IP:]端口，提供 Prometheus 指标 GET /metrics\n"
+                        "      以及 -C <抓包文件>，把收到的帧追加到文件，用 capture_replay 回放\n"
+                        "      -N <记录数> 共享内存中大容量历史环的容量（16 字节一条，一帧 1～3 条），向上取 2 的幂，默认 %u，最大 %u\n"
+                        "      -F <文件> 共享内存映射文件，默认取环境变量 %s，再默认 %s\n"
+                        "      -S <类型=样本数,...> 各类型每个节点保存的样本序列长度（2 的幂，0 不保存），\n"
+                        "         类型为 bme280/lightrain/system_status/gps，默认 bme280=%u,lightrain=%u,system_status=%u,gps=%u\n",
+                argv[0], argv[0], argv[0], HISTORY_RING_DEFAULT, HISTORY_RING_MAX, SHARED_MEMORY_PATH_ENV,
+                SHARED_MEMORY_PATH, series_cap[0], series_cap[1], series_cap[2], series_cap[3]);
+        return 1;
+    }
+    if (history_cap == 0 || history_cap > HISTORY_RING_MAX) {
+        fprintf(stderr, "[receiver] 历史环容量须在 1..%u 之间\n", HISTORY_RING_MAX);
         return 1;
     }
+    uint32_t ring_cap = 1;
+    while (ring_cap < history_cap) ring_cap <<= 1;
     
-    const char *server_ip = argv[1];
-    int port = atoi(argv[2]);
+    const char *server_ip = ring_name ? "shm" : argv[optind];
+    int port = ring_name ? 0 : atoi(argv[optind + 1]);
     
     /* 注册信号处理函数 */
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
     /* 初始化共享内存 */
-    if (init_shared_memory() != 0) {
+    if (shm_path == NULL) shm_path = shm_map_path();
+    if (init_shared_memory(shm_path, ring_cap, series_cap) != 0) {
         fprintf(stderr, "[receiver] 共享内存初始化失败\n");
         return 1;
     }
     
-    /* 保存服务器信息到共享内存 */
-    strncpy(g_shared_data->server_ip, server_ip, sizeof(g_shared_data->server_ip) - 1);
-    g_shared_data->server_port = (uint16_t)port;
+    /* 保存服务器信息到本进程的通道，合并者显示连接最好的那个 */
+    struct writer_lane *lane = &g_shared_data->lanes[g_lane];
+    snprintf(lane->source_ip, sizeof(lane->source_ip), "%s", server_ip);
+    lane->source_port = (uint16_t)port;
+    if (start_merge_thread() != 0) {
+        perror("[receiver] 合并线程启动失败");
+        cleanup_shared_memory();
+        return 1;
+    }
     
     printf("[receiver] 数据接收程序启动 (PID: %d)\n", getpid());
-    printf("[receiver] 共享内存键值: 0x%08X\n", SHARED_MEMORY_KEY);
+    trace_init("receiver");
+
+    if (capture_path != NULL) {
+        if (capture_open(&g_capture, capture_path) != 0) {
+            fprintf(stderr, "[receiver] 无法打开抓包文件 %s\n", capture_path);
+            cleanup_shared_memory();
+            return 1;
+        }
+        atexit(close_capture);
+        printf("[receiver] 抓包写入 %s\n", capture_path);
+    }
+
+    if (prom_spec != NULL) {
+        if (prom_http_start(prom_spec, render_prometheus, &g_running) != 0) {
+            perror("[receiver] 指标端点启动失败");
+            cleanup_shared_memory();
+            return 1;
+        }
+        printf("[receiver] Prometheus 指标: %s/metrics\n", prom_spec);
+    }
+
+    if (ring_name != NULL) {
+        struct frame_ring ring = { 0 };
+        while (g_running && frame_ring_attach(&ring, ring_name) != 0) {
+            update_connection_status(CONNECTION_CONNECTING);
+            printf("[receiver] 环形缓冲区 %s 不可用(%s)，5秒后重试...\n", ring_name, strerror(errno));
+            sleep(5);
+        }
+        if (g_running) {
+            snprintf(lane->source_ip, sizeof(lane->source_ip), "%s", ring_name);
+            update_connection_status(CONNECTION_CONNECTED);
+            ring_loop(&ring);
+            frame_ring_close(&ring);
+        }
+        printf("[receiver] 程序正常退出\n");
+        cleanup_shared_memory();
+        return 0;
+    }
+
+    if (mcast_spec != NULL) {
+        char group[INET_ADDRSTRLEN] = {0};
+        const char *colon = strrchr(mcast_spec, ':');
+        int mport = colon ? atoi(colon + 1) : 0;
+        if (colon == NULL || (size_t)(colon - mcast_spec) >= sizeof(group) || mport <= 0) {
+            fprintf(stderr, "[receiver] 组播地址格式应为 地址:端口\n");
+            cleanup_shared_memory();
+            return 1;
+        }
+        memcpy(group, mcast_spec, (size_t)(colon - mcast_spec));
+
+        int mfd = mcast_join(group, mport);
+        if (mfd >= 0) {
+            update_connection_status(CONNECTION_CONNECTED);
+            update_error_message("已加入组播组");
+            mcast_loop(mfd, server_ip, port);
+            close(mfd);
+        }
+        printf("[receiver] 程序正常退出\n");
+        cleanup_shared_memory();
+        return mfd >= 0 ? 0 : 1;
+    }
     
     /* 主循环 - 支持自动重连 */
     while (g_running) {
@@ -488,6 +845,7 @@ int main(int argc, char **argv) {
         
         /* 接收数据 */
 		//printf("开始接收数据...\n");
+        g_capture_conn++;
         receive_loop(g_socket_fd);
         
         /* 关闭连接 */
@@ -0,0 +1,77 @@
+#!/bin/bash
+# 本机回环上的多进程中继拓扑验证
+#
+#   sender -> root(19000) -> relayA(19001) -> relayC(19003)
+#                         -> relayB(19002, 订阅下推，只要 BME280)
+#   环路：loopX(19004) <-> loopY(19005)，sender 直接发给 loopX
+#
+# 每个节点挂一个接收端统计收到的帧数：树上各节点帧数应一致，
+# relayB 只收到 BME280，环路中的 loopX 每帧只收到一次。
+# 用法：make serv send && ./relay_topology.sh [秒数]
+
+DUR=${1:-10}
+OUT=./output
+TMP=$(mktemp -d)
+PIDS=()
+RPIDS=()
+
+cleanup() {
+    kill "${PIDS[@]}" "${RPIDS[@]}" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+start() {   # start <名字> <参数...>
+    local name=$1; shift
+    "$OUT/server" "$@" 2>"$TMP/$name.log" &
+    PIDS+=($!)
+}
+
+# 接收端：发送角色头（可选订阅消息）后把收到的字节写入文件
+recv_frames() {   # recv_frames <端口> <输出文件> [订阅位图]
+    (
+        exec 3<>/dev/tcp/127.0.0.1/$1 || exit 1
+        printf '\xbb\x00' >&3
+        [ -n "$3" ] && printf "\\xcc\\x$3" >&3
+        timeout $((DUR + 3)) cat <&3 >"$2"
+    ) &
+    RPIDS+=($!)
+}
+
+frames() { echo $(( $(stat -c %s "$1") / 32 )); }
+
+start root   -i 1 19000
+start relayA -i 2 -u 127.0.0.1:19000 19001
+start relayB -i 3 -u 127.0.0.1:19000 -P 19002
+start relayC -i 4 -u 127.0.0.1:19001 19003
+start loopX  -i 5 -u 127.0.0.1:19005 19004
+start loopY  -i 6 -u 127.0.0.1:19004 19005
+sleep 1
+
+for p in 19000 19001 19003 19004; do recv_frames $p "$TMP/r$p"; done
+recv_frames 19002 "$TMP/r19002" 01
+sleep 1
+
+"$OUT/sender" 127.0.0.1 19000 1 >/dev/null &
+PIDS+=($!)
+"$OUT/sender" 127.0.0.1 19004 2 >/dev/null &
+PIDS+=($!)
+
+sleep "$DUR"
+# 先停发送端，等接收端把在途帧收完
+kill "${PIDS[@]: -2}" 2>/dev/null
+wait "${RPIDS[@]}" 2>/dev/null
+
+printf "%-8s %s\n" root "$(frames $TMP/r19000)" relayA "$(frames $TMP/r19001)" \
+       relayC "$(frames $TMP/r19003)" relayB "$(frames $TMP/r19002) (仅 BME280)" \
+       loopX "$(frames $TMP/r19004)"
+
+rc=0
+[ "$(frames $TMP/r19000)" -gt 0 ] || rc=1
+[ "$(frames $TMP/r19001)" = "$(frames $TMP/r19000)" ] || rc=1
+[ "$(frames $TMP/r19003)" = "$(frames $TMP/r19000)" ] || rc=1
+[ "$(frames $TMP/r19002)" -lt "$(frames $TMP/r19000)" ] || rc=1
+[ "$(frames $TMP/r19004)" -le $(( $(frames $TMP/r19000) + 1 )) ] || rc=1
+[ $rc = 0 ] && echo "拓扑检查通过" || echo "拓扑检查失败"
+exit $rc
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -6,61 +6,416 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
 #include <pthread.h>
 
 #include "proto.h"
+#include "frame_ring.h"
+#include "metrics.h"
+#include "trace.h"
+#include "prom_http.h"
+#include "capture.h"
 
 #define BACKLOG 64
 #define MAX_RECV_CLIENTS 128
+#define POLL_INTERVAL_MS 200      /* 连接线程检查退出/升级标志的周期 */
+#define UPGRADE_FD_ENV "MMM_UPGRADE_FD"
+#define UPGRADE_TIMEOUT_MS 5000   /* 等待线程停靠、等待新进程确认的超时 */
+#define MCAST_SEQ_ENV "MMM_MCAST_SEQ"
+#define MCAST_EPOCH_ENV "MMM_MCAST_EPOCH"
+#define REPAIR_IDLE_MS 30000      /* 补发连接空闲超时 */
+#define UDP_BATCH 64              /* 每次 recvmmsg 最多取的数据报数 */
+#define UDP_DGRAM_MAX 2048        /* 单个数据报最多 64 帧 */
+#define UDP_RCVBUF (4 << 20)      /* 突发时靠内核缓冲区吸收 */
+#define STATS_BUF_SIZE (256 * 1024)
 
-static volatile int g_running = 1;
+static volatile sig_atomic_t g_running = 1;
+static volatile sig_atomic_t g_upgrade_req = 0;   /* SIGUSR2 请求热升级 */
+static volatile int g_upgrading = 0;              /* 置位后连接线程在帧边界停靠 */
+static char g_self_path[4096];                    /* 热升级时 exec 的程序路径 */
+
+/* 中继模式：作为 ROLE_RECVR 连接上级服务器，把收到的帧再广播给本地接收端 */
+static uint8_t g_server_id = 0;                   /* 写入帧尾，用于中继防环 */
+static char g_upstream_ip[INET_ADDRSTRLEN] = {0};
+static int g_upstream_port = 0;
+static int g_pushdown = 0;                        /* 把本地订阅的并集下推给上级 */
+static int g_upstream_started = 0;                /* 热升级时已接管上级连接 */
+
+/* 同机共享内存发布：校验通过的帧写入环形缓冲区，本机读者免去 TCP 回环 */
+static struct frame_ring g_ring = { 0 };
+static const char *g_ring_name = NULL;
+static uint32_t g_ring_slots = FRAME_RING_DEFAULT_SLOTS;
+
+/* 组播扇出：每帧只发一次到组播组，接收端按序号发现缺口后经 ROLE_REPAIR 连接补发 */
+static struct {
+    int fd;
+    struct sockaddr_in group;
+    uint64_t seq;                              /* 最近发送的序号 */
+    uint32_t epoch;                            /* 本次启动的纪元，热升级时沿用 */
+    uint8_t hist[MCAST_HISTORY][MCAST_PKT_LEN];
+    pthread_mutex_t mtx;                       /* 保护 hist 与 seq，补发线程读取 */
+} g_mcast = { .fd = -1, .seq = 0, .mtx = PTHREAD_MUTEX_INITIALIZER };
+
+/* UDP 接入：网关把一帧或多帧打包成一个数据报发来，无需 TCP 握手与连接状态 */
+static int g_udp_port = 0;
+static int g_udp_started = 0;                     /* 热升级时已接管 UDP socket */
+
+/* 统计查询：本地 Unix socket，连上后发 "stats" 返回文本报告 */
+static const char *g_stats_path = NULL;
+static const char *g_prom_spec = NULL;            /* Prometheus 指标端点 [ip:]port */
+
+/* 抓包：校验通过的原始帧连同到达时刻、连接编号追加到文件，供 capture_replay 回放 */
+static struct capture_writer g_capture = CAPTURE_WRITER_INIT;
+static uint32_t g_capture_conn = 0;               /* 连接编号，0 留给 UDP 接入 */
 
 /* 维护接收者连接列表，收到一帧就广播 */
 typedef struct {
     int fds[MAX_RECV_CLIENTS];
+    uint8_t masks[MAX_RECV_CLIENTS];   /* 订阅的 CMD 位图 */
+    struct metrics_conn *stats[MAX_RECV_CLIENTS];   /* 在广播锁内更新 */
     int count;
     pthread_mutex_t mtx;
 } recvr_set_t;
 
 static recvr_set_t g_recvers = {
-    .fds = {0}, .count = 0, .mtx = PTHREAD_MUTEX_INITIALIZER
+    .fds = {0}, .masks = {0}, .count = 0, .mtx = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* 上级连接：fd 供下推订阅使用，读帧在 upstream_thread 中 */
+static struct {
+    int fd;
+    int last_mask;                     /* 上次下推的位图，-1 表示尚未下推 */
+    pthread_mutex_t mtx;
+} g_upstream = { .fd = -1, .last_mask = -1, .mtx = PTHREAD_MUTEX_INITIALIZER };
+
+/* 发送端连接列表，仅用于热升级时交接；发送端个数不设上限，按需扩容 */
+typedef struct {
+    int *fds;
+    int count;
+    int cap;
+    pthread_mutex_t mtx;
+} sender_set_t;
+
+static sender_set_t g_senders = {
+    .fds = NULL, .count = 0, .cap = 0, .mtx = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* 连接线程计数与热升级停靠列表 */
+enum { CONN_SENDER = 1, CONN_RECVR = 2, CONN_UPSTREAM = 3, CONN_UDP = 4 };
+
+typedef struct {
+    int fd;
+    int role;
+} parked_conn_t;
+
+static struct {
+    int live;                                  /* 仍在运行的连接线程数 */
+    parked_conn_t *parked;                     /* 停靠列表，跟着连接数扩容 */
+    int nparked;
+    int cap;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+} g_threads = {
+    .live = 0, .parked = NULL, .nparked = 0, .cap = 0,
+    .mtx = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER
 };
 
+/* 追加到停靠列表，调用方持有 g_threads.mtx；扩容失败返回 -1 */
+static int park_append_locked(int fd, int role) {
+    if (g_threads.nparked == g_threads.cap) {
+        int cap = g_threads.cap ? g_threads.cap * 2 : 64;
+        parked_conn_t *p = (parked_conn_t *)realloc(g_threads.parked, sizeof(*p) * (size_t)cap);
+        if (p == NULL) return -1;
+        g_threads.parked = p;
+        g_threads.cap = cap;
+    }
+    g_threads.parked[g_threads.nparked].fd = fd;
+    g_threads.parked[g_threads.nparked].role = role;
+    g_threads.nparked++;
+    return 0;
+}
+
+static void set_cloexec(int fd, int on) {
+    int flags = fcntl(fd, F_GETFD);
+    if (flags < 0) return;
+    fcntl(fd, F_SETFD, on ? (flags | FD_CLOEXEC) : (flags & ~FD_CLOEXEC));
+}
+
 /*增加接收者*/
-static void add_receiver(int fd) {
+static int add_receiver(int fd, uint8_t mask) {
+    int ok = 0;
     pthread_mutex_lock(&g_recvers.mtx);
     if (g_recvers.count < MAX_RECV_CLIENTS) {
+        g_recvers.masks[g_recvers.count] = mask;
+        g_recvers.stats[g_recvers.count] = metrics_conn_open(fd, MCONN_RECVR);
         g_recvers.fds[g_recvers.count++] = fd;
         fprintf(stderr, "[server] receiver added, total=%d\n", g_recvers.count);
+        ok = 1;
     } else {
         fprintf(stderr, "[server] receiver full, closing\n");
-        close(fd);
     }
     pthread_mutex_unlock(&g_recvers.mtx);
+    return ok;
 }
 
+/* 只从列表摘除，不关闭 fd：fd 由所属的 receiver_thread 负责关闭 */
 static void remove_receiver_nolock(int idx) {
-    int fd = g_recvers.fds[idx];
-    if (fd >= 0) close(fd);
+    metrics_conn_close(g_recvers.stats[idx]);
     g_recvers.fds[idx] = g_recvers.fds[g_recvers.count - 1];
+    g_recvers.masks[idx] = g_recvers.masks[g_recvers.count - 1];
+    g_recvers.stats[idx] = g_recvers.stats[g_recvers.count - 1];
     g_recvers.count--;
 }
 
-static void broadcast_frame(const uint8_t *frame) {
+/* 按 fd 摘除接收者；已被广播路径摘除时什么也不做 */
+static void remove_receiver(int fd) {
+    pthread_mutex_lock(&g_recvers.mtx);
+    for (int i = 0; i < g_recvers.count; ++i) {
+        if (g_recvers.fds[i] == fd) {
+            remove_receiver_nolock(i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_recvers.mtx);
+}
+
+/* 所有本地接收端订阅的并集 */
+static uint8_t receivers_mask_union(void) {
+    uint8_t m = 0;
+    pthread_mutex_lock(&g_recvers.mtx);
+    for (int i = 0; i < g_recvers.count; ++i) m |= g_recvers.masks[i];
+    pthread_mutex_unlock(&g_recvers.mtx);
+    return m;
+}
+
+static uint8_t receiver_mask(int fd) {
+    uint8_t m = SUB_ALL;
     pthread_mutex_lock(&g_recvers.mtx);
+    for (int i = 0; i < g_recvers.count; ++i) {
+        if (g_recvers.fds[i] == fd) { m = g_recvers.masks[i]; break; }
+    }
+    pthread_mutex_unlock(&g_recvers.mtx);
+    return m;
+}
+
+/* 订阅下推：本地并集变化时向上级发送订阅消息；force=1 用于新建的上级连接 */
+static void push_subscription(int force) {
+    if (!g_pushdown) return;
+    uint8_t m = receivers_mask_union();
+    pthread_mutex_lock(&g_upstream.mtx);
+    if (g_upstream.fd >= 0 && (force || g_upstream.last_mask != m)) {
+        uint8_t msg[2] = { SUB_HEADER, m };
+        if (send_all(g_upstream.fd, msg, sizeof(msg)) == (ssize_t)sizeof(msg)) {
+            g_upstream.last_mask = m;
+        }
+    }
+    pthread_mutex_unlock(&g_upstream.mtx);
+}
+
+static void set_receiver_mask(int fd, uint8_t mask) {
+    pthread_mutex_lock(&g_recvers.mtx);
+    for (int i = 0; i < g_recvers.count; ++i) {
+        if (g_recvers.fds[i] == fd) { g_recvers.masks[i] = mask; break; }
+    }
+    pthread_mutex_unlock(&g_recvers.mtx);
+    push_subscription(0);
+}
+
+static int add_sender(int fd) {
+    int ok = 0;
+    pthread_mutex_lock(&g_senders.mtx);
+    if (g_senders.count == g_senders.cap) {
+        int cap = g_senders.cap ? g_senders.cap * 2 : 64;
+        int *fds = (int *)realloc(g_senders.fds, sizeof(int) * (size_t)cap);
+        if (fds != NULL) {
+            g_senders.fds = fds;
+            g_senders.cap = cap;
+        }
+    }
+    if (g_senders.count < g_senders.cap) {
+        g_senders.fds[g_senders.count++] = fd;
+        ok = 1;
+    } else {
+        fprintf(stderr, "[server] sender set out of memory, closing\n");
+    }
+    pthread_mutex_unlock(&g_senders.mtx);
+    return ok;
+}
+
+static void remove_sender(int fd) {
+    pthread_mutex_lock(&g_senders.mtx);
+    for (int i = 0; i < g_senders.count; ++i) {
+        if (g_senders.fds[i] == fd) {
+            g_senders.fds[i] = g_senders.fds[g_senders.count - 1];
+            g_senders.count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_senders.mtx);
+}
+
+/* 解析 "ip:port" */
+static int parse_host_port(const char *s, char *ip, size_t iplen, int *port) {
+    const char *colon = strrchr(s, ':');
+    if (colon == NULL || (size_t)(colon - s) >= iplen) return -1;
+    memcpy(ip, s, (size_t)(colon - s));
+    ip[colon - s] = '\0';
+    *port = atoi(colon + 1);
+    return *port > 0 ? 0 : -1;
+}
+
+/* 组播发送一帧并保存到补发历史；在广播锁内调用 */
+static void mcast_send_frame(const uint8_t *frame) {
+    pthread_mutex_lock(&g_mcast.mtx);
+    uint64_t seq = ++g_mcast.seq;
+    uint8_t *pkt = g_mcast.hist[seq & (MCAST_HISTORY - 1)];
+    pkt[0] = 'M'; pkt[1] = 'C'; pkt[2] = MCAST_VERSION; pkt[3] = g_server_id;
+    put_be32(pkt + MCAST_EPOCH_OFF, g_mcast.epoch);
+    put_be64(pkt + MCAST_SEQ_OFF, seq);
+    memcpy(pkt + MCAST_HDR_LEN, frame, FRAME_LEN);
+    pthread_mutex_unlock(&g_mcast.mtx);
+
+    /* UDP 发送不会阻塞在慢接收端上；失败只记日志，接收端靠补发恢复 */
+    if (sendto(g_mcast.fd, pkt, MCAST_PKT_LEN, 0,
+               (struct sockaddr*)&g_mcast.group, sizeof(g_mcast.group)) != MCAST_PKT_LEN) {
+        perror("[server] multicast sendto");
+    }
+}
+
+static int mcast_open(const char *spec, int ttl) {
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    if (parse_host_port(spec, ip, sizeof(ip), &port) != 0) return -1;
+
+    memset(&g_mcast.group, 0, sizeof(g_mcast.group));
+    g_mcast.group.sin_family = AF_INET;
+    g_mcast.group.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, ip, &g_mcast.group.sin_addr) != 1) return -1;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    set_cloexec(fd, 1);
+    unsigned char t = (unsigned char)ttl;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof(t));
+    g_mcast.fd = fd;
+
+    /* 热升级：旧进程通过环境变量传来序号和纪元，接收端看到的序号保持连续 */
+    const char *seq = getenv(MCAST_SEQ_ENV);
+    if (seq != NULL) {
+        g_mcast.seq = strtoull(seq, NULL, 10);
+        unsetenv(MCAST_SEQ_ENV);
+    }
+    const char *epoch = getenv(MCAST_EPOCH_ENV);
+    if (epoch != NULL) {
+        g_mcast.epoch = (uint32_t)strtoul(epoch, NULL, 10);
+        unsetenv(MCAST_EPOCH_ENV);
+    }
+    if (g_mcast.epoch == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        g_mcast.epoch = (uint32_t)ts.tv_sec * 2654435761u ^ (uint32_t)ts.tv_nsec ^ ((uint32_t)getpid() << 16);
+        if (g_mcast.epoch == 0) g_mcast.epoch = 1;
+    }
+    return 0;
+}
+
+/* 在广播锁内调用 */
+static void broadcast_frame_nolock(const uint8_t *frame) {
+    /* 广播锁保证环形缓冲区只有一个写者 */
+    if (g_ring.hdr != NULL) frame_ring_publish(&g_ring, frame);
+    if (g_mcast.fd >= 0) mcast_send_frame(frame);
+    uint8_t bit = CMD_BIT(frame[1]);
+    uint64_t out = 0;
+    if (frame[1] >= CMD_BME280 && frame[1] <= CMD_GPS) metrics_add(MET_TYPE_BASE + frame[1] - 1, 1);
     for (int i = 0; i < g_recvers.count; ) {
+        if (!(g_recvers.masks[i] & bit)) { ++i; continue; }
         if (send_all(g_recvers.fds[i], frame, FRAME_LEN) != FRAME_LEN) {
             fprintf(stderr, "[server] send to receiver failed, removing\n");
+            metrics_add(MET_SEND_FAIL, 1);
+            /* 唤醒对应的 receiver_thread，由它关闭 fd，避免重复 close */
+            shutdown(g_recvers.fds[i], SHUT_RDWR);
             remove_receiver_nolock(i);
             continue; // do not i++
         }
+        metrics_conn_add(g_recvers.stats[i], 1, FRAME_LEN);
+        ++out;
         ++i;
     }
+    metrics_add(MET_FRAMES_OUT, out);
+    metrics_add(MET_BYTES_OUT, out * FRAME_LEN);
+}
+
+/* 一批连续存放的帧只取一次广播锁，帧间顺序不变；
+   t_in 为帧完整读入的时刻，用于入口到发出的延迟统计 */
+static void broadcast_batch(const uint8_t *frames, int n, uint64_t t_in) {
+    if (n <= 0) return;
+    pthread_mutex_lock(&g_recvers.mtx);
+    uint64_t t_lock = metrics_now_ns();
+    for (int i = 0; i < n; ++i) broadcast_frame_nolock(frames + (size_t)i * FRAME_LEN);
+    uint64_t t_done = metrics_now_ns();
     pthread_mutex_unlock(&g_recvers.mtx);
+    if (g_trace.every) {
+        for (int i = 0; i < n; ++i) {
+            trace_span(TRACE_SERVER_BROADCAST, trace_sampled(frames + (size_t)i * FRAME_LEN), t_in, t_done);
+        }
+    }
+
+    metrics_add(MET_BROADCASTS, (uint64_t)n);
+    metrics_add(MET_LOCK_ACQ, 1);
+    metrics_record(HIST_LOCK_HOLD, t_done - t_lock, 1);
+    metrics_record(HIST_INGEST_TO_SEND, t_done - t_in, (uint64_t)n);
+}
+
+static void broadcast_frame(const uint8_t *frame, uint64_t t_in) {
+    broadcast_batch(frame, 1, t_in);
+}
+
+static int spawn_conn_thread(int fd, int role);
+
+/* 连接线程退出：parked=1 表示 fd 留给热升级交接，不关闭；停靠列表扩容失败时按未停靠处理。
+   升级已经放弃（resume_parked 在锁内清了 g_upgrading、取走了列表）时不再停靠，另起线程接着服务 */
+static void thread_leave(int fd, int role, int parked) {
+    int drop = 0, resume = 0;
+    pthread_mutex_lock(&g_threads.mtx);
+    if (parked && !g_upgrading) {
+        resume = 1;
+    } else if (parked && park_append_locked(fd, role) != 0) {
+        drop = 1;
+    }
+    pthread_mutex_unlock(&g_threads.mtx);
+    if (resume && spawn_conn_thread(fd, role) != 0) {
+        perror("[server] pthread_create");
+        drop = 1;
+    }
+    if (drop) {
+        /* 不在持有 g_threads.mtx 时去拿发送端、接收端表的锁 */
+        fprintf(stderr, "[server] 无法停靠或恢复，关闭 fd %d（角色 %d）\n", fd, role);
+        if (role == CONN_SENDER) remove_sender(fd);
+        else if (role == CONN_RECVR) remove_receiver(fd);
+        close(fd);
+    }
+    pthread_mutex_lock(&g_threads.mtx);
+    g_threads.live--;
+    pthread_cond_broadcast(&g_threads.cond);
+    pthread_mutex_unlock(&g_threads.mtx);
+}
+
+/* 等待 fd 可读；返回 1 可读，0 超时（用于检查标志），-1 出错 */
+static int wait_readable(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int n = poll(&pfd, 1, POLL_INTERVAL_MS);
+    if (n < 0) return (errno == EINTR) ? 0 : -1;
+    return n > 0 ? 1 : 0;
 }
 
 /* 发送端线程：不断收 FRAME_LEN，然后广播给所有接收端 */
@@ -69,21 +424,48 @@ static void *sender_thread(void *arg) {
     free(arg);
 
     uint8_t frame[FRAME_LEN];
+    int parked = 0;
+    metrics_thread_init();
+    struct metrics_conn *mc = metrics_conn_open(conn_fd, MCONN_SENDER);
+    uint32_t cap_conn = __atomic_add_fetch(&g_capture_conn, 1, __ATOMIC_RELAXED);
     while (g_running) {
+        /* 只在帧边界停靠，交给新进程的字节流保持对齐 */
+        if (g_upgrading) { parked = 1; break; }
+        int rd = wait_readable(conn_fd);
+        if (rd == 0) continue;
+        if (rd < 0) break;
+
         // 数据解析函数 解析收到的数据的类型
+        uint64_t t_rd = trace_clock();
         int L_r = LORA_ReadAndRarse(conn_fd,frame);
             if(L_r < 0){
+                metrics_add(MET_BAD_FRAMES, 1);
+                metrics_conn_error(mc, 1);
                 continue;
             }
             if (L_r == 0){
                 break;
             }
-        broadcast_frame(frame);
+        uint64_t t_in = metrics_now_ns();
+        trace_span(TRACE_SERVER_INGEST, trace_sampled(frame), t_rd, t_in);
+        capture_frame(&g_capture, t_in, cap_conn, frame);
+        metrics_add(MET_FRAMES_IN, 1);
+        metrics_add(MET_BYTES_IN, FRAME_LEN);
+        metrics_conn_add(mc, 1, FRAME_LEN);
+        /* 本服务器是该帧进入中继树的入口 */
+        frame[FRAME_ORIGIN_OFF] = g_server_id;
+        frame[FRAME_HOPS_OFF] = 0;
+        broadcast_frame(frame, t_in);
     }
+    metrics_conn_close(mc);
+    metrics_thread_exit();
     //fprintf(stderr, "[server] broadcast frame: "); print_hex(frame, FRAME_LEN); fprintf(stderr, "\n");
 
-    
-    close(conn_fd);
+    if (!parked) {
+        remove_sender(conn_fd);
+        close(conn_fd);
+    }
+    thread_leave(conn_fd, CONN_SENDER, parked);
     return NULL;
 }
 
@@ -93,9 +475,16 @@ static void *receiver_thread(void *arg) {
     int conn_fd = *(int*)arg;
     free(arg);
     uint8_t buf[8];  // 用于接收数据
+    int parked = 0;
+    int sub_pending = 0;   /* 已收到 SUB_HEADER，等待位图字节 */
 
-    /* 这里可阻塞读一些字节用于探活；简单起见只睡眠等待，被广播路径写数据 */
+    /* 阻塞等待可读用于探活；数据由广播路径写；对端关闭或广播失败 shutdown 后 recv 返回 0 */
     while (g_running) {
+        if (g_upgrading) { parked = 1; break; }
+        int rd = wait_readable(conn_fd);
+        if (rd == 0) continue;
+        if (rd < 0) break;
+
         ssize_t r = recv(conn_fd, buf, sizeof(buf), 0);  // 尝试接收数据
         if (r == 0) {
             // 如果接收到 0，表示对端关闭连接
@@ -103,60 +492,891 @@ static void *receiver_thread(void *arg) {
             break;  // 断开连接，退出线程
         } 
         else if (r < 0) {
-            // 如果发生错误，则检查是否是连接中断
-            if (errno == EPIPE || errno == ECONNRESET) {
-                fprintf(stderr, "[server] connection reset by receiver\n");
-                break;  // 连接断开，退出线程
+            if (errno == EINTR || errno == EAGAIN) continue;
+            fprintf(stderr, "[server] connection reset by receiver\n");
+            break;  // 连接断开，退出线程
+        }
+
+        /* 接收端唯一会发来的是订阅消息，其他字节忽略 */
+        for (ssize_t i = 0; i < r; ++i) {
+            if (sub_pending) {
+                set_receiver_mask(conn_fd, buf[i] & SUB_ALL);
+                sub_pending = 0;
+            } else if (buf[i] == SUB_HEADER) {
+                sub_pending = 1;
             }
-            //perror("recv");
-            continue;  // 继续检查连接
-        /* 简单 sleep，实际 IO 由广播写；当对端关闭时，send 会失败并移除 */
         }
-    sleep(1);
     }
 
     // 退出前移除接收端
-    remove_receiver_nolock(conn_fd);
-    close(conn_fd);
+    if (!parked) {
+        remove_receiver(conn_fd);
+        close(conn_fd);
+        push_subscription(0);
+    }
+    thread_leave(conn_fd, CONN_RECVR, parked);
+    return NULL;
+}
+
+static int connect_upstream(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) { perror("[server] upstream socket"); return -1; }
+    set_cloexec(fd, 1);
+
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)g_upstream_port);
+    if (inet_pton(AF_INET, g_upstream_ip, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        send_all(fd, ROLE_RECVR, ROLE_LEN) != ROLE_LEN) {
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "[server] relay connected to upstream %s:%d\n", g_upstream_ip, g_upstream_port);
+    return fd;
+}
+
+/* 转发上级来的帧：带本服务器 ID 的帧说明出现了环路，超过跳数上限的也丢弃 */
+static void relay_frame(uint8_t *frame, uint64_t t_in) {
+    if (frame[FRAME_ORIGIN_OFF] == g_server_id) return;
+    if (frame[FRAME_HOPS_OFF] >= RELAY_MAX_HOPS) return;
+    frame[FRAME_HOPS_OFF]++;
+    broadcast_frame(frame, t_in);
+}
+
+static void set_upstream_fd(int fd) {
+    pthread_mutex_lock(&g_upstream.mtx);
+    g_upstream.fd = fd;
+    g_upstream.last_mask = -1;
+    pthread_mutex_unlock(&g_upstream.mtx);
+}
+
+/* 上级连接线程：断线 5 秒后重连；fd=-1 表示需要新建连接 */
+static void *upstream_thread(void *arg) {
+    int fd = *(int*)arg;
+    free(arg);
+
+    uint8_t frame[FRAME_LEN];
+    int parked = 0;
+    metrics_thread_init();
+    while (g_running && !parked) {
+        if (fd < 0) fd = connect_upstream();
+        if (fd < 0) {
+            for (int i = 0; i < 5000 / POLL_INTERVAL_MS && g_running; ++i) {
+                if (g_upgrading) { parked = 1; break; }
+                poll(NULL, 0, POLL_INTERVAL_MS);
+            }
+            continue;
+        }
+
+        set_upstream_fd(fd);
+        push_subscription(1);
+        struct metrics_conn *mc = metrics_conn_open(fd, MCONN_UPSTREAM);
+        uint32_t cap_conn = __atomic_add_fetch(&g_capture_conn, 1, __ATOMIC_RELAXED);
+        while (g_running) {
+            if (g_upgrading) { parked = 1; break; }
+            int rd = wait_readable(fd);
+            if (rd == 0) continue;
+            if (rd < 0) break;
+            uint64_t t_rd = trace_clock();
+            int L_r = LORA_ReadAndRarse(fd, frame);
+            if (L_r < 0) { metrics_add(MET_BAD_FRAMES, 1); metrics_conn_error(mc, 1); continue; }
+            if (L_r == 0) break;
+            uint64_t t_in = metrics_now_ns();
+            trace_span(TRACE_SERVER_INGEST, trace_sampled(frame), t_rd, t_in);
+            capture_frame(&g_capture, t_in, cap_conn, frame);
+            metrics_add(MET_FRAMES_IN, 1);
+            metrics_add(MET_BYTES_IN, FRAME_LEN);
+            metrics_conn_add(mc, 1, FRAME_LEN);
+            relay_frame(frame, t_in);
+        }
+        metrics_conn_close(mc);
+        if (!parked) {
+            fprintf(stderr, "[server] upstream disconnected, retrying in 5s\n");
+            set_upstream_fd(-1);
+            close(fd);
+            fd = -1;
+        }
+    }
+    metrics_thread_exit();
+    thread_leave(fd, CONN_UPSTREAM, parked);
+    return NULL;
+}
+
+static int udp_open(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    set_cloexec(fd, 1);
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    int rcvbuf = UDP_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    return fd;
+}
+
+/* UDP 接入线程：每次 recvmmsg 取一批数据报，数据报内按 FRAME_LEN 切帧校验，
+   整批校验通过的帧一次性广播。错误帧只计数不打印，避免被坏网关刷屏，
+   可通过统计接口查看 */
+static void *udp_thread(void *arg) {
+    int fd = *(int*)arg;
+    free(arg);
+
+    /* 只有一个 UDP 线程，缓冲区放静态区 */
+    static uint8_t bufs[UDP_BATCH][UDP_DGRAM_MAX];
+    static uint8_t frames[UDP_BATCH * (UDP_DGRAM_MAX / FRAME_LEN)][FRAME_LEN];
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    int parked = 0;
+    metrics_thread_init();
+    struct metrics_conn *mc = metrics_conn_open(fd, MCONN_UDP);
+
+    while (g_running) {
+        /* 数据报天然有边界，随时可以停靠 */
+        if (g_upgrading) { parked = 1; break; }
+        int rd = wait_readable(fd);
+        if (rd == 0) continue;
+        if (rd < 0) break;
+
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < UDP_BATCH; ++i) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = UDP_DGRAM_MAX;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            perror("[server] recvmmsg");
+            break;
+        }
+        uint64_t t_in = metrics_now_ns();
+
+        int nf = 0;
+        uint64_t bad = 0;
+        for (int i = 0; i < n; ++i) {
+            unsigned int len = msgs[i].msg_len;
+            /* 被截断或不是整帧的数据报整个丢弃 */
+            if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || len == 0 || len % FRAME_LEN != 0) {
+                bad += (len + FRAME_LEN - 1) / FRAME_LEN;
+                continue;
+            }
+            for (unsigned int off = 0; off < len; off += FRAME_LEN) {
+                uint8_t *frame = frames[nf];
+                memcpy(frame, bufs[i] + off, FRAME_LEN);
+                if (LORA_ParseFrame(frame) <= 0) { bad++; continue; }
+                uint32_t id = trace_sampled(frame);
+                if (id) trace_span(TRACE_SERVER_INGEST, id, t_in, trace_now_ns());
+                capture_frame(&g_capture, t_in, 0, frame);
+                frame[FRAME_ORIGIN_OFF] = g_server_id;
+                frame[FRAME_HOPS_OFF] = 0;
+                nf++;
+            }
+        }
+        metrics_add(MET_FRAMES_IN, (uint64_t)nf);
+        metrics_add(MET_BYTES_IN, (uint64_t)nf * FRAME_LEN);
+        metrics_add(MET_BAD_FRAMES, bad);
+        metrics_conn_add(mc, (uint64_t)nf, (uint64_t)nf * FRAME_LEN);
+        if (bad > 0) metrics_conn_error(mc, bad);
+        broadcast_batch(frames[0], nf, t_in);
+    }
+
+    metrics_conn_close(mc);
+    metrics_thread_exit();
+    if (!parked) close(fd);
+    thread_leave(fd, CONN_UDP, parked);
+    return NULL;
+}
+
+/* 补发连接：按请求把仍保留的组播包经 TCP 发回，最后发一个序号为 0 的结束包 */
+static void *repair_thread(void *arg) {
+    int fd = *(int*)arg;
+    free(arg);
+
+    uint8_t req[MCAST_REQ_LEN];
+    uint8_t out[64][MCAST_PKT_LEN];
+    for (;;) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, REPAIR_IDLE_MS) <= 0) break;
+        if (read_n(fd, req, sizeof(req)) != (ssize_t)sizeof(req)) break;
+
+        uint64_t from = get_be64(req);
+        uint32_t count = ((uint32_t)req[8] << 24) | ((uint32_t)req[9] << 16) |
+                         ((uint32_t)req[10] << 8) | req[11];
+        pthread_mutex_lock(&g_mcast.mtx);
+        uint64_t last = g_mcast.seq;
+        pthread_mutex_unlock(&g_mcast.mtx);
+        uint64_t oldest = last > MCAST_HISTORY ? last - MCAST_HISTORY + 1 : 1;
+        if (from == 0) { from = oldest; count = MCAST_HISTORY; }   /* 快照 */
+        if (from < oldest) from = oldest;
+        uint64_t to = from + count;   /* 不含 */
+        if (to > last + 1) to = last + 1;
+
+        int ok = 1;
+        while (ok && from < to) {
+            int n = 0;
+            pthread_mutex_lock(&g_mcast.mtx);
+            for (; from < to && n < 64; ++from) {
+                const uint8_t *pkt = g_mcast.hist[from & (MCAST_HISTORY - 1)];
+                if (get_be64(pkt + MCAST_SEQ_OFF) != from) continue;   /* 已被覆盖 */
+                memcpy(out[n++], pkt, MCAST_PKT_LEN);
+            }
+            pthread_mutex_unlock(&g_mcast.mtx);
+            if (n > 0 && send_all(fd, out, (size_t)n * MCAST_PKT_LEN) != (ssize_t)n * MCAST_PKT_LEN) ok = 0;
+        }
+        memset(out[0], 0, MCAST_PKT_LEN);
+        out[0][0] = 'M'; out[0][1] = 'C'; out[0][2] = MCAST_VERSION; out[0][3] = g_server_id;
+        put_be32(out[0] + MCAST_EPOCH_OFF, g_mcast.epoch);
+        if (!ok || send_all(fd, out[0], MCAST_PKT_LEN) != MCAST_PKT_LEN) break;
+    }
+    close(fd);
     return NULL;
 }
 
+/* ================== 统计查询 ================== */
+
+/* 生成文本报告：全局计数、延迟分位数、每个连接的帧数/字节数/速率/内核队列深度 */
+static size_t format_stats(char *buf, size_t cap) {
+    static struct metrics_snapshot snap;   /* 只在统计线程中使用 */
+    metrics_collect(&snap);
+    double up = snap.uptime_ns / 1e9;
+    size_t len = 0;
+
+    len = buf_appendf(buf, cap, len, "server_id %u\nuptime_s %.3f\n", g_server_id, up);
+    for (int k = 0; k < MET_COUNTERS; ++k) {
+        len = buf_appendf(buf, cap, len, "%s %llu\n", metrics_counter_names[k],
+                           (unsigned long long)snap.c[k]);
+    }
+    len = buf_appendf(buf, cap, len, "frames_in_per_s %.1f\n", up > 0 ? snap.c[MET_FRAMES_IN] / up : 0.0);
+    len = buf_appendf(buf, cap, len, "receivers %d\nsenders %d\n", __atomic_load_n(&g_recvers.count, __ATOMIC_RELAXED),
+                      __atomic_load_n(&g_senders.count, __ATOMIC_RELAXED));
+    for (int k = 0; k < HIST_COUNT; ++k) {
+        const uint64_t *h = snap.h[k];
+        len = buf_appendf(buf, cap, len, "%s count=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+                           metrics_hist_names[k], (unsigned long long)hist_total(h),
+                           (unsigned long long)hist_quantile(h, 0.50), (unsigned long long)hist_quantile(h, 0.90),
+                           (unsigned long long)hist_quantile(h, 0.99), (unsigned long long)hist_quantile(h, 0.999),
+                           (unsigned long long)hist_quantile(h, 1.0));
+    }
+
+    len = buf_appendf(buf, cap, len, "# role fd peer frames bytes errors avg_fps recent_fps queue_bytes\n");
+    uint64_t now = metrics_now_ns();
+    pthread_mutex_lock(&g_metrics.mtx);
+    for (int i = 0; i < METRICS_CONN_SLOTS; ++i) {
+        struct metrics_conn *mc = &g_metrics.conns[i];
+        if (mc->role == 0) continue;
+        uint64_t frames = __atomic_load_n(&mc->frames, __ATOMIC_RELAXED);
+        double age = (now - mc->opened_ns) / 1e9;
+        double win = (now - mc->last_ns) / 1e9;
+        double recent = win > 0 ? (frames - mc->last_frames) / win : 0.0;
+        mc->last_frames = frames;
+        mc->last_ns = now;
+        /* 接收端看待发送的字节，发送端/上级/UDP 看待读取的字节 */
+        int q = 0;
+        if (ioctl(mc->fd, mc->role == MCONN_RECVR ? SIOCOUTQ : SIOCINQ, &q) != 0) q = -1;
+        len = buf_appendf(buf, cap, len, "%s %d %s %llu %llu %llu %.1f %.1f %d\n",
+                           metrics_role_name(mc->role), mc->fd, mc->peer, (unsigned long long)frames,
+                           (unsigned long long)__atomic_load_n(&mc->bytes, __ATOMIC_RELAXED),
+                           (unsigned long long)__atomic_load_n(&mc->errors, __ATOMIC_RELAXED),
+                           age > 0 ? frames / age : 0.0, recent, q);
+    }
+    pthread_mutex_unlock(&g_metrics.mtx);
+    return len;
+}
+
+static int stats_open(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    set_cloexec(fd, 1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    /* 热升级的新进程直接顶替旧进程的 socket 文件 */
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Prometheus 文本格式；与 format_stats 读同一批计数 */
+static size_t render_prometheus(char *buf, size_t cap) {
+    static struct metrics_snapshot snap;   /* 只在指标端点线程中使用 */
+    metrics_collect(&snap);
+    size_t len = 0;
+
+    for (int k = 0; k < MET_TYPE_BASE; ++k) {
+        len = buf_appendf(buf, cap, len, "# TYPE mmm_server_%s_total counter\nmmm_server_%s_total %llu\n",
+                          metrics_counter_names[k], metrics_counter_names[k], (unsigned long long)snap.c[k]);
+    }
+    len = buf_appendf(buf, cap, len, "# TYPE mmm_server_frames_by_type_total counter\n");
+    for (int k = MET_TYPE_BASE; k <= MET_TYPE_LAST; ++k) {
+        len = buf_appendf(buf, cap, len, "mmm_server_frames_by_type_total{type=\"%s\"} %llu\n",
+                          metrics_counter_names[k] + strlen("frames_"), (unsigned long long)snap.c[k]);
+    }
+    for (int k = 0; k < HIST_COUNT; ++k) {
+        /* 名字以 _ns 结尾，按 Prometheus 惯例换算成秒 */
+        int nl = (int)strlen(metrics_hist_names[k]) - 3;
+        const char *nm = metrics_hist_names[k];
+        len = buf_appendf(buf, cap, len, "# TYPE mmm_server_%.*s_seconds summary\n", nl, nm);
+        static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+        for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); ++i) {
+            len = buf_appendf(buf, cap, len, "mmm_server_%.*s_seconds{quantile=\"%g\"} %.9f\n",
+                              nl, nm, qs[i], hist_quantile(snap.h[k], qs[i]) / 1e9);
+        }
+        len = buf_appendf(buf, cap, len, "mmm_server_%.*s_seconds_sum %.9f\nmmm_server_%.*s_seconds_count %llu\n",
+                          nl, nm, snap.sum[k] / 1e9, nl, nm, (unsigned long long)hist_total(snap.h[k]));
+    }
+    len = buf_appendf(buf, cap, len,
+                      "# TYPE mmm_server_receivers gauge\nmmm_server_receivers %d\n"
+                      "# TYPE mmm_server_senders gauge\nmmm_server_senders %d\n"
+                      "# TYPE mmm_server_uptime_seconds gauge\nmmm_server_uptime_seconds %.3f\n",
+                      __atomic_load_n(&g_recvers.count, __ATOMIC_RELAXED),
+                      __atomic_load_n(&g_senders.count, __ATOMIC_RELAXED), snap.uptime_ns / 1e9);
+
+    static const char *const conn_fields[] = { "frames", "bytes", "errors" };
+    pthread_mutex_lock(&g_metrics.mtx);
+    for (int f = 0; f < 3; ++f) {
+        len = buf_appendf(buf, cap, len, "# TYPE mmm_server_conn_%s_total counter\n", conn_fields[f]);
+        for (int i = 0; i < METRICS_CONN_SLOTS; ++i) {
+            const struct metrics_conn *mc = &g_metrics.conns[i];
+            if (mc->role == 0) continue;
+            const uint64_t *v = (f == 0) ? &mc->frames : (f == 1) ? &mc->bytes : &mc->errors;
+            len = buf_appendf(buf, cap, len, "mmm_server_conn_%s_total{role=\"%s\",fd=\"%d\",peer=\"%s\"} %llu\n",
+                              conn_fields[f], metrics_role_name(mc->role), mc->fd, mc->peer,
+                              (unsigned long long)__atomic_load_n(v, __ATOMIC_RELAXED));
+        }
+    }
+    pthread_mutex_unlock(&g_metrics.mtx);
+    return len;
+}
+
+/* 统计线程：每个连接读一行命令，回复后关闭。只读取计数，不取广播锁 */
+static void *stats_thread(void *arg) {
+    int lfd = *(int*)arg;
+    free(arg);
+    char *out = (char*)malloc(STATS_BUF_SIZE);
+    if (out == NULL) { close(lfd); return NULL; }
+
+    while (g_running) {
+        if (wait_readable(lfd) <= 0) continue;
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+
+        char cmd[64] = {0};
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) == 1) {
+            ssize_t r = recv(fd, cmd, sizeof(cmd) - 1, 0);
+            if (r < 0) r = 0;
+            cmd[r] = '\0';
+        }
+        cmd[strcspn(cmd, "\r\n")] = '\0';
+
+        size_t len;
+        if (cmd[0] == '\0' || strcmp(cmd, "stats") == 0) {
+            len = format_stats(out, STATS_BUF_SIZE);
+        } else {
+            len = (size_t)snprintf(out, STATS_BUF_SIZE, "unknown command '%s', try: stats\n", cmd);
+        }
+        send_all(fd, out, len);
+        close(fd);
+    }
+    free(out);
+    close(lfd);
+    return NULL;
+}
+
+/* 为一个已登记的连接创建处理线程 */
+static int spawn_conn_thread(int fd, int role) {
+    int *pfd = (int*)malloc(sizeof(int));
+    if (pfd == NULL) return -1;
+    *pfd = fd;
+
+    pthread_mutex_lock(&g_threads.mtx);
+    g_threads.live++;
+    pthread_mutex_unlock(&g_threads.mtx);
+
+    void *(*fn)(void *) = (role == CONN_SENDER) ? sender_thread :
+                          (role == CONN_RECVR)  ? receiver_thread :
+                          (role == CONN_UDP)    ? udp_thread : upstream_thread;
+    pthread_t th;
+    if (pthread_create(&th, NULL, fn, pfd) != 0) {
+        free(pfd);
+        pthread_mutex_lock(&g_threads.mtx);
+        g_threads.live--;
+        pthread_mutex_unlock(&g_threads.mtx);
+        return -1;
+    }
+    pthread_detach(th);
+    return 0;
+}
+
+/* 登记连接并启动线程；失败时关闭 fd */
+static void start_conn(int fd, int role) {
+    int ok = (role == CONN_SENDER) ? add_sender(fd) : add_receiver(fd, SUB_ALL);
+    if (!ok) { close(fd); return; }
+    if (spawn_conn_thread(fd, role) != 0) {
+        perror("[server] pthread_create");
+        if (role == CONN_SENDER) remove_sender(fd); else remove_receiver(fd);
+        close(fd);
+        return;
+    }
+    if (role == CONN_RECVR) push_subscription(0);
+}
+
+/* ================== 热升级 ==================
+ * SIGUSR2 触发：所有连接线程在帧边界停靠，fork+exec 新的程序文件，
+ * 通过 Unix socket 用 SCM_RIGHTS 把监听 socket 和全部已建立连接交给新进程，
+ * 新进程确认接管后旧进程退出。停靠期间到达的数据留在内核 socket 缓冲区，不会丢。
+ * 新进程启动失败或超时未确认时，旧进程恢复所有连接线程继续服务。
+ */
+enum { UPG_LISTEN = 1, UPG_SENDER = 2, UPG_RECVR = 3, UPG_END = 4, UPG_UPSTREAM = 5, UPG_UDP = 6 };
+
+/* 交接记录：每条随 SCM_RIGHTS 携带一个 fd（UPG_END 除外） */
+typedef struct {
+    uint8_t kind;
+    uint8_t sub_mask;      /* UPG_RECVR：订阅位图 */
+    uint8_t server_id;     /* UPG_LISTEN：沿用旧进程的服务器 ID，防环判断不受升级影响 */
+    uint8_t reserved[5];
+} upgrade_rec_t;
+
+static const uint8_t UPGRADE_ACK = 0x5A;
+
+static int send_upgrade_rec(int sock, const upgrade_rec_t *rec, int fd) {
+    struct iovec iov = { .iov_base = (void*)rec, .iov_len = sizeof(*rec) };
+    union { struct cmsghdr h; char buf[CMSG_SPACE(sizeof(int))]; } ctrl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    for (;;) {
+        ssize_t w = sendmsg(sock, &msg, 0);
+        if (w == (ssize_t)sizeof(*rec)) return 0;
+        if (w < 0 && errno == EINTR) continue;
+        return -1;
+    }
+}
+
+/* 返回 0 成功，*fd 为收到的描述符（没有则为 -1）；-1 出错，包括控制消息被截断（描述符可能丢了） */
+static int recv_upgrade_rec(int sock, upgrade_rec_t *rec, int *fd) {
+    struct iovec iov = { .iov_base = rec, .iov_len = sizeof(*rec) };
+    union { struct cmsghdr h; char buf[CMSG_SPACE(sizeof(int))]; } ctrl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    ssize_t r;
+    do { r = recvmsg(sock, &msg, MSG_WAITALL); } while (r < 0 && errno == EINTR);
+    if (r != (ssize_t)sizeof(*rec)) return -1;
+
+    *fd = -1;
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c != NULL && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(c), sizeof(int));
+        set_cloexec(*fd, 1);
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        fprintf(stderr, "[server] upgrade record control message truncated\n");
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* 等待连接线程全部停靠；超时返回 -1 */
+static int wait_threads_parked(void) {
+    struct timespec dl;
+    clock_gettime(CLOCK_REALTIME, &dl);
+    dl.tv_sec += UPGRADE_TIMEOUT_MS / 1000;
+
+    int rc = 0;
+    pthread_mutex_lock(&g_threads.mtx);
+    while (g_threads.live > 0 && rc == 0) {
+        rc = pthread_cond_timedwait(&g_threads.cond, &g_threads.mtx, &dl);
+    }
+    int left = g_threads.live;
+    pthread_mutex_unlock(&g_threads.mtx);
+    return left == 0 ? 0 : -1;
+}
+
+/* 升级失败：重新为停靠的连接启动线程 */
+static void resume_parked(void) {
+    pthread_mutex_lock(&g_threads.mtx);
+    /* 在锁内清零：取走列表之后才停下的线程在 thread_leave 里看得到，不会停进已经没人管的列表 */
+    g_upgrading = 0;
+    parked_conn_t *list = g_threads.parked;
+    int n = g_threads.nparked;
+    g_threads.parked = NULL;
+    g_threads.nparked = g_threads.cap = 0;
+    pthread_mutex_unlock(&g_threads.mtx);
+
+    for (int i = 0; i < n; ++i) {
+        if (spawn_conn_thread(list[i].fd, list[i].role) != 0) {
+            if (list[i].role == CONN_SENDER) remove_sender(list[i].fd);
+            else if (list[i].role == CONN_RECVR) remove_receiver(list[i].fd);
+            if (list[i].fd >= 0) close(list[i].fd);
+        }
+    }
+    free(list);
+}
+
+/* 执行热升级；返回 1 表示已交接、当前进程应退出，0 表示失败并已恢复服务 */
+static int do_upgrade(int listen_fd, char **argv) {
+    fprintf(stderr, "[server] hot upgrade requested, parking connections\n");
+    g_upgrading = 1;
+    if (wait_threads_parked() != 0) {
+        fprintf(stderr, "[server] upgrade aborted: connections did not park in time\n");
+        /* 仍在运行的线程看到 g_upgrading=0 后继续服务，停靠的重新启动 */
+        resume_parked();
+        return 0;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("[server] socketpair");
+        resume_parked();
+        return 0;
+    }
+    set_cloexec(sv[0], 1);
+
+    /* 连接都已停靠，把抓包缓冲刷到文件，新进程接着追加 */
+    capture_sync(&g_capture);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("[server] fork");
+        close(sv[0]); close(sv[1]);
+        resume_parked();
+        return 0;
+    }
+    if (pid == 0) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", sv[1]);
+        setenv(UPGRADE_FD_ENV, buf, 1);
+        if (g_mcast.fd >= 0) {
+            char seq[24];
+            snprintf(seq, sizeof(seq), "%llu", (unsigned long long)g_mcast.seq);
+            setenv(MCAST_SEQ_ENV, seq, 1);
+            snprintf(seq, sizeof(seq), "%u", g_mcast.epoch);
+            setenv(MCAST_EPOCH_ENV, seq, 1);
+        }
+        execv(g_self_path, argv);
+        _exit(127);
+    }
+    close(sv[1]);
+
+    upgrade_rec_t rec;
+    int ok = 1;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = UPG_LISTEN;
+    rec.server_id = g_server_id;
+    if (send_upgrade_rec(sv[0], &rec, listen_fd) != 0) ok = 0;
+    rec.server_id = 0;
+
+    pthread_mutex_lock(&g_threads.mtx);
+    for (int i = 0; ok && i < g_threads.nparked; ++i) {
+        const parked_conn_t *pc = &g_threads.parked[i];
+        if (pc->fd < 0) continue;   /* 尚未连上的上级连接由新进程自行建立 */
+        rec.kind = (pc->role == CONN_SENDER) ? UPG_SENDER :
+                   (pc->role == CONN_RECVR)  ? UPG_RECVR :
+                   (pc->role == CONN_UDP)    ? UPG_UDP : UPG_UPSTREAM;
+        rec.sub_mask = (pc->role == CONN_RECVR) ? receiver_mask(pc->fd) : 0;
+        if (send_upgrade_rec(sv[0], &rec, pc->fd) != 0) ok = 0;
+    }
+    int n = g_threads.nparked;
+    pthread_mutex_unlock(&g_threads.mtx);
+
+    rec.kind = UPG_END;
+    if (ok && send_upgrade_rec(sv[0], &rec, -1) != 0) ok = 0;
+
+    /* 等待新进程确认已接管 */
+    uint8_t ack = 0;
+    if (ok) {
+        struct pollfd pfd = { .fd = sv[0], .events = POLLIN };
+        ok = poll(&pfd, 1, UPGRADE_TIMEOUT_MS) == 1 &&
+             read(sv[0], &ack, 1) == 1 && ack == UPGRADE_ACK;
+    }
+    close(sv[0]);
+
+    if (!ok) {
+        fprintf(stderr, "[server] upgrade failed, new process pid=%d did not take over\n", (int)pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        resume_parked();
+        return 0;
+    }
+    fprintf(stderr, "[server] handed %d connections to pid=%d, exiting\n", n, (int)pid);
+    return 1;
+}
+
+/* 新进程：从环境变量给出的 Unix socket 接管监听 socket 和连接；返回监听 fd，非升级启动返回 -1 */
+static int takeover_from_parent(void) {
+    const char *s = getenv(UPGRADE_FD_ENV);
+    if (s == NULL) return -1;
+    int sock = atoi(s);
+    unsetenv(UPGRADE_FD_ENV);
+
+    int listen_fd = -1;
+    upgrade_rec_t rec;
+    int fd;
+    /* 先全部登记再启动线程，避免发送端线程在接收者登记前广播而丢帧 */
+    pthread_mutex_lock(&g_threads.mtx);
+    g_threads.nparked = 0;
+    pthread_mutex_unlock(&g_threads.mtx);
+    int complete = 0;
+    while (recv_upgrade_rec(sock, &rec, &fd) == 0) {
+        if (rec.kind == UPG_END) { complete = 1; break; }
+        if (fd < 0) break;          /* 旧进程每条连接记录都带描述符，没有说明交接出了错 */
+        int role = 0, ok = 0;
+        switch (rec.kind) {
+        case UPG_LISTEN:
+            listen_fd = fd;
+            if (rec.server_id != 0) g_server_id = rec.server_id;
+            continue;
+        case UPG_SENDER:   role = CONN_SENDER;   ok = add_sender(fd);   break;
+        case UPG_RECVR:    role = CONN_RECVR;    ok = add_receiver(fd, rec.sub_mask); break;
+        case UPG_UPSTREAM: role = CONN_UPSTREAM; ok = (g_upstream_port != 0); break;
+        case UPG_UDP:      role = CONN_UDP;      ok = (g_udp_port != 0);      break;
+        default: break;
+        }
+        if (!ok) { close(fd); continue; }
+        pthread_mutex_lock(&g_threads.mtx);
+        int full = park_append_locked(fd, role) != 0;
+        pthread_mutex_unlock(&g_threads.mtx);
+        if (full) { close(fd); break; }
+    }
+    if (!complete) {
+        /* 连接不全：不确认、不接着服务，旧进程等不到确认会杀掉本进程并恢复自己的连接 */
+        fprintf(stderr, "[server] upgrade handoff broken, leaving connections to the old process\n");
+        for (int i = 0; i < g_threads.nparked; ++i) close(g_threads.parked[i].fd);
+        if (listen_fd >= 0) close(listen_fd);
+        close(sock);
+        _exit(1);
+    }
+    int nconn = g_threads.nparked;
+    for (int i = 0; i < nconn; ++i) {
+        if (g_threads.parked[i].role == CONN_UPSTREAM) g_upstream_started = 1;
+        if (g_threads.parked[i].role == CONN_UDP) g_udp_started = 1;
+    }
+    resume_parked();
+
+    if (listen_fd >= 0) {
+        if (write(sock, &UPGRADE_ACK, 1) != 1) perror("[server] upgrade ack");
+        fprintf(stderr, "[server] took over listener and %d connections\n", nconn);
+    } else {
+        fprintf(stderr, "[server] upgrade handoff incomplete, no listener\n");
+    }
+    close(sock);
+    return listen_fd;
+}
+
+/* 记录自身程序路径；程序文件被替换后 /proc/self/exe 带 " (deleted)" 后缀 */
+static void init_self_path(const char *argv0) {
+    ssize_t n = readlink("/proc/self/exe", g_self_path, sizeof(g_self_path) - 1);
+    if (n <= 0) {
+        snprintf(g_self_path, sizeof(g_self_path), "%s", argv0);
+        return;
+    }
+    g_self_path[n] = '\0';
+    const char *suffix = " (deleted)";
+    size_t sl = strlen(suffix);
+    if ((size_t)n > sl && strcmp(g_self_path + n - sl, suffix) == 0) {
+        g_self_path[n - sl] = '\0';
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-u 上级IP:端口] [-i 服务器ID(1-255)] [-P] [-m 共享内存名 [-M 槽位数]]\n"
+                    "          [-g 组播地址:端口 [-t TTL]] [-U UDP端口] [-S 统计socket路径] [-H [IP:]端口]\n"
+                    "          [-C 抓包文件] [port]\n"
+                    "  -u  中继模式，作为接收端连接上级服务器并转发给本地接收端\n"
+                    "  -i  中继防环用的服务器 ID，默认随机\n"
+                    "  -P  把本地接收端订阅的并集下推给上级\n"
+                    "  -m  同时把帧发布到 POSIX 共享内存环形缓冲区（如 %s）\n"
+                    "  -M  环形缓冲区槽位数，2 的幂，默认 %d\n"
+                    "  -g  每帧额外向组播组发送一次，缺口经本端口 ROLE_REPAIR 连接补发\n"
+                    "  -t  组播 TTL，默认 1（仅本网段）\n"
+                    "  -U  开启 UDP 接入，每个数据报含一帧或多帧（各 %d 字节）\n"
+                    "  -S  在该 Unix socket 上提供统计查询，如 echo stats | nc -U /tmp/mmm.sock\n"
+                    "  -H  在该端口提供 Prometheus 指标，GET /metrics\n"
+                    "  -C  把收到的帧连同到达时刻、连接编号追加到抓包文件，用 capture_replay 回放\n",
+            prog, FRAME_RING_DEFAULT_NAME, FRAME_RING_DEFAULT_SLOTS, FRAME_LEN);
+}
+
 static void on_signal(int sig) {
     (void)sig;
     g_running = 0;
 }
 
+static void on_upgrade_signal(int sig) {
+    (void)sig;
+    g_upgrade_req = 1;
+}
+
 int main(int argc, char **argv) {
     signal(SIGINT, on_signal);
     signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_upgrade_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+
+    init_self_path(argv[0]);
+    metrics_init();
+    trace_init("server");
+
+    int opt_c;
+    const char *mcast_spec = NULL;
+    const char *capture_path = NULL;
+    int mcast_ttl = 1;
+    while ((opt_c = getopt(argc, argv, "u:i:Pm:M:g:t:U:S:H:C:h")) != -1) {
+        switch (opt_c) {
+        case 'u':
+            if (parse_host_port(optarg, g_upstream_ip, sizeof(g_upstream_ip), &g_upstream_port) != 0) {
+                usage(argv[0]); return 1;
+            }
+            break;
+        case 'i': g_server_id = (uint8_t)atoi(optarg); break;
+        case 'P': g_pushdown = 1; break;
+        case 'm': g_ring_name = optarg; break;
+        case 'M': g_ring_slots = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'g': mcast_spec = optarg; break;
+        case 't': mcast_ttl = atoi(optarg); break;
+        case 'U': g_udp_port = atoi(optarg); break;
+        case 'S': g_stats_path = optarg; break;
+        case 'H': g_prom_spec = optarg; break;
+        case 'C': capture_path = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (g_server_id == 0) g_server_id = (uint8_t)(1 + (getpid() ^ time(NULL)) % 255);
 
     int port = 8889;
-    if (argc >= 2) port = atoi(argv[1]);
+    if (optind < argc) port = atoi(argv[optind]);
 
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) { perror("socket"); return 1; }
+    /* 先建好环形缓冲区再接管连接，热升级后沿用原序号继续发布 */
+    if (g_ring_name != NULL) {
+        if (frame_ring_create(&g_ring, g_ring_name, g_ring_slots) != 0) {
+            perror("[server] frame ring");
+            return 1;
+        }
+        fprintf(stderr, "[server] publishing frames to shm %s (%u slots)\n", g_ring_name, g_ring_slots);
+    }
 
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (capture_path != NULL) {
+        if (capture_open(&g_capture, capture_path) != 0) {
+            fprintf(stderr, "[server] cannot open capture file %s\n", capture_path);
+            return 1;
+        }
+        fprintf(stderr, "[server] capturing frames to %s\n", capture_path);
+    }
 
-    struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons((uint16_t)port);
+    if (mcast_spec != NULL) {
+        if (mcast_open(mcast_spec, mcast_ttl) != 0) {
+            fprintf(stderr, "[server] bad multicast group %s\n", mcast_spec);
+            return 1;
+        }
+        fprintf(stderr, "[server] multicast fan-out to %s, ttl=%d\n", mcast_spec, mcast_ttl);
+    }
 
-    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return 1; }
-    if (listen(listen_fd, BACKLOG) < 0) { perror("listen"); return 1; }
+    if (g_stats_path != NULL) {
+        int sfd = stats_open(g_stats_path);
+        int *psfd = (int*)malloc(sizeof(int));
+        pthread_t th;
+        if (sfd < 0 || psfd == NULL) { perror("[server] stats socket"); return 1; }
+        *psfd = sfd;
+        if (pthread_create(&th, NULL, stats_thread, psfd) != 0) { perror("[server] stats thread"); return 1; }
+        pthread_detach(th);
+        fprintf(stderr, "[server] stats on unix:%s\n", g_stats_path);
+    }
 
-    fprintf(stderr, "[server] listening on %d\n", port);
+    if (g_prom_spec != NULL) {
+        if (prom_http_start(g_prom_spec, render_prometheus, (volatile int *)&g_running) != 0) {
+            perror("[server] metrics endpoint");
+            return 1;
+        }
+        fprintf(stderr, "[server] prometheus metrics on %s/metrics\n", g_prom_spec);
+    }
+
+    int listen_fd = takeover_from_parent();
+    if (listen_fd < 0) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) { perror("socket"); return 1; }
+        set_cloexec(listen_fd, 1);
+
+        int opt = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        struct sockaddr_in addr; memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons((uint16_t)port);
+
+        if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return 1; }
+        if (listen(listen_fd, BACKLOG) < 0) { perror("listen"); return 1; }
+
+        fprintf(stderr, "[server] listening on %d\n", port);
+    }
+
+    if (g_upstream_port != 0) {
+        fprintf(stderr, "[server] relay mode, id=%u, upstream %s:%d%s\n", g_server_id,
+                g_upstream_ip, g_upstream_port, g_pushdown ? ", subscription pushdown" : "");
+        if (!g_upstream_started && spawn_conn_thread(-1, CONN_UPSTREAM) != 0) {
+            perror("[server] upstream thread");
+        }
+    }
+
+    if (g_udp_port != 0 && !g_udp_started) {
+        int udp_fd = udp_open(g_udp_port);
+        if (udp_fd < 0) { perror("[server] udp bind"); return 1; }
+        if (spawn_conn_thread(udp_fd, CONN_UDP) != 0) { perror("[server] udp thread"); return 1; }
+        fprintf(stderr, "[server] udp ingest on %d, batch=%d\n", g_udp_port, UDP_BATCH);
+    }
 
     while (g_running) {
+        if (g_upgrade_req) {
+            g_upgrade_req = 0;
+            if (do_upgrade(listen_fd, argv)) { capture_close(&g_capture); return 0; }
+            continue;
+        }
+
+        /* 带超时等待新连接，以便及时响应升级/退出信号 */
+        if (wait_readable(listen_fd) <= 0) continue;
+
         struct sockaddr_in cli; socklen_t len = sizeof(cli);
         int conn_fd = accept(listen_fd, (struct sockaddr*)&cli, &len);
         ssize_t r;
         if (conn_fd < 0) {
-            if (errno == EINTR) continue;
+            if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED) continue;
             perror("accept"); break;
         }
+        set_cloexec(conn_fd, 1);
 
         char ip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &cli.sin_addr, ip, sizeof(ip));
@@ -198,7 +1418,8 @@ int main(int argc, char **argv) {
         /* 判断客户端身份 */
         const uint8_t *resp = ROLE_ACK;
         if ( (memcmp(role, ROLE_SENDER, ROLE_LEN) != 0) &&
-             (memcmp(role, ROLE_RECVR , ROLE_LEN) != 0) ) {
+             (memcmp(role, ROLE_RECVR , ROLE_LEN) != 0) &&
+             (memcmp(role, ROLE_REPAIR, ROLE_LEN) != 0 || g_mcast.fd < 0) ) {
             resp = ROLE_ERRORB;
         }
         //if (send_all(conn_fd, resp, ROLE_LEN) != ROLE_LEN) { perror("[server] send ack"); close(conn_fd); continue; }
@@ -209,17 +1430,29 @@ int main(int argc, char **argv) {
 
         /* 根据角色建线程/登记接收者 */
         if (memcmp(role, ROLE_SENDER, ROLE_LEN) == 0) {
+            start_conn(conn_fd, CONN_SENDER);
+        } else if (memcmp(role, ROLE_REPAIR, ROLE_LEN) == 0) {
+            /* 补发连接是短时的请求/应答，热升级时直接随旧进程关闭，接收端会重连 */
             int *pfd = (int*)malloc(sizeof(int)); *pfd = conn_fd;
-            pthread_t th; pthread_create(&th, NULL, sender_thread, pfd);
-            pthread_detach(th);
+            pthread_t th;
+            if (pthread_create(&th, NULL, repair_thread, pfd) != 0) { free(pfd); close(conn_fd); }
+            else pthread_detach(th);
         } else { /* receiver */
-            add_receiver(conn_fd);
-            int *pfd = (int*)malloc(sizeof(int)); *pfd = conn_fd;
-            pthread_t th; pthread_create(&th, NULL, receiver_thread, pfd);
-            pthread_detach(th);
+            start_conn(conn_fd, CONN_RECVR);
         }
     }
 
+    static struct metrics_snapshot snap;
+    metrics_collect(&snap);
+    fprintf(stderr, "[server] exiting: %llu frames in, %llu bad, %llu frames out\n",
+            (unsigned long long)snap.c[MET_FRAMES_IN], (unsigned long long)snap.c[MET_BAD_FRAMES],
+            (unsigned long long)snap.c[MET_FRAMES_OUT]);
+    if (capture_path != NULL) {
+        fprintf(stderr, "[server] captured %llu frames (%llu bytes) to %s\n", (unsigned long long)g_capture.frames,
+                (unsigned long long)g_capture.bytes, capture_path);
+        capture_close(&g_capture);
+    }
+    if (g_stats_path != NULL) unlink(g_stats_path);
     close(listen_fd);
     return 0;
 }
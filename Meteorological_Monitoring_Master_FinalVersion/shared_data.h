@@ -1,17 +1,27 @@
 #ifndef SHARED_DATA_H
 #define SHARED_DATA_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <sched.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* 共享内存标识 */
-#define SHARED_MEMORY_KEY 0x12345678
-#define SHARED_MEMORY_SIZE sizeof(struct shared_weather_data)
+/* 共享内存映射文件（见 shm_map.h）：放在 SD 卡上，接收程序重启、开发板重启后历史和各节点最新值都还在；
+   环境变量 MMM_SHM_PATH 可改路径（例如 /dev/shm/ 下只跨进程重启保留） */
+#define SHARED_MEMORY_PATH "/mnt/SD/mmm_weather.shm"
+#define SHARED_MEMORY_PATH_ENV "MMM_SHM_PATH"
+#define SHARED_MEMORY_SIZE sizeof(struct shared_weather_data)   // 本版本写端建的文件里历史环从这里开始
+#define SHARED_MEMORY_SIZE_FOR(cap) (sizeof(struct shared_weather_data) + (size_t)(cap) * sizeof(struct history_record))
+#define SHARED_MEMORY_MAGIC 0x4D4D5357   // "MMSW"；没有版本头部的旧文件是 0xDEADBEEF
 #define MAX_HISTORY_COUNT 100
+#define MAX_NODE_SLOTS 256      // 按 node_id 直接索引的节点槽位数
+#define HISTORY_RING_DEFAULT (1u << 18)   // 大容量历史环默认记录数（receiver_with_shm -N 可改），16 字节一条，共 4MB
+#define HISTORY_RING_MAX     (1u << 24)
 
 /* 传感器数据类型枚举 */
 enum sensor_data_type {
@@ -79,14 +89,183 @@ struct weather_frame {
     } data;
 };
 
-/* 共享内存结构体 */
+/*
+大容量历史环的一条记录，固定 16 字节。一帧占 1～3 条：首条带类型、节点、时间戳和载荷的前 6 字节，
+续条各带 12 字节。载荷就是校验通过的原始帧里的数据字段（定点数，与线上格式相同），
+读出时由 shm_record_decode 按 shm_write_frame 的换算还原成 struct weather_frame。
+环按记录编号，序号不单独存：tag 是“序号 + 记录内容”的校验（shm_record_tag），读端用期望的序号核对，
+同时发现空记录、改写到一半、属于上一圈或只落盘了一半的记录。0 表示空，HISTORY_TAG_BUSY 表示正在改写。
+*/
+struct history_record {
+    volatile uint32_t tag;
+    union {
+        struct {
+            uint32_t ts;            // 写入时刻（time_t 秒）
+            uint8_t type;           // sensor_data_type
+            uint8_t node_id;
+            uint8_t payload[6];
+        } head;
+        uint8_t cont[12];
+    } u;
+};
+
+#define HISTORY_TAG_BUSY 0xFFFFFFFFu
+#define HISTORY_TAG_CONT 0x9E3779B9u    // 续条的校验与首条区分开，读端落在续条上时能认出来
+#define HISTORY_PAYLOAD_MAX 20          // GPS 帧的数据字段
+
+/*
+按类型、按节点的样本序列：每种类型一段样本区，分成 SERIES_LANES 个 lane，节点第一次上报该类型时分到一个，
+之后它的样本都按时间先后写进自己的 lane（容量 lane_cap 的环）。某节点某类型最近 N 个样本在内存里是连续的，
+读“节点 X 最近 N 个温度”只扫一小段；GPS、系统状态帧再多也不会挤掉温湿度。lane 分完后，空闲最久的 lane 改分给新节点。
+样本是定长的：8 字节头（序号、时间戳）加该类型原始帧的数据字段，按 4 字节补齐。
+seq 是该样本在 lane 内的编号加一，0 表示空，HISTORY_TAG_BUSY 表示正在改写。
+*/
+#define SERIES_TYPES 4                  // SENSOR_BME280..SENSOR_GPS，按 type - 1 索引
+#define SERIES_LANES 32                 // 每种类型同时保存序列的节点数，多出来的节点等别的 lane 空闲下来
+#define SERIES_CAP_MAX (1u << 16)
+/* 每个节点默认保存的样本数（receiver_with_shm -S 可改），按 type - 1 排列：
+   温湿度、光强雨量按 1 分钟一帧约存 34 小时，32 个节点共约 2.3MB */
+#define SERIES_CAP_DEFAULT { 2048, 2048, 128, 512 }
+
+struct series_sample {
+    volatile uint32_t seq;
+    uint32_t ts;                        // 写入时刻（time_t 秒）
+};
+
+struct series_bme280    { struct series_sample h; uint8_t payload[6];  uint8_t pad[2]; };
+struct series_lightrain { struct series_sample h; uint8_t payload[3];  uint8_t pad[1]; };
+struct series_status    { struct series_sample h; uint8_t payload[10]; uint8_t pad[2]; };
+struct series_gps       { struct series_sample h; uint8_t payload[20]; };
+
+/* 一种类型的序列描述；样本区的位置见 hdr.sections[SHM_SECTION_SERIES + type - 1]：lane 0 的 lane_cap 个样本，接着 lane 1…… */
+struct series_desc {
+    uint32_t lane_cap;                  // 每个 lane 的样本数，2 的幂；0 表示该类型不保存序列
+    uint32_t elem_size;                 // 样本字节数（sizeof(struct series_bme280) 等）
+    uint32_t lanes_used;                // 已分配的 lane 数，只有写端修改
+    uint32_t dropped;                   // lane 分完且没有空闲 lane 可腾时没能保存的样本数
+    uint8_t lane_of_node[MAX_NODE_SLOTS]; // 节点的 lane 号加一，0 表示还没分配或已被腾给别的节点
+    uint32_t lane_head[SERIES_LANES];   // 各 lane 累计写入的样本数，即下一个样本的编号
+};
+
+/*
+映射文件头部，固定在文件起点。读端先核对魔数和主版本，再按 sections 找历史环和样本区，不假定它们紧跟在
+自己编译时的 sizeof(struct shared_weather_data) 之后。版本规则：
+  主版本  struct shared_weather_data 已有字段的位置或含义变化，读端不认不同主版本的文件
+  次版本  只在结构体末尾追加字段（data_size 变大）或新增 section；旧读端只读自己认识的前缀，
+          新读端读追加的字段前先用 SHM_HAS 确认文件里有
+写端发现同一主版本但布局或容量不同的文件时在线迁移（shm_migrate），历史和样本都保留；主版本不同才重建。
+*/
+#define SHM_VERSION(major, minor) (((uint32_t)(major) << 16) | (minor))
+#define SHM_VERSION_MAJOR(v) ((v) >> 16)
+#define SHM_VERSION_MINOR(v) ((v) & 0xFFFFu)
+#define SHM_SCHEMA_VERSION SHM_VERSION(2, 1)   // 1.x 是没有头部、魔数 0xDEADBEEF 的旧文件；2.1 追加多写端通道
+
+#define SHM_SECTION_RING   0            // 大容量历史环，history_ring_capacity 条 struct history_record
+#define SHM_SECTION_SERIES 1            // 样本区，按 SHM_SECTION_SERIES + type - 1 排列
+#define SHM_SECTION_LANES  5            // 多写端通道的帧环（2.1），通道 i 的 lane_slots 个 struct lane_slot 依次排列
+#define SHM_SECTION_MAX    8
+
+struct shm_section {
+    uint64_t offset;                    // 相对映射起点，不小于 data_size
+    uint64_t size;
+};
+
+struct shm_header {
+    uint32_t magic;                     // SHARED_MEMORY_MAGIC，文件建好后最后写入
+    uint32_t version;                   // SHM_SCHEMA_VERSION
+    uint32_t header_size;               // sizeof(struct shm_header)，同一主版本内不变
+    uint32_t data_size;                 // 写端的 sizeof(struct shared_weather_data)（含本头部）
+    uint64_t region_size;               // 整个映射文件的字节数
+    uint32_t section_count;
+    uint32_t reserved;
+    struct shm_section sections[SHM_SECTION_MAX];
+};
+
+/*
+缓存行布局：写端每帧都改的字段、读端会写的字段（等待登记、脏位）各占独立的缓存行，
+读端反复读的 history_ring_head、notify_seq 也单独成行，一方写入不会让另一方缓存的
+无关字段失效（伪共享）。SHM_ALIGNED 加在每组的第一个字段上，组与组之间由编译器补齐，
+布局用文件末尾的 SHM_STATIC_ASSERT 检查。i.MX6ULL（Cortex-A7）和 x86 都是 64 字节一行。
+*/
+#define SHM_CACHE_LINE 64
+#define SHM_ALIGNED __attribute__((aligned(SHM_CACHE_LINE)))
+
+/*
+多写端通道（格式 2.1）：同时运行的几个 receiver_with_shm（例如接两台互为备份的服务器）各认领一个通道，
+把收到的原始帧按到达顺序写进自己的单写者帧环，彼此不加锁。各接收程序的合并线程竞争 merge_pid，
+拿到的那个按到达时刻归并各通道、按（节点, 类型, 帧内容）去重后用 shm_write_frame 写入最新数据、
+节点槽位、历史环和样本序列——这些结构仍然只有一个写者，读端不用改。
+通道或合并者的进程退出、崩溃后，其他进程发现 PID 失效用 CAS 接管。
+*/
+#define SHM_WRITER_LANES   4
+#define WRITER_LANE_SLOTS  1024         // 每个通道的帧数，2 的幂，一帧一个缓存行
+#define WRITER_LANE_FRAME  32           // 与 proto.h 的 FRAME_LEN 相同
+
+struct lane_slot {
+    volatile uint64_t seq;              // 帧序号加一，0 表示正在写
+    uint64_t ts_ns;                     // 到达时刻（CLOCK_REALTIME ns），合并时按它归并
+    uint8_t frame[WRITER_LANE_FRAME];
+    uint8_t pad[16];
+};
+
+struct writer_lane {
+    /* 通道的写者（认领它的接收程序）写 */
+    uint32_t owner_pid;                 // 0 表示空闲，认领、释放都用 CAS
+    uint32_t frames;                    // 写入的帧数
+    uint64_t head;                      // 下一帧的序号
+    uint32_t errors;                    // 接收侧的错误帧数（组播丢包未补回、环形缓冲区读得太慢等）
+    uint8_t connection_status;
+    uint16_t source_port;
+    char source_ip[16];                 // 上游服务器，或环形缓冲区名
+
+    /* 很少变的错误信息单独成行，合并者每轮读 head 时不会碰到 */
+    SHM_ALIGNED uint32_t error_seq;     // last_error 每改一次加一
+    char last_error[120];
+
+    /* 合并者写 */
+    SHM_ALIGNED uint64_t merged;        // 已合并到的序号
+    uint32_t applied;                   // 校验后写入共享内存的帧数（含校验失败的）
+    uint32_t duplicates;                // 与其他通道重复而丢弃的帧数
+    uint32_t lost;                      // 合并者落后超过通道容量，被覆盖的帧数
+    uint32_t errors_seen;               // 已计入全局 total_errors 的 errors
+    uint32_t error_seen;                // 已转到全局 last_error 的 error_seq
+};
+
+/* 单个节点各类型的最新值。seq 是该槽位的顺序锁，seq/2 即版本号（写入次数），0 表示从未写入；
+   每个槽位从新的缓存行开始，写端更新一个节点时不会打断读端读相邻节点 */
+struct node_slot {
+    SHM_ALIGNED uint32_t seq;
+    struct bme280_data bme280;
+    struct lightrain_data lightrain;
+    struct system_status_data system_status;
+    struct gps_data gps;
+};
+
+/* 共享内存结构体。每帧都变的字段不再用 volatile，统一经 __atomic 内建函数按注明的内存序访问
+   （C99 的写端和 C++11 的界面共用同一个头文件，<stdatomic.h> 与 std::atomic 不能混用） */
 struct shared_weather_data {
-    /* 控制信息 */
-    volatile uint32_t magic;           // 魔数，用于验证共享内存有效性
+    /* 版本头部（见 struct shm_header），建文件时写一次 */
+    struct shm_header hdr;
+
+    /* 控制信息：启动、退出、连接状态变化时才写 */
     volatile uint32_t writer_pid;      // 写进程PID
     volatile uint32_t reader_pid;      // 读进程PID
-    volatile uint32_t update_counter;  // 数据更新计数器
     volatile uint8_t connection_status; // 连接状态 (0=断开, 1=连接中, 2=已连接)
+    volatile uint32_t history_ring_capacity; // 大容量历史环条目数（见 shm_history_read），2 的幂，0 表示未启用；位置见 hdr.sections[SHM_SECTION_RING]
+
+    /* 配置信息 */
+    char server_ip[16];     // 服务器IP地址
+    uint16_t server_port;   // 服务器端口
+
+    /* 写入本文件时的开机 ID（/proc/sys/kernel/random/boot_id）；重启后不同，说明 reader_pid、notify_waiters 已失效 */
+    char boot_id[40];
+
+    /* 错误信息 */
+    char last_error[256];   // 最后错误信息
+
+    /* 顺序锁保护的最新数据：写端每帧写、界面整块读，这几行本就在双方之间传递 */
+    SHM_ALIGNED uint32_t seq;          // 顺序锁序号，奇数表示写端正在更新（见 shm_read_latest）
+    uint32_t update_counter;           // 数据更新计数器；界面在锁外用 shm_stat_get 判断有没有新数据
     
     /* 最新数据 */
     struct weather_frame latest_data;
@@ -96,39 +275,543 @@ struct shared_weather_data {
     struct lightrain_data latest_lightrain;
     struct system_status_data latest_system_status;
     struct gps_data latest_gps;
+
+    /* 链路追踪（见 trace.h）：最近一次写入的帧 ID 和写入时刻（CLOCK_MONOTONIC ns），未采样时 ID 为 0 */
+    uint32_t trace_frame_id;
+    uint64_t trace_write_ns;
     
-    /* 历史数据缓冲区 */
-    volatile uint32_t history_write_index;  // 写入索引
-    volatile uint32_t history_count;        // 历史数据数量
-    struct weather_frame history[MAX_HISTORY_COUNT];
-    
-    /* 统计信息 */
-    volatile uint32_t total_received;       // 总接收帧数
-    volatile uint32_t total_errors;         // 总错误帧数
-    volatile time_t last_update_time;       // 最后更新时间
+    /* 统计信息：只有写端修改（shm_stat_inc），读端偶尔读（shm_stat_get） */
+    SHM_ALIGNED uint32_t total_received;    // 总接收帧数
+    uint32_t total_errors;                  // 总错误帧数
+    time_t last_update_time;                // 最后更新时间
     
     /* 各类型数据计数 */
-    volatile uint32_t bme280_count;
-    volatile uint32_t lightrain_count;
-    volatile uint32_t system_status_count;
-    volatile uint32_t gps_count;
-    
-    /* 配置信息 */
-    char server_ip[16];     // 服务器IP地址
-    uint16_t server_port;   // 服务器端口
-    
-    /* 错误信息 */
-    char last_error[256];   // 最后错误信息
+    uint32_t bme280_count;
+    uint32_t lightrain_count;
+    uint32_t system_status_count;
+    uint32_t gps_count;
+
+    /* 历史数据缓冲区：最近 MAX_HISTORY_COUNT 帧，各类型混在一起（按类型、按节点保存的见 series） */
+    uint32_t history_write_index;  // 写入索引
+    uint32_t history_count;        // 历史数据数量
+    struct weather_frame history[MAX_HISTORY_COUNT];
+
+    /* 大容量历史环的写入位置：写端每帧推进，各读端轮询它 */
+    SHM_ALIGNED uint64_t history_ring_head; // 下一帧的序号，即累计写入的帧数
+
+    /* 变化通知（见 shm_notify.h）：写端每次更新后加一，读端在 notify_seq 上 futex 等待 */
+    SHM_ALIGNED uint32_t notify_seq;
+
+    /* 读端写的字段：每次等待前后加减 notify_waiters，与写端每帧写的字段分开 */
+    SHM_ALIGNED uint32_t notify_waiters;    // 正在等待的读端数，为 0 时写端不做唤醒系统调用
+
+    /* 按节点的最新值：写端更新槽位后置位 node_dirty 中对应的位，界面取走置位的节点只刷新这些 */
+    SHM_ALIGNED uint32_t node_dirty[MAX_NODE_SLOTS / 32];
+    struct node_slot nodes[MAX_NODE_SLOTS];
+
+    /* 按类型、按节点的样本序列（见 shm_series_read），样本区在历史环之后 */
+    SHM_ALIGNED struct series_desc series[SERIES_TYPES];
+
+    /* 以下为格式 2.1 追加，读之前用 SHM_HAS 判断。多写端通道见 struct writer_lane */
+    SHM_ALIGNED uint32_t merge_pid;     // 合并者，即上面各结构的唯一写者；0 表示没有
+    uint32_t lane_slots;                // 每个通道的帧数
+    SHM_ALIGNED uint32_t lane_notify;   // 通道写者每帧加一，合并者阻塞在它上面（同 notify_seq）
+    uint32_t lane_waiters;
+    struct writer_lane lanes[SHM_WRITER_LANES];
+};
+
+/* 一次一致读取得到的最新数据快照 */
+struct shm_latest {
+    uint32_t update_counter;
+    struct weather_frame latest_data;
+    struct bme280_data latest_bme280;
+    struct lightrain_data latest_lightrain;
+    struct system_status_data latest_system_status;
+    struct gps_data latest_gps;
+    uint32_t trace_frame_id;
+    uint64_t trace_write_ns;
+};
+
+/* 一个节点槽位的一致快照；version 为 0 表示该节点从未上报 */
+struct node_latest {
+    uint32_t version;
+    struct bme280_data bme280;
+    struct lightrain_data lightrain;
+    struct system_status_data system_status;
+    struct gps_data gps;
 };
 
-/* 魔数定义 */
-#define SHARED_MEMORY_MAGIC 0xDEADBEEF
+/* 读端放弃前的最大重试次数：写端在更新中途被挂起或退出时，本轮读取失败，下次轮询再读 */
+#define SHM_READ_MAX_RETRY 1000
+
+/*
+顺序锁（seqlock）：写端修改数据前后各把序号加一，写入期间序号为奇数。
+读端复制前后各读一次序号，两次相同且为偶数才说明拷贝没有被写入打断，否则重试。
+整个结构用 seq 保护最新数据、历史记录和计数器，每个节点槽位另有自己的 seq。
+只允许一个写进程；读端从不阻塞写端。
+*/
+static inline void shm_seq_write_begin(volatile uint32_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);   /* 序号先于数据可见 */
+}
+
+static inline void shm_seq_write_end(volatile uint32_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t shm_seq_read_begin(const volatile uint32_t *seq) {
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+/* 拷贝期间有写入（或开始时写端正在更新）返回非零，需要重读 */
+static inline int shm_seq_read_retry(const volatile uint32_t *seq, uint32_t start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);   /* 数据读取先于第二次读序号 */
+    return (start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+/* 统计计数器只有写端修改，不用读-改-写原子指令（ARM 上是 ldrex/strex 循环），读端读到的是某一时刻的完整值 */
+static inline void shm_stat_add(uint32_t *c, uint32_t n) {
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void shm_stat_inc(uint32_t *c) {
+    shm_stat_add(c, 1);
+}
+
+static inline uint32_t shm_stat_get(const uint32_t *c) {
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+/* 读取最新数据的一致快照；成功返回 0，重试 SHM_READ_MAX_RETRY 次仍失败返回 -1 */
+static inline int shm_read_latest(const struct shared_weather_data *sd, struct shm_latest *out) {
+    for (int i = 0; i < SHM_READ_MAX_RETRY; i++) {
+        uint32_t s = shm_seq_read_begin(&sd->seq);
+        if (s & 1) {
+            sched_yield();                     /* 单核上让写端先跑完 */
+            continue;
+        }
+        out->update_counter = sd->update_counter;
+        out->latest_data = sd->latest_data;
+        out->latest_bme280 = sd->latest_bme280;
+        out->latest_lightrain = sd->latest_lightrain;
+        out->latest_system_status = sd->latest_system_status;
+        out->latest_gps = sd->latest_gps;
+        out->trace_frame_id = sd->trace_frame_id;
+        out->trace_write_ns = sd->trace_write_ns;
+        if (!shm_seq_read_retry(&sd->seq, s)) return 0;
+    }
+    return -1;
+}
+
+/* 读取一个节点槽位的一致快照；返回值同 shm_read_latest */
+static inline int shm_read_node(const struct shared_weather_data *sd, uint8_t node_id, struct node_latest *out) {
+    const struct node_slot *ns = &sd->nodes[node_id];
+    for (int i = 0; i < SHM_READ_MAX_RETRY; i++) {
+        uint32_t s = shm_seq_read_begin(&ns->seq);
+        if (s & 1) {
+            sched_yield();
+            continue;
+        }
+        out->version = s / 2;
+        out->bme280 = ns->bme280;
+        out->lightrain = ns->lightrain;
+        out->system_status = ns->system_status;
+        out->gps = ns->gps;
+        if (!shm_seq_read_retry(&ns->seq, s)) return 0;
+    }
+    return -1;
+}
+
+/* 写端：槽位写完后置位，release 保证读端看到置位时槽位内容已经可见 */
+static inline void shm_node_mark_dirty(struct shared_weather_data *sd, uint8_t node_id) {
+    __atomic_fetch_or(&sd->node_dirty[node_id / 32], 1u << (node_id % 32), __ATOMIC_RELEASE);
+}
+
+/*
+读端：取走所有置位的节点并清零，节点号写入 ids（至少 MAX_NODE_SLOTS 个），返回个数。
+只扫 MAX_NODE_SLOTS/32 个字，代价与变化的节点数成正比。位图只供一个读端（界面）消费，
+取走之后再有更新会重新置位，下次再取；读端自己读槽位失败时可用 shm_node_mark_dirty 放回。
+*/
+static inline int shm_take_dirty(struct shared_weather_data *sd, uint8_t *ids) {
+    int n = 0;
+    for (int w = 0; w < MAX_NODE_SLOTS / 32; w++) {
+        if (__atomic_load_n(&sd->node_dirty[w], __ATOMIC_RELAXED) == 0) continue;
+        uint32_t bits = __atomic_exchange_n(&sd->node_dirty[w], 0, __ATOMIC_ACQUIRE);
+        while (bits != 0) {
+            ids[n++] = (uint8_t)(w * 32 + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    return n;
+}
+
+static inline struct history_record *shm_history_ring(const struct shared_weather_data *sd) {
+    return (struct history_record *)((uint8_t *)sd + sd->hdr.sections[SHM_SECTION_RING].offset);
+}
+
+/* 当前写入位置（记录序号）；从这里开始读就只看之后的新帧 */
+static inline uint64_t shm_history_head(const struct shared_weather_data *sd) {
+    return __atomic_load_n(&sd->history_ring_head, __ATOMIC_ACQUIRE);
+}
+
+/* 环里还保存着的最早记录序号（可能落在某帧的续条上，读的时候跳过） */
+static inline uint64_t shm_history_oldest(const struct shared_weather_data *sd) {
+    uint64_t head = shm_history_head(sd);
+    uint32_t cap = sd->history_ring_capacity;
+    return head > cap ? head - cap : 0;
+}
+
+/* 各类型帧的数据字段长度（原始帧第 2 字节起）；未知类型返回 0 */
+static inline int shm_record_payload_len(uint8_t type) {
+    switch (type) {
+        case SENSOR_BME280:        return 6;
+        case SENSOR_LIGHTRAIN:     return 3;
+        case SENSOR_SYSTEM_STATUS: return 10;
+        case SENSOR_GPS:           return 20;
+        default:                   return 0;
+    }
+}
+
+/* 一帧占用的记录条数 */
+static inline int shm_record_count(uint8_t type) {
+    int len = shm_record_payload_len(type);
+    return len <= 6 ? 1 : 1 + (len - 6 + 11) / 12;
+}
+
+/* 类型名（命令行、指标标签用），未知类型返回 NULL */
+static inline const char *shm_sensor_type_name(uint8_t type) {
+    switch (type) {
+        case SENSOR_BME280:        return "bme280";
+        case SENSOR_LIGHTRAIN:     return "lightrain";
+        case SENSOR_SYSTEM_STATUS: return "system_status";
+        case SENSOR_GPS:           return "gps";
+        default:                   return NULL;
+    }
+}
+
+/* 按类型名查类型，未知返回 0 */
+static inline uint8_t shm_sensor_type_parse(const char *name) {
+    for (uint8_t t = 1; t <= SERIES_TYPES; t++) {
+        if (strcmp(name, shm_sensor_type_name(t)) == 0) return t;
+    }
+    return 0;
+}
+
+/* 各类型样本的字节数；未知类型返回 0 */
+static inline size_t shm_series_elem_size(uint8_t type) {
+    switch (type) {
+        case SENSOR_BME280:        return sizeof(struct series_bme280);
+        case SENSOR_LIGHTRAIN:     return sizeof(struct series_lightrain);
+        case SENSOR_SYSTEM_STATUS: return sizeof(struct series_status);
+        case SENSOR_GPS:           return sizeof(struct series_gps);
+        default:                   return 0;
+    }
+}
+
+/* 一种类型样本区的字节数，补齐到缓存行，下一段也从行首开始 */
+static inline size_t shm_series_bytes(uint8_t type, uint32_t lane_cap) {
+    size_t n = (size_t)SERIES_LANES * lane_cap * shm_series_elem_size(type);
+    return (n + SHM_CACHE_LINE - 1) & ~(size_t)(SHM_CACHE_LINE - 1);
+}
+
+/* 本版本写端建的映射文件总大小：结构体、ring_cap 条记录的历史环、各类型的样本区（series_cap 按 type - 1 索引）、
+   各写端通道的帧环 */
+static inline size_t shm_layout_size(uint32_t ring_cap, const uint32_t *series_cap) {
+    size_t size = SHARED_MEMORY_SIZE_FOR(ring_cap);
+    for (int t = 0; t < SERIES_TYPES; t++) size += shm_series_bytes((uint8_t)(t + 1), series_cap[t]);
+    return size + (size_t)SHM_WRITER_LANES * WRITER_LANE_SLOTS * sizeof(struct lane_slot);
+}
+
+/* 2.0 的全部字段；以后次版本追加的字段不在其中，读之前用 SHM_HAS 判断 */
+#define SHM_DATA_BASE_SIZE (offsetof(struct shared_weather_data, series) + sizeof(((struct shared_weather_data *)0)->series))
+#define SHM_HAS(sd, field) (offsetof(struct shared_weather_data, field) + sizeof(((struct shared_weather_data *)0)->field) <= (sd)->hdr.data_size)
+
+static inline int shm_section_fits(const struct shared_weather_data *sd, int i, uint64_t need) {
+    const struct shm_section *sec = &sd->hdr.sections[i];
+    return need == 0 || (i < (int)sd->hdr.section_count && sec->offset >= sd->hdr.data_size && sec->size >= need &&
+                         sec->offset <= sd->hdr.region_size && sd->hdr.region_size - sec->offset >= sec->size);
+}
+
+/*
+读端映射后核对头部：魔数、主版本、结构体至少包含 2.0 的字段，头部声明的历史环、各样本区和写端通道都落在
+len 字节之内。通过返回 NULL，否则返回原因（用于日志）。
+*/
+static inline const char *shm_header_check(const struct shared_weather_data *sd, size_t len) {
+    const struct shm_header *h = &sd->hdr;
+    if (len < sizeof(*h)) return "文件比头部还短";
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHARED_MEMORY_MAGIC) return "魔数不符（没有版本头部的旧文件或不是本程序的文件）";
+    if (SHM_VERSION_MAJOR(h->version) != SHM_VERSION_MAJOR(SHM_SCHEMA_VERSION)) return "主版本不同";
+    if (h->header_size != sizeof(*h) || h->section_count > SHM_SECTION_MAX) return "头部大小不符";
+    if (h->data_size < SHM_DATA_BASE_SIZE || h->region_size > len || h->data_size > h->region_size) return "文件大小与头部不符";
+    uint32_t cap = sd->history_ring_capacity;
+    if ((cap & (cap - 1)) != 0 || !shm_section_fits(sd, SHM_SECTION_RING, (uint64_t)cap * sizeof(struct history_record))) {
+        return "历史环超出文件";
+    }
+    for (int t = 0; t < SERIES_TYPES; t++) {
+        const struct series_desc *d = &sd->series[t];
+        if (d->lane_cap == 0) continue;
+        if (d->elem_size != shm_series_elem_size((uint8_t)(t + 1)) || (d->lane_cap & (d->lane_cap - 1)) != 0 ||
+            !shm_section_fits(sd, SHM_SECTION_SERIES + t, (uint64_t)SERIES_LANES * d->lane_cap * d->elem_size)) {
+            return "样本区超出文件";
+        }
+    }
+    if (SHM_HAS(sd, lanes)) {
+        uint32_t slots = sd->lane_slots;
+        if (slots == 0 || (slots & (slots - 1)) != 0 ||
+            !shm_section_fits(sd, SHM_SECTION_LANES, (uint64_t)SHM_WRITER_LANES * slots * sizeof(struct lane_slot))) {
+            return "写端通道超出文件";
+        }
+    }
+    return NULL;
+}
+
+/* 记录校验：FNV-1a，覆盖序号和记录内容；续条再异或 HISTORY_TAG_CONT。结果避开 0 和 HISTORY_TAG_BUSY */
+static inline uint32_t shm_record_tag(uint64_t seq, const struct history_record *r, int cont) {
+    const uint8_t *p = (const uint8_t *)&r->u;
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 8; i++) h = (h ^ (uint8_t)(seq >> (i * 8))) * 16777619u;
+    for (size_t i = 0; i < sizeof(r->u); i++) h = (h ^ p[i]) * 16777619u;
+    if (cont) h ^= HISTORY_TAG_CONT;
+    if (h == 0 || h == HISTORY_TAG_BUSY) h = 1;
+    return h;
+}
+
+/* 读出序号 s 处的记录到 *out：是 s 的首条返回 1，续条返回 2；空、正在改写或不属于 s 返回 0 */
+static inline int shm_record_load(const struct shared_weather_data *sd, uint64_t s, struct history_record *out) {
+    const struct history_record *r = &shm_history_ring(sd)[s & (sd->history_ring_capacity - 1)];
+    uint32_t v = __atomic_load_n(&r->tag, __ATOMIC_ACQUIRE);
+    if (v == 0 || v == HISTORY_TAG_BUSY) return 0;
+    out->u = r->u;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&r->tag, __ATOMIC_RELAXED) != v) return 0;
+    if (v == shm_record_tag(s, out, 0)) return shm_record_payload_len(out->u.head.type) > 0 ? 1 : 0;
+    if (v == shm_record_tag(s, out, 1)) return 2;
+    return 0;
+}
+
+/* 把数据字段按 shm_write_frame 的换算还原成 struct weather_frame；p 的布局与原始帧第 2 字节起相同 */
+static inline void shm_record_decode(uint8_t type, uint8_t node_id, time_t ts, const uint8_t *p,
+                                     struct weather_frame *out) {
+    memset(out, 0, sizeof(*out));
+    out->data_type = type;
+    switch (type) {
+        case SENSOR_BME280: {
+            struct bme280_data *d = &out->data.bme280;
+            int16_t t100 = (int16_t)((p[0] << 8) | p[1]);
+            int16_t p10 = (int16_t)((p[2] << 8) | p[3]);
+            int16_t h100 = (int16_t)((p[4] << 8) | p[5]);
+            d->node_id = node_id;
+            d->temperature = t100 / 100.0f;
+            d->pressure = p10 / 10.0f;
+            d->humidity = h100 / 100.0f;
+            d->timestamp = ts;
+            d->valid = 1;
+            break;
+        }
+        case SENSOR_LIGHTRAIN: {
+            struct lightrain_data *d = &out->data.lightrain;
+            int16_t lux10 = (int16_t)((p[0] << 8) | p[1]);
+            d->node_id = node_id;
+            d->light_intensity = lux10 / 10.0f;
+            d->rainfall = p[2];
+            d->timestamp = ts;
+            d->valid = 1;
+            break;
+        }
+        case SENSOR_SYSTEM_STATUS: {
+            struct system_status_data *d = &out->data.system_status;
+            d->node_id = node_id;
+            d->bme280_status = p[0];
+            d->bh1750_status = p[1];
+            d->rain_sensor_status = p[2];
+            d->i2c_bus_status = p[3];
+            d->uptime_seconds = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+            d->total_errors = (uint16_t)((p[8] << 8) | p[9]);
+            d->timestamp = ts;
+            d->valid = 1;
+            break;
+        }
+        case SENSOR_GPS: {
+            struct gps_data *d = &out->data.gps;
+            int32_t lat1e5 = (int32_t)(((uint32_t)p[6] << 24) | ((uint32_t)p[7] << 16) | ((uint32_t)p[8] << 8) | p[9]);
+            int32_t lon1e5 = (int32_t)(((uint32_t)p[10] << 24) | ((uint32_t)p[11] << 16) | ((uint32_t)p[12] << 8) | p[13]);
+            int16_t hdop10 = (int16_t)((p[16] << 8) | p[17]);
+            int16_t alt10 = (int16_t)((p[18] << 8) | p[19]);
+            d->node_id = node_id;
+            for (int i = 0; i < 6 && p[i] != 0; i++) d->utc[i] = (char)p[i];   /* 与写端 strncpy 一致，其余为 0 */
+            d->latitude = lat1e5 / 1e5f;
+            d->longitude = lon1e5 / 1e5f;
+            d->positioning = p[14];
+            d->satellites = p[15];
+            d->hdop = hdop10 / 10.0f;
+            d->altitude = alt10 / 10.0f;
+            d->timestamp = ts;
+            d->valid = 1;
+            break;
+        }
+    }
+}
+
+/*
+读出序号 s 起的一整帧（首条加续条）；成功返回占用的记录条数，s 处不是完整的一帧返回 0，
+s 处是续条（上一帧的首条已经读过或已被覆盖）返回 -1。
+*/
+static inline int shm_history_load_frame(const struct shared_weather_data *sd, uint64_t s, uint64_t head,
+                                         struct weather_frame *out) {
+    struct history_record r;
+    int kind = shm_record_load(sd, s, &r);
+    if (kind != 1) return kind == 2 ? -1 : 0;
+    uint8_t payload[HISTORY_PAYLOAD_MAX];
+    int len = shm_record_payload_len(r.u.head.type);
+    int k = shm_record_count(r.u.head.type);
+    if (s + (uint64_t)k > head) return 0;
+    memcpy(payload, r.u.head.payload, len < 6 ? len : 6);
+    for (int i = 1; i < k; i++) {
+        struct history_record c;
+        if (shm_record_load(sd, s + i, &c) != 2) return 0;
+        int off = 6 + (i - 1) * 12;
+        int n = len - off < 12 ? len - off : 12;
+        memcpy(payload + off, c.u.cont, n);
+    }
+    shm_record_decode(r.u.head.type, r.u.head.node_id, (time_t)r.u.head.ts, payload, out);
+    return k;
+}
+
+/*
+大容量历史环（单写多读，读端互不影响）：从记录序号 *cursor 起读取至多 max 帧到 out，
+各帧首条记录的序号写入 out_seq（可为 NULL），返回帧数并把 *cursor 移到下一帧。游标由各读端自己保存，
+轮询之间只要没落后超过容量就一帧不漏；落后太多时，被写端覆盖而跳过的记录条数精确累加到 *lost。
+每条记录的校验包含序号，读之前和读之后各检查一次，读到一半被改写也能发现。
+*/
+static inline int shm_history_read(const struct shared_weather_data *sd, uint64_t *cursor,
+                                   struct weather_frame *out, uint64_t *out_seq, int max, uint64_t *lost) {
+    uint32_t cap = sd->history_ring_capacity;
+    if (cap == 0) return 0;
+    uint64_t head = shm_history_head(sd);
+    uint64_t s = *cursor;
+    int n = 0;
+    if (s > head) s = head;                    /* 游标超前：写端重建了共享内存，从当前位置接着读 */
+    while (n < max && s < head) {
+        if (head - s > cap) {
+            *lost += head - cap - s;
+            s = head - cap;
+        }
+        int k = shm_history_load_frame(sd, s, head, &out[n]);
+        if (k > 0) {
+            if (out_seq != NULL) out_seq[n] = s;
+            n++;
+            s += (uint64_t)k;
+            continue;
+        }
+        if (k < 0) {
+            /* 续条：所属帧的首条已被覆盖，这条单独没有用 */
+            (*lost)++;
+            s++;
+            continue;
+        }
+        /* 记录已经（或正在）被 s + cap 之后的帧改写：跳到写端当前还没碰到的最早序号 */
+        head = shm_history_head(sd);
+        uint64_t oldest = head >= cap ? head - cap + 1 : 0;
+        if (oldest <= s) oldest = s + 1;
+        *lost += oldest - s;
+        s = oldest;
+    }
+    *cursor = s;
+    return n;
+}
+
+/* 节点 node_id 的 type 类型样本所在的 lane（0 起），没有分配返回 -1 */
+static inline int shm_series_lane(const struct shared_weather_data *sd, uint8_t type, uint8_t node_id) {
+    if (type < 1 || type > SERIES_TYPES || sd->series[type - 1].lane_cap == 0) return -1;
+    uint8_t lane = __atomic_load_n(&sd->series[type - 1].lane_of_node[node_id], __ATOMIC_ACQUIRE);
+    return (lane == 0 || lane > SERIES_LANES) ? -1 : lane - 1;
+}
+
+/* 第 t 种类型（type - 1）lane 号 lane 中编号 s 的样本 */
+static inline struct series_sample *shm_series_at(const struct shared_weather_data *sd, int t, int lane, uint32_t s) {
+    const struct series_desc *d = &sd->series[t];
+    size_t idx = (size_t)lane * d->lane_cap + (s & (d->lane_cap - 1));
+    return (struct series_sample *)((uint8_t *)sd + sd->hdr.sections[SHM_SECTION_SERIES + t].offset + idx * d->elem_size);
+}
+
+/*
+读节点 node_id 最近的至多 max 个 type 类型样本，按时间先后解码到 out，样本编号写入 out_seq（可为 NULL），
+返回个数；该节点没有这类序列时返回 0。同一 lane 的样本连续存放，顺序扫过即可。
+与历史环一样读前读后各查一次 seq，被写端改写中或已被下一圈覆盖的样本跳过；
+读完再查一次节点的 lane，读的过程中 lane 被腾给了别的节点就返回 0。
+*/
+static inline int shm_series_read(const struct shared_weather_data *sd, uint8_t type, uint8_t node_id,
+                                  struct weather_frame *out, uint32_t *out_seq, int max) {
+    int lane = shm_series_lane(sd, type, node_id);
+    if (lane < 0 || max <= 0) return 0;
+    const struct series_desc *d = &sd->series[type - 1];
+    uint32_t head = __atomic_load_n(&d->lane_head[lane], __ATOMIC_ACQUIRE);
+    uint32_t want = (uint32_t)max < d->lane_cap ? (uint32_t)max : d->lane_cap;
+    uint32_t s = head > want ? head - want : 0;
+    int len = shm_record_payload_len(type), n = 0;
+    uint8_t payload[HISTORY_PAYLOAD_MAX];
+    for (; s < head; s++) {
+        const struct series_sample *e = shm_series_at(sd, type - 1, lane, s);
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != s + 1) continue;
+        uint32_t ts = e->ts;
+        memcpy(payload, e + 1, (size_t)len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != s + 1) continue;
+        shm_record_decode(type, node_id, (time_t)ts, payload, &out[n]);
+        if (out_seq != NULL) out_seq[n] = s;
+        n++;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&d->lane_of_node[node_id], __ATOMIC_RELAXED) != lane + 1) return 0;
+    return n;
+}
+
+/* 写端通道 lane 中序号为 s 的帧槽 */
+static inline struct lane_slot *shm_lane_slot(const struct shared_weather_data *sd, int lane, uint64_t s) {
+    size_t idx = (size_t)lane * sd->lane_slots + (size_t)(s & (sd->lane_slots - 1));
+    return (struct lane_slot *)((uint8_t *)sd + sd->hdr.sections[SHM_SECTION_LANES].offset) + idx;
+}
 
 /* 连接状态定义 */
 #define CONNECTION_DISCONNECTED 0
 #define CONNECTION_CONNECTING   1  
 #define CONNECTION_CONNECTED    2
 
+/* 布局检查：各组从缓存行起点开始，结构体大小是缓存行的整数倍，紧跟其后的历史环也对齐 */
+#ifdef __cplusplus
+#define SHM_STATIC_ASSERT(cond, msg) static_assert(cond, msg)
+#else
+#define SHM_STATIC_ASSERT(cond, msg) _Static_assert(cond, msg)
+#endif
+#define SHM_LINE_START(field) (offsetof(struct shared_weather_data, field) % SHM_CACHE_LINE == 0)
+SHM_STATIC_ASSERT(offsetof(struct shared_weather_data, hdr) == 0, "schema header must be at the start of the file");
+SHM_STATIC_ASSERT(sizeof(struct shm_header) == 160, "schema header layout is fixed within a major version");
+SHM_STATIC_ASSERT(SHM_LINE_START(seq), "seqlock block must start a cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(total_received), "writer counters must start a cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(history_ring_head), "history_ring_head must have its own cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(notify_seq), "notify_seq must have its own cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(notify_waiters), "notify_waiters must have its own cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(node_dirty), "node_dirty must start a cache line");
+SHM_STATIC_ASSERT(offsetof(struct shared_weather_data, notify_seq) - offsetof(struct shared_weather_data, history_ring_head) == SHM_CACHE_LINE,
+                  "history_ring_head must not share its line");
+SHM_STATIC_ASSERT(offsetof(struct shared_weather_data, notify_waiters) - offsetof(struct shared_weather_data, notify_seq) == SHM_CACHE_LINE,
+                  "notify_seq must not share its line");
+SHM_STATIC_ASSERT(offsetof(struct shared_weather_data, node_dirty) - offsetof(struct shared_weather_data, notify_waiters) == SHM_CACHE_LINE,
+                  "notify_waiters must not share its line");
+SHM_STATIC_ASSERT(sizeof(struct node_slot) % SHM_CACHE_LINE == 0, "node slots must not share cache lines");
+SHM_STATIC_ASSERT(sizeof(struct shared_weather_data) % SHM_CACHE_LINE == 0, "history ring must start on a cache line");
+SHM_STATIC_ASSERT(sizeof(struct history_record) == 16, "history records are 16 bytes, four per cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(series), "series descriptors must start a cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(merge_pid), "2.1 fields are appended on a new cache line");
+SHM_STATIC_ASSERT(SHM_LINE_START(lane_notify) && SHM_LINE_START(lanes), "lane_notify must have its own cache line");
+SHM_STATIC_ASSERT(offsetof(struct writer_lane, merged) == 3 * SHM_CACHE_LINE && sizeof(struct writer_lane) == 4 * SHM_CACHE_LINE,
+                  "lane writer and merger fields must not share a cache line");
+SHM_STATIC_ASSERT(sizeof(struct lane_slot) == SHM_CACHE_LINE, "lane slots are one cache line each");
+SHM_STATIC_ASSERT(sizeof(struct series_bme280) == 16 && sizeof(struct series_lightrain) == 12 &&
+                  sizeof(struct series_status) == 20 && sizeof(struct series_gps) == 28,
+                  "series samples are the 8-byte header plus the frame payload, padded to 4 bytes");
+#undef SHM_LINE_START
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,83 @@
+/*
+共享内存写端的功能自检
+
+在进程内存里按 receiver_with_shm 的布局建一份 shared_weather_data，直接调用 shm_writer.h 的函数，
+检查计时基准看不出来的行为。任一项不满足打印 FAIL 并返回 1，make check 编译后直接运行。
+
+  series_reclaim  64 个节点轮流上报温湿度，每轮间隔超过 SERIES_LANE_IDLE_SEC，lane 只有 32 个：
+                  后来的节点应当腾到最久没更新的节点的 lane，读得到自己的样本，被腾走的节点读不到；
+                  lane 都还忙时新节点只计 dropped
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto.h"
+#include "shared_data.h"
+#include "shm_writer.h"
+
+static int g_failed = 0;
+
+static void verdict(const char *what, int bad, const char *detail) {
+    printf("  %-4s %-40s %s\n", bad ? "FAIL" : "ok", what, detail);
+    if (bad) g_failed = 1;
+}
+
+/* 只保存温湿度样本、每节点 4 个的布局，按缓存行对齐（与 mmap 得到的一致） */
+static struct shared_weather_data *make_layout(void **mem) {
+    static const uint32_t cap[SERIES_TYPES] = { 4, 0, 0, 0 };
+    size_t size = shm_layout_size(HISTORY_RING_DEFAULT, cap);
+    *mem = NULL;
+    if (posix_memalign(mem, SHM_CACHE_LINE, size) != 0) return NULL;
+    memset(*mem, 0, size);
+    struct shared_weather_data *sd = (struct shared_weather_data *)*mem;
+    shm_layout_init(sd, HISTORY_RING_DEFAULT, cap);
+    return sd;
+}
+
+static void check_series_reclaim(void) {
+    void *mem;
+    struct shared_weather_data *sd = make_layout(&mem);
+    if (sd == NULL) {
+        verdict("series_reclaim layout", 1, "out of memory");
+        return;
+    }
+    static const uint8_t payload[6] = { 0x09, 0xC4, 0x27, 0x74, 0x13, 0x88 };
+    struct weather_frame out[4];
+    char detail[128];
+
+    time_t ts = 1000;
+    for (int n = 0; n < SERIES_LANES; ++n) shm_series_push(sd, SENSOR_BME280, (uint8_t)n, ts, payload);
+    shm_series_push(sd, SENSOR_BME280, 200, ts + 1, payload);
+    snprintf(detail, sizeof(detail), "lane %d, dropped %u", shm_series_lane(sd, SENSOR_BME280, 200),
+             sd->series[0].dropped);
+    verdict("busy lanes are not taken", shm_series_lane(sd, SENSOR_BME280, 200) >= 0 || sd->series[0].dropped != 1,
+            detail);
+
+    int got = 0, stale = 0;
+    for (int n = SERIES_LANES; n < 2 * SERIES_LANES; ++n) {
+        ts += SERIES_LANE_IDLE_SEC + 1;
+        shm_series_push(sd, SENSOR_BME280, (uint8_t)n, ts, payload);
+        shm_series_push(sd, SENSOR_BME280, (uint8_t)n, ts, payload);
+        if (shm_series_read(sd, SENSOR_BME280, (uint8_t)n, out, NULL, 4) == 2) got++;
+        if (shm_series_read(sd, SENSOR_BME280, (uint8_t)(n - SERIES_LANES), out, NULL, 4) != 0) stale++;
+    }
+    snprintf(detail, sizeof(detail), "%d/%d new nodes read their own samples", got, SERIES_LANES);
+    verdict("idle lanes go to new nodes", got != SERIES_LANES, detail);
+    snprintf(detail, sizeof(detail), "%d evicted nodes still readable", stale);
+    verdict("evicted nodes read nothing", stale != 0, detail);
+    snprintf(detail, sizeof(detail), "lanes_used %u, dropped %u", sd->series[0].lanes_used, sd->series[0].dropped);
+    verdict("lane table stays bounded", sd->series[0].lanes_used != SERIES_LANES || sd->series[0].dropped != 1,
+            detail);
+    free(mem);
+}
+
+int main(void) {
+    printf("series_reclaim\n");
+    check_series_reclaim();
+    printf("[shm_check] %s\n", g_failed ? "FAIL" : "PASS");
+    return g_failed;
+}
@@ -0,0 +1,76 @@
+/*
+共享内存映射文件
+
+struct shared_weather_data 和其后的大容量历史环、各类型样本区放在一个普通文件里，各进程 MAP_SHARED 映射。
+写端（receiver_with_shm）退出时不删除文件，开发板重启后重新映射就能拿回历史和各节点
+最新值，界面一启动就有数据。内核按脏页回写周期（默认约 30 秒）把改动落盘，
+写端正常退出时 msync 一次；掉电时没落盘的部分由写端下次启动时的恢复流程处理（shm_writer.h）。
+
+布局或容量变化时写端另建新文件（同一主版本时把历史迁移过去）再 rename 覆盖，已映射旧文件的读端
+不会因文件被截短而 SIGBUS，用 shm_map_replaced() 发现后重新映射即可。读端不按自己编译时的结构体大小
+判断文件，映射后由 shm_header_check 核对头部（shared_data.h 的 struct shm_header）。
+
+使用前需先包含 shared_data.h。
+*/
+#ifndef SHM_MAP_H
+#define SHM_MAP_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/* 映射文件路径：环境变量 MMM_SHM_PATH 优先 */
+static inline const char *shm_map_path(void) {
+    const char *p = getenv(SHARED_MEMORY_PATH_ENV);
+    return (p != NULL && p[0] != '\0') ? p : SHARED_MEMORY_PATH;
+}
+
+/* 映射整个文件；文件小于 min_len 时失败（errno = EINVAL）。*len、*ino 返回映射长度和文件 inode */
+static inline struct shared_weather_data *shm_map_open(const char *path, size_t min_len, size_t *len, ino_t *ino) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < min_len) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);                              /* 映射建立后不再需要描述符 */
+    if (p == MAP_FAILED) return NULL;
+    *len = (size_t)st.st_size;
+    *ino = st.st_ino;
+    return (struct shared_weather_data *)p;
+}
+
+/* 读端：映射写端建好的文件并核对头部；主版本不同或头部声明的各段超出文件时失败（errno = EPROTO） */
+static inline struct shared_weather_data *shm_map_attach(const char *path, size_t *len, ino_t *ino) {
+    struct shared_weather_data *sd = shm_map_open(path, sizeof(struct shm_header), len, ino);
+    if (sd == NULL) return NULL;
+    if (shm_header_check(sd, *len) != NULL) {
+        munmap(sd, *len);
+        errno = EPROTO;
+        return NULL;
+    }
+    return sd;
+}
+
+static inline void shm_map_detach(struct shared_weather_data *sd, size_t len) {
+    if (sd != NULL) munmap(sd, len);
+}
+
+/* 路径上的文件已不是映射的那一个（写端重建了文件，或文件被删除） */
+static inline int shm_map_replaced(const char *path, ino_t ino) {
+    struct stat st;
+    return stat(path, &st) != 0 || st.st_ino != ino;
+}
+
+#endif /* SHM_MAP_H */
@@ -0,0 +1,64 @@
+/*
+共享内存变化通知
+
+写端每次更新共享内存后把 notify_seq 加一，有读端在等时再用 futex 唤醒；读端阻塞在
+同一个字上，没有新数据时一次也不会醒来，有数据时毫秒级返回。futex 跨进程使用，
+两边映射地址不同也没关系。futex 不能放进 poll()，需要接入事件循环的读端（Qt 界面）
+用一个等待线程把唤醒转成事件。
+
+读端先登记 notify_waiters 再复查 notify_seq，写端先递增 notify_seq 再查 notify_waiters，
+两边都是顺序一致的原子操作，不会丢唤醒。读端异常退出时 notify_waiters 可能多一，
+代价只是写端每帧多一次空唤醒的系统调用。
+
+使用前需先包含 shared_data.h，并定义 _GNU_SOURCE（syscall）。
+*/
+#ifndef SHM_NOTIFY_H
+#define SHM_NOTIFY_H
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static inline long shm_futex(volatile uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t *)addr, op, val, timeout, NULL, 0);
+}
+
+/* 写端：每次更新共享内存后调用；没有读端在等时只是一次原子加和一次读 */
+static inline void shm_notify_readers(struct shared_weather_data *sd) {
+    __atomic_fetch_add(&sd->notify_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sd->notify_waiters, __ATOMIC_SEQ_CST) != 0) {
+        shm_futex(&sd->notify_seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+static inline uint32_t shm_notify_current(const struct shared_weather_data *sd) {
+    return __atomic_load_n(&sd->notify_seq, __ATOMIC_ACQUIRE);
+}
+
+/*
+读端：等到 last（上次 shm_notify_current / shm_notify_wait 的返回值）之后有新的更新，
+或超时（timeout_ms < 0 表示一直等）。返回当前的 notify_seq；超时或被信号打断时
+可能仍等于 last。读端要让自己的等待线程退出时，调用一次 shm_notify_readers 即可。
+*/
+static inline uint32_t shm_notify_wait(struct shared_weather_data *sd, uint32_t last, int timeout_ms) {
+    uint32_t cur = shm_notify_current(sd);
+    if (cur != last) return cur;
+
+    struct timespec ts, *pts = NULL;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        pts = &ts;
+    }
+    __atomic_fetch_add(&sd->notify_waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sd->notify_seq, __ATOMIC_SEQ_CST) == last) {
+        /* 内核在休眠前再比较一次字的值，写端在这之间递增也不会睡过去 */
+        shm_futex(&sd->notify_seq, FUTEX_WAIT, last, pts);
+    }
+    __atomic_fetch_sub(&sd->notify_waiters, 1, __ATOMIC_SEQ_CST);
+    return shm_notify_current(sd);
+}
+
+#endif /* SHM_NOTIFY_H */
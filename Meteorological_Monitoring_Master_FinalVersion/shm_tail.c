@@ -0,0 +1,252 @@
+/*
+共享内存历史查看：从 receiver_with_shm 的大容量历史环里按序号读帧并逐行打印，
+类似 tail -f（阻塞在写端的变化通知上，空闲时不唤醒）。游标只在本进程里，多个 shm_tail 与 Qt 界面互不影响；
+落后超过环容量时报告被覆盖而跳过的记录条数（一帧 1～3 条），可用来确认某个轮询间隔下是否漏帧。
+-n/-t 改为打印某节点某类型的样本序列（shm_series_read）最近的若干个后退出，序号一列为该节点的样本编号。
+-L 列出多写端通道（几个 receiver_with_shm 冗余接入同一个映射文件时）及各自的计数后退出。
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared_data.h"
+#include "shm_map.h"
+#include "shm_notify.h"
+
+#define TAIL_BATCH 256
+
+static volatile int g_stop = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static void print_frame(uint64_t seq, const struct weather_frame *f) {
+    switch (f->data_type) {
+        case SENSOR_BME280: {
+            const struct bme280_data *d = &f->data.bme280;
+            printf("%llu,BME280,%u,%ld,%.2f,%.2f,%.1f\n", (unsigned long long)seq, d->node_id,
+                   (long)d->timestamp, d->temperature, d->humidity, d->pressure);
+            break;
+        }
+        case SENSOR_LIGHTRAIN: {
+            const struct lightrain_data *d = &f->data.lightrain;
+            printf("%llu,LIGHTRAIN,%u,%ld,%.1f,%u\n", (unsigned long long)seq, d->node_id,
+                   (long)d->timestamp, d->light_intensity, d->rainfall);
+            break;
+        }
+        case SENSOR_SYSTEM_STATUS: {
+            const struct system_status_data *d = &f->data.system_status;
+            printf("%llu,SYSTEM,%u,%ld,%u,%u,%u,%u,%u,%u\n", (unsigned long long)seq, d->node_id,
+                   (long)d->timestamp, d->bme280_status, d->bh1750_status, d->rain_sensor_status,
+                   d->i2c_bus_status, d->uptime_seconds, d->total_errors);
+            break;
+        }
+        case SENSOR_GPS: {
+            const struct gps_data *d = &f->data.gps;
+            printf("%llu,GPS,%u,%ld,%.6s,%.5f,%.5f,%u,%u,%.1f,%.1f\n", (unsigned long long)seq, d->node_id,
+                   (long)d->timestamp, d->utc, d->latitude, d->longitude, d->positioning, d->satellites,
+                   d->hdop, d->altitude);
+            break;
+        }
+        default:
+            printf("%llu,UNKNOWN,%u\n", (unsigned long long)seq, f->data_type);
+            break;
+    }
+}
+
+/* 打印节点 node_id 的 type 类型最近 count 个样本 */
+static int print_series(const struct shared_weather_data *sd, uint8_t type, uint8_t node_id, int count) {
+    int lane = shm_series_lane(sd, type, node_id);
+    if (lane < 0) {
+        fprintf(stderr, "[shm_tail] 节点 %u 没有 %s 样本序列\n", node_id, shm_sensor_type_name(type));
+        return 1;
+    }
+    const struct series_desc *d = &sd->series[type - 1];
+    if (count <= 0 || (uint32_t)count > d->lane_cap) count = (int)d->lane_cap;
+    struct weather_frame *frames = malloc(sizeof(*frames) * (size_t)count);
+    uint32_t *seqs = malloc(sizeof(*seqs) * (size_t)count);
+    if (frames == NULL || seqs == NULL) {
+        perror("[shm_tail] malloc");
+        free(frames);
+        free(seqs);
+        return 1;
+    }
+    int n = shm_series_read(sd, type, node_id, frames, seqs, count);
+    for (int i = 0; i < n; i++) print_frame(seqs[i], &frames[i]);
+    fprintf(stderr, "[shm_tail] 节点 %u %s：lane %d，每节点 %u 个样本，已写入 %u 个，打印 %d 个\n", node_id,
+            shm_sensor_type_name(type), lane, d->lane_cap, __atomic_load_n(&d->lane_head[lane], __ATOMIC_ACQUIRE), n);
+    free(frames);
+    free(seqs);
+    return 0;
+}
+
+/* 列出各写端通道 */
+static int print_lanes(const struct shared_weather_data *sd) {
+    if (!SHM_HAS(sd, lanes)) {
+        fprintf(stderr, "[shm_tail] 格式 %u.%u 没有写端通道\n", SHM_VERSION_MAJOR(sd->hdr.version),
+                SHM_VERSION_MINOR(sd->hdr.version));
+        return 1;
+    }
+    static const char *const status_name[] = { "断开", "连接中", "已连接" };
+    printf("合并者 PID %u，每通道 %u 帧\n", sd->merge_pid, sd->lane_slots);
+    printf("lane,pid,source,status,frames,applied,duplicates,lost,pending\n");
+    for (int i = 0; i < SHM_WRITER_LANES; i++) {
+        const struct writer_lane *l = &sd->lanes[i];
+        uint64_t head = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE);
+        uint64_t merged = __atomic_load_n(&l->merged, __ATOMIC_ACQUIRE);
+        if (l->owner_pid == 0 && head == 0) continue;
+        printf("%d,%u,%.16s:%u,%s,%u,%u,%u,%u,%llu\n", i, l->owner_pid, l->source_ip, l->source_port,
+               l->connection_status < 3 ? status_name[l->connection_status] : "?", shm_stat_get(&l->frames),
+               shm_stat_get(&l->applied), shm_stat_get(&l->duplicates), shm_stat_get(&l->lost),
+               (unsigned long long)(head - merged));
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-s 序号 | -a] [-f] [-q]\n"
+                    "      %s -n 节点 -t 类型 [-c 个数]\n"
+                    "      %s -L\n"
+                    "  -s 序号  从该记录序号开始读（默认从当前位置，只看新帧）\n"
+                    "  -a       从环里还保存着的最早一帧开始\n"
+                    "  -f       读完后阻塞等待写端通知，持续打印新帧\n"
+                    "  -q       不打印帧，只在结束时输出统计\n"
+                    "  -n 节点 -t 类型  打印该节点该类型的样本序列后退出，类型为 bme280/lightrain/system_status/gps\n"
+                    "  -c 个数  与 -n/-t 一起用，只打印最近的若干个（默认全部）\n"
+                    "  -L       列出多写端通道：认领它的接收程序、来源、写入/合并/重复/被覆盖的帧数、待合并帧数\n"
+                    "每行：序号,类型,节点,时间戳,各字段...\n"
+                    "映射文件取环境变量 %s，默认 %s\n",
+            prog, prog, prog, SHARED_MEMORY_PATH_ENV, SHARED_MEMORY_PATH);
+}
+
+int main(int argc, char **argv) {
+    int from_oldest = 0, follow = 0, quiet = 0, have_start = 0, list_lanes = 0;
+    int series_node = -1, series_count = 0;
+    uint8_t series_type = 0;
+    uint64_t cursor = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:afqn:t:c:Lh")) != -1) {
+        switch (opt) {
+        case 's': cursor = strtoull(optarg, NULL, 0); have_start = 1; break;
+        case 'a': from_oldest = 1; break;
+        case 'f': follow = 1; break;
+        case 'q': quiet = 1; break;
+        case 'n': series_node = atoi(optarg); break;
+        case 't':
+            series_type = shm_sensor_type_parse(optarg);
+            if (series_type == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c': series_count = atoi(optarg); break;
+        case 'L': list_lanes = 1; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if ((series_node >= 0 || series_type != 0) &&
+        (series_node < 0 || series_node >= MAX_NODE_SLOTS || series_type == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* 读写映射：32 位 ARM 上 64 位原子读可能编译成 ldrexd/strexd，只读映射会出错 */
+    const char *path = shm_map_path();
+    size_t len = 0;
+    ino_t ino;
+    struct shared_weather_data *sd = shm_map_attach(path, &len, &ino);
+    if (sd == NULL) {
+        if (errno == EPROTO) {
+            struct shared_weather_data *raw = shm_map_open(path, sizeof(struct shm_header), &len, &ino);
+            fprintf(stderr, "[shm_tail] %s 的格式不支持：%s\n", path, raw ? shm_header_check(raw, len) : strerror(errno));
+            if (raw != NULL) shm_map_detach(raw, len);
+        } else {
+            fprintf(stderr, "[shm_tail] 无法映射 %s：%s（receiver_with_shm 是否运行过？）\n", path, strerror(errno));
+        }
+        return 1;
+    }
+    if (list_lanes) {
+        int rc = print_lanes(sd);
+        shm_map_detach(sd, len);
+        return rc;
+    }
+    if (series_type != 0) {
+        int rc = print_series(sd, series_type, (uint8_t)series_node, series_count);
+        shm_map_detach(sd, len);
+        return rc;
+    }
+    uint32_t cap = sd->history_ring_capacity;
+    if (cap == 0) {
+        fprintf(stderr, "[shm_tail] %s 中没有大容量历史环\n", path);
+        shm_map_detach(sd, len);
+        return 1;
+    }
+
+    if (from_oldest) cursor = shm_history_oldest(sd);
+    else if (!have_start) cursor = shm_history_head(sd);
+    fprintf(stderr, "[shm_tail] 格式 %u.%u，历史环 %u 条记录，最早序号 %llu，下一序号 %llu，从 %llu 开始\n",
+            SHM_VERSION_MAJOR(sd->hdr.version), SHM_VERSION_MINOR(sd->hdr.version), cap,
+            (unsigned long long)shm_history_oldest(sd), (unsigned long long)shm_history_head(sd),
+            (unsigned long long)cursor);
+
+    /* 不带 SA_RESTART，Ctrl-C 能打断 futex 等待 */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    static struct weather_frame frames[TAIL_BATCH];
+    static uint64_t seqs[TAIL_BATCH];
+    uint64_t total = 0, lost = 0, reported_lost = 0;
+    uint32_t notified = shm_notify_current(sd);
+    while (!g_stop) {
+        int n = shm_history_read(sd, &cursor, frames, seqs, TAIL_BATCH, &lost);
+        if (lost != reported_lost) {
+            fprintf(stderr, "[shm_tail] 落后超过环容量，%llu 条记录已被覆盖（累计 %llu）\n",
+                    (unsigned long long)(lost - reported_lost), (unsigned long long)lost);
+            reported_lost = lost;
+        }
+        if (!quiet) {
+            for (int i = 0; i < n; i++) print_frame(seqs[i], &frames[i]);
+        }
+        total += (uint64_t)n;
+        if (n == TAIL_BATCH) continue;
+        if (!follow) break;
+        if (sd->writer_pid == 0) {
+            /* 写端迁移到新布局时先把新文件 rename 到位再清旧文件的 writer_pid，序号不变，换过去接着读；
+               否则是接收程序退出了，已写完的帧都读完了 */
+            size_t nlen = 0;
+            ino_t nino;
+            struct shared_weather_data *nsd = shm_map_replaced(path, ino) ? shm_map_attach(path, &nlen, &nino) : NULL;
+            if (nsd == NULL) {
+                fprintf(stderr, "[shm_tail] 接收程序已退出\n");
+                break;
+            }
+            shm_map_detach(sd, len);
+            sd = nsd;
+            len = nlen;
+            ino = nino;
+            notified = shm_notify_current(sd);
+            fprintf(stderr, "[shm_tail] 映射文件已更换（格式 %u.%u，历史环 %u 条记录），从序号 %llu 接着读\n",
+                    SHM_VERSION_MAJOR(sd->hdr.version), SHM_VERSION_MINOR(sd->hdr.version), sd->history_ring_capacity,
+                    (unsigned long long)cursor);
+            continue;
+        }
+        fflush(stdout);
+        notified = shm_notify_wait(sd, notified, -1);
+    }
+
+    fprintf(stderr, "[shm_tail] 读到 %llu 帧，被覆盖 %llu 条记录，下一序号 %llu\n", (unsigned long long)total,
+            (unsigned long long)lost, (unsigned long long)cursor);
+    shm_map_detach(sd, len);
+    return 0;
+}
@@ -0,0 +1,828 @@
+/*
+共享内存写入
+
+receiver_with_shm 把校验通过的帧写进 struct shared_weather_data 的逻辑，
+抽成头文件后微基准（micro_bench.c）可以对同一份代码计时。
+
+使用前需先包含 proto.h 和 shared_data.h，并定义 _GNU_SOURCE。
+*/
+#ifndef SHM_WRITER_H
+#define SHM_WRITER_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "trace.h"
+#include "shm_notify.h"
+
+/* 写一条记录：先标成改写中，写完内容再填校验 */
+static inline void shm_record_store(struct history_record *r, uint64_t seq, const struct history_record *src, int cont) {
+    __atomic_store_n(&r->tag, HISTORY_TAG_BUSY, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->u = src->u;
+    __atomic_store_n(&r->tag, shm_record_tag(seq, src, cont), __ATOMIC_RELEASE);
+}
+
+/* 追加到大容量历史环：payload 是原始帧第 2 字节起的数据字段，拆成首条和续条，全部写完再推进 head */
+static inline void shm_history_ring_push(struct shared_weather_data *sd, uint8_t type, uint8_t node_id,
+                                         time_t ts, const uint8_t *payload) {
+    uint32_t cap = sd->history_ring_capacity;
+    int len = shm_record_payload_len(type);
+    if (cap == 0 || len == 0) return;
+    struct history_record *ring = shm_history_ring(sd);
+    uint64_t s = __atomic_load_n(&sd->history_ring_head, __ATOMIC_RELAXED);   /* 只有写端修改 */
+    struct history_record r;
+    memset(&r, 0, sizeof(r));
+    r.u.head.ts = (uint32_t)ts;
+    r.u.head.type = type;
+    r.u.head.node_id = node_id;
+    memcpy(r.u.head.payload, payload, len < 6 ? len : 6);
+    shm_record_store(&ring[s & (cap - 1)], s, &r, 0);
+    int k = shm_record_count(type);
+    for (int i = 1; i < k; i++) {
+        int off = 6 + (i - 1) * 12;
+        int n = len - off < 12 ? len - off : 12;
+        memset(&r, 0, sizeof(r));
+        memcpy(r.u.cont, payload + off, n);
+        shm_record_store(&ring[(s + i) & (cap - 1)], s + i, &r, 1);
+    }
+    __atomic_store_n(&sd->history_ring_head, s + k, __ATOMIC_RELEASE);
+}
+
+/*
+建文件时确定布局并填好头部（魔数除外，文件完整后由调用方最后写）：历史环 ring_cap 条记录紧跟在结构体之后，
+各类型每个 lane 保存 series_cap[type - 1] 个样本（2 的幂，0 表示不保存），样本区依次排在历史环之后，
+最后是 SHM_WRITER_LANES 个写端通道的帧环。映射长度至少为 shm_layout_size(ring_cap, series_cap)
+*/
+static inline void shm_layout_init(struct shared_weather_data *sd, uint32_t ring_cap, const uint32_t *series_cap) {
+    struct shm_header *h = &sd->hdr;
+    size_t off = SHARED_MEMORY_SIZE;
+    h->version = SHM_SCHEMA_VERSION;
+    h->header_size = sizeof(*h);
+    h->data_size = sizeof(*sd);
+    h->region_size = shm_layout_size(ring_cap, series_cap);
+    h->section_count = SHM_SECTION_LANES + 1;
+    h->sections[SHM_SECTION_RING].offset = off;
+    h->sections[SHM_SECTION_RING].size = (uint64_t)ring_cap * sizeof(struct history_record);
+    off += (size_t)h->sections[SHM_SECTION_RING].size;
+    sd->history_ring_capacity = ring_cap;
+    for (int t = 0; t < SERIES_TYPES; t++) {
+        struct series_desc *d = &sd->series[t];
+        d->lane_cap = series_cap[t];
+        d->elem_size = (uint32_t)shm_series_elem_size((uint8_t)(t + 1));
+        h->sections[SHM_SECTION_SERIES + t].offset = off;
+        h->sections[SHM_SECTION_SERIES + t].size = shm_series_bytes((uint8_t)(t + 1), series_cap[t]);
+        off += (size_t)h->sections[SHM_SECTION_SERIES + t].size;
+    }
+    sd->lane_slots = WRITER_LANE_SLOTS;
+    h->sections[SHM_SECTION_LANES].offset = off;
+    h->sections[SHM_SECTION_LANES].size = (uint64_t)SHM_WRITER_LANES * WRITER_LANE_SLOTS * sizeof(struct lane_slot);
+}
+
+/* lane 分完后，最后一个样本早于新样本这么多秒的 lane 可以让给新节点 */
+#define SERIES_LANE_IDLE_SEC 3600
+
+/*
+第 t 种类型的 lane 分完后给新节点腾一个，返回 lane 号加一，没有可腾的返回 0。优先没有节点占着的 lane
+（写端改分配时崩溃留下的），其次是空闲超过 SERIES_LANE_IDLE_SEC 秒的 lane 中最久没更新的。
+先撤掉原节点的映射，再把 lane 编号整体往后跳一圈：lane 里的旧样本编号都对不上新编号，读端不会当成新节点的
+*/
+static inline uint8_t shm_series_evict(struct shared_weather_data *sd, int t, time_t now) {
+    struct series_desc *d = &sd->series[t];
+    int owner[SERIES_LANES];
+    for (int i = 0; i < SERIES_LANES; i++) owner[i] = -1;
+    for (int n = 0; n < MAX_NODE_SLOTS; n++) {
+        uint8_t l = d->lane_of_node[n];
+        if (l != 0 && l <= SERIES_LANES) owner[l - 1] = n;
+    }
+    int victim = -1;
+    uint32_t oldest = 0;
+    for (int i = 0; i < SERIES_LANES; i++) {
+        if (owner[i] < 0) {
+            victim = i;
+            break;
+        }
+        uint32_t h = d->lane_head[i];
+        uint32_t last = h == 0 ? 0 : shm_series_at(sd, t, i, h - 1)->ts;
+        if ((int64_t)now - (int64_t)last < SERIES_LANE_IDLE_SEC) continue;
+        if (victim < 0 || last < oldest) {
+            victim = i;
+            oldest = last;
+        }
+    }
+    if (victim < 0) return 0;
+    if (owner[victim] >= 0) __atomic_store_n(&d->lane_of_node[owner[victim]], 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&d->lane_head[victim], d->lane_head[victim] + d->lane_cap, __ATOMIC_RELEASE);
+    return (uint8_t)(victim + 1);
+}
+
+/* 追加到节点的样本序列：节点第一次出现时分配 lane，lane 分完后腾空闲最久的（shm_series_evict），
+   腾不出来才只计数。样本先标成改写中，写完再填编号 */
+static inline void shm_series_push(struct shared_weather_data *sd, uint8_t type, uint8_t node_id,
+                                   time_t ts, const uint8_t *payload) {
+    if (type < 1 || type > SERIES_TYPES) return;
+    struct series_desc *d = &sd->series[type - 1];
+    if (d->lane_cap == 0) return;
+    uint8_t lane = d->lane_of_node[node_id];
+    if (lane == 0) {
+        if (d->lanes_used < SERIES_LANES) {
+            shm_stat_inc(&d->lanes_used);
+            lane = (uint8_t)d->lanes_used;
+        } else if ((lane = shm_series_evict(sd, type - 1, ts)) == 0) {
+            shm_stat_inc(&d->dropped);
+            return;
+        }
+        __atomic_store_n(&d->lane_of_node[node_id], lane, __ATOMIC_RELEASE);
+    }
+    uint32_t s = d->lane_head[lane - 1];      /* 只有写端修改 */
+    struct series_sample *e = shm_series_at(sd, type - 1, lane - 1, s);
+    __atomic_store_n(&e->seq, HISTORY_TAG_BUSY, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ts = (uint32_t)ts;
+    memcpy(e + 1, payload, (size_t)shm_record_payload_len(type));
+    __atomic_store_n(&e->seq, s + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&d->lane_head[lane - 1], s + 1, __ATOMIC_RELEASE);
+}
+
+/* 把 latest_data 追加到历史环形缓冲区（最近 MAX_HISTORY_COUNT 帧，各类型混在一起），
+   原始帧 frame 追加到大容量历史环和发送节点该类型的样本序列 */
+static inline void shm_history_push(struct shared_weather_data *sd, const uint8_t *frame, time_t ts) {
+    uint32_t write_idx = sd->history_write_index;
+    sd->history[write_idx] = sd->latest_data;
+    
+    /* 更新写入索引 */
+    sd->history_write_index = (write_idx + 1) % MAX_HISTORY_COUNT;
+    
+    /* 更新历史数据计数 */
+    if (sd->history_count < MAX_HISTORY_COUNT) {
+        shm_stat_inc(&sd->history_count);
+    }
+
+    shm_history_ring_push(sd, sd->latest_data.data_type, frame[0], ts, frame + 2);
+    shm_series_push(sd, sd->latest_data.data_type, frame[0], ts, frame + 2);
+}
+
+/*
+接管上次留下的映射文件（写端崩溃或掉电之后）：
+停在奇数的顺序锁补成偶数（内容可能新旧混杂，下一帧到来时覆盖）。历史环的 head 和记录不一定同时落盘，
+先从文件里的 head 往后逐帧核对，把已落盘但 head 没来得及记下的完整帧接上；再按新的 head
+逐条核对每个位置应有的序号，校验不对（空、改写到一半、只落盘一半、上一圈留下的）的记录清零，
+读端按“被覆盖”计入 lost。样本序列同样从各 lane 文件里的 head 往后接上已落盘的样本；
+lane 分配表和 lanes_used 可能只落盘了一个，取两者中较大的，已分出去的 lane 不再分给别的节点。
+写端通道也从文件里的 head 往后接上已落盘的帧，没合并完的由合并者接着合并。
+返回保留下来的完整帧数，*dropped 返回清掉的记录数。
+*/
+static inline uint64_t shm_recover(struct shared_weather_data *sd, uint64_t *dropped) {
+    if (sd->seq & 1) sd->seq++;
+    for (int i = 0; i < MAX_NODE_SLOTS; i++) {
+        if (sd->nodes[i].seq & 1) sd->nodes[i].seq++;
+    }
+
+    uint32_t cap = sd->history_ring_capacity;
+    struct history_record *ring = shm_history_ring(sd);
+    struct weather_frame f;
+    uint64_t head = sd->history_ring_head, kept = 0;
+    *dropped = 0;
+    for (uint64_t limit = head + cap; head < limit; ) {
+        int k = shm_history_load_frame(sd, head, limit, &f);
+        if (k <= 0) break;
+        head += (uint64_t)k;
+    }
+
+    uint64_t first = head > cap ? head - cap : 0;
+    for (uint64_t s = first; s < first + cap; s++) {
+        struct history_record *r = &ring[s & (cap - 1)];
+        struct history_record c;
+        if (r->tag == 0) continue;
+        int kind = s < head ? shm_record_load(sd, s, &c) : 0;
+        if (kind == 0) {
+            r->tag = 0;
+            (*dropped)++;
+        } else if (kind == 1) {
+            kept++;
+        }
+    }
+    sd->history_ring_head = head;
+
+    for (int t = 0; t < SERIES_TYPES; t++) {
+        struct series_desc *d = &sd->series[t];
+        if (d->lane_cap == 0) continue;
+        uint32_t used = d->lanes_used > SERIES_LANES ? SERIES_LANES : d->lanes_used;
+        for (int i = 0; i < MAX_NODE_SLOTS; i++) {
+            if (d->lane_of_node[i] > SERIES_LANES) d->lane_of_node[i] = 0;
+            else if (d->lane_of_node[i] > used) used = d->lane_of_node[i];
+        }
+        d->lanes_used = used;
+        for (uint32_t lane = 0; lane < used; lane++) {
+            uint32_t h = d->lane_head[lane];
+            for (uint32_t k = 0; k < d->lane_cap && shm_series_at(sd, t, (int)lane, h)->seq == h + 1; k++) h++;
+            d->lane_head[lane] = h;
+        }
+    }
+
+    if (SHM_HAS(sd, lanes)) {
+        for (int i = 0; i < SHM_WRITER_LANES; i++) {
+            struct writer_lane *l = &sd->lanes[i];
+            uint64_t h = l->head;
+            for (uint32_t k = 0; k < sd->lane_slots && shm_lane_slot(sd, i, h)->seq == h + 1; k++) h++;
+            l->head = h;
+            if (l->merged > h) l->merged = h;
+        }
+    }
+    return kept;
+}
+
+/*
+在线迁移：把 src（同一主版本、已经 shm_recover 过的旧文件）搬进按新布局新建的 dst（已清零，长度为
+shm_layout_size(ring_cap, series_cap)）。结构体里两边都有的字段原样复制，旧文件没有的（次版本更低）保持 0；
+历史环记录和样本按原来的序号放进新容量下的位置，容量变小时只留最近的。序号、样本编号都不变，
+读端换到新文件后游标接着用。写端通道不搬（调用前已没有别的写端，剩下的帧已合并），在新文件里从空开始。返回搬过去的记录条数，*samples 返回样本数。
+*/
+static inline uint64_t shm_migrate(struct shared_weather_data *dst, const struct shared_weather_data *src,
+                                   uint32_t ring_cap, const uint32_t *series_cap, uint64_t *samples) {
+    size_t n = src->hdr.data_size < sizeof(*dst) ? src->hdr.data_size : sizeof(*dst);
+    memcpy((uint8_t *)dst + sizeof(dst->hdr), (const uint8_t *)src + sizeof(src->hdr), n - sizeof(src->hdr));
+    shm_layout_init(dst, ring_cap, series_cap);
+    dst->notify_waiters = 0;                  /* 读端换到新文件后重新登记 */
+    dst->merge_pid = 0;
+    dst->lane_notify = dst->lane_waiters = 0;
+    memset(dst->lanes, 0, sizeof(dst->lanes));
+
+    uint64_t copied = 0;
+    uint32_t old_cap = src->history_ring_capacity;
+    uint32_t keep = old_cap < ring_cap ? old_cap : ring_cap;
+    uint64_t head = src->history_ring_head;
+    struct history_record *ring = shm_history_ring(dst);
+    for (uint64_t s = head > keep ? head - keep : 0; s < head; s++) {
+        struct history_record r;
+        int kind = shm_record_load(src, s, &r);
+        if (kind == 0) continue;
+        struct history_record *d = &ring[s & (ring_cap - 1)];
+        d->u = r.u;
+        d->tag = shm_record_tag(s, &r, kind == 2);
+        copied++;
+    }
+
+    *samples = 0;
+    for (int t = 0; t < SERIES_TYPES; t++) {
+        uint32_t old_lane = src->series[t].lane_cap, new_lane = series_cap[t];
+        if (old_lane == 0 || new_lane == 0 || src->series[t].elem_size != dst->series[t].elem_size) continue;
+        uint32_t lane_keep = old_lane < new_lane ? old_lane : new_lane;
+        for (uint32_t lane = 0; lane < dst->series[t].lanes_used && lane < SERIES_LANES; lane++) {
+            uint32_t h = dst->series[t].lane_head[lane];
+            for (uint32_t s = h > lane_keep ? h - lane_keep : 0; s < h; s++) {
+                const struct series_sample *e = shm_series_at(src, t, (int)lane, s);
+                if (e->seq != s + 1) continue;
+                memcpy(shm_series_at(dst, t, (int)lane, s), e, dst->series[t].elem_size);
+                (*samples)++;
+            }
+        }
+    }
+    return copied;
+}
+
+/* 把 latest_data 写入发送节点的槽位并置脏位 */
+static inline void shm_node_update(struct shared_weather_data *sd, uint8_t node_id) {
+    struct node_slot *ns = &sd->nodes[node_id];
+    shm_seq_write_begin(&ns->seq);
+    switch (sd->latest_data.data_type) {
+        case SENSOR_BME280:        ns->bme280 = sd->latest_bme280; break;
+        case SENSOR_LIGHTRAIN:     ns->lightrain = sd->latest_lightrain; break;
+        case SENSOR_SYSTEM_STATUS: ns->system_status = sd->latest_system_status; break;
+        case SENSOR_GPS:           ns->gps = sd->latest_gps; break;
+    }
+    shm_seq_write_end(&ns->seq);
+    shm_node_mark_dirty(sd, node_id);
+}
+
+/* 校验一帧并写入共享内存：更新对应类型的最新数据、追加历史记录、递增更新计数器。
+   校验失败只累加 total_errors；成功时的全部修改处在同一个顺序锁写区间内 */
+static inline void shm_write_frame(struct shared_weather_data *sd, const uint8_t *frame) {
+    uint8_t node_id = frame[0];
+    uint8_t cmd = frame[1];
+    time_t now = time(NULL);
+    uint32_t trace_id = trace_sampled(frame);
+    uint64_t t_shm = trace_id ? trace_now_ns() : 0;
+    
+    /* 根据命令类型解析数据并写入共享内存 */
+    switch (cmd) {
+        case CMD_BME280: {
+            if (frame[10] != END_SYMBOL[0]) {
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 解析BME280数据
+            int16_t t100 = (frame[2] << 8) | frame[3];
+            int16_t p10 = (frame[4] << 8) | frame[5];
+            int16_t h100 = (frame[6] << 8) | frame[7];
+            uint8_t recv_crc4 = frame[8] & 0x0F;
+            uint8_t frame_cs = frame[9];
+            
+            // 验证帧校验和
+            uint8_t calc_cs = 0;
+            for (int i = 0; i < 9; i++) calc_cs ^= frame[i];
+            if (calc_cs != frame_cs) {
+                //printf("[shared_memory] Node %d BME280 frame checksum error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 验证CRC4
+            uint8_t crc_data[6] = {frame[2], frame[3], frame[4], frame[5], frame[6], frame[7]};
+            uint8_t calc_crc4 = Calculate_CRC4(crc_data, 6);
+            if (calc_crc4 != recv_crc4) {
+                //printf("[shared_memory] Node %d BME280 CRC4 error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            /* 校验通过后才进入写区间，错误帧不打扰读端 */
+            shm_seq_write_begin(&sd->seq);
+            // 更新BME280数据
+            sd->latest_bme280.node_id = node_id;
+            sd->latest_bme280.temperature = t100 / 100.0f;
+            sd->latest_bme280.pressure = p10 / 10.0f;
+            sd->latest_bme280.humidity = h100 / 100.0f;
+            sd->latest_bme280.timestamp = now;
+            sd->latest_bme280.valid = 1;
+            
+            // 更新通用数据帧
+            sd->latest_data.data_type = SENSOR_BME280;
+            sd->latest_data.data.bme280 = sd->latest_bme280;
+            
+            shm_stat_inc(&sd->bme280_count);
+            //printf("[shared_memory] BME280 data updated: Node=%u, T=%.2f°C, P=%.1f hPa, H=%.2f%%\n",
+            //       node_id, sd->latest_bme280.temperature, 
+            //       sd->latest_bme280.pressure, sd->latest_bme280.humidity);
+            break;
+        }
+        
+        case CMD_LIGHTRAIN: {
+            if (frame[7] != END_SYMBOL[0]) {
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 解析光强雨量数据
+            int16_t lux10 = (frame[2] << 8) | frame[3];
+            uint8_t rain = frame[4];
+            uint8_t recv_crc4 = frame[5] & 0x0F;
+            uint8_t frame_cs = frame[6];
+            
+            // 验证帧校验和
+            uint8_t calc_cs = 0;
+            for (int i = 0; i < 6; i++) calc_cs ^= frame[i];
+            if (calc_cs != frame_cs) {
+                //printf("[shared_memory] Node %d LightRain frame checksum error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 验证CRC4
+            uint8_t crc_data[3] = {frame[2], frame[3], frame[4]};
+            uint8_t calc_crc4 = Calculate_CRC4(crc_data, 3);
+            if (calc_crc4 != recv_crc4) {
+                //printf("[shared_memory] Node %d LightRain CRC4 error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            shm_seq_write_begin(&sd->seq);
+            // 更新光强雨量数据
+            sd->latest_lightrain.node_id = node_id;
+            sd->latest_lightrain.light_intensity = lux10 / 10.0f;
+            sd->latest_lightrain.rainfall = rain;
+            sd->latest_lightrain.timestamp = now;
+            sd->latest_lightrain.valid = 1;
+            
+            // 更新通用数据帧
+            sd->latest_data.data_type = SENSOR_LIGHTRAIN;
+            sd->latest_data.data.lightrain = sd->latest_lightrain;
+            
+            shm_stat_inc(&sd->lightrain_count);
+            //printf("[shared_memory] LightRain data updated: Node=%u, Lux=%.1f lx, Rain=%u%%\n",
+            //       node_id, sd->latest_lightrain.light_intensity, 
+            //       sd->latest_lightrain.rainfall);
+            break;
+        }
+        
+        case CMD_SYSTEM_STATUS: {
+            if (frame[14] != END_SYMBOL[0]) {
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 解析系统状态数据
+            uint8_t bme280_status = frame[2];
+            uint8_t bh1750_status = frame[3];
+            uint8_t rain_sensor_status = frame[4];
+            uint8_t i2c_bus_status = frame[5];
+            uint32_t uptime_seconds = (frame[6] << 24) | (frame[7] << 16) | (frame[8] << 8) | frame[9];
+            uint16_t total_errors = (frame[10] << 8) | frame[11];
+            uint8_t frame_cs = frame[13];
+            
+            // 验证帧校验和
+            uint8_t calc_cs = 0;
+            for (int i = 0; i < 13; i++) calc_cs ^= frame[i];
+            if (calc_cs != frame_cs) {
+                //printf("[shared_memory] Node %d SystemStatus frame checksum error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            shm_seq_write_begin(&sd->seq);
+            // 更新系统状态数据
+            sd->latest_system_status.node_id = node_id;
+            sd->latest_system_status.bme280_status = bme280_status;
+            sd->latest_system_status.bh1750_status = bh1750_status;
+            sd->latest_system_status.rain_sensor_status = rain_sensor_status;
+            sd->latest_system_status.i2c_bus_status = i2c_bus_status;
+            sd->latest_system_status.uptime_seconds = uptime_seconds;
+            sd->latest_system_status.total_errors = total_errors;
+            sd->latest_system_status.timestamp = now;
+            sd->latest_system_status.valid = 1;
+            
+            // 更新通用数据帧
+            sd->latest_data.data_type = SENSOR_SYSTEM_STATUS;
+            sd->latest_data.data.system_status = sd->latest_system_status;
+            
+            shm_stat_inc(&sd->system_status_count);
+            //printf("[shared_memory] SystemStatus data updated: Node=%u, Uptime=%u s, Errors=%u\n",
+            //       node_id, uptime_seconds, total_errors);
+            break;
+        }
+        
+        case CMD_GPS: {
+            if (frame[24] != END_SYMBOL[0]) {
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 解析GPS数据
+            char utc[7] = {0};
+            memcpy(utc, &frame[2], 6);
+            int32_t lat1e5 = (frame[8] << 24) | (frame[9] << 16) | (frame[10] << 8) | frame[11];
+            int32_t lon1e5 = (frame[12] << 24) | (frame[13] << 16) | (frame[14] << 8) | frame[15];
+            uint8_t positioning = frame[16];
+            uint8_t sats = frame[17];
+            int16_t hdop10 = (frame[18] << 8) | frame[19];
+            int16_t alt10 = (frame[20] << 8) | frame[21];
+            uint8_t recv_crc4 = frame[22] & 0x0F;
+            uint8_t frame_cs = frame[23];
+            
+            // 验证帧校验和
+            uint8_t calc_cs = 0;
+            for (int i = 0; i < 23; i++) calc_cs ^= frame[i];
+            if (calc_cs != frame_cs) {
+                //printf("[shared_memory] Node %d GPS frame checksum error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            // 验证CRC4
+            uint8_t crc_data[20];
+            memcpy(crc_data, &frame[2], 20);
+            uint8_t calc_crc4 = Calculate_CRC4(crc_data, 20);
+            if (calc_crc4 != recv_crc4) {
+                //printf("[shared_memory] Node %d GPS CRC4 error!\n", node_id);
+                shm_stat_inc(&sd->total_errors);
+                return;
+            }
+            
+            shm_seq_write_begin(&sd->seq);
+            // 更新GPS数据
+            sd->latest_gps.node_id = node_id;
+            strncpy(sd->latest_gps.utc, utc, sizeof(sd->latest_gps.utc) - 1);
+            sd->latest_gps.latitude = lat1e5 / 1e5f;
+            sd->latest_gps.longitude = lon1e5 / 1e5f;
+            sd->latest_gps.positioning = positioning;
+            sd->latest_gps.satellites = sats;
+            sd->latest_gps.hdop = hdop10 / 10.0f;
+            sd->latest_gps.altitude = alt10 / 10.0f;
+            sd->latest_gps.timestamp = now;
+            sd->latest_gps.valid = 1;
+            
+            // 更新通用数据帧
+            sd->latest_data.data_type = SENSOR_GPS;
+            sd->latest_data.data.gps = sd->latest_gps;
+            
+            shm_stat_inc(&sd->gps_count);
+            //printf("[shared_memory] GPS data updated: Node=%u, UTC=%s, Lat=%.5f, Lon=%.5f\n",
+            //       node_id, utc, sd->latest_gps.latitude, sd->latest_gps.longitude);
+            break;
+        }
+        
+        default:
+            printf("[shared_memory] Unknown command: 0x%02X\n", cmd);
+            shm_stat_inc(&sd->total_errors);
+            return;
+    }
+    
+    /* 按节点保存，几次轮询之间多个节点先后上报也不会互相覆盖 */
+    shm_node_update(sd, node_id);
+
+    /* 添加到历史缓冲区 */
+    shm_history_push(sd, frame, now);
+
+    /* 界面据此把自己的区间挂到同一帧上，需在计数器变化之前写好 */
+    uint64_t t_done = trace_id ? trace_now_ns() : 0;
+    sd->trace_frame_id = trace_id;
+    sd->trace_write_ns = t_done;
+    trace_span(TRACE_RECV_SHM_WRITE, trace_id, t_shm, t_done);
+
+    /* 更新计数器和统计信息 */
+    shm_stat_inc(&sd->update_counter);
+    shm_stat_inc(&sd->total_received);
+    __atomic_store_n(&sd->last_update_time, now, __ATOMIC_RELAXED);
+    shm_seq_write_end(&sd->seq);
+
+    /* 唤醒阻塞等待的读端，界面不用再定时轮询 */
+    shm_notify_readers(sd);
+}
+
+/* ================== 多写端通道 ================== */
+
+/* 进程是否还在（与 boot_id 的判断一样，只认 ESRCH；没有权限发信号的进程也算活着） */
+static inline int shm_pid_alive(uint32_t pid) {
+    return pid != 0 && (kill((pid_t)pid, 0) == 0 || errno != ESRCH);
+}
+
+/* 认领一个空闲或原主已退出的通道，返回通道号；都被占用时返回 -1。
+   原主留下没合并完的帧不动，新主从原来的 head 接着写 */
+static inline int shm_lane_claim(struct shared_weather_data *sd, uint32_t pid) {
+    for (int i = 0; i < SHM_WRITER_LANES; i++) {
+        struct writer_lane *l = &sd->lanes[i];
+        uint32_t owner = __atomic_load_n(&l->owner_pid, __ATOMIC_ACQUIRE);
+        if (owner == pid || (owner != 0 && shm_pid_alive(owner))) continue;
+        if (__atomic_compare_exchange_n(&l->owner_pid, &owner, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            l->connection_status = CONNECTION_DISCONNECTED;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline void shm_lane_release(struct shared_weather_data *sd, int lane, uint32_t pid) {
+    __atomic_compare_exchange_n(&sd->lanes[lane].owner_pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* 通道的写者：叫醒合并者（同 shm_notify_readers） */
+static inline void shm_lane_notify(struct shared_weather_data *sd) {
+    __atomic_fetch_add(&sd->lane_notify, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sd->lane_waiters, __ATOMIC_SEQ_CST) != 0) {
+        shm_futex(&sd->lane_notify, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+/* 通道的写者：追加一帧（单写者，不加锁）。帧槽先标成改写中，写完再填序号、推进 head。
+   只在通道原来是空的（合并者已合并到本帧之前）时叫醒合并者：不空时合并者还在本轮归并里，
+   存 merged 后会重读 head 看到本帧（两边都是 SEQ_CST，二者至少有一个成立），积压时不再每帧一次 FUTEX_WAKE */
+static inline void shm_lane_push(struct shared_weather_data *sd, int lane, const uint8_t *frame, uint64_t ts_ns) {
+    struct writer_lane *l = &sd->lanes[lane];
+    uint64_t h = l->head;                     /* 只有本通道的写者修改 */
+    struct lane_slot *s = shm_lane_slot(sd, lane, h);
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->ts_ns = ts_ns;
+    memcpy(s->frame, frame, WRITER_LANE_FRAME);
+    __atomic_store_n(&s->seq, h + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&l->head, h + 1, __ATOMIC_SEQ_CST);
+    shm_stat_inc(&l->frames);
+    if (__atomic_load_n(&l->merged, __ATOMIC_SEQ_CST) >= h) shm_lane_notify(sd);
+}
+
+/* 通道的写者：更新本通道的错误信息，由合并者转到全局 last_error */
+static inline void shm_lane_set_error(struct shared_weather_data *sd, int lane, const char *msg) {
+    struct writer_lane *l = &sd->lanes[lane];
+    strncpy(l->last_error, msg, sizeof(l->last_error) - 1);
+    l->last_error[sizeof(l->last_error) - 1] = '\0';
+    __atomic_fetch_add(&l->error_seq, 1, __ATOMIC_RELEASE);
+}
+
+/* 合并者：等到有通道写入新帧（seen 为等待前读到的 lane_notify），或超时 */
+static inline void shm_lane_wait(struct shared_weather_data *sd, uint32_t seen, int timeout_ms) {
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    __atomic_fetch_add(&sd->lane_waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sd->lane_notify, __ATOMIC_SEQ_CST) == seen) {
+        shm_futex(&sd->lane_notify, FUTEX_WAIT, seen, &ts);
+    }
+    __atomic_fetch_sub(&sd->lane_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/* 成为合并者：merge_pid 为 0 或原合并者已退出时用 CAS 接管。已经是合并者时也返回 1 */
+static inline int shm_merge_claim(struct shared_weather_data *sd, uint32_t pid) {
+    uint32_t cur = __atomic_load_n(&sd->merge_pid, __ATOMIC_ACQUIRE);
+    if (cur == pid) return 1;
+    if (cur != 0 && shm_pid_alive(cur)) return 0;
+    return __atomic_compare_exchange_n(&sd->merge_pid, &cur, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* 放弃合并者身份，并叫醒在 merge_pid 上等着接手的进程 */
+static inline void shm_merge_release(struct shared_weather_data *sd, uint32_t pid) {
+    if (__atomic_compare_exchange_n(&sd->merge_pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        shm_futex(&sd->merge_pid, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+/* 不是合并者的进程：等当前合并者放弃（shm_merge_release），崩溃时只能靠超时后重新检查 */
+static inline void shm_merge_wait(struct shared_weather_data *sd, int timeout_ms) {
+    uint32_t cur = __atomic_load_n(&sd->merge_pid, __ATOMIC_ACQUIRE);
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    if (cur != 0) shm_futex(&sd->merge_pid, FUTEX_WAIT, cur, &ts);
+}
+
+/*
+去重表：以帧内容（节点、类型、数据字段和发送端时间戳，即 FRAME_ORIGIN_OFF 之前的字节）的哈希为键，
+按哈希分组，每组 SHM_DEDUP_WAYS 项，组满时替换最早的一项；慢的通道落后几十毫秒时中间的帧不会把
+还在窗口内的项挤掉。两个通道在 SHM_DEDUP_WINDOW_NS 内到达的相同帧只写入一次；
+同一通道里的重复帧是节点真的又发了一次，照常写入。由合并者进程私有，不放在共享内存里
+*/
+#define SHM_DEDUP_SLOTS     4096
+#define SHM_DEDUP_WAYS      8
+#define SHM_DEDUP_WINDOW_NS 2000000000ull
+
+struct shm_dedup {
+    uint64_t key[SHM_DEDUP_SLOTS];
+    uint64_t ts_ns[SHM_DEDUP_SLOTS];
+    uint8_t lane[SHM_DEDUP_SLOTS];
+};
+
+/* 帧已由其他通道在窗口内写入过时返回 1；否则登记并返回 0 */
+static inline int shm_dedup_seen(struct shm_dedup *dd, const uint8_t *frame, int lane, uint64_t ts_ns) {
+    uint64_t h = 1469598103934665603ull;      /* FNV-1a */
+    for (int i = 0; i < FRAME_ORIGIN_OFF; i++) h = (h ^ frame[i]) * 1099511628211ull;
+    if (h == 0) h = 1;
+    uint32_t base = ((uint32_t)(h ^ (h >> 32)) & (SHM_DEDUP_SLOTS - 1)) & ~(uint32_t)(SHM_DEDUP_WAYS - 1);
+    uint32_t slot = base;
+    for (uint32_t i = base; i < base + SHM_DEDUP_WAYS; i++) {
+        if (dd->key[i] == h) {
+            uint64_t dt = ts_ns > dd->ts_ns[i] ? ts_ns - dd->ts_ns[i] : dd->ts_ns[i] - ts_ns;
+            if (dd->lane[i] != lane && dt < SHM_DEDUP_WINDOW_NS) return 1;
+            slot = i;
+            break;
+        }
+        if (dd->ts_ns[i] < dd->ts_ns[slot]) slot = i;
+    }
+    dd->key[slot] = h;
+    dd->ts_ns[slot] = ts_ns;
+    dd->lane[slot] = (uint8_t)lane;
+    return 0;
+}
+
+/*
+合并者：把各通道里还没合并的帧按到达时刻归并，去重后经 shm_write_frame 写入，返回处理的帧数。
+每次取所有通道待合并帧里到达最早的一帧，最多 budget 帧。帧槽读前读后各查一次序号，
+写者已绕回一圈把它改写了的帧计入该通道的 lost
+*/
+static inline int shm_merge_lanes(struct shared_weather_data *sd, struct shm_dedup *dd, int budget) {
+    uint32_t slots = sd->lane_slots;
+    int n = 0;
+    while (n < budget) {
+        int best = -1;
+        uint64_t best_ts = 0;
+        struct lane_slot copy;
+        for (int i = 0; i < SHM_WRITER_LANES; i++) {
+            struct writer_lane *l = &sd->lanes[i];
+            uint64_t head = __atomic_load_n(&l->head, __ATOMIC_SEQ_CST);
+            while (l->merged < head) {
+                if (head - l->merged > slots) {
+                    shm_stat_add(&l->lost, (uint32_t)(head - slots - l->merged));
+                    __atomic_store_n(&l->merged, head - slots, __ATOMIC_SEQ_CST);
+                }
+                const struct lane_slot *s = shm_lane_slot(sd, i, l->merged);
+                if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == l->merged + 1) break;
+                shm_stat_inc(&l->lost);
+                __atomic_store_n(&l->merged, l->merged + 1, __ATOMIC_SEQ_CST);
+            }
+            if (l->merged == head) continue;
+            uint64_t ts = shm_lane_slot(sd, i, l->merged)->ts_ns;
+            if (best < 0 || ts < best_ts) {
+                best = i;
+                best_ts = ts;
+            }
+        }
+        if (best < 0) break;
+
+        struct writer_lane *l = &sd->lanes[best];
+        const struct lane_slot *s = shm_lane_slot(sd, best, l->merged);
+        copy = *s;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != l->merged + 1) {
+            shm_stat_inc(&l->lost);
+        } else if (shm_dedup_seen(dd, copy.frame, best, copy.ts_ns)) {
+            shm_stat_inc(&l->duplicates);
+        } else {
+            shm_write_frame(sd, copy.frame);
+            shm_stat_inc(&l->applied);
+        }
+        __atomic_store_n(&l->merged, l->merged + 1, __ATOMIC_SEQ_CST);
+        n++;
+    }
+    return n;
+}
+
+/*
+合并者进程自己收到的帧：别的通道都没有主人（本进程是唯一的写端）时不经通道，先把各通道剩下的帧合并完，
+再去重后直接 shm_write_frame，省掉每帧一次叫醒合并线程的 FUTEX_WAKE 和上下文切换。帧照样登记进去重表，
+随后加入的接收程序送来的同一帧仍能认出来。调用方须与本进程的合并线程互斥（两边都写全局结构和 dd）。
+不是合并者或还有别的写端时返回 0，调用方改用 shm_lane_push
+*/
+static inline int shm_lane_write_through(struct shared_weather_data *sd, struct shm_dedup *dd, int lane, uint32_t pid,
+                                         const uint8_t *frame, uint64_t ts_ns) {
+    if (__atomic_load_n(&sd->merge_pid, __ATOMIC_ACQUIRE) != pid) return 0;
+    for (int i = 0; i < SHM_WRITER_LANES; i++) {
+        if (i != lane && __atomic_load_n(&sd->lanes[i].owner_pid, __ATOMIC_ACQUIRE) != 0) return 0;
+    }
+    struct writer_lane *l = &sd->lanes[lane];
+    shm_merge_lanes(sd, dd, INT_MAX);
+    shm_stat_inc(&l->frames);
+    if (shm_dedup_seen(dd, frame, lane, ts_ns)) {
+        shm_stat_inc(&l->duplicates);
+    } else {
+        shm_write_frame(sd, frame);
+        shm_stat_inc(&l->applied);
+    }
+    return 1;
+}
+
+/*
+合并者：把各通道的连接状态、接收侧错误计数和错误信息汇总到全局字段。全局连接状态取各通道中最好的，
+服务器地址显示该通道的；有变化时通知读端。返回是否有变化
+*/
+static inline int shm_merge_publish(struct shared_weather_data *sd) {
+    int changed = 0, best = -1;
+    uint8_t status = CONNECTION_DISCONNECTED;
+    for (int i = 0; i < SHM_WRITER_LANES; i++) {
+        struct writer_lane *l = &sd->lanes[i];
+        uint32_t errors = shm_stat_get(&l->errors);
+        if (errors != l->errors_seen) {
+            shm_stat_add(&sd->total_errors, errors - l->errors_seen);
+            l->errors_seen = errors;
+            changed = 1;
+        }
+        uint32_t es = __atomic_load_n(&l->error_seq, __ATOMIC_ACQUIRE);
+        if (es != l->error_seen) {
+            char msg[sizeof(l->last_error)];
+            memcpy(msg, l->last_error, sizeof(msg));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&l->error_seq, __ATOMIC_RELAXED) == es) {   /* 写者正在改时下一轮再转 */
+                msg[sizeof(msg) - 1] = '\0';
+                snprintf(sd->last_error, sizeof(sd->last_error), "%s", msg);
+                l->error_seen = es;
+                changed = 1;
+            }
+        }
+        if (__atomic_load_n(&l->owner_pid, __ATOMIC_ACQUIRE) != 0 && (best < 0 || l->connection_status > status)) {
+            status = l->connection_status;
+            best = i;
+        }
+    }
+    if (status != sd->connection_status) {
+        sd->connection_status = status;
+        changed = 1;
+    }
+    if (best >= 0 && (sd->server_port != sd->lanes[best].source_port ||
+                      strncmp(sd->server_ip, sd->lanes[best].source_ip, sizeof(sd->lanes[best].source_ip)) != 0)) {
+        memcpy(sd->server_ip, sd->lanes[best].source_ip, sizeof(sd->server_ip));
+        sd->server_ip[sizeof(sd->server_ip) - 1] = '\0';
+        sd->server_port = sd->lanes[best].source_port;
+        changed = 1;
+    }
+    if (changed) {
+        __atomic_store_n(&sd->last_update_time, time(NULL), __ATOMIC_RELAXED);
+        shm_notify_readers(sd);
+    }
+    return changed;
+}
+
+/* 合并者：原主已退出却没释放（崩溃）的通道标成空闲、断开，返回收回的个数；剩下的帧照常合并 */
+static inline int shm_lane_reap(struct shared_weather_data *sd) {
+    int n = 0;
+    for (int i = 0; i < SHM_WRITER_LANES; i++) {
+        struct writer_lane *l = &sd->lanes[i];
+        uint32_t owner = __atomic_load_n(&l->owner_pid, __ATOMIC_ACQUIRE);
+        if (owner == 0 || shm_pid_alive(owner)) continue;
+        if (__atomic_compare_exchange_n(&l->owner_pid, &owner, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            l->connection_status = CONNECTION_DISCONNECTED;
+            n++;
+        }
+    }
+    return n;
+}
+
+/* 除 self 外是否还有活着的写端：合并者或某个通道的主人 */
+static inline int shm_other_writer(const struct shared_weather_data *sd, uint32_t self) {
+    uint32_t m = __atomic_load_n(&sd->merge_pid, __ATOMIC_ACQUIRE);
+    if (m != self && shm_pid_alive(m)) return 1;
+    for (int i = 0; i < SHM_WRITER_LANES; i++) {
+        uint32_t owner = __atomic_load_n(&sd->lanes[i].owner_pid, __ATOMIC_ACQUIRE);
+        if (owner != self && shm_pid_alive(owner)) return 1;
+    }
+    return 0;
+}
+
+#endif /* SHM_WRITER_H */
@@ -0,0 +1,137 @@
+/*
+慢接收端模拟
+
+完成 ROLE_RECVR 握手后按指定方式读取，用来观察一个跟不上的开发板对服务器
+广播路径和其他接收端的影响：
+  throttle:<字节/秒>      限速读取，每 10ms 最多读一个配额
+  pause:<读毫秒>/<停毫秒>  正常读一段时间，再完全不读一段时间，循环
+  stop                    握手后不再读取，连接保持打开
+
+接收缓冲区设得很小，让内核缓冲尽快填满，反压更早传到服务器。
+slow_receiver.c 和 bench_pipeline.c 共用。
+*/
+#ifndef SLOW_READER_H
+#define SLOW_READER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define SLOW_SLOT_NS   10000000ull   /* 限速配额的时间片 */
+#define SLOW_RCVBUF    4096          /* 内核按此值翻倍并有下限，实际约几 KB */
+
+enum { SLOW_THROTTLE = 1, SLOW_PAUSE, SLOW_STOP };
+
+struct slow_mode {
+    int kind;
+    double bytes_per_s;            /* throttle */
+    int run_ms, pause_ms;          /* pause */
+};
+
+struct slow_result {
+    uint64_t bytes;                /* 读到的字节数 */
+    uint64_t closed_ns;            /* 服务器断开的时刻，0 表示直到结束都连着 */
+};
+
+static inline uint64_t slow_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 解析模式字符串，失败返回 -1 */
+static inline int slow_mode_parse(const char *s, struct slow_mode *m) {
+    memset(m, 0, sizeof(*m));
+    if (strncmp(s, "throttle:", 9) == 0) {
+        m->kind = SLOW_THROTTLE;
+        m->bytes_per_s = atof(s + 9);
+        return m->bytes_per_s > 0 ? 0 : -1;
+    }
+    if (strncmp(s, "pause:", 6) == 0) {
+        m->kind = SLOW_PAUSE;
+        return (sscanf(s + 6, "%d/%d", &m->run_ms, &m->pause_ms) == 2 && m->run_ms > 0 && m->pause_ms > 0) ? 0 : -1;
+    }
+    if (strcmp(s, "stop") == 0) {
+        m->kind = SLOW_STOP;
+        return 0;
+    }
+    return -1;
+}
+
+/* 连接服务器并完成接收端握手；rcvbuf 须在 connect 前设置才影响窗口 */
+static inline int slow_connect(const struct sockaddr_in *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int rcvbuf = SLOW_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 ||
+        send_all(fd, ROLE_RECVR, ROLE_LEN) != ROLE_LEN) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 最多读 max 字节，最多等 wait_ms；返回读到的字节数，对端关闭返回 -1 */
+static inline ssize_t slow_read_some(int fd, uint8_t *buf, size_t max, int wait_ms) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, wait_ms) <= 0) return 0;
+    ssize_t r = recv(fd, buf, max, MSG_DONTWAIT);
+    if (r < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    return r > 0 ? r : -1;
+}
+
+/* 按模式读取，直到 *stop 置位、到达 until（CLOCK_MONOTONIC ns，0 不限）或服务器断开 */
+static inline void slow_read_loop(int fd, const struct slow_mode *m, volatile int *stop, uint64_t until,
+                                  struct slow_result *res) {
+    uint8_t buf[16 * 1024];
+    uint64_t t0 = slow_now_ns(), slot = t0, quota = 0;
+    memset(res, 0, sizeof(*res));
+    while (!*stop) {
+        uint64_t now = slow_now_ns();
+        if (until != 0 && now >= until) break;
+        size_t want = sizeof(buf);
+        int reading = 1;
+        switch (m->kind) {
+        case SLOW_THROTTLE:
+            if (now >= slot) {
+                slot = now + SLOW_SLOT_NS;
+                quota = (uint64_t)(m->bytes_per_s * SLOW_SLOT_NS / 1e9);
+                if (quota == 0) quota = 1;
+            }
+            want = quota < sizeof(buf) ? (size_t)quota : sizeof(buf);
+            reading = want > 0;
+            break;
+        case SLOW_PAUSE: {
+            uint64_t period = (uint64_t)(m->run_ms + m->pause_ms) * 1000000ull;
+            reading = (now - t0) % period < (uint64_t)m->run_ms * 1000000ull;
+            break;
+        }
+        default:
+            reading = 0;
+            break;
+        }
+        if (!reading) {
+            /* 不读时仍要发现服务器断开：只窥探不取数据 */
+            struct pollfd pfd = { .fd = fd, .events = POLLRDHUP };
+            if (poll(&pfd, 1, 10) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+                res->closed_ns = slow_now_ns();
+                return;
+            }
+            continue;
+        }
+        ssize_t r = slow_read_some(fd, buf, want, 10);
+        if (r < 0) { res->closed_ns = slow_now_ns(); return; }
+        res->bytes += (uint64_t)r;
+        if (m->kind == SLOW_THROTTLE) quota -= (uint64_t)r;
+    }
+}
+
+#endif /* SLOW_READER_H */
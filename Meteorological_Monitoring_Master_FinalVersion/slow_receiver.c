@@ -0,0 +1,100 @@
+/*
+慢接收端：以接收端身份连上服务器后按限速 / 间歇 / 停止的方式读取，
+用来在真实部署上复现“一块开发板拖慢所有人”的情况。
+每条连接一个线程，Ctrl-C 或到时后打印每条连接读到的字节数和是否被服务器断开。
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "proto.h"
+#include "slow_reader.h"
+
+#define MAX_CONNS 256
+
+struct slow_conn {
+    int fd;
+    struct slow_result res;
+};
+
+static volatile int g_stop = 0;
+static struct slow_mode g_mode;
+static uint64_t g_until = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static void *slow_thread(void *arg) {
+    struct slow_conn *c = (struct slow_conn *)arg;
+    slow_read_loop(c->fd, &g_mode, &g_stop, g_until, &c->res);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-m 模式] [-n 连接数] [-d 秒数] <server_ip> <port>\n"
+                    "  -m  throttle:<字节/秒> | pause:<读毫秒>/<停毫秒> | stop，默认 stop\n"
+                    "  -n  同时打开的慢连接数（1-%d），默认 1\n"
+                    "  -d  运行秒数，默认直到 Ctrl-C\n",
+            prog, MAX_CONNS);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = "stop";
+    int n = 1, opt;
+    double dur = 0;
+    while ((opt = getopt(argc, argv, "m:n:d:h")) != -1) {
+        switch (opt) {
+        case 'm': mode = optarg; break;
+        case 'n': n = atoi(optarg); break;
+        case 'd': dur = atof(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind < 2 || n < 1 || n > MAX_CONNS || slow_mode_parse(mode, &g_mode) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &addr.sin_addr) != 1) { usage(argv[0]); return 1; }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    static struct slow_conn conns[MAX_CONNS];
+    pthread_t th[MAX_CONNS];
+    uint64_t t0 = slow_now_ns();
+    if (dur > 0) g_until = t0 + (uint64_t)(dur * 1e9);
+    int opened = 0;
+    for (int i = 0; i < n; ++i) {
+        conns[i].fd = slow_connect(&addr);
+        if (conns[i].fd < 0) { perror("[receiver] connect"); break; }
+        if (pthread_create(&th[i], NULL, slow_thread, &conns[i]) != 0) { close(conns[i].fd); break; }
+        opened++;
+    }
+    printf("[receiver] %d slow connection(s), mode %s\n", opened, mode);
+
+    for (int i = 0; i < opened; ++i) {
+        pthread_join(th[i], NULL);
+        close(conns[i].fd);
+        if (conns[i].res.closed_ns) {
+            printf("[receiver] conn %d: %llu bytes, closed by server after %.3f s\n", i,
+                   (unsigned long long)conns[i].res.bytes, (conns[i].res.closed_ns - t0) / 1e9);
+        } else {
+            printf("[receiver] conn %d: %llu bytes\n", i, (unsigned long long)conns[i].res.bytes);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,526 @@
+/*
+加速浸泡测试
+
+启动一个 server 和一个连着它的 receiver_with_shm，再用若干工作线程反复建立、
+断开各种连接，模拟几周的现场连接抖动：
+  sender    发送端握手后发几帧，停一会儿再断开
+  receiver  接收端握手（有时带订阅消息），读一会儿再断开
+  norole    连上后不发角色直接断开
+  partial   发送端发到半帧时断开
+  badframe  发送端发一帧校验和错误的帧
+断开时大部分用 RST（SO_LINGER 0），避免本机 TIME_WAIT 耗尽临时端口。
+
+采样线程按固定间隔记录两个进程的 RSS、打开的 fd 数、线程数，以及服务器统计
+socket 报告的接收端 / 发送端集合大小。RSS 分两列：VmRSS 含 mmap 文件页
+（receiver 的共享内存文件越写越多，页数跟着涨，不是泄漏），只作参考；
+泄漏判定看 RssAnon，即堆和匿名映射。判定：
+  1. 抖动停止、等待收敛后，fd 数、线程数回到抖动前的水平，连接集合清空；
+  2. 去掉预热段后，后三分之一的 fd / 线程峰值不高于前三分之一太多，
+     RssAnon 的增长不超过阈值（按最小二乘斜率外推到整个窗口）；
+  3. 两个进程都还活着。
+任一不满足打印 FAIL 并返回 1；-o 把全部采样写成 CSV，便于画图。
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "proto.h"
+
+#define MAX_WORKERS   64
+#define MAX_SAMPLES   100000
+#define WARMUP_FRAC   0.25         /* 抖动开始后这一段不参与增长判定：线程栈、malloc arena 等一次性增长 */
+
+enum { K_SENDER, K_RECEIVER, K_NOROLE, K_PARTIAL, K_BADFRAME, K_KINDS };
+static const char *const kind_names[K_KINDS] = { "sender", "receiver", "norole", "partial", "badframe" };
+static const int kind_weight[K_KINDS] = { 40, 40, 8, 6, 6 };
+
+static struct {
+    const char *server_bin;
+    const char *recv_bin;          /* NULL 表示不启动 receiver_with_shm */
+    int port;
+    double duration;               /* 抖动时长，秒 */
+    int workers;
+    double rate;                   /* 每秒总建连数，0 不限 */
+    int interval_ms;               /* 采样间隔 */
+    double settle;                 /* 抖动停止后等待收敛的最长时间，秒 */
+    int fd_tol, thr_tol;           /* 允许的 fd / 线程数偏差 */
+    long rss_tol_kb;
+    const char *csv;
+} g_opt = { "./output/server", "./output/receiver_with_shm", 19500, 60, 8, 300, 1000, 5, 2, 2, 4096, NULL };
+
+struct proc_sample {
+    long rss_kb;                   /* VmRSS，仅作参考 */
+    long anon_kb;                  /* RssAnon，泄漏判定用 */
+    int fds;
+    int threads;
+    int alive;
+};
+
+struct sample {
+    double t;                      /* 相对抖动开始的秒数，负数为抖动前 */
+    struct proc_sample srv, rcv;
+    int receivers, senders;        /* -1 表示统计 socket 无响应 */
+    uint64_t churns;
+};
+
+static struct sample *g_samples;
+static int g_nsamples = 0;
+static volatile int g_churning = 0;
+static volatile sig_atomic_t g_interrupted = 0;
+static char g_stats_path[108];
+static char g_shm_path[64];
+static uint64_t g_kind_count[K_KINDS];
+static uint64_t g_churns = 0, g_connect_fail = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+    poll(NULL, 0, ms);
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_interrupted = 1;
+}
+
+/* ---------------- /proc 采样 ---------------- */
+
+static int count_dir(const char *path) {
+    DIR *d = opendir(path);
+    if (d == NULL) return -1;
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) if (e->d_name[0] != '.') n++;
+    closedir(d);
+    return n;
+}
+
+static void sample_proc(pid_t pid, struct proc_sample *s) {
+    char path[64], line[256];
+    memset(s, 0, sizeof(*s));
+    if (pid <= 0 || waitpid(pid, NULL, WNOHANG) != 0) return;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) s->rss_kb = atol(line + 6);
+        else if (strncmp(line, "RssAnon:", 8) == 0) s->anon_kb = atol(line + 8);
+        else if (strncmp(line, "Threads:", 8) == 0) s->threads = atoi(line + 8);
+    }
+    fclose(f);
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    s->fds = count_dir(path);
+    s->alive = 1;
+}
+
+/* 向服务器统计 socket 要一份报告，取 receivers / senders 两行 */
+static void query_sets(int *receivers, int *senders) {
+    *receivers = *senders = -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return;
+    struct sockaddr_un a;
+    memset(&a, 0, sizeof(a));
+    a.sun_family = AF_UNIX;
+    snprintf(a.sun_path, sizeof(a.sun_path), "%s", g_stats_path);
+    static char buf[256 * 1024];
+    size_t len = 0;
+    if (connect(fd, (struct sockaddr *)&a, sizeof(a)) == 0 && send_all(fd, "stats", 5) == 5) {
+        shutdown(fd, SHUT_WR);
+        ssize_t r;
+        while (len < sizeof(buf) - 1 && (r = recv(fd, buf + len, sizeof(buf) - 1 - len, 0)) > 0) len += (size_t)r;
+    }
+    close(fd);
+    buf[len] = '\0';
+    const char *p = strstr(buf, "\nreceivers ");
+    if (p != NULL) *receivers = atoi(p + 11);
+    p = strstr(buf, "\nsenders ");
+    if (p != NULL) *senders = atoi(p + 9);
+}
+
+static void take_sample(struct sample *s, double t, pid_t srv, pid_t rcv) {
+    s->t = t;
+    sample_proc(srv, &s->srv);
+    sample_proc(rcv, &s->rcv);
+    query_sets(&s->receivers, &s->senders);
+    s->churns = __atomic_load_n(&g_churns, __ATOMIC_RELAXED);
+}
+
+/* ---------------- 连接抖动 ---------------- */
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)g_opt.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    return fd;
+}
+
+/* abortive=1 发 RST，不留 TIME_WAIT */
+static void close_conn(int fd, int abortive) {
+    if (abortive) {
+        struct linger lg = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(fd);
+}
+
+static void build_frame(uint8_t *buf, uint8_t node, int corrupt) {
+    memset(buf, 0, FRAME_LEN);
+    buf[0] = node;
+    buf[1] = CMD_BME280;
+    buf[2] = 0x09; buf[3] = 0xC4;
+    buf[4] = 0x27; buf[5] = 0x74;
+    buf[6] = 0x13; buf[7] = 0x88;
+    buf[8] = Calculate_CRC4(&buf[2], 6) & 0x0F;
+    uint8_t cs = 0;
+    for (int i = 0; i < 9; i++) cs ^= buf[i];
+    buf[9] = corrupt ? (uint8_t)~cs : cs;
+    buf[10] = END_SYMBOL[0];
+}
+
+static uint32_t xorshift(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
+}
+
+static void churn_once(uint32_t *rng) {
+    int w = (int)(xorshift(rng) % 100), kind = 0;
+    while (w >= kind_weight[kind]) w -= kind_weight[kind++];
+    int fd = connect_server();
+    if (fd < 0) { __atomic_fetch_add(&g_connect_fail, 1, __ATOMIC_RELAXED); sleep_ms(10); return; }
+    int abortive = xorshift(rng) % 4 != 0;
+    uint8_t frames[20][FRAME_LEN];
+    int n;
+
+    switch (kind) {
+    case K_SENDER:
+        n = 1 + (int)(xorshift(rng) % 20);
+        for (int i = 0; i < n; ++i) build_frame(frames[i], (uint8_t)(1 + xorshift(rng) % 250), 0);
+        if (send_all(fd, ROLE_SENDER, ROLE_LEN) == ROLE_LEN) send_all(fd, frames, (size_t)n * FRAME_LEN);
+        sleep_ms((int)(xorshift(rng) % 20));
+        break;
+    case K_RECEIVER: {
+        if (send_all(fd, ROLE_RECVR, ROLE_LEN) != ROLE_LEN) break;
+        if (xorshift(rng) % 2) {
+            uint8_t sub[2] = { SUB_HEADER, (uint8_t)(1 + xorshift(rng) % SUB_ALL) };
+            send_all(fd, sub, sizeof(sub));
+        }
+        uint8_t buf[4096];
+        uint64_t until = now_ns() + (xorshift(rng) % 50) * 1000000ull;
+        while (now_ns() < until) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, 5) > 0 && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) == 0) break;
+        }
+        break;
+    }
+    case K_NOROLE:
+        break;
+    case K_PARTIAL:
+        build_frame(frames[0], 1, 0);
+        if (send_all(fd, ROLE_SENDER, ROLE_LEN) == ROLE_LEN) send_all(fd, frames[0], 1 + xorshift(rng) % (FRAME_LEN - 1));
+        break;
+    default:
+        build_frame(frames[0], 1, 1);
+        if (send_all(fd, ROLE_SENDER, ROLE_LEN) == ROLE_LEN) send_all(fd, frames[0], FRAME_LEN);
+        break;
+    }
+    close_conn(fd, abortive);
+    __atomic_fetch_add(&g_kind_count[kind], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_churns, 1, __ATOMIC_RELAXED);
+}
+
+static void *worker_main(void *arg) {
+    uint32_t rng = 2463534242u ^ (uint32_t)(uintptr_t)arg * 2654435761u;
+    /* 每个线程按总速率均分，绝对节拍，单次慢了后面追上 */
+    uint64_t period = g_opt.rate > 0 ? (uint64_t)(1e9 * g_opt.workers / g_opt.rate) : 0;
+    uint64_t next = now_ns();
+    while (g_churning) {
+        churn_once(&rng);
+        if (period) {
+            next += period;
+            uint64_t now = now_ns();
+            if (next > now) sleep_ms((int)((next - now) / 1000000ull));
+            else if (now - next > 1000000000ull) next = now;   /* 落后太多不再补 */
+        }
+    }
+    return NULL;
+}
+
+/* ---------------- 进程管理 ---------------- */
+
+static pid_t spawn(char *const argv[]) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) { dup2(devnull, 1); dup2(devnull, 2); close(devnull); }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_proc(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGINT);
+    for (int i = 0; i < 50; ++i) {
+        if (waitpid(pid, NULL, WNOHANG) != 0) return;
+        sleep_ms(100);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+/* ---------------- 判定 ---------------- */
+
+static int g_failed = 0;
+
+static void verdict(const char *what, int bad, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void verdict(const char *what, int bad, const char *fmt, ...) {
+    va_list ap;
+    printf("  %-4s %-40s ", bad ? "FAIL" : "ok", what);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    if (bad) g_failed = 1;
+}
+
+/* 样本 [from, to) 中的最大 fd / 线程数 */
+static int max_field(int from, int to, int proc, int field) {
+    int m = 0;
+    for (int i = from; i < to; ++i) {
+        const struct proc_sample *p = proc ? &g_samples[i].rcv : &g_samples[i].srv;
+        int v = field ? p->threads : p->fds;
+        if (v > m) m = v;
+    }
+    return m;
+}
+
+/* RssAnon 最小二乘斜率，kB/秒 */
+static double anon_slope(int from, int to, int proc) {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = from; i < to; ++i) {
+        double x = g_samples[i].t, y = (double)(proc ? g_samples[i].rcv.anon_kb : g_samples[i].srv.anon_kb);
+        n++; sx += x; sy += y; sxx += x * x; sxy += x * y;
+    }
+    double d = n * sxx - sx * sx;
+    return (n < 3 || d == 0) ? 0 : (n * sxy - sx * sy) / d;
+}
+
+static void check_proc(const char *name, int proc, const struct sample *base, const struct sample *fin,
+                       int w0, int w1) {
+    const struct proc_sample *b = proc ? &base->rcv : &base->srv;
+    const struct proc_sample *f = proc ? &fin->rcv : &fin->srv;
+    char what[64];
+
+    snprintf(what, sizeof(what), "%s alive", name);
+    verdict(what, !f->alive, "%s", f->alive ? "yes" : "exited during the run");
+    if (!f->alive) return;
+
+    snprintf(what, sizeof(what), "%s fds after settle", name);
+    verdict(what, f->fds - b->fds > g_opt.fd_tol, "%d -> %d", b->fds, f->fds);
+    snprintf(what, sizeof(what), "%s threads after settle", name);
+    verdict(what, f->threads - b->threads > g_opt.thr_tol, "%d -> %d", b->threads, f->threads);
+
+    /* 窗口三等分，比较首尾两段的峰值：有界的抖动两段峰值相当，泄漏会一路上涨 */
+    int third = (w1 - w0) / 3;
+    if (third < 2) {
+        verdict("growth window", 0, "too few samples (%d), skipped", w1 - w0);
+        return;
+    }
+    int slack = g_opt.workers + g_opt.fd_tol;
+    int fd0 = max_field(w0, w0 + third, proc, 0), fd1 = max_field(w1 - third, w1, proc, 0);
+    int th0 = max_field(w0, w0 + third, proc, 1), th1 = max_field(w1 - third, w1, proc, 1);
+    snprintf(what, sizeof(what), "%s fd peak growth", name);
+    verdict(what, fd1 - fd0 > slack, "%d -> %d (allowed +%d)", fd0, fd1, slack);
+    snprintf(what, sizeof(what), "%s thread peak growth", name);
+    verdict(what, th1 - th0 > slack, "%d -> %d (allowed +%d)", th0, th1, slack);
+
+    const struct proc_sample *s0 = proc ? &g_samples[w0].rcv : &g_samples[w0].srv;
+    double slope = anon_slope(w0, w1, proc);
+    double span = g_samples[w1 - 1].t - g_samples[w0].t;
+    snprintf(what, sizeof(what), "%s anon rss growth", name);
+    verdict(what, slope * span > g_opt.rss_tol_kb, "%ld -> %ld kB, trend %+.1f kB/min (allowed %ld kB over %.0f s)",
+            s0->anon_kb, f->anon_kb, slope * 60, g_opt.rss_tol_kb, span);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-d 秒] [-w 线程数] [-C 每秒建连数] [-i 采样毫秒] [-p 端口] [-s server] [-r receiver|-n]\n"
+                    "          [-F fd容差] [-T 线程容差] [-M RssAnon容差kB] [-W 收敛秒数] [-o 采样.csv]\n"
+                    "  -d  抖动时长，默认 60 秒\n"
+                    "  -w  抖动线程数（1-%d），默认 8，每个线程同一时刻只有一条连接\n"
+                    "  -C  每秒总建连数，0 不限，默认 300\n"
+                    "  -s  server 程序，默认 ./output/server\n"
+                    "  -r  receiver_with_shm 程序，默认 ./output/receiver_with_shm；-n 不启动\n"
+                    "  -F/-T  收敛后 fd / 线程数允许高出抖动前的个数，默认 2\n"
+                    "  -M  去掉预热段后 RssAnon 允许的增长，默认 4096 kB\n",
+            prog, MAX_WORKERS);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:C:i:p:s:r:nF:T:M:W:o:h")) != -1) {
+        switch (opt) {
+        case 'd': g_opt.duration = atof(optarg); break;
+        case 'w': g_opt.workers = atoi(optarg); break;
+        case 'C': g_opt.rate = atof(optarg); break;
+        case 'i': g_opt.interval_ms = atoi(optarg); break;
+        case 'p': g_opt.port = atoi(optarg); break;
+        case 's': g_opt.server_bin = optarg; break;
+        case 'r': g_opt.recv_bin = optarg; break;
+        case 'n': g_opt.recv_bin = NULL; break;
+        case 'F': g_opt.fd_tol = atoi(optarg); break;
+        case 'T': g_opt.thr_tol = atoi(optarg); break;
+        case 'M': g_opt.rss_tol_kb = atol(optarg); break;
+        case 'W': g_opt.settle = atof(optarg); break;
+        case 'o': g_opt.csv = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (g_opt.duration <= 0 || g_opt.workers < 1 || g_opt.workers > MAX_WORKERS || g_opt.interval_ms < 10 ||
+        g_opt.rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    g_samples = (struct sample *)calloc(MAX_SAMPLES, sizeof(struct sample));
+    if (g_samples == NULL) { perror("[soak] calloc"); return 1; }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    /* 服务器：带统计 socket，用来读接收端 / 发送端集合大小 */
+    char port[16];
+    snprintf(port, sizeof(port), "%d", g_opt.port);
+    snprintf(g_stats_path, sizeof(g_stats_path), "/tmp/mmm-soak-%d.sock", (int)getpid());
+    char *srv_argv[] = { (char *)g_opt.server_bin, "-S", g_stats_path, port, NULL };
+    pid_t srv = spawn(srv_argv);
+    int up = 0;
+    for (int i = 0; i < 100 && !up; ++i) {
+        sleep_ms(50);
+        int r, s;
+        query_sets(&r, &s);
+        up = r >= 0;
+    }
+    if (!up) { fprintf(stderr, "[soak] cannot start %s on %d\n", g_opt.server_bin, g_opt.port); stop_proc(srv); return 1; }
+
+    pid_t rcv = 0;
+    if (g_opt.recv_bin != NULL) {
+        /* 映射文件放 /tmp，不碰开发板上 SD 卡里的那份 */
+        snprintf(g_shm_path, sizeof(g_shm_path), "/tmp/mmm-soak-%d.shm", (int)getpid());
+        char *rcv_argv[] = { (char *)g_opt.recv_bin, "-F", g_shm_path, "127.0.0.1", port, NULL };
+        rcv = spawn(rcv_argv);
+        sleep_ms(1000);
+    }
+
+    /* 抖动前的基线；服务器刚启动，以空闲一会儿后的状态为准 */
+    struct sample base;
+    sleep_ms(500);
+    take_sample(&base, 0, srv, rcv);
+    printf("[soak] server pid %d, receiver pid %d, churning %.0f s with %d workers at %.0f conn/s\n",
+           (int)srv, (int)rcv, g_opt.duration, g_opt.workers, g_opt.rate);
+    printf("%8s %10s %10s %6s %6s %6s %6s %10s %10s %6s %6s %10s\n", "t", "srv_rss", "srv_anon", "fds", "thr",
+           "recvs", "sends", "rcv_rss", "rcv_anon", "fds", "thr", "churns");
+
+    g_churning = 1;
+    pthread_t th[MAX_WORKERS];
+    int nth = 0;
+    for (int i = 0; i < g_opt.workers; ++i) {
+        if (pthread_create(&th[i], NULL, worker_main, (void *)(uintptr_t)(i + 1)) != 0) break;
+        nth++;
+    }
+
+    uint64_t t0 = now_ns(), t_end = t0 + (uint64_t)(g_opt.duration * 1e9);
+    uint64_t next = t0;
+    while (!g_interrupted && now_ns() < t_end && g_nsamples < MAX_SAMPLES) {
+        next += (uint64_t)g_opt.interval_ms * 1000000ull;
+        uint64_t now = now_ns();
+        if (next > now) sleep_ms((int)((next - now) / 1000000ull));
+        struct sample *s = &g_samples[g_nsamples++];
+        take_sample(s, (now_ns() - t0) / 1e9, srv, rcv);
+        printf("%8.1f %10ld %10ld %6d %6d %6d %6d %10ld %10ld %6d %6d %10llu\n", s->t, s->srv.rss_kb,
+               s->srv.anon_kb, s->srv.fds, s->srv.threads, s->receivers, s->senders, s->rcv.rss_kb,
+               s->rcv.anon_kb, s->rcv.fds, s->rcv.threads, (unsigned long long)s->churns);
+        fflush(stdout);
+        if (!s->srv.alive) break;
+    }
+    g_churning = 0;
+    for (int i = 0; i < nth; ++i) pthread_join(th[i], NULL);
+    double churn_s = (now_ns() - t0) / 1e9;
+
+    /* 等连接线程发现对端断开、退出 */
+    struct sample fin;
+    uint64_t settle_end = now_ns() + (uint64_t)(g_opt.settle * 1e9);
+    do {
+        sleep_ms(200);
+        take_sample(&fin, (now_ns() - t0) / 1e9, srv, rcv);
+    } while (now_ns() < settle_end && fin.srv.alive &&
+             (fin.receivers != base.receivers || fin.senders != base.senders ||
+              fin.srv.fds - base.srv.fds > g_opt.fd_tol || fin.srv.threads - base.srv.threads > g_opt.thr_tol));
+
+    printf("\n[soak] %llu connections in %.1f s (%.0f/s), %llu connect failures:",
+           (unsigned long long)g_churns, churn_s, g_churns / churn_s, (unsigned long long)g_connect_fail);
+    for (int k = 0; k < K_KINDS; ++k) printf(" %s=%llu", kind_names[k], (unsigned long long)g_kind_count[k]);
+    printf("\n");
+
+    int w0 = 0;
+    while (w0 < g_nsamples && g_samples[w0].t < churn_s * WARMUP_FRAC) w0++;
+    check_proc("server", 0, &base, &fin, w0, g_nsamples);
+    if (fin.srv.alive) {
+        verdict("server receiver set", fin.receivers != base.receivers, "%d -> %d", base.receivers, fin.receivers);
+        verdict("server sender set", fin.senders != base.senders, "%d -> %d", base.senders, fin.senders);
+    }
+    if (rcv > 0) check_proc("receiver_with_shm", 1, &base, &fin, w0, g_nsamples);
+
+    if (g_opt.csv != NULL) {
+        FILE *f = fopen(g_opt.csv, "w");
+        if (f == NULL) {
+            perror("[soak] csv");
+        } else {
+            fprintf(f, "t,srv_rss_kb,srv_anon_kb,srv_fds,srv_threads,receivers,senders,rcv_rss_kb,rcv_anon_kb,rcv_fds,"
+                       "rcv_threads,churns\n");
+            for (int i = 0; i < g_nsamples; ++i) {
+                const struct sample *s = &g_samples[i];
+                fprintf(f, "%.3f,%ld,%ld,%d,%d,%d,%d,%ld,%ld,%d,%d,%llu\n", s->t, s->srv.rss_kb, s->srv.anon_kb,
+                        s->srv.fds, s->srv.threads, s->receivers, s->senders, s->rcv.rss_kb, s->rcv.anon_kb,
+                        s->rcv.fds, s->rcv.threads, (unsigned long long)s->churns);
+            }
+            fclose(f);
+        }
+    }
+
+    stop_proc(rcv);
+    stop_proc(srv);
+    unlink(g_stats_path);
+    if (rcv > 0) unlink(g_shm_path);
+    printf("[soak] %s\n", g_failed ? "FAIL" : "PASS");
+    free(g_samples);
+    return g_failed ? 1 : 0;
+}
@@ -9,12 +9,23 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <time.h>
 #include <math.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
 
 #include "proto.h"
+#include "hdr_hist.h"
 
 #define SEND_INTERVAL 3   /* 发送间隔秒数 */
+#define UDP_MAX_BATCH 64  /* 每个数据报最多帧数，与服务器 UDP_DGRAM_MAX 对应 */
+
+static int g_quiet = 0;   /* 压测时不逐帧打印 */
 
 /* 生成BME280数据包 (11字节) */
 static void build_bme280_frame(uint8_t *buf, uint8_t node_id) {
@@ -56,7 +67,7 @@ static void build_bme280_frame(uint8_t *buf, uint8_t node_id) {
     // 结束符
     buf[10] = END_SYMBOL[0];
     
-    printf("[sender] BME280: Node=%u, T=%.2f°C, P=%.1f hPa, H=%.2f%%, CRC4=0x%X\n",
+    if (!g_quiet) printf("[sender] BME280: Node=%u, T=%.2f°C, P=%.1f hPa, H=%.2f%%, CRC4=0x%X\n",
            node_id, temp, pressure, humidity, crc4);
 }
 
@@ -92,7 +103,7 @@ static void build_lightrain_frame(uint8_t *buf, uint8_t node_id) {
     // 结束符
     buf[7] = END_SYMBOL[0];
     
-    printf("[sender] LightRain: Node=%u, Lux=%.1f lx, Rain=%u%%, CRC4=0x%X\n",
+    if (!g_quiet) printf("[sender] LightRain: Node=%u, Lux=%.1f lx, Rain=%u%%, CRC4=0x%X\n",
            node_id, lux, rain, crc4);
 }
 
@@ -134,7 +145,7 @@ static void build_system_status_frame(uint8_t *buf, uint8_t node_id, uint32_t *u
     // 结束符
     buf[14] = END_SYMBOL[0];
     
-    printf("[sender] SystemStatus: Node=%u, BME=%s, BH=%s, Rain=%s, I2C=%s, Up=%u s, Err=%u\n",
+    if (!g_quiet) printf("[sender] SystemStatus: Node=%u, BME=%s, BH=%s, Rain=%s, I2C=%s, Up=%u s, Err=%u\n",
            node_id, buf[2] ? "ERR" : "OK", buf[3] ? "ERR" : "OK", 
            buf[4] ? "ERR" : "OK", buf[5] ? "ERR" : "OK", *uptime, total_errors);
 }
@@ -201,10 +212,34 @@ static void build_gps_frame(uint8_t *buf, uint8_t node_id) {
     // 结束符
     buf[24] = END_SYMBOL[0];
     
-    printf("[sender] GPS: Node=%u, UTC=%s, Lat=%.5f, Lon=%.5f, Alt=%.1f m, Sats=%u, HDOP=%.1f, CRC4=0x%X\n",
+    if (!g_quiet) printf("[sender] GPS: Node=%u, UTC=%s, Lat=%.5f, Lon=%.5f, Alt=%.1f m, Sats=%u, HDOP=%.1f, CRC4=0x%X\n",
            node_id, (char*)&buf[2], lat, lon, alt, buf[17], hdop, crc4);
 }
 
+/* 按序号轮流生成四种数据包，返回有效长度 */
+static int build_next_frame(uint8_t *buf, uint8_t node_id, int idx, uint32_t *uptime) {
+    switch (idx % 4) {
+    case 0:  build_bme280_frame(buf, node_id);                return 11;
+    case 1:  build_lightrain_frame(buf, node_id);             return 8;
+    case 2:  build_system_status_frame(buf, node_id, uptime); return 15;
+    default: build_gps_frame(buf, node_id);                   return 25;
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 按绝对时间节拍休眠，发送耗时不累积成速率误差 */
+static void pace_next(struct timespec *next, long long period_ns) {
+    next->tv_nsec += period_ns % 1000000000LL;
+    next->tv_sec += period_ns / 1000000000LL;
+    if (next->tv_nsec >= 1000000000L) { next->tv_nsec -= 1000000000L; next->tv_sec++; }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) { }
+}
+
 /* 发送数据包的通用函数 */
 static int send_packet(int fd, uint8_t *buf, int len) {
     if (send_all(fd, buf, len) != len) {
@@ -227,20 +262,722 @@ static int send_packet(int fd, uint8_t *buf, int len) {
     return 0;
 }
 
+/* ================== 集群模式 ==================
+ * 一个 epoll 循环 + 1ms timerfd 节拍驱动成千上万个虚拟节点：每个 (节点, 类型)
+ * 的下一次发送时刻放在最小堆里，到期就把帧追加到所属连接的发送缓冲区，
+ * 再用非阻塞写尽量发出，写不动时等 EPOLLOUT。热循环里不打印，结束时输出统计。
+ */
+#define FLEET_TICK_NS    1000000LL
+#define FLEET_CONN_BUF   (64 * 1024)
+#define FLEET_MAX_EVENTS 256
+#define FLEET_RETRY_NS   1000000000ull   /* 连接失败或被断开后 1 秒重连 */
+#define FLEET_TIMER_TAG  UINT32_MAX
+#define FLEET_MON_TAG    (UINT32_MAX - 1)
+#define FLEET_MON_BUF    (64 * 1024)
+#define FLEET_LANES      256             /* FRAME_LANE_OFF 只有 8 位 */
+
+enum { ARRIVAL_FIXED = 0, ARRIVAL_POISSON, ARRIVAL_BURST };
+enum { FC_DOWN = 0, FC_CONNECTING, FC_UP };
+
+/* 故障注入类别 */
+enum { FAULT_CRC = 0, FAULT_XOR, FAULT_CMD, FAULT_TRUNC, FAULT_SPLIT, FAULT_STALL, FAULT_CLASSES };
+static const char *const fault_names[FAULT_CLASSES] = { "crc", "xor", "cmd", "trunc", "split", "stall" };
+
+struct fleet_conn {
+    int fd;
+    int state;
+    int want_out;                /* 已注册 EPOLLOUT */
+    int dirty;                   /* 已在待发送列表中 */
+    uint64_t retry_at;
+    uint64_t connect_start;
+    uint32_t uptime;
+    size_t head, len;            /* buf[head, head+len) 待发送 */
+    size_t cut_left;             /* 拆分/停顿故障：再发这么多字节后暂停，0 表示无 */
+    uint64_t resume_at;          /* 暂停到此时刻 */
+    uint8_t buf[FLEET_CONN_BUF];
+};
+
+struct fleet_event {
+    uint64_t t;
+    uint32_t node;
+    uint32_t type;               /* 0..3 对应 build_next_frame 的轮转顺序 */
+};
+
+static struct {
+    int nodes, conns;
+    double type_rate[4];         /* 每节点每类型的帧率 */
+    int arrival, burst;
+    int stamp;                   /* 在 FRAME_TS_OFF 写入发送时刻，供端到端延迟测量 */
+    double duration;             /* 秒，0 不限 */
+    long long total;             /* 帧数，0 不限 */
+    double storm_every;          /* 每隔多少秒全部连接同时断开重连，0 不模拟 */
+    double connect_rate;         /* 每秒最多发起的连接数，0 不限 */
+    double fault_rate[FAULT_CLASSES];   /* 每帧注入各类故障的概率 */
+    int faults;
+    double stall_ms;             /* 停顿故障的时长 */
+    int monitor;                 /* 同一循环里挂一个接收端统计送达、延迟与恢复时间 */
+    struct sockaddr_in addr;
+} g_fleet = { .burst = 8, .stall_ms = 500 };
+
+static struct {
+    uint64_t frames, bytes;
+    uint64_t drop_full;          /* 连接发送缓冲区满 */
+    uint64_t drop_down;          /* 所属连接未建立 */
+    uint64_t connects, connect_fail, disconnects, storms;
+    uint64_t connect_hist[HIST_BUCKETS];   /* 建连耗时 (ns) */
+    uint64_t injected[FAULT_CLASSES];
+    uint64_t episodes[FAULT_CLASSES];      /* 连接从正常进入故障的次数，恢复前再注入不重复计 */
+    uint64_t recovered[FAULT_CLASSES];
+    uint64_t recovery_hist[FAULT_CLASSES][HIST_BUCKETS];   /* 注入到该连接下一帧送达 (ns) */
+    uint64_t delivered, mon_bad, mon_lost;
+    uint64_t latency_hist[HIST_BUCKETS];   /* 监视接收端看到的端到端延迟 (ns) */
+} g_fstat;
+
+/* 每条连接（按 FRAME_LANE_OFF）未恢复的故障：发送时刻不早于 need 的帧送达即视为恢复 */
+static struct {
+    uint64_t since;              /* 注入时刻，0 表示无 */
+    uint64_t need;
+    int cls;
+} g_lanes[FLEET_LANES];
+
+static volatile sig_atomic_t g_fleet_running = 1;
+static struct fleet_conn *g_conns;
+static int *g_dirty, g_ndirty;
+static int g_epfd = -1;
+static int g_mon_fd = -1;
+static uint8_t g_mon_buf[FLEET_MON_BUF];
+static size_t g_mon_len;
+
+static void on_fleet_signal(int sig) {
+    (void)sig;
+    g_fleet_running = 0;
+}
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64*，泊松到达需要大量随机数，rand() 太慢 */
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+static double rand_unit(void) {
+    g_rng ^= g_rng >> 12; g_rng ^= g_rng << 25; g_rng ^= g_rng >> 27;
+    return (double)((g_rng * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* 下一次发送的间隔；突发模式每次事件发 burst 帧，间隔相应拉长 */
+static uint64_t fleet_gap_ns(double rate) {
+    double gap;
+    switch (g_fleet.arrival) {
+    case ARRIVAL_POISSON: gap = -log(1.0 - rand_unit()) / rate; break;
+    case ARRIVAL_BURST:   gap = g_fleet.burst / rate; break;
+    default:              gap = 1.0 / rate; break;
+    }
+    return (uint64_t)(gap * 1e9) + 1;
+}
+
+/* ---------- 事件最小堆 ---------- */
+static struct fleet_event *g_heap;
+static size_t g_nheap;
+
+static void heap_push(struct fleet_event e) {
+    size_t i = g_nheap++;
+    while (i > 0) {
+        size_t p = (i - 1) / 2;
+        if (g_heap[p].t <= e.t) break;
+        g_heap[i] = g_heap[p];
+        i = p;
+    }
+    g_heap[i] = e;
+}
+
+static struct fleet_event heap_pop(void) {
+    struct fleet_event top = g_heap[0], last = g_heap[--g_nheap];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= g_nheap) break;
+        if (c + 1 < g_nheap && g_heap[c + 1].t < g_heap[c].t) c++;
+        if (last.t <= g_heap[c].t) break;
+        g_heap[i] = g_heap[c];
+        i = c;
+    }
+    if (g_nheap > 0) g_heap[i] = last;
+    return top;
+}
+
+/* ---------- 连接管理 ---------- */
+static void fleet_epoll(int idx, int op, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = (uint32_t)idx;
+    epoll_ctl(g_epfd, op, g_conns[idx].fd, &ev);
+}
+
+static void fleet_disconnect(int idx, uint64_t retry_at) {
+    struct fleet_conn *c = &g_conns[idx];
+    if (c->fd >= 0) close(c->fd);   /* close 同时从 epoll 中移除 */
+    if (c->state == FC_UP) g_fstat.disconnects++;
+    c->fd = -1;
+    c->state = FC_DOWN;
+    c->want_out = 0;
+    c->head = c->len = 0;
+    c->cut_left = 0;
+    c->resume_at = 0;
+    c->retry_at = retry_at;
+}
+
+static void fleet_mark_dirty(int idx) {
+    if (!g_conns[idx].dirty) {
+        g_conns[idx].dirty = 1;
+        g_dirty[g_ndirty++] = idx;
+    }
+}
+
+static int fleet_append(struct fleet_conn *c, const uint8_t *p, size_t n) {
+    if (c->head + c->len + n > FLEET_CONN_BUF) {
+        memmove(c->buf, c->buf + c->head, c->len);
+        c->head = 0;
+        if (c->len + n > FLEET_CONN_BUF) return -1;
+    }
+    memcpy(c->buf + c->head + c->len, p, n);
+    c->len += n;
+    return 0;
+}
+
+static void fleet_connected(int idx, uint64_t now) {
+    struct fleet_conn *c = &g_conns[idx];
+    c->state = FC_UP;
+    g_fstat.connects++;
+    g_fstat.connect_hist[hist_bucket(now - c->connect_start)]++;
+    /* 握手角色头与后续帧走同一个缓冲区 */
+    fleet_append(c, ROLE_SENDER, ROLE_LEN);
+    fleet_mark_dirty(idx);
+    fleet_epoll(idx, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP);
+}
+
+static void fleet_connect(int idx, uint64_t now) {
+    struct fleet_conn *c = &g_conns[idx];
+    c->connect_start = now;
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0) { g_fstat.connect_fail++; c->retry_at = now + FLEET_RETRY_NS; return; }
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    if (g_fleet.faults) {
+        /* 拆分写要真的落在两个 TCP 段里 */
+        int one = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    int rc = connect(c->fd, (struct sockaddr *)&g_fleet.addr, sizeof(g_fleet.addr));
+    if (rc < 0 && errno != EINPROGRESS) {
+        g_fstat.connect_fail++;
+        fleet_disconnect(idx, now + FLEET_RETRY_NS);
+        return;
+    }
+    c->state = FC_CONNECTING;
+    fleet_epoll(idx, EPOLL_CTL_ADD, EPOLLOUT);
+    if (rc == 0) fleet_connected(idx, now);
+}
+
+/* 返回 1 表示因拆分/停顿故障暂停，需要在之后的节拍里继续发送 */
+static int fleet_flush(int idx, uint64_t now) {
+    struct fleet_conn *c = &g_conns[idx];
+    int paused = 0;
+    while (c->len > 0) {
+        if (c->cut_left == 0 && now < c->resume_at) { paused = 1; break; }
+        size_t n = c->len;
+        if (c->cut_left > 0 && n > c->cut_left) n = c->cut_left;
+        ssize_t w = send(c->fd, c->buf + c->head, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (w > 0) {
+            c->head += (size_t)w;
+            c->len -= (size_t)w;
+            if (c->cut_left > 0) c->cut_left -= (size_t)w;
+            g_fstat.bytes += (uint64_t)w;
+            continue;
+        }
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!c->want_out) { c->want_out = 1; fleet_epoll(idx, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP | EPOLLOUT); }
+            return 0;
+        }
+        if (w < 0 && errno == EINTR) continue;
+        fleet_disconnect(idx, now + FLEET_RETRY_NS);
+        return 0;
+    }
+    if (c->len == 0) c->head = 0;
+    if (c->want_out) { c->want_out = 0; fleet_epoll(idx, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP); }
+    return paused;
+}
+
+static void fleet_conn_event(int idx, uint32_t events, uint64_t now) {
+    struct fleet_conn *c = &g_conns[idx];
+    if (c->state == FC_CONNECTING) {
+        int err = 0;
+        socklen_t el = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &el);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            g_fstat.connect_fail++;
+            fleet_disconnect(idx, now + FLEET_RETRY_NS);
+            return;
+        }
+        if (events & EPOLLOUT) fleet_connected(idx, now);
+        return;
+    }
+    if (c->state != FC_UP) return;
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP | EPOLLIN)) {
+        /* 服务器不会向发送端发数据，可读即对端关闭 */
+        char tmp[64];
+        if (!(events & EPOLLIN) || recv(c->fd, tmp, sizeof(tmp), MSG_DONTWAIT) <= 0) {
+            fleet_disconnect(idx, now + FLEET_RETRY_NS);
+            return;
+        }
+    }
+    if ((events & EPOLLOUT) && fleet_flush(idx, now)) fleet_mark_dirty(idx);
+}
+
+/* ---------- 故障注入 ---------- */
+
+/* 按配置的概率为一帧抽取故障类别，-1 表示正常帧 */
+static int fleet_pick_fault(void) {
+    if (!g_fleet.faults) return -1;
+    double u = rand_unit();
+    for (int k = 0; k < FAULT_CLASSES; ++k) {
+        if (u < g_fleet.fault_rate[k]) return k;
+        u -= g_fleet.fault_rate[k];
+    }
+    return -1;
+}
+
+/* 数据包内 CRC4 字节的位置；系统状态包没有 CRC4 */
+static int fault_crc_off(uint8_t cmd) {
+    switch (cmd) {
+    case CMD_BME280:    return 8;
+    case CMD_LIGHTRAIN: return 5;
+    case CMD_GPS:       return 22;
+    default:            return -1;
+    }
+}
+
+/* 改写帧内容并返回写入连接的字节数（截断时小于 FRAME_LEN），-1 表示该帧不适用 */
+static int fleet_corrupt(uint8_t *frame, int cls) {
+    int len = LORA_FrameLen(frame[1]);
+    switch (cls) {
+    case FAULT_CRC: {
+        int off = fault_crc_off(frame[1]);
+        if (off < 0) return -1;
+        frame[off] ^= 0x01;
+        frame[len - 2] ^= 0x01;   /* 同步修正异或校验和，让错误落到 CRC4 检查上 */
+        return FRAME_LEN;
+    }
+    case FAULT_XOR:   frame[len - 2] ^= 0x5A; return FRAME_LEN;
+    case FAULT_CMD:   frame[1] = 0x7E; return FRAME_LEN;
+    case FAULT_TRUNC: return 1 + (int)(rand_unit() * (FRAME_LEN - 1));
+    default:          return FRAME_LEN;
+    }
+}
+
+/* 一个到期事件：生成帧追加到所属连接 */
+static void fleet_fire(const struct fleet_event *e, uint64_t now) {
+    int idx = (int)(e->node % (uint32_t)g_fleet.conns);
+    struct fleet_conn *c = &g_conns[idx];
+    int k = g_fleet.arrival == ARRIVAL_BURST ? g_fleet.burst : 1;
+    if (c->state != FC_UP) { g_fstat.drop_down += (uint64_t)k; return; }
+    uint8_t frame[FRAME_LEN];
+    for (int i = 0; i < k; ++i) {
+        build_next_frame(frame, (uint8_t)(e->node % 255 + 1), (int)e->type, &c->uptime);
+        frame[FRAME_LANE_OFF] = (uint8_t)idx;
+        uint64_t t = now;
+        if (g_fleet.stamp) {
+            /* 逐帧取时刻，恢复时间按发送先后区分同一节拍里的帧 */
+            t = mono_ns();
+            uint32_t ts = (uint32_t)t;
+            put_be32(frame + FRAME_TS_OFF, ts ? ts : 1);
+        }
+        int cls = fleet_pick_fault();
+        int n = FRAME_LEN;
+        if (cls == FAULT_SPLIT || cls == FAULT_STALL) {
+            if (c->cut_left > 0 || c->resume_at > now) cls = -1;   /* 上一次拆分/停顿还没结束 */
+        } else if (cls >= 0) {
+            n = fleet_corrupt(frame, cls);
+            if (n < 0) { cls = -1; n = FRAME_LEN; }
+        }
+        size_t before = c->len;
+        if (fleet_append(c, frame, (size_t)n) != 0) { g_fstat.drop_full++; continue; }
+        g_fstat.frames++;
+        if (cls < 0) continue;
+
+        if (cls == FAULT_SPLIT || cls == FAULT_STALL) {
+            c->cut_left = before + 1 + (size_t)(rand_unit() * (FRAME_LEN - 1));
+            c->resume_at = cls == FAULT_SPLIT ? now + 1 : now + (uint64_t)(g_fleet.stall_ms * 1e6);
+        }
+        g_fstat.injected[cls]++;
+        if (g_mon_fd >= 0 && g_lanes[idx % FLEET_LANES].since == 0) {
+            /* 拆分/停顿的这一帧本身送达即恢复，其余类别要等之后发出的帧 */
+            g_lanes[idx % FLEET_LANES].since = t;
+            g_lanes[idx % FLEET_LANES].need = (cls == FAULT_SPLIT || cls == FAULT_STALL) ? t : t + 1;
+            g_lanes[idx % FLEET_LANES].cls = cls;
+            g_fstat.episodes[cls]++;
+        }
+    }
+    fleet_mark_dirty(idx);
+}
+
+/* ---------- 监视接收端 ---------- */
+
+static int fleet_monitor_open(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(fd, (struct sockaddr *)&g_fleet.addr, sizeof(g_fleet.addr)) < 0 ||
+        send_all(fd, ROLE_RECVR, ROLE_LEN) != ROLE_LEN) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data = { .u32 = FLEET_MON_TAG } };
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev);
+    return fd;
+}
+
+static void fleet_monitor_frame(const uint8_t *f, uint64_t now) {
+    uint8_t frame[FRAME_LEN];
+    memcpy(frame, f, FRAME_LEN);
+    if (LORA_ParseFrame(frame) <= 0) { g_fstat.mon_bad++; return; }
+    g_fstat.delivered++;
+    uint32_t ts = get_be32(frame + FRAME_TS_OFF);
+    /* 截断造成错位时，拼出来的“合法”帧里时刻是别的字节，差值为负的丢弃 */
+    if (ts == 0 || (int32_t)((uint32_t)now - ts) < 0) return;
+    g_fstat.latency_hist[hist_bucket((uint32_t)now - ts)]++;
+    int lane = frame[FRAME_LANE_OFF];
+    if (g_lanes[lane].since != 0 && (int32_t)(ts - (uint32_t)g_lanes[lane].need) >= 0) {
+        int cls = g_lanes[lane].cls;
+        g_fstat.recovered[cls]++;
+        g_fstat.recovery_hist[cls][hist_bucket(now - g_lanes[lane].since)]++;
+        g_lanes[lane].since = 0;
+    }
+}
+
+static void fleet_monitor_read(void) {
+    while (g_mon_fd >= 0) {
+        ssize_t r = recv(g_mon_fd, g_mon_buf + g_mon_len, sizeof(g_mon_buf) - g_mon_len, MSG_DONTWAIT);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (r <= 0) {
+            g_fstat.mon_lost = 1;
+            close(g_mon_fd);
+            g_mon_fd = -1;
+            return;
+        }
+        uint64_t now = mono_ns();
+        g_mon_len += (size_t)r;
+        size_t off = 0;
+        for (; off + FRAME_LEN <= g_mon_len; off += FRAME_LEN) fleet_monitor_frame(g_mon_buf + off, now);
+        memmove(g_mon_buf, g_mon_buf + off, g_mon_len - off);
+        g_mon_len -= off;
+    }
+}
+
+static void fleet_report(double el) {
+    const uint64_t *h = g_fstat.connect_hist;
+    printf("[sender] fleet: %d nodes over %d connections, %.3f s\n", g_fleet.nodes, g_fleet.conns, el);
+    printf("[sender] frames=%llu (%.0f frames/s) bytes=%llu dropped_full=%llu dropped_disconnected=%llu\n",
+           (unsigned long long)g_fstat.frames, el > 0 ? g_fstat.frames / el : 0.0,
+           (unsigned long long)g_fstat.bytes, (unsigned long long)g_fstat.drop_full,
+           (unsigned long long)g_fstat.drop_down);
+    printf("[sender] connects=%llu failed=%llu disconnects=%llu storms=%llu connect_ms p50=%.3f p99=%.3f max=%.3f\n",
+           (unsigned long long)g_fstat.connects, (unsigned long long)g_fstat.connect_fail,
+           (unsigned long long)g_fstat.disconnects, (unsigned long long)g_fstat.storms,
+           hist_quantile(h, 0.5) / 1e6, hist_quantile(h, 0.99) / 1e6, hist_quantile(h, 1.0) / 1e6);
+    if (g_fleet.monitor) {
+        const uint64_t *l = g_fstat.latency_hist;
+        printf("[sender] monitor: delivered=%llu (%.2f%% of sent) bad=%llu%s latency_ms p50=%.3f p99=%.3f p999=%.3f max=%.3f\n",
+               (unsigned long long)g_fstat.delivered,
+               g_fstat.frames ? 100.0 * g_fstat.delivered / g_fstat.frames : 0.0,
+               (unsigned long long)g_fstat.mon_bad, g_fstat.mon_lost ? " (disconnected)" : "",
+               hist_quantile(l, 0.5) / 1e6, hist_quantile(l, 0.99) / 1e6,
+               hist_quantile(l, 0.999) / 1e6, hist_quantile(l, 1.0) / 1e6);
+    }
+    for (int k = 0; k < FAULT_CLASSES; ++k) {
+        if (g_fleet.fault_rate[k] <= 0) continue;
+        const uint64_t *r = g_fstat.recovery_hist[k];
+        printf("[sender] fault %-5s injected=%llu episodes=%llu recovered=%llu recovery_ms p50=%.3f p99=%.3f max=%.3f\n",
+               fault_names[k], (unsigned long long)g_fstat.injected[k],
+               (unsigned long long)g_fstat.episodes[k], (unsigned long long)g_fstat.recovered[k],
+               hist_quantile(r, 0.5) / 1e6, hist_quantile(r, 0.99) / 1e6, hist_quantile(r, 1.0) / 1e6);
+    }
+}
+
+static int fleet_main(void) {
+    g_quiet = 1;
+    signal(SIGINT, on_fleet_signal);
+    signal(SIGTERM, on_fleet_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* 几千条连接需要放开 fd 上限 */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    g_conns = (struct fleet_conn *)calloc((size_t)g_fleet.conns, sizeof(*g_conns));
+    g_dirty = (int *)calloc((size_t)g_fleet.conns, sizeof(int));
+    g_heap = (struct fleet_event *)calloc((size_t)g_fleet.nodes * 4, sizeof(*g_heap));
+    g_epfd = epoll_create1(0);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (g_conns == NULL || g_dirty == NULL || g_heap == NULL || g_epfd < 0 || tfd < 0) {
+        perror("[sender] fleet init");
+        return 1;
+    }
+    struct itimerspec its = { { 0, FLEET_TICK_NS }, { 0, FLEET_TICK_NS } };
+    timerfd_settime(tfd, 0, &its, NULL);
+    struct epoll_event tev = { .events = EPOLLIN, .data = { .u32 = FLEET_TIMER_TAG } };
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, tfd, &tev);
+    if (g_fleet.monitor && (g_mon_fd = fleet_monitor_open()) < 0) {
+        perror("[sender] monitor connect");
+        return 1;
+    }
+
+    uint64_t start = mono_ns();
+    g_rng ^= start;
+    for (int i = 0; i < g_fleet.conns; ++i) { g_conns[i].fd = -1; g_conns[i].retry_at = start; }
+    int ndown = g_fleet.conns;
+
+    /* 每个 (节点, 类型) 随机相位起步，避免所有节点在同一毫秒发送 */
+    for (int n = 0; n < g_fleet.nodes; ++n) {
+        for (int t = 0; t < 4; ++t) {
+            if (g_fleet.type_rate[t] <= 0) continue;
+            struct fleet_event e = { start + (uint64_t)(rand_unit() * 1e9 / g_fleet.type_rate[t]), (uint32_t)n, (uint32_t)t };
+            heap_push(e);
+        }
+    }
+
+    uint64_t end = g_fleet.duration > 0 ? start + (uint64_t)(g_fleet.duration * 1e9) : UINT64_MAX;
+    uint64_t storm_ns = (uint64_t)(g_fleet.storm_every * 1e9);
+    uint64_t next_storm = storm_ns ? start + storm_ns : UINT64_MAX;
+    double tokens = 0, last_tok = (double)start;
+    struct epoll_event evs[FLEET_MAX_EVENTS];
+
+    while (g_fleet_running) {
+        int n = epoll_wait(g_epfd, evs, FLEET_MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) { perror("[sender] epoll_wait"); break; }
+        uint64_t now = mono_ns();
+        int tick = 0;
+        for (int i = 0; i < n; ++i) {
+            if (evs[i].data.u32 == FLEET_TIMER_TAG) {
+                uint64_t exp;
+                if (read(tfd, &exp, sizeof(exp)) == (ssize_t)sizeof(exp)) tick = 1;
+                continue;
+            }
+            if (evs[i].data.u32 == FLEET_MON_TAG) { fleet_monitor_read(); continue; }
+            int idx = (int)evs[i].data.u32;
+            int was_up = g_conns[idx].state != FC_DOWN;
+            fleet_conn_event(idx, evs[i].events, now);
+            if (was_up && g_conns[idx].state == FC_DOWN) ndown++;
+        }
+        if (!tick) continue;
+
+        /* 重连风暴：所有连接同时断开，随后在同一时刻一起重连 */
+        if (now >= next_storm) {
+            for (int i = 0; i < g_fleet.conns; ++i) {
+                if (g_conns[i].state != FC_DOWN) { fleet_disconnect(i, now); ndown++; }
+                else g_conns[i].retry_at = now;
+            }
+            g_fstat.storms++;
+            next_storm += storm_ns;
+        }
+
+        if (ndown > 0) {
+            if (g_fleet.connect_rate > 0) {
+                tokens += g_fleet.connect_rate * ((double)now - last_tok) / 1e9;
+                double cap = g_fleet.connect_rate / 100 + 1;   /* 最多攒 10ms 的配额 */
+                if (tokens > cap) tokens = cap;
+            }
+            last_tok = (double)now;
+            for (int i = 0; i < g_fleet.conns && ndown > 0; ++i) {
+                struct fleet_conn *c = &g_conns[i];
+                if (c->state != FC_DOWN || c->retry_at > now) continue;
+                if (g_fleet.connect_rate > 0) { if (tokens < 1) break; tokens -= 1; }
+                fleet_connect(i, now);
+                if (c->state != FC_DOWN) ndown--;
+            }
+        }
+
+        while (g_nheap > 0 && g_heap[0].t <= now) {
+            struct fleet_event e = heap_pop();
+            fleet_fire(&e, now);
+            e.t += fleet_gap_ns(g_fleet.type_rate[e.type]);
+            heap_push(e);
+            if (g_fleet.total > 0 && g_fstat.frames >= (uint64_t)g_fleet.total) break;
+        }
+
+        /* 暂停中的连接留在列表里，下个节拍再发 */
+        int keep = 0;
+        for (int i = 0; i < g_ndirty; ++i) {
+            int idx = g_dirty[i];
+            g_conns[idx].dirty = 0;
+            if (g_conns[idx].state != FC_UP) continue;
+            if (fleet_flush(idx, now)) { g_conns[idx].dirty = 1; g_dirty[keep++] = idx; }
+            if (g_conns[idx].state == FC_DOWN) ndown++;
+        }
+        g_ndirty = keep;
+
+        if (now >= end || (g_fleet.total > 0 && g_fstat.frames >= (uint64_t)g_fleet.total)) break;
+    }
+
+    /* 尽量把缓冲区里剩下的发完再退出 */
+    uint64_t stop = mono_ns();
+    for (int i = 0; i < g_fleet.conns; ++i) {
+        if (g_conns[i].state != FC_UP) continue;
+        fcntl(g_conns[i].fd, F_SETFL, fcntl(g_conns[i].fd, F_GETFL) & ~O_NONBLOCK);
+        if (g_conns[i].len > 0 && send_all(g_conns[i].fd, g_conns[i].buf + g_conns[i].head, g_conns[i].len) > 0) {
+            g_fstat.bytes += g_conns[i].len;
+        }
+        close(g_conns[i].fd);
+    }
+    /* 监视接收端再收一会儿，直到 300ms 内没有新帧 */
+    uint64_t quiet_since = mono_ns();
+    while (g_mon_fd >= 0 && mono_ns() - quiet_since < 300000000ull) {
+        struct pollfd pfd = { .fd = g_mon_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 50) == 1) {
+            uint64_t before = g_fstat.delivered;
+            fleet_monitor_read();
+            if (g_fstat.delivered != before) quiet_since = mono_ns();
+        }
+    }
+    if (g_mon_fd >= 0) close(g_mon_fd);
+    fleet_report((stop - start) / 1e9);
+    close(tfd);
+    close(g_epfd);
+    return 0;
+}
+
+/* 解析 "a,b,c,d" 形式的每类型帧率 */
+static int parse_type_rates(const char *s, double *out) {
+    for (int i = 0; i < 4; ++i) {
+        char *end;
+        out[i] = strtod(s, &end);
+        if (end == s || out[i] < 0) return -1;
+        if (i < 3) { if (*end != ',') return -1; s = end + 1; }
+    }
+    return 0;
+}
+
+/* 解析 "crc=0.001,split=0.01" 形式的故障注入概率 */
+static int parse_faults(const char *spec) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s", spec);
+    double sum = 0;
+    for (char *tok = strtok(tmp, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '=');
+        if (eq == NULL) return -1;
+        *eq = '\0';
+        int k = 0;
+        while (k < FAULT_CLASSES && strcmp(tok, fault_names[k]) != 0) ++k;
+        if (k == FAULT_CLASSES) return -1;
+        g_fleet.fault_rate[k] = atof(eq + 1);
+        if (g_fleet.fault_rate[k] < 0) return -1;
+        sum += g_fleet.fault_rate[k];
+    }
+    if (sum > 1) return -1;
+    g_fleet.faults = sum > 0;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "用法：%s [-u] [-b 每报帧数] [-r 帧/秒] [-n 总帧数] [-q] <server_ip> <port> [node_id]\n"
+                    "      %s -N 节点数 [-c 连接数] [-T 各类型帧率] [-A fixed|poisson|burst[:n]] [-t]\n"
+                    "          [-d 秒] [-n 总帧数] [-K 风暴间隔秒] [-C 每秒建连数]\n"
+                    "          [-F 类别=概率,...] [-W 停顿毫秒] [-M] <server_ip> <port>\n"
+                    "  -u  UDP 模式，发往服务器 -U 指定的端口，无需握手\n"
+                    "  -b  UDP 模式下每个数据报打包的帧数（1-%d），默认 1\n"
+                    "  -r  发送速率（帧/秒），0 表示不限速；默认每 %d 秒一帧；集群模式下为总帧率，均分到各节点各类型\n"
+                    "  -n  发送多少帧后退出，默认不停\n"
+                    "  -q  不逐帧打印，结束时输出统计\n"
+                    "集群模式（单个 epoll 循环驱动多个虚拟节点，不逐帧打印）：\n"
+                    "  -N  虚拟节点数，节点 ID 按 1-255 循环\n"
+                    "  -c  TCP 连接数，节点轮流分到各连接，默认每节点一条\n"
+                    "  -T  每节点 BME280,光强雨量,系统状态,GPS 的帧率，如 1,1,0.2,0.5；默认合计每 %d 秒一帧\n"
+                    "  -A  到达过程：固定间隔、泊松、突发（每次连发 n 帧，默认 8）\n"
+                    "  -t  在帧填充区写入发送时刻，供接收端测端到端延迟\n"
+                    "  -d  运行秒数\n"
+                    "  -K  每隔若干秒让全部连接同时断开并重连，模拟早高峰重连风暴\n"
+                    "  -C  每秒最多发起的连接数，默认不限\n"
+                    "  -F  按帧概率注入故障：crc 改 CRC4、xor 改异或校验、cmd 未知命令字、trunc 截断帧、\n"
+                    "      split 一帧拆成两个 TCP 段、stall 发到半帧停顿，如 -F crc=0.001,split=0.01\n"
+                    "  -W  stall 故障的停顿时长（毫秒），默认 500\n"
+                    "  -M  同时以接收端身份连上服务器，统计送达率、端到端延迟和各类故障的恢复时间（隐含 -t）\n",
+            prog, prog, UDP_MAX_BATCH, SEND_INTERVAL, SEND_INTERVAL);
+}
+
 int main(int argc, char **argv) {
-    if (argc < 3) {
-        fprintf(stderr, "用法：%s <server_ip> <port> [node_id]\n", argv[0]);
+    int udp = 0, batch = 1, opt;
+    double rate = -1;          /* <0：保持原来的固定间隔 */
+    long long total = 0;       /* 0：不限 */
+    int type_rates_set = 0;
+    while ((opt = getopt(argc, argv, "ub:r:n:qN:c:T:A:td:K:C:F:W:Mh")) != -1) {
+        switch (opt) {
+        case 'u': udp = 1; break;
+        case 'b': batch = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'n': total = atoll(optarg); break;
+        case 'q': g_quiet = 1; break;
+        case 'N': g_fleet.nodes = atoi(optarg); break;
+        case 'c': g_fleet.conns = atoi(optarg); break;
+        case 'T':
+            if (parse_type_rates(optarg, g_fleet.type_rate) != 0) { usage(argv[0]); return 1; }
+            type_rates_set = 1;
+            break;
+        case 'A':
+            if (strcmp(optarg, "fixed") == 0) g_fleet.arrival = ARRIVAL_FIXED;
+            else if (strcmp(optarg, "poisson") == 0) g_fleet.arrival = ARRIVAL_POISSON;
+            else if (strncmp(optarg, "burst", 5) == 0) {
+                g_fleet.arrival = ARRIVAL_BURST;
+                if (optarg[5] == ':') g_fleet.burst = atoi(optarg + 6);
+            } else { usage(argv[0]); return 1; }
+            break;
+        case 't': g_fleet.stamp = 1; break;
+        case 'd': g_fleet.duration = atof(optarg); break;
+        case 'K': g_fleet.storm_every = atof(optarg); break;
+        case 'C': g_fleet.connect_rate = atof(optarg); break;
+        case 'F':
+            if (parse_faults(optarg) != 0) { usage(argv[0]); return 1; }
+            break;
+        case 'W': g_fleet.stall_ms = atof(optarg); break;
+        case 'M': g_fleet.monitor = 1; g_fleet.stamp = 1; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind < 2 || batch < 1 || batch > UDP_MAX_BATCH || (!udp && batch != 1) ||
+        g_fleet.burst < 1 || g_fleet.nodes < 0 || (g_fleet.nodes > 0 && udp)) {
+        usage(argv[0]);
         return 1;
     }
     
-    const char *server_ip = argv[1];
-    int port = atoi(argv[2]);
-    uint8_t node_id = (argc >= 4) ? (uint8_t)atoi(argv[3]) : 1;  // 默认节点ID为1
+    const char *server_ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    if (g_fleet.nodes > 0) {
+        if (g_fleet.conns <= 0 || g_fleet.conns > g_fleet.nodes) g_fleet.conns = g_fleet.nodes;
+        if (rate > 0) {
+            for (int t = 0; t < 4; ++t) g_fleet.type_rate[t] = rate / (g_fleet.nodes * 4.0);
+        } else if (!type_rates_set) {
+            for (int t = 0; t < 4; ++t) g_fleet.type_rate[t] = 1.0 / (SEND_INTERVAL * 4.0);
+        }
+        g_fleet.total = total;
+        memset(&g_fleet.addr, 0, sizeof(g_fleet.addr));
+        g_fleet.addr.sin_family = AF_INET;
+        g_fleet.addr.sin_port = htons((uint16_t)port);
+        if (inet_pton(AF_INET, server_ip, &g_fleet.addr.sin_addr) != 1) { usage(argv[0]); return 1; }
+        return fleet_main();
+    }
+    uint8_t node_id = (argc - optind >= 3) ? (uint8_t)atoi(argv[optind + 2]) : 1;  // 默认节点ID为1
 
     // 初始化随机数种子
     srand((unsigned int)time(NULL));
 
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
     if (fd < 0) { 
         perror("socket"); 
         return 1; 
@@ -257,66 +994,72 @@ int main(int argc, char **argv) {
         return 1;
     }
     
+    /* UDP 也 connect，之后可直接 send，并能收到 ICMP 端口不可达错误 */
     if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("connect"); 
         close(fd); 
         return 1;
     }
     
-    printf("[sender] connected to %s:%d, Node ID=%u\n", server_ip, port, node_id);
+    printf("[sender] %s to %s:%d, Node ID=%u\n", udp ? "udp" : "connected", server_ip, port, node_id);
 
-    /* 握手：发角色头，等服务器处理 */
-    if (send_all(fd, ROLE_SENDER, ROLE_LEN) != ROLE_LEN) { 
+    /* 握手：发角色头，等服务器处理；UDP 没有连接，不需要握手 */
+    if (!udp && send_all(fd, ROLE_SENDER, ROLE_LEN) != ROLE_LEN) { 
         perror("send role"); 
         close(fd); 
         return 1; 
     }
     
-    printf("[sender] role sent, starting data transmission...\n");
+    printf("[sender] %s, starting data transmission...\n", udp ? "no handshake" : "role sent");
+
+    /* 每次发送 batch 帧；TCP 模式 batch 固定为 1 */
+    long long period_ns = 0;
+    if (rate < 0) period_ns = (long long)SEND_INTERVAL * 1000000000LL;
+    else if (rate > 0) period_ns = (long long)(batch * 1e9 / rate);
 
     /* 数据发送循环 */
     uint32_t uptime = 0;
-    int packet_count = 0;
-    uint8_t buf[32];
-
-    while (1) {
-        // 循环发送不同类型的数据包
-        switch (packet_count % 4) {
-            case 0:
-                build_bme280_frame(buf, node_id);
-                if (send_packet(fd, buf, 11) < 0) {
-                    goto cleanup;
-                }
-                break;
-                
-            case 1:
-                build_lightrain_frame(buf, node_id);
-                if (send_packet(fd, buf, 8) < 0) {
-                    goto cleanup;
-                }
-                break;
-                
-            case 2:
-                build_system_status_frame(buf, node_id, &uptime);
-                if (send_packet(fd, buf, 15) < 0) {
-                    goto cleanup;
-                }
-                break;
-                
-            case 3:
-                build_gps_frame(buf, node_id);
-                if (send_packet(fd, buf, 25) < 0) {
-                    goto cleanup;
-                }
-                break;
+    long long packet_count = 0, dgram_count = 0, send_errors = 0;
+    uint8_t dgram[UDP_MAX_BATCH * FRAME_LEN];
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    double t0 = now_sec();
+
+    while (total == 0 || packet_count < total) {
+        int n = batch;
+        if (total > 0 && total - packet_count < n) n = (int)(total - packet_count);
+
+        if (udp) {
+            for (int i = 0; i < n; ++i) {
+                build_next_frame(dgram + i * FRAME_LEN, node_id, (int)(packet_count + i), &uptime);
+            }
+            if (send(fd, dgram, (size_t)n * FRAME_LEN, 0) != (ssize_t)n * FRAME_LEN) {
+                /* 服务器未启动时会收到端口不可达，计数后继续 */
+                send_errors++;
+            }
+        } else {
+            // 循环发送不同类型的数据包
+            int len = build_next_frame(dgram, node_id, (int)packet_count, &uptime);
+            if (send_packet(fd, dgram, len) < 0) {
+                goto cleanup;
+            }
         }
         
-        packet_count++;
-        printf("[sender] Packet %d sent, sleeping %d seconds...\n\n", packet_count, SEND_INTERVAL);
-        sleep(SEND_INTERVAL);
+        packet_count += n;
+        dgram_count++;
+        if (rate < 0) {
+            printf("[sender] Packet %lld sent, sleeping %d seconds...\n\n", packet_count, SEND_INTERVAL);
+        }
+        if (period_ns > 0) pace_next(&next, period_ns);
     }
 
 cleanup:
+    {
+        double el = now_sec() - t0;
+        printf("[sender] sent %lld frames in %lld %s, %lld errors, %.3f s, %.0f frames/s\n",
+               packet_count, dgram_count, udp ? "datagrams" : "writes", send_errors,
+               el, el > 0 ? packet_count / el : 0.0);
+    }
     close(fd);
     return 0;
-}
\ No newline at end of file
+}
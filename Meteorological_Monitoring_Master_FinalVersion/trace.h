@@ -0,0 +1,200 @@
+/*
+采样式链路追踪
+
+server、receiver_with_shm 和 Qt 界面在各自的关键阶段记录耗时区间，按
+Chrome trace-event 格式导出，可直接在 chrome://tracing 或 Perfetto 中打开。
+
+- 帧 ID：帧前 TRACE_ID_LEN 字节（节点、命令、数据和发送时刻，不含中继改写的
+  [29..31]）的 FNV-1a 哈希。各进程独立计算结果相同，据此把同一帧在不同进程
+  里的区间用 flow 事件连起来。
+- 采样：环境变量 MMM_TRACE=N 时只记录 ID 能被 N 整除的帧（N=1 全部记录），
+  各进程采到的是同一批帧。未设置时 trace_sampled()/trace_clock() 只做一次
+  分支判断，不计算哈希也不读时钟。
+- 存储：每个进程一个固定大小的环形缓冲区，写者原子递增领取槽位，不加锁，
+  写满后覆盖最旧的记录。
+- 导出：向进程发送 SIGUSR1，后台线程把缓冲区写到
+  $MMM_TRACE_DIR（默认 /tmp）/mmm-trace-<名字>-<pid>.json，
+  多个进程的文件用 trace_merge.sh 合并成一个。
+
+使用前需定义 _GNU_SOURCE，并链接 -lpthread。C 和 C++ 均可包含，
+FinalVersion 与 Qt 工程中的两份需保持一致。
+*/
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define TRACE_RING_SIZE  32768        /* 槽位数，2 的幂 */
+#define TRACE_ID_LEN     29           /* 参与帧 ID 计算的字节数，即 FRAME_ORIGIN_OFF */
+#define TRACE_POLL_MS    100          /* 导出线程检查 SIGUSR1 请求的间隔 */
+
+enum trace_stage {
+    TRACE_SERVER_INGEST = 0,   /* server：读取并校验一帧 */
+    TRACE_SERVER_BROADCAST,    /* server：校验通过到发完所有接收端（含等广播锁） */
+    TRACE_RECV_PARSE,          /* receiver：读取并校验一帧 */
+    TRACE_RECV_SHM_WRITE,      /* receiver：写入共享内存 */
+    TRACE_UI_POLL_WAIT,        /* 界面：写入共享内存到被定时器发现 */
+    TRACE_UI_UPDATE,           /* 界面：刷新显示 */
+    TRACE_STAGES
+};
+
+/* flow 相位：s 起点，t 中间，f 终点 */
+static const struct { const char *name; const char *cat; char flow; } trace_stage_info[TRACE_STAGES] = {
+    { "ingest",      "server",   's' },
+    { "broadcast",   "server",   't' },
+    { "parse",       "receiver", 't' },
+    { "shm_write",   "receiver", 't' },
+    { "ui_poll_wait","ui",       't' },
+    { "ui_update",   "ui",       'f' },
+};
+
+struct trace_slot {
+    uint64_t seq;              /* 写入序号 + 1，0 表示正在写 */
+    uint64_t start_ns, dur_ns; /* CLOCK_MONOTONIC，同一台机器上各进程可比 */
+    uint32_t frame_id;
+    uint32_t tid;
+    uint32_t stage;
+};
+
+static struct {
+    uint32_t every;            /* 采样间隔，0 表示关闭 */
+    struct trace_slot *ring;
+    uint64_t head;
+    const char *name;
+    volatile sig_atomic_t dump_req;
+} g_trace = { 0, NULL, 0, NULL, 0 };
+
+static __thread uint32_t t_trace_tid = 0;
+
+static inline uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 关闭时返回 0，不读时钟 */
+static inline uint64_t trace_clock(void) {
+    return __builtin_expect(g_trace.every != 0, 0) ? trace_now_ns() : 0;
+}
+
+static inline uint32_t trace_frame_id(const uint8_t *frame) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < TRACE_ID_LEN; ++i) h = (h ^ frame[i]) * 16777619u;
+    return h ? h : 1;
+}
+
+/* 该帧被采样时返回帧 ID，否则返回 0 */
+static inline uint32_t trace_sampled(const uint8_t *frame) {
+    if (__builtin_expect(g_trace.every == 0, 1)) return 0;
+    uint32_t id = trace_frame_id(frame);
+    return id % g_trace.every == 0 ? id : 0;
+}
+
+/* 记录一个区间；id 为 0 时不记录 */
+static inline void trace_span(int stage, uint32_t id, uint64_t start_ns, uint64_t end_ns) {
+    if (id == 0 || g_trace.ring == NULL) return;
+    if (t_trace_tid == 0) t_trace_tid = (uint32_t)syscall(SYS_gettid);
+    uint64_t idx = __atomic_fetch_add(&g_trace.head, 1, __ATOMIC_RELAXED);
+    struct trace_slot *s = &g_trace.ring[idx & (TRACE_RING_SIZE - 1)];
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->start_ns = start_ns;
+    s->dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    s->frame_id = id;
+    s->tid = t_trace_tid;
+    s->stage = (uint32_t)stage;
+    __atomic_store_n(&s->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/* 把缓冲区写成 Chrome trace JSON；先写临时文件再改名，读者不会看到半个文件 */
+static inline int trace_dump(void) {
+    if (g_trace.ring == NULL) return -1;
+    const char *dir = getenv("MMM_TRACE_DIR");
+    char path[256], tmp[272];
+    snprintf(path, sizeof(path), "%s/mmm-trace-%s-%d.json", dir ? dir : "/tmp", g_trace.name, (int)getpid());
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) return -1;
+
+    int pid = (int)getpid();
+    uint64_t head = __atomic_load_n(&g_trace.head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (uint64_t i = first; i < head; ++i) {
+        struct trace_slot *s = &g_trace.ring[i & (TRACE_RING_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq != i + 1) continue;
+        struct trace_slot c = *s;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq || c.stage >= TRACE_STAGES) continue;   /* 读的时候被覆盖 */
+        double ts = c.start_ns / 1e3;
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                   "\"args\":{\"frame\":\"%08x\"}},\n",
+                trace_stage_info[c.stage].name, trace_stage_info[c.stage].cat, ts, c.dur_ns / 1e3, pid, c.tid, c.frame_id);
+        fprintf(f, "{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":\"0x%08x\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u,\"bp\":\"e\"},\n",
+                trace_stage_info[c.stage].flow, c.frame_id, ts, pid, c.tid);
+    }
+    /* 最后一行不带逗号，trace_merge.sh 依赖这个格式 */
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}\n]}\n", pid, g_trace.name);
+    int err = ferror(f);
+    if (fclose(f) != 0 || err || rename(tmp, path) != 0) { unlink(tmp); return -1; }
+    fprintf(stderr, "[trace] %llu spans written to %s\n", (unsigned long long)(head - first), path);
+    return 0;
+}
+
+static inline void trace_on_sigusr1(int sig) {
+    (void)sig;
+    g_trace.dump_req = 1;
+}
+
+/* 信号处理函数里不能做文件 I/O，由这个线程代为导出 */
+static inline void *trace_dump_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        struct timespec ts = { 0, TRACE_POLL_MS * 1000000L };
+        nanosleep(&ts, NULL);
+        if (g_trace.dump_req) {
+            g_trace.dump_req = 0;
+            trace_dump();
+        }
+    }
+    return NULL;
+}
+
+/* 按 MMM_TRACE 开启追踪；未设置时什么都不做 */
+static inline void trace_init(const char *name) {
+    const char *env = getenv("MMM_TRACE");
+    long every = env ? atol(env) : 0;
+    if (every <= 0) return;
+    g_trace.ring = (struct trace_slot *)calloc(TRACE_RING_SIZE, sizeof(struct trace_slot));
+    if (g_trace.ring == NULL) return;
+    g_trace.name = name;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_on_sigusr1;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    /* 导出线程屏蔽所有信号，信号仍由原来的线程处理 */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_t th;
+    int rc = pthread_create(&th, NULL, trace_dump_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) { free(g_trace.ring); g_trace.ring = NULL; return; }
+    pthread_detach(th);
+    g_trace.every = (uint32_t)every;
+    fprintf(stderr, "[trace] sampling 1/%ld frames, kill -USR1 %d to dump\n", every, (int)getpid());
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,31 @@
+#!/bin/bash
+# 把各进程 SIGUSR1 导出的追踪文件合并成一个 Chrome trace JSON
+#
+# 用法：./trace_merge.sh [输出文件] [追踪文件...]
+#   不给追踪文件时合并 ${MMM_TRACE_DIR:-/tmp}/mmm-trace-*.json
+#   结果在 chrome://tracing 或 https://ui.perfetto.dev 中打开，
+#   同一帧在 server / receiver / ui 中的区间由 flow 箭头连起来（args.frame 相同）
+
+OUT=${1:-mmm-trace.json}
+shift
+FILES=("$@")
+[ ${#FILES[@]} -eq 0 ] && FILES=("${MMM_TRACE_DIR:-/tmp}"/mmm-trace-*.json)
+if [ ! -e "${FILES[0]}" ]; then
+    echo "没有追踪文件：先用 MMM_TRACE=N 启动各进程，再 kill -USR1 <pid>" >&2
+    exit 1
+fi
+
+# 每个文件首行是 {"...","traceEvents":[，末行是 ]}，倒数第二行是不带逗号的进程名事件
+{
+    echo '{"displayTimeUnit":"ns","traceEvents":['
+    n=${#FILES[@]}
+    for ((i = 0; i < n; i++)); do
+        if [ $i -lt $((n - 1)) ]; then
+            sed '1d;$d' "${FILES[$i]}" | sed '$s/$/,/'
+        else
+            sed '1d;$d' "${FILES[$i]}"
+        fi
+    done
+    echo ']}'
+} >"$OUT"
+echo "合并 ${#FILES[@]} 个文件 -> $OUT"